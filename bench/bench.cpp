@@ -0,0 +1,473 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <string>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/utsname.h>
+#include <drm/drm_fourcc.h>
+
+#include "helpers.hpp"
+#include "capture.hpp"
+#include "display.hpp"
+#include "reactor.hpp"
+#include "scheduler.hpp"
+#include "latency.hpp"
+#include "replay.hpp"
+#include "convert.hpp"
+
+// camcap_bench: costs of the capture, scanout and conversion hot paths, plus end-to-end scenarios.
+// Results are written as JSON, one flat {name, unit, value} entry each, to be compared between releases.
+// Benchmarks needing hardware run when it is there: the display when a DRM device is found, the
+// camera with -d, the replay with -p.
+
+#define BENCH_VERBOSITY false
+#define BENCH_VERSION 1 // JSON layout
+#define BENCH_ITERATIONS 300
+#define BENCH_CONV_WIDTH 1920
+#define BENCH_CONV_HEIGHT 1080
+#define BENCH_CONV_THREADS 4
+#define BENCH_CAM_BUF_COUNT 4
+#define BENCH_POLL_TIMEOUT_MS 1000
+#define BENCH_NO_REPORT 0xffffffffu // LatencyTracker period: the bench reads the histograms itself
+
+typedef struct {
+    std::string name;
+    std::string unit;
+    double value;
+} bench_result_t;
+
+class BenchResults {
+private:
+    std::vector<bench_result_t> m_results;
+
+public:
+    void add(const std::string& name, const std::string& unit, double value){
+        m_results.push_back({name, unit, value});
+        printf("[BENCH] %-36s %12.2f %s\n", name.c_str(), value, unit.c_str());
+    }
+
+    void addHistogram(const std::string& name, const LatencyHistogram& h){
+        if(!h.count())
+            return;
+        add(name + ".p50", "us", (double)h.percentile(50));
+        add(name + ".p99", "us", (double)h.percentile(99));
+        add(name + ".max", "us", (double)h.max());
+    }
+
+    bool write(const std::string& path){
+        FILE *f = fopen(path.c_str(), "w");
+        struct utsname uts{};
+
+        if(!f){
+            printf("[BENCH] Failed to create %s: %s\n", path.c_str(), strerror(errno));
+            return false;
+        }
+        uname(&uts);
+        fprintf(f, "{\n  \"bench_version\": %d,\n  \"host\": \"%s\",\n  \"machine\": \"%s\",\n  \"kernel\": \"%s\",\n  \"timestamp\": %lld,\n  \"results\": [\n",
+                BENCH_VERSION, uts.nodename, uts.machine, uts.release, (long long)time(nullptr));
+        for(size_t i = 0; i < m_results.size(); i++){
+            const bench_result_t& r = m_results[i];
+            fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"value\": %.3f}%s\n", r.name.c_str(), r.unit.c_str(), r.value,
+                    (i + 1 < m_results.size()) ? "," : "");
+        }
+        fprintf(f, "  ]\n}\n");
+
+        return (fclose(f) == 0);
+    }
+};
+
+static void usage(const char* name)
+{
+    printf("Usage: %s [-d <video device> [-s <width>x<height>]] [-p <file>] [-n <iterations>] [-b <bench>,...] [-o <file>]\n", name);
+    printf("  -d: camera benchmarks: ioctl cost, DQBUF/QBUF round trips, FB import cold vs cached, live scanout\n");
+    printf("  -s: camera size (default 1920x1080)\n");
+    printf("  -p: end-to-end replay of a recording, as fast as the display takes it\n");
+    printf("  -n: iterations of each micro-benchmark, flips of each scenario (default %d)\n", BENCH_ITERATIONS);
+    printf("  -b: only run these: convert, commit, ioctl, capture, import, camera, replay\n");
+    printf("  -o: JSON results file (default camcap_bench.json)\n");
+}
+
+static bool selected(const std::vector<std::string>& only, const char* bench)
+{
+    if(only.empty())
+        return true;
+    for(const auto& b : only){
+        if(b == bench)
+            return true;
+    }
+    return false;
+}
+
+// Wait for the display fd and dispatch its events
+static bool waitFlip(Display& disp)
+{
+    struct pollfd pfd = {disp.get_fd(), POLLIN, 0};
+
+    while(disp.flipPending()){
+        if(poll(&pfd, 1, BENCH_POLL_TIMEOUT_MS) <= 0 || !disp.handleEvent())
+            return false;
+    }
+    return true;
+}
+
+// CPU conversion kernels, source bytes per second, single thread and the pool
+static void benchConvert(BenchResults& res, unsigned int iterations)
+{
+    const struct { uint32_t src; uint32_t dst; const char *name; } convs[] = {
+        {DRM_FORMAT_NV12, DRM_FORMAT_XRGB8888, "nv12_xr24"},
+        {DRM_FORMAT_NV16, DRM_FORMAT_XRGB8888, "nv16_xr24"},
+        {DRM_FORMAT_YUYV, DRM_FORMAT_XRGB8888, "yuyv_xr24"},
+        {DRM_FORMAT_YUYV, DRM_FORMAT_NV12, "yuyv_nv12"},
+    };
+    uint32_t w = BENCH_CONV_WIDTH;
+    uint32_t h = BENCH_CONV_HEIGHT;
+    std::vector<uint8_t> src_mem((size_t)w * h * 2), dst_mem((size_t)w * h * 4);
+
+    for(size_t i = 0; i < src_mem.size(); i++)
+        src_mem[i] = (uint8_t)(i * 7);
+
+    for(unsigned int threads : {1u, (unsigned int)BENCH_CONV_THREADS}){
+        Converter conv(threads, BENCH_VERBOSITY);
+        for(const auto& c : convs){
+            // Planes back to back in one allocation, like the capture buffers
+            bool packed = (c.src == DRM_FORMAT_YUYV);
+            image_t src = {c.src, w, h, {src_mem.data(), packed ? nullptr : src_mem.data() + (size_t)w * h}, {packed ? w * 2 : w, packed ? 0 : w}};
+            bool xr24 = (c.dst == DRM_FORMAT_XRGB8888);
+            image_t dst = {c.dst, w, h, {dst_mem.data(), xr24 ? nullptr : dst_mem.data() + (size_t)w * h}, {xr24 ? w * 4 : w, xr24 ? 0 : w}};
+            size_t src_bytes = (c.src == DRM_FORMAT_NV12) ? (size_t)w * h * 3 / 2 : (size_t)w * h * 2;
+
+            // Warm up: pool threads awake, pages touched
+            if(!conv.convert(src, dst) || !conv.convert(src, dst)){
+                printf("[BENCH] convert %s failed\n", c.name);
+                continue;
+            }
+            uint64_t start_ns = monotonic_ns();
+            for(unsigned int n = 0; n < iterations; n++)
+                conv.convert(src, dst);
+            double secs = (double)(monotonic_ns() - start_ns) / 1e9;
+            std::string name = std::string("convert.") + c.name + ".t" + std::to_string(threads);
+            res.add(name, "MB/s", (double)src_bytes * iterations / secs / 1e6);
+            res.add(name + ".frame", "us", secs * 1e6 / iterations);
+        }
+    }
+}
+
+// Test pattern ring: commit call cost, commit to flip, flips per second and vblanks missed
+static void benchCommit(BenchResults& res, unsigned int flips)
+{
+    display_config conf;
+    conf.testing_display = true;
+    std::unique_ptr<Display> disp;
+    LatencyHistogram commit, to_flip;
+
+    try{
+        disp.reset(new Display(conf, BENCH_VERBOSITY));
+    } catch(const std::exception& e){
+        printf("[BENCH] No display, skipping commit: %s\n", e.what());
+        return;
+    }
+    if(!disp->initialize() || !waitFlip(*disp)){
+        printf("[BENCH] Display initialize failed\n");
+        return;
+    }
+
+    uint64_t start_ns = monotonic_ns();
+    for(unsigned int n = 0; n < flips; n++){
+        uint64_t t0 = monotonic_ns();
+        if(!disp->scanout(0))
+            return;
+        uint64_t t1 = monotonic_ns();
+        if(!waitFlip(*disp))
+            return;
+        commit.record((t1 - t0) / 1000);
+        if(disp->lastFlipNs() > t1)
+            to_flip.record((disp->lastFlipNs() - t1) / 1000);
+    }
+    double secs = (double)(monotonic_ns() - start_ns) / 1e9;
+
+    res.add("commit.flips", "flips/s", flips / secs);
+    res.add("commit.missed_vblanks", "vblanks", (double)disp->missedVblanks());
+    res.addHistogram("commit.call", commit);
+    res.addHistogram("commit.to_flip", to_flip);
+}
+
+// Raw ioctl cost, on the cheapest request every driver has
+static void benchIoctl(BenchResults& res, Capture& cap, unsigned int iterations)
+{
+    struct v4l2_capability caps{};
+
+    uint64_t start_ns = monotonic_ns();
+    for(unsigned int n = 0; n < iterations; n++){
+        if(!xioctl(cap.get_fd(), VIDIOC_QUERYCAP, &caps))
+            return;
+    }
+    res.add("ioctl.querycap", "ns", (double)(monotonic_ns() - start_ns) / iterations);
+}
+
+// DQBUF and QBUF round trips, frames given back right away
+static bool benchCapture(BenchResults& res, Capture& cap, unsigned int frames)
+{
+    struct pollfd pfd = {cap.get_fd(), POLLIN, 0};
+    LatencyHistogram dq, q;
+    unsigned int n = 0;
+
+    uint64_t start_ns = monotonic_ns();
+    while(n < frames){
+        if(poll(&pfd, 1, BENCH_POLL_TIMEOUT_MS) <= 0){
+            printf("[BENCH] No frame from the camera\n");
+            return false;
+        }
+        capture_frame_t frame;
+        uint64_t t0 = monotonic_ns();
+        if(!cap.tryDequeue(frame))
+            return false;
+        if(frame.index < 0)
+            continue;
+        uint64_t t1 = monotonic_ns();
+        if(!cap.release(frame))
+            return false;
+        dq.record((t1 - t0) / 1000);
+        q.record((monotonic_ns() - t1) / 1000);
+        n++;
+    }
+    res.add("capture.fps", "frames/s", frames / ((double)(monotonic_ns() - start_ns) / 1e9));
+    res.addHistogram("capture.dqbuf", dq);
+    res.addHistogram("capture.qbuf", q);
+
+    return true;
+}
+
+// Camera buffer to FB: GEM handle lookup and drmModeAddFB2 on first use, the FB cache after
+static void benchImport(BenchResults& res, Capture& cap, Display& disp, unsigned int iterations)
+{
+    struct pollfd pfd = {cap.get_fd(), POLLIN, 0};
+    LatencyHistogram cold, cached;
+
+    for(unsigned int n = 0; n < iterations; ){
+        capture_frame_t frame;
+        if(poll(&pfd, 1, BENCH_POLL_TIMEOUT_MS) <= 0 || !cap.tryDequeue(frame))
+            return;
+        if(frame.index < 0)
+            continue;
+        int fd = frame.dma_fd[0];
+        disp.invalidateBuffer(fd); // Never scanned out here
+        uint64_t t0 = monotonic_ns();
+        bool ok = disp.prepareBuffer(fd);
+        uint64_t t1 = monotonic_ns();
+        ok = ok && disp.prepareBuffer(fd);
+        uint64_t t2 = monotonic_ns();
+        disp.invalidateBuffer(fd);
+        cap.release(frame);
+        if(!ok)
+            return;
+        cold.record((t1 - t0) / 1000);
+        cached.record((t2 - t1) / 1000);
+        n++;
+    }
+    res.addHistogram("import.cold", cold);
+    res.addHistogram("import.cached", cached);
+}
+
+// Run a source through the FrameScheduler until flips frames were displayed
+static bool runScenario(Display& disp, FrameSource& src, LatencyTracker& latency, unsigned int flips, std::function<bool()> finished)
+{
+    Reactor reactor(BENCH_VERBOSITY);
+    FrameScheduler sched(src, disp, latency, reactor, BENCH_VERBOSITY);
+
+    bool ok = reactor.addFd(disp.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        if(!sched.handleFlipEvent())
+            return false;
+        if(latency.displayed() >= flips || finished())
+            reactor.stop();
+        return true;
+    });
+    ok = ok && reactor.addFd(src.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleCaptureReady();
+    });
+
+    ok = ok && reactor.run();
+
+    // Every frame back to the source before the next scenario uses it
+    disp.showSplash();
+    return sched.drain() && ok;
+}
+
+static void reportScenario(BenchResults& res, const std::string& name, LatencyTracker& latency, uint64_t start_ns)
+{
+    res.add(name + ".fps", "frames/s", latency.displayed() / ((double)(monotonic_ns() - start_ns) / 1e9));
+    res.addHistogram(name + ".commit_to_flip", latency.commitToFlip());
+    res.addHistogram(name + ".end_to_end", latency.endToEnd());
+    res.addHistogram(name + ".flip_interval", latency.flipInterval());
+}
+
+int main(int argc, char *argv[])
+{
+    int opt;
+    std::string device, replay_path;
+    std::string out_path = "camcap_bench.json";
+    uint32_t width = 1920, height = 1080;
+    unsigned int iterations = BENCH_ITERATIONS;
+    std::vector<std::string> only;
+    BenchResults res;
+
+    while((opt = getopt(argc, argv, "d:s:p:n:b:o:h")) != -1){
+        switch(opt){
+            case 'd':
+                device = optarg;
+                break;
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 'n':
+                if(sscanf(optarg, "%u", &iterations) != 1 || iterations == 0){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'b': {
+                std::string list = optarg;
+                size_t pos = 0;
+                while(pos <= list.size()){
+                    size_t end = list.find(',', pos);
+                    if(end == std::string::npos)
+                        end = list.size();
+                    only.push_back(list.substr(pos, end - pos));
+                    pos = end + 1;
+                }
+                break;
+            }
+            case 'o':
+                out_path = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    // No hardware needed
+    if(selected(only, "convert"))
+        benchConvert(res, iterations);
+
+    // Display alone
+    if(selected(only, "commit"))
+        benchCommit(res, iterations);
+
+    // Camera
+    if(!device.empty()){
+        try{
+            capture_config cap_conf;
+            cap_conf.fmt_fourcc = "NV12";
+            cap_conf.width = width;
+            cap_conf.height = height;
+            cap_conf.mem_type = TYPE_MMAP;
+            cap_conf.buf_count = BENCH_CAM_BUF_COUNT;
+            // Before the capture: its release callback reaches the display until the buffers are freed
+            std::unique_ptr<Display> disp;
+            Capture cap(device, cap_conf, BENCH_VERBOSITY);
+
+            // A failed step skips the rest, what was measured is still written
+            if(selected(only, "ioctl"))
+                benchIoctl(res, cap, iterations);
+            bool ok = cap.start();
+            if(!ok)
+                printf("[BENCH] Capture start failed\n");
+            if(ok && selected(only, "capture"))
+                benchCapture(res, cap, iterations);
+
+            // Zero-copy scanout of the camera
+            if(ok && (selected(only, "import") || selected(only, "camera"))){
+                display_config conf;
+                conf.testing_display = false;
+                conf.cam_buf = {"NV12", width, height, width};
+                conf.gpu_buf = {"XR24", width, height, width};
+                disp.reset(new Display(conf, BENCH_VERBOSITY));
+                Display& d = *disp;
+                cap.setReleaseCallback([&d](int dma_fd){
+                    d.invalidateBuffer(dma_fd);
+                });
+                if(!d.initialize() || !d.setCameraLayout(cap.layout()) || !waitFlip(d)){
+                    printf("[BENCH] Display initialize failed\n");
+                } else {
+                    if(selected(only, "import"))
+                        benchImport(res, cap, d, iterations);
+                    if(selected(only, "camera")){
+                        LatencyTracker latency(BENCH_NO_REPORT, BENCH_VERBOSITY);
+                        uint64_t start_ns = monotonic_ns();
+                        if(runScenario(d, cap, latency, iterations, [](){ return false; }))
+                            reportScenario(res, "camera", latency, start_ns);
+                    }
+                    d.showSplash();
+                }
+            }
+            cap.stop();
+        } catch(const std::exception& e){
+            printf("[BENCH] Camera benchmarks failed: %s\n", e.what());
+        }
+    }
+
+    // Recording through the display, no pacing
+    if(!replay_path.empty() && selected(only, "replay")){
+        try{
+            ReplaySource replay(replay_path, BENCH_VERBOSITY);
+            display_config conf;
+            conf.testing_display = false;
+            uint32_t w = replay.config().width;
+            uint32_t h = replay.config().height;
+            conf.cam_buf = {"NV12", w, h, w};
+            conf.gpu_buf = {"XR24", w, h, w};
+            Display disp(conf, BENCH_VERBOSITY);
+            std::vector<dmabuf_t> bufs;
+            LatencyTracker latency(BENCH_NO_REPORT, BENCH_VERBOSITY);
+            if(!disp.initialize() || !disp.allocateCameraBuffers(BENCH_CAM_BUF_COUNT, bufs) || !replay.importBuffers(bufs) ||
+               !waitFlip(disp) || !replay.start(true)){
+                printf("[BENCH] Replay setup failed\n");
+            } else {
+                uint64_t start_ns = monotonic_ns();
+                if(runScenario(disp, replay, latency, iterations, [&replay](){ return replay.finished(); }))
+                    reportScenario(res, "replay", latency, start_ns);
+            }
+        } catch(const std::exception& e){
+            printf("[BENCH] Replay benchmark failed: %s\n", e.what());
+        }
+    }
+
+    printf("[BENCH] %s\n", out_path.c_str());
+    return res.write(out_path) ? 0 : -1;
+}
@@ -0,0 +1,336 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/eventfd.h>
+#include <linux/dma-buf.h>
+
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "analytics.hpp"
+
+// Column sums of one row, and its histogram. colsum lanes hold at most 8 * 255.
+static void accumulate_row(const uint8_t *y, uint32_t width, uint16_t *colsum, uint32_t (*hist)[ANA_HIST_BINS])
+{
+    uint32_t x = 0;
+
+#if defined(__ARM_NEON)
+    for(; x + 16 <= width; x += 16){
+        uint8x16_t v = vld1q_u8(y + x);
+        uint16x8_t lo = vld1q_u16(colsum + x);
+        uint16x8_t hi = vld1q_u16(colsum + x + 8);
+        vst1q_u16(colsum + x, vaddw_u8(lo, vget_low_u8(v)));
+        vst1q_u16(colsum + x + 8, vaddw_u8(hi, vget_high_u8(v)));
+    }
+#endif
+    for(; x < width; x++)
+        colsum[x] += y[x];
+
+    // Four sub-histograms: consecutive equal pixels don't wait on each other
+    x = 0;
+    for(; x + 4 <= width; x += 4){
+        hist[0][y[x]]++;
+        hist[1][y[x + 1]]++;
+        hist[2][y[x + 2]]++;
+        hist[3][y[x + 3]]++;
+    }
+    for(; x < width; x++)
+        hist[0][y[x]]++;
+}
+
+// Box average of factor x factor blocks, colsum already holds factor rows
+static void reduce_row(const uint16_t *colsum, uint32_t thumb_width, unsigned int factor, uint8_t *out)
+{
+    unsigned int shift = (factor == 8) ? 6 : 4;
+    uint32_t round = 1u << (shift - 1);
+
+    for(uint32_t x = 0; x < thumb_width; x++){
+        const uint16_t *c = colsum + x * factor;
+        uint32_t sum = 0;
+        for(unsigned int i = 0; i < factor; i++)
+            sum += c[i];
+        out[x] = (uint8_t)((sum + round) >> shift);
+    }
+}
+
+static bool dmabuf_sync(int fd, uint64_t flags)
+{
+    struct dma_buf_sync sync{};
+    sync.flags = flags;
+    while(ioctl(fd, DMA_BUF_IOCTL_SYNC, &sync) < 0){
+        if(errno != EINTR && errno != EAGAIN)
+            return false;
+    }
+    return true;
+}
+
+AnalyticsTap::AnalyticsTap(const analytics_config& conf, bool verbose)
+    : m_config(conf), m_logger("analytics", verbose)
+{
+    Logger& log = m_logger;
+
+    // Check config
+    if(conf.factor != 4 && conf.factor != 8)
+        log.fatal("Analytics downscale factor must be 4 or 8");
+
+    m_done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(m_done_fd < 0)
+        log.fatal("eventfd failed: " + std::string(strerror(errno)));
+    m_pending.index = -1;
+    for(auto& r : m_results)
+        r.seq.store(0);
+}
+
+bool AnalyticsTap::start(const frame_layout_t& layout)
+{
+    Logger& log = m_logger;
+    analytics_config& c = m_config;
+    unsigned int f = c.factor;
+
+    // Sanity check
+    if(!layout.fourcc || layout.width < f || layout.height < f){
+        log.error("Analytics: unknown capture layout");
+        return false;
+    }
+    if(layout.fourcc != v4l2_fourcc('N', 'V', '1', '2') && layout.fourcc != v4l2_fourcc('N', 'V', '1', '6')){
+        log.error("Analytics: %.4s has no separate luma plane", (const char*)&layout.fourcc);
+        return false;
+    }
+
+    // ROI clamped to the frame, whole blocks only
+    if(!c.roi_w || !c.roi_h){
+        c.roi_x = c.roi_y = 0;
+        c.roi_w = layout.width;
+        c.roi_h = layout.height;
+    }
+    if(c.roi_x >= layout.width || c.roi_y >= layout.height){
+        log.error("Analytics: ROI +%u+%u outside the %ux%u frame", c.roi_x, c.roi_y, layout.width, layout.height);
+        return false;
+    }
+    c.roi_w = std::min(c.roi_w, layout.width - c.roi_x) / f * f;
+    c.roi_h = std::min(c.roi_h, layout.height - c.roi_y) / f * f;
+    if(!c.roi_w || !c.roi_h){
+        log.error("Analytics: ROI smaller than one %ux%u block", f, f);
+        return false;
+    }
+
+    m_layout = layout;
+    m_colsum.assign(c.roi_w, 0);
+    for(auto& r : m_results)
+        r.thumb.assign((c.roi_w / f) * (c.roi_h / f), 0);
+
+    m_quit = false;
+    try{
+        m_worker = std::thread(&AnalyticsTap::workerLoop, this);
+    } catch(const std::system_error& e){
+        log.error("Failed to start analytics thread: %s", e.what());
+        return false;
+    }
+    log.status("Analytics on %ux%u+%u+%u, %ux%u thumbnail", c.roi_w, c.roi_h, c.roi_x, c.roi_y, c.roi_w / f, c.roi_h / f);
+
+    return true;
+}
+
+bool AnalyticsTap::process(const capture_frame_t& frame, result_t& out)
+{
+    const analytics_config& c = m_config;
+    unsigned int f = c.factor;
+    uint32_t thumb_w = c.roi_w / f;
+    uint32_t thumb_h = c.roi_h / f;
+    uint64_t start = monotonic_ns();
+
+    // CPU reads see what the device wrote
+    int fd = frame.dma_fd[m_layout.mem_plane[0]];
+    bool synced = (fd >= 0) && dmabuf_sync(fd, DMA_BUF_SYNC_START | DMA_BUF_SYNC_READ);
+
+    const uint8_t *base = static_cast<const uint8_t*>(frame.plane_addr[m_layout.mem_plane[0]]) + m_layout.offset[0];
+    memset(m_hist, 0, sizeof(m_hist));
+    for(uint32_t ty = 0; ty < thumb_h; ty++){
+        std::fill(m_colsum.begin(), m_colsum.end(), 0);
+        for(unsigned int r = 0; r < f; r++){
+            const uint8_t *row = base + (size_t)(c.roi_y + ty * f + r) * m_layout.pitch[0] + c.roi_x;
+            accumulate_row(row, c.roi_w, m_colsum.data(), m_hist);
+        }
+        reduce_row(m_colsum.data(), thumb_w, f, out.thumb.data() + (size_t)ty * thumb_w);
+    }
+
+    if(synced)
+        dmabuf_sync(fd, DMA_BUF_SYNC_END | DMA_BUF_SYNC_READ);
+
+    // Merge the sub-histograms, the mean comes with them
+    luma_stats_t& s = out.stats;
+    uint64_t sum = 0;
+    for(unsigned int b = 0; b < ANA_HIST_BINS; b++){
+        s.histogram[b] = m_hist[0][b] + m_hist[1][b] + m_hist[2][b] + m_hist[3][b];
+        sum += (uint64_t)b * s.histogram[b];
+    }
+    s.sequence = frame.sequence;
+    s.timestamp_ns = frame.timestamp_ns;
+    s.thumb_width = thumb_w;
+    s.thumb_height = thumb_h;
+    s.mean = (float)sum / ((float)c.roi_w * c.roi_h);
+    s.process_ns = monotonic_ns() - start;
+
+    return true;
+}
+
+void AnalyticsTap::workerLoop()
+{
+    Logger& log = m_logger;
+
+    while(true){
+        capture_frame_t frame;
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [this]{ return m_quit || m_pending.index >= 0; });
+            if(m_pending.index < 0)
+                break; // Quitting
+            frame = m_pending;
+            m_pending.index = -1;
+        }
+
+        // Write the back slot. Readers retry if they raced with it (odd or changed seq)
+        unsigned int back = m_front.load(std::memory_order_relaxed) ^ 1;
+        result_t& r = m_results[back];
+        r.seq.fetch_add(1, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        process(frame, r);
+        r.seq.fetch_add(1, std::memory_order_release);
+        m_front.store(back, std::memory_order_release);
+        m_published.store(true, std::memory_order_release);
+        m_frames++;
+
+        if(m_report_rl.allow()){
+            const luma_stats_t& s = r.stats;
+            uint32_t clipped = s.histogram[ANA_HIST_BINS - 1] + s.histogram[ANA_HIST_BINS - 2];
+            log.info("Frame %u: mean luma %.1f, %.2f%% clipped, %llu us (%u similar messages suppressed)", s.sequence, s.mean,
+                     100.0f * clipped / ((float)m_config.roi_w * m_config.roi_h), (unsigned long long)(s.process_ns / 1000),
+                     m_report_rl.takeSuppressed());
+        }
+
+        // Back to the owner
+        {
+            std::lock_guard<std::mutex> lock(m_mutex);
+            m_done.push_back(frame);
+            m_busy = false;
+        }
+        uint64_t one = 1;
+        if(write(m_done_fd, &one, sizeof(one)) < 0)
+            log.error("Completion signal failed: %s", strerror(errno));
+    }
+}
+
+bool AnalyticsTap::submit(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    unsigned int mp = m_layout.mem_plane[0];
+
+    // Sanity check
+    if(frame.index < 0 || !m_worker.joinable())
+        return false;
+    if(mp >= frame.num_planes || !frame.plane_addr[mp]){
+        log.error("submit: buffer %d luma plane has no CPU mapping", frame.index);
+        return false;
+    }
+
+    // Latest frame only: a busy worker skips this one
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if(m_busy){
+            m_skipped++;
+            return false;
+        }
+        m_pending = frame;
+        m_busy = true;
+    }
+    m_wake.notify_one();
+
+    return true;
+}
+
+bool AnalyticsTap::collect(std::vector<capture_frame_t>& done)
+{
+    Logger& log = m_logger;
+
+    // Clear the completion counter
+    uint64_t v;
+    if(read(m_done_fd, &v, sizeof(v)) < 0 && errno != EAGAIN){
+        log.error("Completion read failed: %s", strerror(errno));
+        return false;
+    }
+
+    std::lock_guard<std::mutex> lock(m_mutex);
+    done.insert(done.end(), m_done.begin(), m_done.end());
+    m_done.clear();
+
+    return true;
+}
+
+bool AnalyticsTap::snapshot(luma_stats_t& stats, std::vector<uint8_t> *thumb)
+{
+    if(!m_published.load(std::memory_order_acquire))
+        return false;
+
+    // Seqlock read of the front slot
+    while(true){
+        unsigned int front = m_front.load(std::memory_order_acquire);
+        const result_t& r = m_results[front];
+        uint32_t seq = r.seq.load(std::memory_order_acquire);
+        if(seq & 1)
+            continue; // Lapped: the worker is rewriting it
+        stats = r.stats;
+        if(thumb)
+            thumb->assign(r.thumb.begin(), r.thumb.end());
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if(r.seq.load(std::memory_order_relaxed) == seq)
+            return true;
+    }
+}
+
+void AnalyticsTap::stop()
+{
+    Logger& log = m_logger;
+
+    if(!m_worker.joinable())
+        return;
+
+    // A frame handed over is processed first
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_one();
+    m_worker.join();
+    log.info("%llu frames analysed, %llu skipped (worker busy)", (unsigned long long)m_frames, (unsigned long long)m_skipped);
+}
+
+AnalyticsTap::~AnalyticsTap()
+{
+    stop();
+    close(m_done_fd);
+}
@@ -29,12 +29,23 @@
 #include <errno.h>
 #include <vector>
 #include <fstream>
+#include <memory>
+#include <poll.h>
 
 #include "helpers.hpp"
 #include "capture.hpp"
+#include "fmtcache.hpp"
+
+static capture_buf emptyCaptureBuf()
+{
+    capture_buf buf{};
+    for(unsigned int p = 0; p < VIDEO_MAX_PLANES; p++)
+        buf.dma_fd[p] = -1;
+    return buf;
+}
 
 Capture::Capture(const std::string& device, capture_config& conf, bool verbose)
-    : m_config(conf), m_logger("capture", verbose)
+    : m_config(conf), m_pool(verbose), m_logger("capture", verbose)
 {
     Logger& log = m_logger;
     // Check device
@@ -47,7 +58,7 @@ Capture::Capture(const std::string& device, capture_config& conf, bool verbose)
     }
 
     log.status("Opening device %s", device.c_str());
-    m_fd = open(device.c_str(), O_RDWR);
+    m_fd = open(device.c_str(), O_RDWR | O_NONBLOCK); // DQBUF returns EAGAIN instead of blocking
     if(m_fd < 0)
         log.fatal("Failed to open device " + device + ": " + strerror(errno));
     
@@ -60,7 +71,7 @@ Capture::Capture(const std::string& device, capture_config& conf, bool verbose)
 
     // Init members
     try{
-        m_capture_buf.resize(conf.buf_count);
+        m_capture_buf.resize(conf.buf_count, emptyCaptureBuf());
     } catch(const std::bad_alloc& e){
         log.fatal("Failed to allocate capture buffers");
     }
@@ -83,6 +94,7 @@ bool Capture::checkDeviceCapabilities()
     log.info("Driver Name: %s", caps.driver);
     log.info("Device Bus: %s", (const char*)caps.bus_info);
     log.info("Device Version: %u", (unsigned int)caps.version);
+    m_device_key = FormatCache::deviceKey((const char*)caps.driver, (const char*)caps.bus_info);
     log.info("Device Caps:");
     if(log.get_verbose())
         print_v4l2_device_caps(caps.capabilities);
@@ -262,6 +274,11 @@ bool Capture::setFormat()
         format.fmt.pix_mp.pixelformat = v4l2_fmt;
         format.fmt.pix_mp.width = m_config.width;
         format.fmt.pix_mp.height = m_config.height;
+        if(m_config.mem_type == TYPE_DMABUF){
+            // Imported buffers dictate the line pitch
+            format.fmt.pix_mp.num_planes = 1;
+            format.fmt.pix_mp.plane_fmt[0].bytesperline = m_dmabufs[0].pitch;
+        }
     } else {
         log.error("TODO: Capture class doesn't support Non-Planar devices");
         return false;
@@ -274,6 +291,8 @@ bool Capture::setFormat()
 
     // Verify
     if(m_is_mp_device){
+        m_fmt_adjusted = (format.fmt.pix_mp.pixelformat != v4l2_fmt || format.fmt.pix_mp.width != m_config.width ||
+                          format.fmt.pix_mp.height != m_config.height);
         if(format.fmt.pix_mp.pixelformat != v4l2_fmt){
             log.warning("Driver adjusted pixel format from %s to %c%c%c%c", fourcc.c_str(), format.fmt.pix_mp.pixelformat & 0xFF,
                 (format.fmt.pix_mp.pixelformat >> 8) & 0xFF,
@@ -285,6 +304,32 @@ bool Capture::setFormat()
             log.warning("Driver adjusted resolution from %dx%d to %dx%d", m_config.width, m_config.height, format.fmt.pix_mp.width, format.fmt.pix_mp.height);
         }
         log.info("Format set: %dx%d, num_planes=%d", format.fmt.pix_mp.width, format.fmt.pix_mp.height, format.fmt.pix_mp.num_planes);
+
+        // Publish the layout the driver chose: pitches may be padded for the DMA
+        if(layout_from_v4l2(format.fmt.pix_mp, m_layout)){
+            for(unsigned int p = 0; p < m_layout.num_planes; p++){
+                log.info(". Plane %u: pitch=%u, offset=%u, memory plane %u", p, m_layout.pitch[p], m_layout.offset[p], m_layout.mem_plane[p]);
+            }
+        }
+        else {
+            log.warning("No frame layout known for this format, frames can't be scanned out directly");
+        }
+
+        if(m_config.mem_type == TYPE_DMABUF){
+            struct v4l2_plane_pix_format& pfmt = format.fmt.pix_mp.plane_fmt[0];
+            if(format.fmt.pix_mp.num_planes != 1){
+                log.error("DMABUF import only supports single memory plane formats (got %d planes)", format.fmt.pix_mp.num_planes);
+                return false;
+            }
+            if(pfmt.bytesperline != m_dmabufs[0].pitch){
+                log.error("Driver pitch %u doesn't match imported buffer pitch %u", pfmt.bytesperline, m_dmabufs[0].pitch);
+                return false;
+            }
+            if(pfmt.sizeimage > m_dmabufs[0].size){
+                log.error("Imported buffers too small: %u bytes, driver needs %u bytes", m_dmabufs[0].size, pfmt.sizeimage);
+                return false;
+            }
+        }
     }
 
     return true;
@@ -307,12 +352,16 @@ bool Capture::requestBuffers()
     }
 
     // Verify
+    if(m_config.mem_type == TYPE_DMABUF && req.count > m_dmabufs.size()){
+        log.error("Driver needs %d buffers, only %zu imported", req.count, m_dmabufs.size());
+        return false;
+    }
     if(req.count != m_config.buf_count){
         log.warning("Driver adjusted buffer count from %d to %d", m_config.buf_count, req.count); 
         m_config.buf_count = req.count;
 
         try{
-            m_capture_buf.resize(req.count);
+            m_capture_buf.resize(req.count, emptyCaptureBuf());
         } catch(const std::bad_alloc& e) {
             log.error("Failed to resize capture buffer vector");
             return false;
@@ -324,11 +373,22 @@ bool Capture::requestBuffers()
     return true;
 }
 
+// Read one byte per page: the CPU users of the mapping (analytics, recorder, converter) don't fault in the frame path
+static void prefault(const void *addr, size_t size)
+{
+    const volatile uint8_t *p = (const volatile uint8_t *)addr;
+    long page = sysconf(_SC_PAGESIZE);
+
+    for(size_t off = 0; off < size; off += (size_t)page)
+        (void)p[off];
+}
+
 bool Capture::mapBuffers()
 {
     Logger& log = m_logger;
     struct v4l2_buffer buf{};
     struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    int map_flags = MAP_SHARED; // Not MAP_POPULATE: it skips the PFN mappings most exporters use, prefault() below faults them in
     
     log.status("Mapping capture buffers: Using %s", (m_config.mem_type == TYPE_DMABUF) ? "DMABUF" : "MMAP" );
     
@@ -350,30 +410,53 @@ bool Capture::mapBuffers()
             return false;
         }
         
+        // Imported buffers: no driver memory to map, keep a CPU view of the DMA-BUF if possible
+        if(m_config.mem_type == TYPE_DMABUF){
+            const dmabuf_t& dbuf = m_dmabufs[i];
+            void* mapped = mmap(NULL, dbuf.size, PROT_READ | PROT_WRITE, map_flags, dbuf.fd, 0);
+            if(mapped == MAP_FAILED){
+                log.warning("mmap failed for imported buffer %d: %s. No CPU access.", i, strerror(errno));
+                mapped = nullptr;
+            } else if(m_config.prefault){
+                prefault(mapped, dbuf.size);
+            }
+            m_capture_buf[i].plane_addr[0] = mapped;
+            m_capture_buf[i].plane_size[0] = dbuf.size;
+            m_capture_buf[i].dma_fd[0] = dbuf.fd;
+            m_capture_buf[i].num_planes = 1;
+
+            log.info(". Buffer %d: imported dma_fd=%d, size=%u bytes, addr=%p", i, dbuf.fd, dbuf.size, mapped);
+            continue;
+        }
+
         // Map buffer planes
         if(m_is_mp_device){
             log.info(". Buffer %d: (%d plane(s))", i, buf.length);
             
             for(unsigned int p = 0; p < buf.length; p++){
-                void* mapped = mmap(NULL, planes[p].length, PROT_READ | PROT_WRITE, MAP_SHARED, m_fd, planes[p].m.mem_offset);
+                void* mapped = mmap(NULL, planes[p].length, PROT_READ | PROT_WRITE, map_flags, m_fd, planes[p].m.mem_offset);
                 if(mapped == MAP_FAILED){
                     log.error("mmap failed for buffer %d plane %d: %s", i, p, strerror(errno));
-                    // Unmap previously mapped buffers
-                    for(unsigned int j = 0; j <= i; j++){
-                        for(unsigned int k = 0; k < buf.length; k++){
-                            if(m_capture_buf[j].plane_addr[k] != nullptr){
-                                munmap(m_capture_buf[j].plane_addr[k], m_capture_buf[j].plane_size[k]);
-                            }
-                        }
-                    }
+                    freeBuffers(); // Planes mapped and fds exported so far
                     return false;
                 }
+                if(m_config.prefault)
+                    prefault(mapped, planes[p].length);
+
                 // Save addr and size
                 m_capture_buf[i].plane_addr[p] = mapped;
                 m_capture_buf[i].plane_size[p] = planes[p].length;
                 
                 log.info("    Plane %d: addr=%p, size=%u bytes, offset=%u", p, mapped, planes[p].length, planes[p].m.mem_offset);
+
+                // Export plane as DMA-BUF for zero-copy consumers (e.g. display)
+                if(!exportBuffer(i, p)){
+                    log.error("Failed to export buffer %d plane %d", i, p);
+                    freeBuffers();
+                    return false;
+                }
             }
+            m_capture_buf[i].num_planes = buf.length;
         } else {
             log.error("TODO: Capture class doesn't support Non-Planar devices");
             return false;
@@ -385,28 +468,41 @@ bool Capture::mapBuffers()
     return true;
 }
 
+bool Capture::exportBuffer(unsigned int index, unsigned int plane)
+{
+    Logger& log = m_logger;
+    struct v4l2_exportbuffer expbuf{};
+
+    expbuf.type = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    expbuf.index = index;
+    expbuf.plane = plane;
+    expbuf.flags = O_RDWR | O_CLOEXEC;
+    if(!xioctl(m_fd, VIDIOC_EXPBUF, &expbuf)){
+        log.error("VIDIOC_EXPBUF failed for buffer %d plane %d", index, plane);
+        return false;
+    }
+
+    m_capture_buf[index].dma_fd[plane] = expbuf.fd;
+    log.info("    Plane %d: exported as dma_fd=%d", plane, expbuf.fd);
+
+    return true;
+}
+
 bool Capture::queueBuffers()
 {
     Logger& log = m_logger;
-    struct v4l2_buffer buf{};
-    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
     
     log.status("Queuing capture buffers");
-    // Fill v4l2_buffer struct
-    buf.type = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = (m_config.mem_type == TYPE_DMABUF) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
-    
-    if(m_is_mp_device){
-        buf.m.planes = planes;
-        buf.length   = VIDEO_MAX_PLANES;
-    }
     
+    // From now on the pool requeues, when the last holder lets go
+    m_pool.reset(m_config.buf_count, [this](unsigned int index){ return queueBuffer(index); });
+
     // Queue each buffer
     for(unsigned int i = 0; i < m_config.buf_count; i++){
-        buf.index = i;
-        
-        if(!xioctl(m_fd, VIDIOC_QBUF, &buf)){
-            log.error("VIDIOC_QBUF failed for buffer %d", i);
+        m_pool.setQueued(i, true);
+        if(!queueBuffer(i)){
+            log.error("Failed to queue buffer %d", i);
+            m_pool.setQueued(i, false);
             return false;
         }
         
@@ -416,6 +512,69 @@ bool Capture::queueBuffers()
     return true;
 }
 
+bool Capture::queueBuffer(unsigned int index)
+{
+    Logger& log = m_logger;
+    struct v4l2_buffer buf{};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+
+    // Fill v4l2_buffer struct
+    buf.type = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = (m_config.mem_type == TYPE_DMABUF) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    buf.index = index;
+    if(m_is_mp_device){
+        buf.m.planes = planes;
+        buf.length   = m_capture_buf[index].num_planes;
+    }
+    if(m_config.mem_type == TYPE_DMABUF){
+        planes[0].m.fd = m_dmabufs[index].fd;
+        planes[0].length = m_dmabufs[index].size;
+    }
+
+    if(!xioctl(m_fd, VIDIOC_QBUF, &buf)){
+        log.error("VIDIOC_QBUF failed for buffer %d", index);
+        return false;
+    }
+
+    return true;
+}
+
+bool Capture::subscribeEvents()
+{
+    Logger& log = m_logger;
+    struct v4l2_event_subscription sub{};
+
+    // Source change (e.g. resolution change on HDMI-in): reported through POLLPRI
+    sub.type = V4L2_EVENT_SOURCE_CHANGE;
+    if(ioctl(m_fd, VIDIOC_SUBSCRIBE_EVENT, &sub) < 0){
+        log.info("V4L2_EVENT_SOURCE_CHANGE not supported by device: %s", strerror(errno));
+    }
+
+    return true;
+}
+
+bool Capture::handleEvent()
+{
+    Logger& log = m_logger;
+    struct v4l2_event ev{};
+
+    // Drain all pending events
+    while(ioctl(m_fd, VIDIOC_DQEVENT, &ev) == 0){
+        if(ev.type == V4L2_EVENT_SOURCE_CHANGE && (ev.u.src_change.changes & V4L2_EVENT_SRC_CH_RESOLUTION)){
+            log.warning("Source resolution changed !");
+            m_source_changed = true;
+        } else {
+            log.info("Unhandled V4L2 event type %u", ev.type);
+        }
+    }
+    if(errno != ENOENT){
+        log.error("VIDIOC_DQEVENT failed: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
 bool Capture::streamOn()
 {
     Logger& log = m_logger;
@@ -433,18 +592,70 @@ bool Capture::streamOn()
     return true;
 }
 
+bool Capture::importBuffers(const std::vector<dmabuf_t>& bufs)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(m_config.mem_type != TYPE_DMABUF){
+        log.error("importBuffers: capture is not configured for DMABUF");
+        return false;
+    }
+    if(bufs.empty()){
+        log.error("importBuffers: no buffer provided");
+        return false;
+    }
+    for(const auto& b : bufs){
+        if(b.fd < 0 || b.size == 0 || b.pitch != bufs[0].pitch){
+            log.error("importBuffers: invalid buffer (fd=%d, size=%u, pitch=%u)", b.fd, b.size, b.pitch);
+            return false;
+        }
+    }
+
+    // One V4L2 buffer per imported DMA-BUF
+    if(bufs.size() != m_config.buf_count){
+        log.warning("Buffer count adjusted from %d to %zu imported buffers", m_config.buf_count, bufs.size());
+        m_config.buf_count = bufs.size();
+    }
+    try{
+        m_capture_buf.resize(m_config.buf_count, emptyCaptureBuf());
+        m_dmabufs = bufs;
+    } catch(const std::bad_alloc& e){
+        log.error("Failed to resize capture buffer vector");
+        return false;
+    }
+
+    log.info("Imported %zu DMA-BUF(s), pitch=%u", bufs.size(), bufs[0].pitch);
+
+    return true;
+}
+
 bool Capture::start()
 {
     Logger& log = m_logger;
 
+    if(m_config.mem_type == TYPE_DMABUF && m_dmabufs.empty()){
+        log.error("DMABUF mode: call importBuffers() before start()");
+        return false;
+    }
+
     // Check Caps
     if(!checkDeviceCapabilities()){
         log.error("Capture::checkDeviceCapabilities Failed !");
         return false;
     }
 
-    // Check format
-    if(!checkFormat()){
+    // Check format, unless this device already streamed it
+    std::unique_ptr<FormatCache> cache;
+    bool cached = false;
+    if(!m_config.format_cache.empty()){
+        cache.reset(new FormatCache(m_config.format_cache, log.get_verbose()));
+        cached = cache->lookup(m_device_key, m_config.fmt_fourcc, m_config.width, m_config.height);
+    }
+    if(cached){
+        log.status("Format %s %ux%u known good, skipping enumeration", m_config.fmt_fourcc.c_str(), m_config.width, m_config.height);
+    }
+    else if(!checkFormat()){
         log.error("Capture::checkFormat Failed !");
         return false;
     }
@@ -473,12 +684,28 @@ bool Capture::start()
         return false;
     }
 
+    // Subscribe to device events
+    if(!subscribeEvents()){
+        log.error("Capture::subscribeEvents Failed !");
+        return false;
+    }
+
     // Start streaming
     if(!streamOn()){
         log.error("Capture::streamOn Failed !");
         return false;
     }
 
+    // Streaming: known good from now on. A cached format the driver adjusted is enumerated again next time
+    if(cache && !cached && !m_fmt_adjusted){
+        cache->store(m_device_key, m_config.fmt_fourcc, m_config.width, m_config.height);
+        cache->save();
+    }
+    else if(cache && cached && m_fmt_adjusted){
+        cache->remove(m_device_key, m_config.fmt_fourcc, m_config.width, m_config.height);
+        cache->save();
+    }
+
     log.status("Capture is ON !");
 
     return true;
@@ -487,8 +714,8 @@ bool Capture::start()
 bool Capture::saveOneFrame(const std::string& path)
 {
     Logger& log = m_logger;
-    struct v4l2_buffer buf{};
-    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+    capture_frame_t frame{};
+    struct pollfd pfd{};
     
     log.status("Capturing one frame to %s", path.c_str());
 
@@ -498,47 +725,54 @@ bool Capture::saveOneFrame(const std::string& path)
         return false;
     }
 
-    // Prepare v4l2_buffer struct
-    buf.type = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
-    buf.memory = (m_config.mem_type == TYPE_DMABUF) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
-    
-    if(m_is_mp_device){
-        buf.m.planes = planes;
-        buf.length   = VIDEO_MAX_PLANES;
-    }
+    // Wait for a frame: the device is non-blocking
+    pfd.fd = m_fd;
+    pfd.events = POLLIN;
+    do {
+        if(poll(&pfd, 1, -1) < 0 && errno != EINTR){
+            log.error("poll failed: %s", strerror(errno));
+            return false;
+        }
+        if(!tryDequeue(frame)){
+            log.error("Capture::tryDequeue Failed !");
+            return false;
+        }
+    } while(frame.index < 0);
     
-    // Dequeue buffer
-    if(!xioctl(m_fd, VIDIOC_DQBUF, &buf)){ // This will block when no buffer is in the driver's outgoing queue.
-        log.error("VIDIOC_DQBUF failed");
+    log.info("Dequeued buffer %d", frame.index);
+    const capture_buf& cbuf = m_capture_buf[frame.index];
+
+    // Imported buffers may have no CPU mapping
+    if(cbuf.plane_addr[0] == nullptr){
+        log.error("Buffer %d has no CPU mapping, cannot save it", frame.index);
+        release(frame);
         return false;
     }
     
-    log.info("Dequeued buffer %d", buf.index);
-    
     // Open output file
     std::ofstream outfile(path, std::ios::binary);
     if(!outfile.is_open()){
         log.error("Failed to open output file: %s", path.c_str());
         // Important: re-queue buffer before returning
-        xioctl(m_fd, VIDIOC_QBUF, &buf);
+        release(frame);
         return false;
     }
     
     // Write frame data
     if(m_is_mp_device){
-        for(unsigned int p = 0; p < buf.length; p++){
-            if(planes[p].bytesused > 0){
-                outfile.write(static_cast<const char*>(m_capture_buf[buf.index].plane_addr[p]), planes[p].bytesused);
+        for(unsigned int p = 0; p < frame.num_planes; p++){
+            if(frame.bytesused[p] > 0){
+                outfile.write(static_cast<const char*>(cbuf.plane_addr[p]), frame.bytesused[p]);
                 // Check if write okay
                 if(outfile.fail()){
                     log.error("Failed to write plane %d to file: %s", p, strerror(errno));
                     outfile.close();
 
                     // Re-queue buffer before returning
-                    xioctl(m_fd, VIDIOC_QBUF, &buf);
+                    release(frame);
                     return false;
                 }
-                log.info("Wrote plane %d: %u bytes", p, planes[p].bytesused);
+                log.info("Wrote plane %d: %u bytes", p, frame.bytesused[p]);
             }
         }
     }
@@ -547,14 +781,105 @@ bool Capture::saveOneFrame(const std::string& path)
     log.info("Frame saved to %s", path.c_str());
     
     // Re-queue buffer
-    if(!xioctl(m_fd, VIDIOC_QBUF, &buf)){
-        log.error("VIDIOC_QBUF failed while re-queuing buffer %d", buf.index);
+    return release(frame);
+}
+
+bool Capture::tryDequeue(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    struct v4l2_buffer buf{};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+
+    frame.index = -1;
+
+    // Prepare v4l2_buffer struct
+    buf.type = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    buf.memory = (m_config.mem_type == TYPE_DMABUF) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    if(m_is_mp_device){
+        buf.m.planes = planes;
+        buf.length   = VIDEO_MAX_PLANES;
+    }
+
+    // Dequeue buffer: device is non-blocking, EAGAIN means no frame ready yet
+    while(ioctl(m_fd, VIDIOC_DQBUF, &buf) < 0){
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN)
+            return true;
+        log.error("VIDIOC_DQBUF failed: %s", strerror(errno));
         return false;
     }
-    
+
+    if((buf.flags & V4L2_BUF_FLAG_ERROR) && m_buf_error_rl.allow()){
+        log.warning("Buffer %d dequeued with error flag (sequence %u, %u similar messages suppressed)", buf.index, buf.sequence, m_buf_error_rl.takeSuppressed());
+    }
+
+    capture_buf& cbuf = m_capture_buf[buf.index];
+    if(!m_pool.acquire(buf.index)){
+        log.error("Buffer %d dequeued but not owned by the driver", buf.index);
+        // Back to the driver, unless a consumer still holds it: its last release requeues it
+        if(!m_pool.isHeld(buf.index)){
+            m_pool.setQueued(buf.index, true);
+            if(!queueBuffer(buf.index))
+                m_pool.setQueued(buf.index, false);
+        }
+        return false;
+    }
+
+    // Fill the handle
+    frame.index = buf.index;
+    frame.num_planes = cbuf.num_planes;
+    for(unsigned int p = 0; p < cbuf.num_planes; p++){
+        frame.bytesused[p] = m_is_mp_device ? planes[p].bytesused : buf.bytesused;
+        frame.dma_fd[p] = cbuf.dma_fd[p];
+        frame.plane_addr[p] = cbuf.plane_addr[p];
+    }
+    frame.timestamp_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ull + (uint64_t)buf.timestamp.tv_usec * 1000ull;
+    frame.sequence = buf.sequence;
+
+    return true;
+}
+
+bool Capture::retain(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_config.buf_count || !m_pool.retain(index)){
+        log.error("retain: buffer %d is not dequeued", index);
+        return false;
+    }
+
     return true;
 }
 
+bool Capture::release(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_config.buf_count){
+        log.error("release: invalid buffer index %d", index);
+        return false;
+    }
+
+    // Re-queued once the last holder released it
+    if(!m_pool.release(index)){
+        log.error("Failed releasing buffer %d", index);
+        return false;
+    }
+    frame.index = -1;
+
+    return true;
+}
+
+unsigned int Capture::queuedCount()
+{
+    return m_pool.queuedCount();
+}
+
 bool Capture::streamOff()
 {
     Logger& log = m_logger;
@@ -566,6 +891,10 @@ bool Capture::streamOff()
         return false;
     }
     
+    // STREAMOFF gives all buffers back to userspace
+    m_pool.report();
+    m_pool.returnAll();
+
     log.info("Streaming stopped successfully");
 
     return true;
@@ -581,25 +910,63 @@ bool Capture::stop()
         return false;
     }
 
+    // Free buffers so the next start() doesn't leak them
+    if(!freeBuffers()){
+        log.warning("Capture::freeBuffers Failed !");
+    }
+
     log.status("Capture is OFF !");
 
     return true;
 }
 
-Capture::~Capture()
+bool Capture::freeBuffers()
 {
     Logger& log = m_logger;
-    log.status("Quitting...");
+    bool mapped = false;
 
-    // Unmap requested buffers
-    for(unsigned int i = 0; i < m_config.buf_count; i++){
+    // Unmap requested buffers and close exported fds
+    for(auto& cbuf : m_capture_buf){
         for(unsigned int p = 0; p < VIDEO_MAX_PLANES; p++){
-            if(m_capture_buf[i].plane_addr[p] != nullptr){
-                munmap(m_capture_buf[i].plane_addr[p], m_capture_buf[i].plane_size[p]);
-                m_capture_buf[i].plane_addr[p] = nullptr;
+            if(cbuf.plane_addr[p] != nullptr){
+                munmap(cbuf.plane_addr[p], cbuf.plane_size[p]);
+                mapped = true;
+            }
+            if(cbuf.dma_fd[p] >= 0 && m_config.mem_type == TYPE_MMAP){ // Imported fds belong to the exporter
+                // Importers (e.g. display FB cache) must let go first, or the driver keeps the memory busy
+                if(m_release_cb)
+                    m_release_cb(cbuf.dma_fd[p]);
+                close(cbuf.dma_fd[p]);
+                mapped = true;
             }
         }
+        cbuf = emptyCaptureBuf();
+    }
+    if(!mapped){
+        return true; // Nothing allocated
+    }
+
+    // Release driver buffers
+    struct v4l2_requestbuffers req{};
+    req.count  = 0;
+    req.type   = m_is_mp_device ? V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE : V4L2_BUF_TYPE_VIDEO_CAPTURE;
+    req.memory = (m_config.mem_type == TYPE_DMABUF) ? V4L2_MEMORY_DMABUF : V4L2_MEMORY_MMAP;
+    if(!xioctl(m_fd, VIDIOC_REQBUFS, &req)){
+        log.error("VIDIOC_REQBUFS(0) failed: %s", strerror(errno));
+        return false;
     }
+
+    log.info("Buffers freed");
+
+    return true;
+}
+
+Capture::~Capture()
+{
+    Logger& log = m_logger;
+    log.status("Quitting...");
+
+    freeBuffers();
     
     // Close device FD
     close(m_fd);
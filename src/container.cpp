@@ -0,0 +1,229 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "container.hpp"
+
+ContainerReader::ContainerReader(const std::string& path, bool verbose)
+    : m_logger("container", verbose)
+{
+    Logger& log = m_logger;
+    struct stat st{};
+
+    // Open and map the whole file, pages are only read when touched
+    m_fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(m_fd < 0){
+        log.fatal("Failed to open " + path + ": " + strerror(errno));
+    }
+    if(fstat(m_fd, &st) < 0 || (size_t)st.st_size < CC_ALIGN){
+        close(m_fd);
+        log.fatal(path + " is too small to be a camcap file");
+    }
+    m_size = (size_t)st.st_size;
+    void* base = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if(base == MAP_FAILED){
+        close(m_fd);
+        log.fatal("mmap failed for " + path + ": " + strerror(errno));
+    }
+    m_base = static_cast<const uint8_t*>(base);
+    madvise(base, m_size, MADV_RANDOM); // Seeking around, don't read ahead whole GBs
+
+    // Validate header
+    m_hdr = reinterpret_cast<const cc_file_hdr_t*>(m_base);
+    if(m_hdr->magic != CC_FILE_MAGIC || m_hdr->version < CC_MIN_VERSION || m_hdr->version > CC_VERSION){
+        munmap(base, m_size);
+        close(m_fd);
+        log.fatal(path + " is not a camcap v" + std::to_string(CC_VERSION) + " file");
+    }
+
+    // Index
+    if(!loadIndex() && !scanRecords()){
+        munmap(base, m_size);
+        close(m_fd);
+        log.fatal("No usable frame in " + path);
+    }
+
+    log.info("Opened %s: %.4s %ux%u, %llu frames", path.c_str(), m_hdr->fourcc, m_hdr->width, m_hdr->height,
+             (unsigned long long)m_frame_count);
+}
+
+bool ContainerReader::loadIndex()
+{
+    Logger& log = m_logger;
+    uint64_t offset = m_hdr->index_offset;
+    uint64_t count = m_hdr->frame_count;
+
+    if(!offset){
+        log.warning("File has no index (interrupted recording?), scanning records");
+        return false;
+    }
+
+    // Sanity check
+    if(offset + sizeof(cc_index_hdr_t) > m_size ||
+       (m_size - offset - sizeof(cc_index_hdr_t)) / sizeof(cc_index_entry_t) < count){
+        log.warning("Index out of file bounds, scanning records");
+        return false;
+    }
+    const cc_index_hdr_t *ihdr = reinterpret_cast<const cc_index_hdr_t*>(m_base + offset);
+    if(ihdr->magic != CC_INDEX_MAGIC || ihdr->frame_count != count){
+        log.warning("Corrupted index, scanning records");
+        return false;
+    }
+
+    m_index = reinterpret_cast<const cc_index_entry_t*>(ihdr + 1);
+    m_frame_count = count;
+
+    return true;
+}
+
+bool ContainerReader::scanRecords()
+{
+    uint64_t offset = CC_ALIGN;
+    uint64_t end = m_hdr->index_offset ? m_hdr->index_offset : m_size; // A bad index may still bound the frames
+
+    m_scanned.clear();
+    while(offset + sizeof(cc_frame_hdr_t) <= end){
+        const cc_frame_hdr_t *fhdr = reinterpret_cast<const cc_frame_hdr_t*>(m_base + offset);
+        if(fhdr->magic != CC_FRAME_MAGIC || fhdr->num_planes > VIDEO_MAX_PLANES)
+            break;
+
+        // Record size
+        uint64_t size = CC_ALIGN;
+        for(unsigned int p = 0; p < fhdr->num_planes; p++)
+            size += fhdr->padded_size[p];
+        if(offset + size > end)
+            break; // Truncated record
+
+        cc_index_entry_t entry{};
+        entry.offset = offset;
+        entry.timestamp_ns = fhdr->timestamp_ns;
+        entry.sequence = fhdr->sequence;
+        m_scanned.push_back(entry);
+        offset += size;
+    }
+
+    m_index = m_scanned.data();
+    m_frame_count = m_scanned.size();
+
+    return m_frame_count > 0;
+}
+
+bool ContainerReader::getFrame(uint64_t n, cc_frame_t& out)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(n >= m_frame_count){
+        log.error("getFrame: frame %llu out of range (%llu frames)", (unsigned long long)n, (unsigned long long)m_frame_count);
+        return false;
+    }
+
+    uint64_t offset = m_index[n].offset;
+    if(offset + CC_ALIGN > m_size){
+        log.error("getFrame: frame %llu offset out of file bounds", (unsigned long long)n);
+        return false;
+    }
+    const cc_frame_hdr_t *fhdr = reinterpret_cast<const cc_frame_hdr_t*>(m_base + offset);
+    if(fhdr->magic != CC_FRAME_MAGIC || fhdr->num_planes > VIDEO_MAX_PLANES){
+        log.error("getFrame: bad record for frame %llu", (unsigned long long)n);
+        return false;
+    }
+
+    // Planes follow the header
+    offset += CC_ALIGN;
+    out.hdr = fhdr;
+    for(unsigned int p = 0; p < VIDEO_MAX_PLANES; p++){
+        out.plane[p] = nullptr;
+        if(p >= fhdr->num_planes)
+            continue;
+        if(offset + fhdr->padded_size[p] > m_size){
+            log.error("getFrame: frame %llu plane %u truncated", (unsigned long long)n, p);
+            return false;
+        }
+        out.plane[p] = m_base + offset;
+        offset += fhdr->padded_size[p];
+    }
+
+    return true;
+}
+
+void ContainerReader::prefetch(uint64_t n)
+{
+    static const uint64_t page_size = (uint64_t)sysconf(_SC_PAGESIZE);
+
+    if(n >= m_frame_count)
+        return;
+
+    // Record range, from the index alone: the header page may not be resident yet
+    uint64_t start = m_index[n].offset;
+    uint64_t end = (n + 1 < m_frame_count) ? m_index[n + 1].offset : (m_hdr->index_offset ? m_hdr->index_offset : m_size);
+    if(end > m_size || end <= start)
+        return;
+
+    start &= ~(page_size - 1);
+    madvise(const_cast<uint8_t*>(m_base) + start, end - start, MADV_WILLNEED);
+}
+
+capture_config ContainerReader::captureConfig()
+{
+    capture_config conf;
+    conf.fmt_fourcc = std::string(m_hdr->fourcc, 4);
+    conf.width = m_hdr->width;
+    conf.height = m_hdr->height;
+    conf.mem_type = (m_hdr->mem_type < MEM_TYPE_MAX) ? (mem_type_t)m_hdr->mem_type : TYPE_MMAP;
+    conf.buf_count = m_hdr->buf_count;
+    return conf;
+}
+
+bool ContainerReader::layout(frame_layout_t& out)
+{
+    out = frame_layout_t{};
+    if(m_hdr->version < 2 || !m_hdr->num_planes || m_hdr->num_planes > LAYOUT_MAX_PLANES)
+        return false;
+
+    out.fourcc = m_hdr->layout_fourcc;
+    out.width = m_hdr->width;
+    out.height = m_hdr->height;
+    out.num_planes = m_hdr->num_planes;
+    for(uint32_t p = 0; p < out.num_planes; p++){
+        if(m_hdr->mem_plane[p] >= VIDEO_MAX_PLANES)
+            return false;
+        out.pitch[p] = m_hdr->pitch[p];
+        out.offset[p] = m_hdr->offset[p];
+        out.mem_plane[p] = m_hdr->mem_plane[p];
+        out.num_mem_planes = std::max(out.num_mem_planes, out.mem_plane[p] + 1);
+    }
+    return true;
+}
+
+ContainerReader::~ContainerReader()
+{
+    munmap(const_cast<uint8_t*>(m_base), m_size);
+    close(m_fd);
+}
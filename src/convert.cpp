@@ -0,0 +1,578 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <linux/dma-buf.h>
+#include <drm/drm_fourcc.h>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "convert.hpp"
+
+// BT.601 limited range, 6 fractional bits: every intermediate fits an int16 NEON lane.
+// The scalar path uses the same coefficients and rounding, both give identical pixels.
+#define CONV_CY  74
+#define CONV_CRV 102
+#define CONV_CGU 25
+#define CONV_CGV 52
+#define CONV_CBU 129
+
+static inline uint8_t clamp_u8(int v)
+{
+    return (uint8_t)((v < 0) ? 0 : (v > 255) ? 255 : v);
+}
+
+static inline void yuv_to_xrgb(int y, int u, int v, uint8_t *out)
+{
+    int yy = CONV_CY * (y - 16);
+    u -= 128;
+    v -= 128;
+    out[0] = clamp_u8((yy + CONV_CBU * u + 32) >> 6);                 // B
+    out[1] = clamp_u8((yy - CONV_CGU * u - CONV_CGV * v + 32) >> 6);  // G
+    out[2] = clamp_u8((yy + CONV_CRV * v + 32) >> 6);                 // R
+    out[3] = 0xff;                                                    // X
+}
+
+#if defined(__ARM_NEON)
+typedef struct {
+    int16x8_t r;
+    int16x8_t g; // Subtracted from luma
+    int16x8_t b;
+} chroma_t;
+
+static inline chroma_t neon_chroma(uint8x8_t u8, uint8x8_t v8)
+{
+    const int16x8_t c128 = vdupq_n_s16(128);
+    int16x8_t u = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(u8)), c128);
+    int16x8_t v = vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(v8)), c128);
+    chroma_t c;
+    c.r = vmulq_n_s16(v, CONV_CRV);
+    c.g = vmlaq_n_s16(vmulq_n_s16(u, CONV_CGU), v, CONV_CGV);
+    c.b = vmulq_n_s16(u, CONV_CBU);
+    return c;
+}
+
+static inline int16x8_t neon_luma(uint8x8_t y8)
+{
+    return vmulq_n_s16(vsubq_s16(vreinterpretq_s16_u16(vmovl_u8(y8)), vdupq_n_s16(16)), CONV_CY);
+}
+#endif
+
+// One row of a semi-planar 4:2:x source (NV12, NV16): chroma pairs cover 2 pixels
+static void sp_row_to_xrgb(const uint8_t *y, const uint8_t *uv, uint8_t *dst, uint32_t width)
+{
+    uint32_t x = 0;
+
+#if defined(__ARM_NEON)
+    for(; x + 16 <= width; x += 16){
+        uint8x16_t yv = vld1q_u8(y + x);
+        uint8x8x2_t uvv = vld2_u8(uv + x);
+        chroma_t c = neon_chroma(uvv.val[0], uvv.val[1]);
+        int16x8_t ylo = neon_luma(vget_low_u8(yv));
+        int16x8_t yhi = neon_luma(vget_high_u8(yv));
+
+        // Duplicate chroma for both pixels of each pair
+        int16x8x2_t r = vzipq_s16(c.r, c.r);
+        int16x8x2_t g = vzipq_s16(c.g, c.g);
+        int16x8x2_t b = vzipq_s16(c.b, c.b);
+
+        uint8x16x4_t out;
+        out.val[0] = vcombine_u8(vqrshrun_n_s16(vqaddq_s16(ylo, b.val[0]), 6), vqrshrun_n_s16(vqaddq_s16(yhi, b.val[1]), 6));
+        out.val[1] = vcombine_u8(vqrshrun_n_s16(vqsubq_s16(ylo, g.val[0]), 6), vqrshrun_n_s16(vqsubq_s16(yhi, g.val[1]), 6));
+        out.val[2] = vcombine_u8(vqrshrun_n_s16(vqaddq_s16(ylo, r.val[0]), 6), vqrshrun_n_s16(vqaddq_s16(yhi, r.val[1]), 6));
+        out.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + x * 4, out);
+    }
+#endif
+
+    for(; x < width; x++){
+        uint32_t c = x & ~1u;
+        yuv_to_xrgb(y[x], uv[c], uv[c + 1], dst + x * 4);
+    }
+}
+
+// One row of YUYV
+static void yuyv_row_to_xrgb(const uint8_t *src, uint8_t *dst, uint32_t width)
+{
+    uint32_t x = 0;
+
+#if defined(__ARM_NEON)
+    for(; x + 16 <= width; x += 16){
+        uint8x8x4_t p = vld4_u8(src + x * 2); // Y0 U Y1 V, 8 pixel pairs
+        chroma_t c = neon_chroma(p.val[1], p.val[3]);
+        int16x8_t ye = neon_luma(p.val[0]);
+        int16x8_t yo = neon_luma(p.val[2]);
+
+        // Even and odd pixels, interleaved back
+        uint8x8x2_t b = vzip_u8(vqrshrun_n_s16(vqaddq_s16(ye, c.b), 6), vqrshrun_n_s16(vqaddq_s16(yo, c.b), 6));
+        uint8x8x2_t g = vzip_u8(vqrshrun_n_s16(vqsubq_s16(ye, c.g), 6), vqrshrun_n_s16(vqsubq_s16(yo, c.g), 6));
+        uint8x8x2_t r = vzip_u8(vqrshrun_n_s16(vqaddq_s16(ye, c.r), 6), vqrshrun_n_s16(vqaddq_s16(yo, c.r), 6));
+
+        uint8x16x4_t out;
+        out.val[0] = vcombine_u8(b.val[0], b.val[1]);
+        out.val[1] = vcombine_u8(g.val[0], g.val[1]);
+        out.val[2] = vcombine_u8(r.val[0], r.val[1]);
+        out.val[3] = vdupq_n_u8(0xff);
+        vst4q_u8(dst + x * 4, out);
+    }
+#endif
+
+    for(; x < width; x++){
+        const uint8_t *pair = src + (x & ~1u) * 2;
+        yuv_to_xrgb(src[x * 2], pair[1], pair[3], dst + x * 4);
+    }
+}
+
+// Two YUYV rows into two Y rows and one UV row, chroma averaged vertically
+static void yuyv_rows_to_nv12(const uint8_t *s0, const uint8_t *s1, uint8_t *y0, uint8_t *y1, uint8_t *uv, uint32_t width)
+{
+    uint32_t x = 0;
+
+#if defined(__ARM_NEON)
+    for(; x + 16 <= width; x += 16){
+        uint8x16x2_t a = vld2q_u8(s0 + x * 2); // Y, then U V interleaved: already NV12 chroma order
+        uint8x16x2_t b = vld2q_u8(s1 + x * 2);
+        vst1q_u8(y0 + x, a.val[0]);
+        vst1q_u8(y1 + x, b.val[0]);
+        vst1q_u8(uv + x, vrhaddq_u8(a.val[1], b.val[1]));
+    }
+#endif
+
+    for(; x < width; x++){
+        y0[x] = s0[x * 2];
+        y1[x] = s1[x * 2];
+        uv[x] = (uint8_t)((s0[x * 2 + 1] + s1[x * 2 + 1] + 1) >> 1);
+    }
+}
+
+static void convert_rows(const image_t& src, const image_t& dst, uint32_t begin, uint32_t end)
+{
+    switch(src.fourcc){
+        case DRM_FORMAT_NV12:
+        case DRM_FORMAT_NV16:{
+            bool half = (src.fourcc == DRM_FORMAT_NV12);
+            for(uint32_t y = begin; y < end; y++){
+                const uint8_t *uv = src.plane[1] + (size_t)(half ? y / 2 : y) * src.stride[1];
+                sp_row_to_xrgb(src.plane[0] + (size_t)y * src.stride[0], uv, dst.plane[0] + (size_t)y * dst.stride[0], src.width);
+            }
+            break;
+        }
+        case DRM_FORMAT_YUYV:
+            if(dst.fourcc == DRM_FORMAT_NV12){
+                for(uint32_t y = begin; y + 1 < end; y += 2){
+                    yuyv_rows_to_nv12(src.plane[0] + (size_t)y * src.stride[0], src.plane[0] + (size_t)(y + 1) * src.stride[0],
+                                      dst.plane[0] + (size_t)y * dst.stride[0], dst.plane[0] + (size_t)(y + 1) * dst.stride[0],
+                                      dst.plane[1] + (size_t)(y / 2) * dst.stride[1], src.width);
+                }
+            }
+            else {
+                for(uint32_t y = begin; y < end; y++)
+                    yuyv_row_to_xrgb(src.plane[0] + (size_t)y * src.stride[0], dst.plane[0] + (size_t)y * dst.stride[0], src.width);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+Converter::Converter(unsigned int threads, bool verbose)
+    : m_pool(threads ? threads - 1 : 0, verbose), m_logger("convert", verbose) // The caller is one of the threads
+{
+    Logger& log = m_logger;
+#if defined(__ARM_NEON)
+    log.info("Using NEON kernels, %u threads", m_pool.size() + 1);
+#else
+    log.info("Using scalar kernels, %u threads", m_pool.size() + 1);
+#endif
+}
+
+bool Converter::supported(uint32_t src_fourcc, uint32_t dst_fourcc)
+{
+    if(dst_fourcc == DRM_FORMAT_XRGB8888)
+        return src_fourcc == DRM_FORMAT_NV12 || src_fourcc == DRM_FORMAT_NV16 || src_fourcc == DRM_FORMAT_YUYV;
+    if(dst_fourcc == DRM_FORMAT_NV12)
+        return src_fourcc == DRM_FORMAT_YUYV;
+    return false;
+}
+
+bool Converter::convert(const image_t& src, const image_t& dst)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(!supported(src.fourcc, dst.fourcc)){
+        log.error("convert: unsupported conversion %.4s -> %.4s", (const char*)&src.fourcc, (const char*)&dst.fourcc);
+        return false;
+    }
+    if(src.width != dst.width || src.height != dst.height || ((src.width | src.height) & 1)){
+        log.error("convert: sizes must match and be even (%ux%u -> %ux%u)", src.width, src.height, dst.width, dst.height);
+        return false;
+    }
+
+    // Row tiles
+    uint32_t height = src.height;
+    unsigned int tiles = (height + CONV_TILE_ROWS - 1) / CONV_TILE_ROWS;
+    m_pool.run(tiles, [&](unsigned int tile){
+        uint32_t begin = tile * CONV_TILE_ROWS;
+        convert_rows(src, dst, begin, std::min(begin + CONV_TILE_ROWS, height));
+    });
+
+    return true;
+}
+
+ConvertStage::ConvertStage(FrameSource& upstream, const capture_config& src_conf, const convert_config& conf, bool verbose)
+    : m_upstream(upstream), m_src_config(src_conf), m_rotation(conf.rotation), m_threads(conf.threads), m_logger("convert", verbose)
+{
+    Logger& log = m_logger;
+    const std::string& s = src_conf.fmt_fourcc;
+    const std::string& d = conf.fourcc;
+
+    // Sanity check
+    if(s.length() != 4 || d.length() != 4){
+        log.fatal("Invalid fourcc");
+    }
+    if(m_rotation % 90 || m_rotation >= 360){
+        log.fatal("Invalid rotation " + std::to_string(m_rotation));
+    }
+    m_src_fourcc = fourcc_code(s[0], s[1], s[2], s[3]);
+    m_dst_fourcc = fourcc_code(d[0], d[1], d[2], d[3]);
+
+    // Output format
+    bool swap = (m_rotation == 90 || m_rotation == 270);
+    m_config = src_conf;
+    m_config.fmt_fourcc = d;
+    m_config.width = conf.width ? conf.width : (swap ? src_conf.height : src_conf.width);
+    m_config.height = conf.height ? conf.height : (swap ? src_conf.width : src_conf.height);
+
+    // Backend: RGA when built in, CPU otherwise
+#if defined(CAMCAP_HAVE_RGA)
+    if(RgaEngine::supported(m_src_fourcc, m_dst_fourcc)){
+        m_rga.reset(new RgaEngine(verbose));
+        log.info("%s %ux%u -> %s %ux%u (rotation %u) on the RGA", s.c_str(), src_conf.width, src_conf.height,
+                 d.c_str(), m_config.width, m_config.height, m_rotation);
+        return;
+    }
+#endif
+    if(!cpuCapable()){
+        log.fatal(s + " " + std::to_string(src_conf.width) + "x" + std::to_string(src_conf.height) + " -> " + d + " " +
+                  std::to_string(m_config.width) + "x" + std::to_string(m_config.height) + " (rotation " +
+                  std::to_string(m_rotation) + ") is not supported without the RGA");
+    }
+    m_converter.reset(new Converter(m_threads, verbose));
+    log.info("%s -> %s on the CPU", s.c_str(), d.c_str());
+}
+
+bool ConvertStage::cpuCapable()
+{
+    return Converter::supported(m_src_fourcc, m_dst_fourcc) && m_rotation == 0 &&
+           m_config.width == m_src_config.width && m_config.height == m_src_config.height;
+}
+
+bool ConvertStage::importBuffers(const std::vector<dmabuf_t>& bufs)
+{
+    Logger& log = m_logger;
+
+    if(bufs.empty()){
+        log.error("importBuffers: no buffer");
+        return false;
+    }
+
+    for(const auto& dbuf : bufs){
+        void* mapped = mmap(NULL, dbuf.size, PROT_READ | PROT_WRITE, MAP_SHARED, dbuf.fd, 0);
+        if(mapped == MAP_FAILED){
+            log.error("mmap failed for dma_fd %d: %s", dbuf.fd, strerror(errno));
+            return false;
+        }
+        conv_buf_t cbuf{};
+        cbuf.dbuf = dbuf;
+        cbuf.addr = mapped;
+        m_bufs.push_back(cbuf);
+    }
+    layout_contiguous(m_dst_fourcc, m_config.width, m_config.height, bufs[0].pitch, m_layout);
+
+    log.info("Imported %zu output buffers", m_bufs.size());
+
+    return true;
+}
+
+bool ConvertStage::setSourceLayout(const frame_layout_t& layout)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(layout.fourcc != m_src_fourcc || layout.num_planes > 2){
+        log.error("setSourceLayout: %.4s layout for a %.4s source", (const char*)&layout.fourcc, (const char*)&m_src_fourcc);
+        return false;
+    }
+
+    // The driver may have adjusted the size
+    if(layout.width != m_src_config.width || layout.height != m_src_config.height){
+        log.warning("Source is %ux%u instead of %ux%u", layout.width, layout.height, m_src_config.width, m_src_config.height);
+        m_src_config.width = layout.width;
+        m_src_config.height = layout.height;
+#if defined(CAMCAP_HAVE_RGA)
+        if(!m_rga && !cpuCapable()){
+#else
+        if(!cpuCapable()){
+#endif
+            log.error("%ux%u -> %ux%u is not supported without the RGA", layout.width, layout.height, m_config.width, m_config.height);
+            return false;
+        }
+    }
+    m_src_layout = layout;
+
+    return true;
+}
+
+bool ConvertStage::sourceImage(const capture_frame_t& frame, image_t& img)
+{
+    Logger& log = m_logger;
+    const frame_layout_t& l = m_src_layout;
+
+    img.fourcc = m_src_fourcc;
+    img.width = m_src_config.width;
+    img.height = m_src_config.height;
+    img.plane[1] = nullptr;
+    img.stride[1] = 0;
+    if(!l.fourcc){
+        log.error("Source layout unknown");
+        return false;
+    }
+
+    // Pitches and offsets as negotiated: padding past the rows is never mistaken for pixels
+    for(uint32_t p = 0; p < l.num_planes; p++){
+        uint32_t m = l.mem_plane[p];
+        if(m >= frame.num_planes || !frame.plane_addr[m]){
+            log.error("Frame %u has no CPU mapping", frame.sequence);
+            return false;
+        }
+        img.plane[p] = static_cast<uint8_t*>(frame.plane_addr[m]) + l.offset[p];
+        img.stride[p] = l.pitch[p];
+    }
+
+    return true;
+}
+
+bool ConvertStage::convertCpu(const capture_frame_t& frame, conv_buf_t& cbuf)
+{
+    image_t src, dst;
+
+    if(!sourceImage(frame, src))
+        return false;
+    dst.fourcc = m_dst_fourcc;
+    dst.width = m_config.width;
+    dst.height = m_config.height;
+    dst.plane[0] = static_cast<uint8_t*>(cbuf.addr);
+    dst.stride[0] = cbuf.dbuf.pitch;
+    dst.plane[1] = (m_dst_fourcc == DRM_FORMAT_NV12) ? dst.plane[0] + (size_t)dst.stride[0] * dst.height : nullptr;
+    dst.stride[1] = (m_dst_fourcc == DRM_FORMAT_NV12) ? dst.stride[0] : 0;
+
+    // Bracketed for CPU cache maintenance
+    struct dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+    ioctl(cbuf.dbuf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+    bool ok = m_converter->convert(src, dst);
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+    ioctl(cbuf.dbuf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    return ok;
+}
+
+#if defined(CAMCAP_HAVE_RGA)
+bool ConvertStage::convertRga(const capture_frame_t& frame, conv_buf_t& cbuf)
+{
+    Logger& log = m_logger;
+    uint32_t height = m_src_config.height;
+
+    // The engine takes one contiguous DMA-BUF per image
+    if(frame.num_planes != 1 || frame.dma_fd[0] < 0 || !frame.bytesused[0]){
+        log.error("Frame %u is not a single plane DMA-BUF", frame.sequence);
+        return false;
+    }
+    // Same pitch for both planes, chroma a whole number of rows after luma
+    const frame_layout_t& l = m_src_layout;
+    uint32_t rows = height;
+    if(l.num_planes == 2){
+        if(l.mem_plane[1] != 0 || l.pitch[1] != l.pitch[0] || l.offset[0] != 0 || !l.pitch[0] || l.offset[1] % l.pitch[0]){
+            log.error("Source layout can't be described to the RGA");
+            return false;
+        }
+        rows = l.offset[1] / l.pitch[0];
+    }
+    rga_image_t src{frame.dma_fd[0], l.mem_size[0] ? l.mem_size[0] : frame.bytesused[0], m_src_fourcc, m_src_config.width, height, l.pitch[0], rows};
+    rga_image_t dst{cbuf.dbuf.fd, cbuf.dbuf.size, m_dst_fourcc, m_config.width, m_config.height, cbuf.dbuf.pitch, 0};
+
+    return m_rga->process(src, dst, m_rotation);
+}
+#endif
+
+void ConvertStage::invalidateBuffer(int buf_fd)
+{
+#if defined(CAMCAP_HAVE_RGA)
+    if(m_rga)
+        m_rga->forget(buf_fd);
+#else
+    (void)buf_fd;
+#endif
+}
+
+bool ConvertStage::tryDequeue(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    capture_frame_t newest{};
+    bool ok = false;
+
+    frame.index = -1;
+    newest.index = -1;
+
+    // Convert only the newest of all ready frames
+    while(true){
+        capture_frame_t f{};
+        if(!m_upstream.tryDequeue(f))
+            return false;
+        if(f.index < 0)
+            break;
+        if(newest.index >= 0){
+            m_skipped++;
+            if(!m_upstream.release(newest))
+                return false;
+        }
+        newest = f;
+    }
+    if(newest.index < 0)
+        return true;
+
+    // Free output buffer
+    int index = -1;
+    for(unsigned int i = 0; i < m_bufs.size(); i++){
+        if(!m_bufs[i].out){
+            index = i;
+            break;
+        }
+    }
+    if(index < 0){
+        m_dropped++;
+        if(m_drop_rl.allow())
+            log.warning("No free output buffer, frame %u dropped (%u similar messages suppressed)", newest.sequence, m_drop_rl.takeSuppressed());
+        return m_upstream.release(newest);
+    }
+    conv_buf_t& cbuf = m_bufs[index];
+
+    // Output layout: same as Display::allocateCameraBuffers()
+    uint32_t pitch = cbuf.dbuf.pitch;
+    uint32_t size = (m_dst_fourcc == DRM_FORMAT_NV12) ? pitch * m_config.height * 3 / 2 : pitch * m_config.height;
+    if(size > cbuf.dbuf.size){
+        log.error("Output buffers are too small (%u < %u bytes)", cbuf.dbuf.size, size);
+        m_upstream.release(newest);
+        return false;
+    }
+
+    // Convert. The RGA gives way to the CPU for good if it fails on a job the CPU can do
+    uint64_t start_ns = monotonic_ns();
+#if defined(CAMCAP_HAVE_RGA)
+    if(m_rga){
+        ok = convertRga(newest, cbuf);
+        if(!ok && cpuCapable()){
+            log.warning("RGA failed, falling back to the CPU converter");
+            m_rga.reset();
+            m_converter.reset(new Converter(m_threads, log.get_verbose()));
+        }
+    }
+#endif
+    if(m_converter)
+        ok = convertCpu(newest, cbuf);
+    m_convert_ns += monotonic_ns() - start_ns;
+
+    // The source buffer can go back right away
+    capture_frame_t converted = newest;
+    if(!m_upstream.release(newest) || !ok)
+        return false;
+    m_converted++;
+
+    // Fill the handle
+    cbuf.out = true;
+    frame.index = index;
+    frame.num_planes = 1;
+    frame.bytesused[0] = size;
+    frame.dma_fd[0] = cbuf.dbuf.fd;
+    frame.plane_addr[0] = cbuf.addr;
+    frame.timestamp_ns = converted.timestamp_ns;
+    frame.sequence = converted.sequence;
+
+    return true;
+}
+
+bool ConvertStage::retain(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_bufs.size() || !m_bufs[index].out){
+        log.error("retain: buffer %d is not handed out", index);
+        return false;
+    }
+
+    m_bufs[index].users++;
+
+    return true;
+}
+
+bool ConvertStage::release(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_bufs.size() || !m_bufs[index].out){
+        log.error("release: buffer %d is not handed out", index);
+        return false;
+    }
+    frame.index = -1;
+
+    conv_buf_t& cbuf = m_bufs[index];
+    if(cbuf.users > 0)
+        cbuf.users--;
+    else
+        cbuf.out = false;
+
+    return true;
+}
+
+ConvertStage::~ConvertStage()
+{
+    Logger& log = m_logger;
+
+    log.info("Converted %llu frames (%.2f ms avg), %llu skipped, %llu dropped", (unsigned long long)m_converted,
+             m_converted ? (double)m_convert_ns / (double)m_converted / 1e6 : 0.0,
+             (unsigned long long)m_skipped, (unsigned long long)m_dropped);
+
+    for(auto& cbuf : m_bufs){
+        munmap(cbuf.addr, cbuf.dbuf.size);
+    }
+}
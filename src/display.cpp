@@ -21,6 +21,7 @@
  */
 
 #include <iostream>
+#include <algorithm>
 #include <fcntl.h>
 #include <unistd.h>
 #include <sys/mman.h>
@@ -28,6 +29,7 @@
 #include <drm/drm_fourcc.h>
 
 #include "display.hpp"
+#include "splash.hpp"
 
 Display::Display(display_config& conf, bool verbose)
     : m_config(conf), m_logger("display", verbose)
@@ -81,6 +83,11 @@ Display::Display(display_config& conf, bool verbose)
             log.fatal("Enabling atomic modesettings failed !");
         }
 
+        // Explicit buffer layouts (tiled, compressed)
+        uint64_t cap = 0;
+        m_fb_modifiers = (drmGetCap(m_drmFd, DRM_CAP_ADDFB2_MODIFIERS, &cap) == 0 && cap);
+        log.info("FB modifiers %ssupported", m_fb_modifiers ? "" : "NOT ");
+
         // Create GBM device
         m_gbmDev = gbm_create_device(m_drmFd);
         if(!m_gbmDev){
@@ -96,9 +103,12 @@ Display::Display(display_config& conf, bool verbose)
             log.fatal("Specified format " + fourcc + " is NOT supported");
         }
 
+        // FB cache
+        m_fb_cache.reset(new FbCache(m_drmFd, m_config.fb_cache_size, verbose));
+
         // Set camera Format
-        fourcc = m_config.cam_buf.fourcc;
-        m_cam_format = fourcc_code(fourcc[0], fourcc[1], fourcc[2], fourcc[3]);
+        std::string& cam_fourcc = m_config.cam_buf.fourcc;
+        m_cam_format = fourcc_code(cam_fourcc[0], cam_fourcc[1], cam_fourcc[2], cam_fourcc[3]);
 
     } catch (...) {
         if(m_gbmDev) gbm_device_destroy(m_gbmDev);
@@ -242,13 +252,24 @@ bool Display::findCrtc()
     return true;
 }
 
+static bool plane_supports(const plane_caps_t& plane, uint32_t format, uint64_t modifier)
+{
+    auto it = plane.formats.find(format);
+    if(it == plane.formats.end())
+        return false;
+    for(uint64_t mod : it->second){
+        if(mod == modifier)
+            return true;
+    }
+    return false;
+}
+
 bool Display::findPlane()
 {
     Logger& log = m_logger;
     int crtc_index = -1;
-    bool plane_format_ok = false;
 
-    log.status("Finding primary plane...");
+    log.status("Finding planes...");
 
     // Planes require a separate get resources call
     drmModePlaneRes *planeRes = drmModeGetPlaneResources(m_drmFd);
@@ -264,72 +285,443 @@ bool Display::findPlane()
             break;
         }
     }
-    
-    // Find a primary plane
+
+    // Keep every plane compatible with our CRTC, probePipeline() chooses among them
+    m_planes.clear();
     for(uint32_t i = 0; i < planeRes->count_planes; i++){
         drmModePlane *plane = drmModeGetPlane(m_drmFd, planeRes->planes[i]);
         if(!plane)
             continue;
-        
-        // Check if plane is compatible with our CRTC
-        if(plane->possible_crtcs & (1u << crtc_index)){
-            // Check if it's a PRIMARY plane
-            drmModeObjectProperties *props = drmModeObjectGetProperties(m_drmFd, plane->plane_id, DRM_MODE_OBJECT_PLANE);
-            if(props){
-                for(uint32_t j = 0; j < props->count_props; j++){
-                    drmModePropertyRes *prop = drmModeGetProperty(m_drmFd, props->props[j]);
-                    if(prop){
-                        if(strcmp(prop->name, "type") == 0 && props->prop_values[j] == DRM_PLANE_TYPE_PRIMARY){
-                            // Validate primary plane against camera format
-                            for(uint32_t k = 0; k < plane->count_formats; k++){
-                                if(plane->formats[k] == m_cam_format){
-                                    plane_format_ok = true;
-                                    break;
-                                }
-                            }
-                            // Plane found
-                            if(plane_format_ok){
-                                m_primaryPlaneId = plane->plane_id;
-                                m_drmPrimaryPlane = plane;
-                                log.info("Found Primary DRM plane ID : %d", m_primaryPlaneId);
-                            }
-                        }
-                        drmModeFreeProperty(prop);
-                    }
-                    // TODO: add lookup for an overlay plane for GPU.
-                    // TODO: validate overlay plane against GPU format.
-                    if(m_primaryPlaneId) break;
-                }
-                drmModeFreeObjectProperties(props);
-            }
+        if(!(plane->possible_crtcs & (1u << crtc_index))){
+            drmModeFreePlane(plane);
+            continue;
         }
-        if(m_primaryPlaneId) break;
+
+        plane_caps_t caps{};
+        caps.id = plane->plane_id;
+        caps.on_crtc = (plane->crtc_id == m_crtcId);
+        std::map<std::string, drm_prop_t> props;
+        if(!get_drmModeProperties(m_drmFd, caps.id, DRM_MODE_OBJECT_PLANE, props) || !cachePlaneProperties(caps.id, caps.props)){
+            log.warning("Skipping plane %u: missing properties", caps.id);
+            drmModeFreePlane(plane);
+            continue;
+        }
+        auto type = props.find("type");
+        caps.type = (type != props.end()) ? type->second.value : DRM_PLANE_TYPE_OVERLAY;
+        auto zpos = props.find("zpos");
+        caps.zpos = (zpos != props.end()) ? zpos->second.value : 0;
+
+        // Formats and modifiers: IN_FORMATS, or the legacy list which implies LINEAR
+        auto in_formats = props.find("IN_FORMATS");
+        if(in_formats == props.end() || !get_drmModeInFormats(m_drmFd, (uint32_t)in_formats->second.value, caps.formats)){
+            for(uint32_t k = 0; k < plane->count_formats; k++)
+                caps.formats[plane->formats[k]].push_back(DRM_FORMAT_MOD_LINEAR);
+        }
+
+        if(log.get_verbose())
+            print_drmModePlane(plane);
+        log.info("Plane %u: type %llu, %zu formats", caps.id, (unsigned long long)caps.type, caps.formats.size());
+
+        if(caps.type != DRM_PLANE_TYPE_CURSOR)
+            m_planes.push_back(caps);
         drmModeFreePlane(plane);
     }
 
     drmModeFreePlaneResources(planeRes);
 
-    if(!m_primaryPlaneId){
-        log.error("findPlane: No Primary plane found !");
+    if(m_planes.empty()){
+        log.error("findPlane: No plane found for CRTC %u !", m_crtcId);
         return false;
     }
 
-    if(log.get_verbose()){
-        print_drmModePlane(m_drmPrimaryPlane);
+    return true;
+}
+
+bool Display::cachePlaneProperties(uint32_t plane_id, plane_props_t& props)
+{
+    Logger& log = m_logger;
+    std::map<std::string, drm_prop_t> map;
+
+    if(!get_drmModeProperties(m_drmFd, plane_id, DRM_MODE_OBJECT_PLANE, map)){
+        log.error("Failed to get properties of plane %u", plane_id);
+        return false;
     }
-    
+
+    struct { const char* name; uint32_t* id; bool required; } table[] = {
+        {"type",             &props.type,             true},
+        {"FB_ID",            &props.fb_id,            true},
+        {"CRTC_ID",          &props.crtc_id,          true},
+        {"SRC_X",            &props.src_x,            true},
+        {"SRC_Y",            &props.src_y,            true},
+        {"SRC_W",            &props.src_w,            true},
+        {"SRC_H",            &props.src_h,            true},
+        {"CRTC_X",           &props.crtc_x,           true},
+        {"CRTC_Y",           &props.crtc_y,           true},
+        {"CRTC_W",           &props.crtc_w,           true},
+        {"CRTC_H",           &props.crtc_h,           true},
+        {"IN_FENCE_FD",      &props.in_fence_fd,      false},
+        {"IN_FORMATS",       &props.in_formats,       false},
+        {"zpos",             &props.zpos,             false},
+        {"pixel blend mode", &props.pixel_blend_mode, false},
+    };
+    for(const auto& entry : table){
+        auto it = map.find(entry.name);
+        *entry.id = (it != map.end()) ? it->second.id : 0;
+        if(entry.required && !*entry.id){
+            log.error("Failed to find Plane %u property: %s", plane_id, entry.name);
+            return false;
+        }
+    }
+
+    // Stacking and blending of the GPU plane: zpos only when it can be set, with its range
+    if(props.zpos){
+        drmModePropertyRes *prop = drmModeGetProperty(m_drmFd, props.zpos);
+        bool settable = prop && !(prop->flags & DRM_MODE_PROP_IMMUTABLE) && (prop->flags & DRM_MODE_PROP_RANGE) && prop->count_values == 2;
+        props.zpos_max = settable ? prop->values[1] : 0;
+        if(!settable)
+            props.zpos = 0;
+        if(prop)
+            drmModeFreeProperty(prop);
+    }
+    if(props.pixel_blend_mode){
+        drmModePropertyRes *prop = drmModeGetProperty(m_drmFd, props.pixel_blend_mode);
+        bool found = false;
+        for(int i = 0; prop && (prop->flags & DRM_MODE_PROP_ENUM) && i < prop->count_enums && !found; i++){
+            if(strcmp(prop->enums[i].name, "Pre-multiplied") == 0){
+                props.blend_premulti = prop->enums[i].value;
+                found = true;
+            }
+        }
+        if(!found)
+            props.pixel_blend_mode = 0;
+        if(prop)
+            drmModeFreeProperty(prop);
+    }
+
+    return true;
+}
+
+bool Display::cacheProperties()
+{
+    Logger& log = m_logger;
+    std::map<std::string, drm_prop_t> map;
+
+    log.status("Caching DRM properties...");
+
+    // Connector
+    if(!get_drmModeProperties(m_drmFd, m_connectorId, DRM_MODE_OBJECT_CONNECTOR, map) || !map.count("CRTC_ID")){
+        log.error("Failed to find CRTC_ID property on connector");
+        return false;
+    }
+    m_connProps.crtc_id = map["CRTC_ID"].id;
+
+    // CRTC
+    if(!get_drmModeProperties(m_drmFd, m_crtcId, DRM_MODE_OBJECT_CRTC, map) || !map.count("MODE_ID") || !map.count("ACTIVE")){
+        log.error("Failed to find CRTC properties: MODE_ID/ACTIVE");
+        return false;
+    }
+    m_crtcProps.mode_id = map["MODE_ID"].id;
+    m_crtcProps.active = map["ACTIVE"].id;
+    m_crtcProps.out_fence_ptr = map.count("OUT_FENCE_PTR") ? map["OUT_FENCE_PTR"].id : 0;
+    if(m_config.explicit_sync && !m_crtcProps.out_fence_ptr){
+        log.warning("Explicit sync requested but CRTC has no OUT_FENCE_PTR: falling back to flip events");
+    }
+
+    log.info("Properties cached: conn CRTC_ID=%u, crtc MODE_ID=%u ACTIVE=%u",
+        m_connProps.crtc_id, m_crtcProps.mode_id, m_crtcProps.active);
+
     return true;
 }
 
+void Display::addPlaneState(drmModeAtomicReq *req, const std::vector<plane_state_t>& planes)
+{
+    for(const auto& p : m_planes){
+        const plane_state_t *state = nullptr;
+        for(const auto& s : planes){
+            if(s.plane == &p)
+                state = &s;
+        }
+
+        // Unused: off, but only if it was ours (planes can be shared with other CRTCs)
+        if(!state){
+            if(p.on_crtc){
+                drmModeAtomicAddProperty(req, p.id, p.props.fb_id, 0);
+                drmModeAtomicAddProperty(req, p.id, p.props.crtc_id, 0);
+            }
+            continue;
+        }
+
+        // Source in 16.16 fixed point, destination in integer
+        drmModeAtomicAddProperty(req, p.id, p.props.fb_id, state->fbId);
+        drmModeAtomicAddProperty(req, p.id, p.props.crtc_id, m_crtcId);
+        drmModeAtomicAddProperty(req, p.id, p.props.src_x, state->src.x << 16);
+        drmModeAtomicAddProperty(req, p.id, p.props.src_y, state->src.y << 16);
+        drmModeAtomicAddProperty(req, p.id, p.props.src_w, state->src.w << 16);
+        drmModeAtomicAddProperty(req, p.id, p.props.src_h, state->src.h << 16);
+        drmModeAtomicAddProperty(req, p.id, p.props.crtc_x, state->dst.x);
+        drmModeAtomicAddProperty(req, p.id, p.props.crtc_y, state->dst.y);
+        drmModeAtomicAddProperty(req, p.id, p.props.crtc_w, state->dst.w);
+        drmModeAtomicAddProperty(req, p.id, p.props.crtc_h, state->dst.h);
+        if(state->below)
+            addOverlayStacking(req, p, state->below->zpos);
+    }
+}
+
+void Display::addOverlayStacking(drmModeAtomicReq *req, const plane_caps_t& overlay, uint64_t below_zpos)
+{
+    const plane_props_t& op = overlay.props;
+
+    // Above the camera: the default order puts some overlays under the primary plane
+    if(op.zpos && overlay.zpos <= below_zpos && below_zpos < op.zpos_max)
+        drmModeAtomicAddProperty(req, overlay.id, op.zpos, below_zpos + 1);
+
+    // GL renders premultiplied alpha, a previous client may have left another mode
+    if(op.pixel_blend_mode && m_gpu_format == GBM_FORMAT_ARGB8888)
+        drmModeAtomicAddProperty(req, overlay.id, op.pixel_blend_mode, op.blend_premulti);
+}
+
+bool Display::testCommit(uint32_t mode_blob, const std::vector<plane_state_t>& planes)
+{
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    if(!req)
+        return false;
+
+    // The full state of the first real commit, the kernel only checks it
+    drmModeAtomicAddProperty(req, m_connectorId, m_connProps.crtc_id, m_crtcId);
+    drmModeAtomicAddProperty(req, m_crtcId, m_crtcProps.mode_id, mode_blob);
+    drmModeAtomicAddProperty(req, m_crtcId, m_crtcProps.active, 1);
+    addPlaneState(req, planes);
+
+    int ret = drmModeAtomicCommit(m_drmFd, req, DRM_MODE_ATOMIC_TEST_ONLY | DRM_MODE_ATOMIC_ALLOW_MODESET, nullptr);
+    drmModeAtomicFree(req);
+
+    return (ret == 0);
+}
+
+int Display::addFramebuffer(uint32_t width, uint32_t height, uint32_t format, const uint32_t handles[4], const uint32_t pitches[4],
+                            const uint32_t offsets[4], uint64_t modifier, uint32_t *out_fbId)
+{
+    // Explicit modifier when the driver takes them. INVALID: legacy, layout implied by the driver
+    if(modifier != DRM_FORMAT_MOD_INVALID && m_fb_modifiers){
+        uint64_t modifiers[4] = {0, 0, 0, 0};
+        for(int p = 0; p < 4; p++)
+            modifiers[p] = handles[p] ? modifier : 0;
+        return drmModeAddFB2WithModifiers(m_drmFd, width, height, format, handles, pitches, offsets, modifiers, out_fbId, DRM_MODE_FB_MODIFIERS);
+    }
+    if(modifier != DRM_FORMAT_MOD_INVALID && modifier != DRM_FORMAT_MOD_LINEAR){
+        errno = EINVAL; // Can't express it
+        return -1;
+    }
+    return drmModeAddFB2(m_drmFd, width, height, format, handles, pitches, offsets, out_fbId, 0);
+}
+
+bool Display::createProbeFb(uint32_t format, uint32_t width, uint32_t height, uint64_t modifier, dumb_buf_t& out)
+{
+    struct drm_mode_create_dumb creq{};
+    bool nv12 = (format == DRM_FORMAT_NV12);
+    bool linear = (modifier == DRM_FORMAT_MOD_LINEAR);
+
+    out = dumb_buf_t{};
+    out.fd = -1;
+
+    // Never scanned out, only big enough for the kernel size checks (compressed layouts carry headers)
+    creq.width = width;
+    creq.height = nv12 ? height + height / 2 : height;
+    if(!linear)
+        creq.height += creq.height / 4 + 16;
+    creq.bpp = nv12 ? 8 : 32;
+    if(drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0)
+        return false;
+    out.handle = creq.handle;
+    out.size = creq.size;
+    out.pitch = creq.pitch;
+
+    uint32_t handles[4] = {out.handle, nv12 ? out.handle : 0, 0, 0};
+    uint32_t pitches[4] = {out.pitch, nv12 ? out.pitch : 0, 0, 0};
+    uint32_t offsets[4] = {0, nv12 ? out.pitch * height : 0, 0, 0};
+    if(addFramebuffer(width, height, format, handles, pitches, offsets, modifier, &out.fbId) < 0){
+        destroyDumbBuffer(out);
+        return false;
+    }
+
+    return true;
+}
+
+bool Display::probePipeline()
+{
+    Logger& log = m_logger;
+    bool testing = m_config.testing_display;
+    uint32_t hdisplay = m_modeSettings.hdisplay;
+    uint32_t vdisplay = m_modeSettings.vdisplay;
+    uint32_t blob_id = 0;
+    dumb_buf_t cam_fb{}, gpu_fb{};
+    cam_fb.fd = gpu_fb.fd = -1;
+    plane_state_t cam{};
+    bool ok = false;
+
+    log.status("Probing display pipeline...");
+
+    // What the camera plane shows: camera buffers, after the XR24 splashscreen/test pattern
+    uint32_t cam_format = testing ? (uint32_t)DRM_FORMAT_XRGB8888 : m_cam_format;
+    uint32_t gpu_w = testing ? hdisplay : m_config.gpu_buf.width;
+    uint32_t gpu_h = testing ? vdisplay : m_config.gpu_buf.height;
+
+    if(drmModeCreatePropertyBlob(m_drmFd, &m_modeSettings, sizeof(m_modeSettings), &blob_id) < 0){
+        log.error("Failed to create mode blob");
+        return false;
+    }
+    if(!createProbeFb(cam_format, m_cam_src.w, m_cam_src.h, DRM_FORMAT_MOD_LINEAR, cam_fb)){
+        log.error("Failed to create the camera probe FB: %s", strerror(errno));
+        drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+        return false;
+    }
+
+    // Camera plane: linear buffers (dumb, V4L2). The primary plane first, it costs nothing extra
+    std::vector<const plane_caps_t*> candidates;
+    for(int pass = 0; pass < 2; pass++){
+        for(const auto& p : m_planes){
+            bool primary = (p.type == DRM_PLANE_TYPE_PRIMARY);
+            if(primary == (pass == 0) && plane_supports(p, cam_format, DRM_FORMAT_MOD_LINEAR) &&
+               plane_supports(p, DRM_FORMAT_XRGB8888, DRM_FORMAT_MOD_LINEAR))
+                candidates.push_back(&p);
+        }
+    }
+
+    // Unscaled fallback: 1:1, centered, cropped to the screen
+    rect_t src1 = m_cam_src, dst1{0, 0, 0, 0};
+    src1.w = std::min(m_cam_src.w, hdisplay);
+    src1.h = std::min(m_cam_src.h, vdisplay);
+    src1.x = (m_cam_src.w - src1.w) / 2;
+    src1.y = (m_cam_src.h - src1.h) / 2;
+    dst1 = {(hdisplay - src1.w) / 2, (vdisplay - src1.h) / 2, src1.w, src1.h};
+    bool scaled = (m_cam_src.w != m_cam_dst.w || m_cam_src.h != m_cam_dst.h);
+
+    for(const plane_caps_t *p : candidates){
+        cam = {p, cam_fb.fbId, m_cam_src, m_cam_dst, nullptr};
+        if(testCommit(blob_id, {cam})){
+            ok = true;
+            break;
+        }
+        if(scaled){
+            cam.src = src1;
+            cam.dst = dst1;
+            if(testCommit(blob_id, {cam})){
+                log.warning("Plane %u can't scale %ux%u to %ux%u, showing the camera unscaled", p->id,
+                            m_cam_src.w, m_cam_src.h, m_cam_dst.w, m_cam_dst.h);
+                m_cam_src = src1;
+                m_cam_dst = dst1;
+                ok = true;
+                break;
+            }
+        }
+        log.info("Plane %u rejected for the camera", p->id);
+    }
+    if(!ok){
+        log.error("probePipeline: No plane can show %.4s %ux%u", (const char*)&cam_format, m_cam_src.w, m_cam_src.h);
+        destroyDumbBuffer(cam_fb);
+        drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+        return false;
+    }
+    m_camPlaneId = cam.plane->id;
+    m_camProps = cam.plane->props;
+    log.info("Camera plane: %u (%s)", m_camPlaneId, (cam.plane->type == DRM_PLANE_TYPE_PRIMARY) ? "primary" : "overlay");
+
+    // GPU plane: tested together with the camera plane, as it will be used
+    m_overlayPlaneId = 0;
+    m_gpu_modifiers.clear();
+    if(gpu_w && gpu_h && createProbeFb(m_gpu_format, gpu_w, gpu_h, DRM_FORMAT_MOD_LINEAR, gpu_fb)){
+        for(const auto& p : m_planes){
+            if(&p == cam.plane || p.type != DRM_PLANE_TYPE_OVERLAY || !plane_supports(p, m_gpu_format, DRM_FORMAT_MOD_LINEAR))
+                continue;
+            plane_state_t gpu{&p, gpu_fb.fbId, {0, 0, gpu_w, gpu_h}, {0, 0, hdisplay, vdisplay}, cam.plane};
+            if(!p.props.zpos && p.zpos <= cam.plane->zpos)
+                log.warning("Plane %u can't be stacked above the camera plane (zpos %llu)", p.id, (unsigned long long)cam.plane->zpos);
+            if(!testCommit(blob_id, {cam, gpu})){
+                log.info("Plane %u rejected for the GPU buffer", p.id);
+                continue;
+            }
+            m_overlayPlaneId = p.id;
+            m_overlayProps = p.props;
+            m_gpu_modifiers.push_back(DRM_FORMAT_MOD_LINEAR);
+
+            // Other advertised modifiers (AFBC...) are kept when the driver takes them
+            for(uint64_t mod : p.formats.at(m_gpu_format)){
+                dumb_buf_t fb{};
+                if(mod == DRM_FORMAT_MOD_LINEAR || mod == DRM_FORMAT_MOD_INVALID)
+                    continue;
+                if(createProbeFb(m_gpu_format, gpu_w, gpu_h, mod, fb)){
+                    gpu.fbId = fb.fbId;
+                    if(testCommit(blob_id, {cam, gpu}))
+                        m_gpu_modifiers.push_back(mod);
+                    destroyDumbBuffer(fb);
+                }
+            }
+            log.info("Overlay plane: %u, %zu GPU modifiers validated", m_overlayPlaneId, m_gpu_modifiers.size());
+            break;
+        }
+        destroyDumbBuffer(gpu_fb);
+    }
+    if(!m_overlayPlaneId){
+        log.warning("probePipeline: No Overlay plane takes the GPU format, GPU buffer won't be displayed");
+    }
+
+    destroyDumbBuffer(cam_fb);
+    drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+
+    return true;
+}
+
+bool Display::testCameraPlane()
+{
+    Logger& log = m_logger;
+    const plane_caps_t *cam_plane = nullptr;
+    const plane_caps_t *gpu_plane = nullptr;
+    uint32_t gpu_w = m_config.gpu_buf.width;
+    uint32_t gpu_h = m_config.gpu_buf.height;
+    uint32_t blob_id = 0;
+    dumb_buf_t cam_fb{}, gpu_fb{};
+    cam_fb.fd = gpu_fb.fd = -1;
+
+    for(const auto& p : m_planes){
+        if(p.id == m_camPlaneId)
+            cam_plane = &p;
+        if(p.id == m_overlayPlaneId)
+            gpu_plane = &p;
+    }
+    if(!cam_plane){
+        log.error("testCameraPlane: no camera plane");
+        return false;
+    }
+
+    if(drmModeCreatePropertyBlob(m_drmFd, &m_modeSettings, sizeof(m_modeSettings), &blob_id) < 0){
+        log.error("Failed to create mode blob");
+        return false;
+    }
+    if(!createProbeFb(m_cam_format, m_cam_src.w, m_cam_src.h, DRM_FORMAT_MOD_LINEAR, cam_fb)){
+        log.error("Failed to create the camera probe FB: %s", strerror(errno));
+        drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+        return false;
+    }
+
+    // With the GPU plane as it will be used: both can compete for the same scaler
+    std::vector<plane_state_t> planes{{cam_plane, cam_fb.fbId, m_cam_src, m_cam_dst, nullptr}};
+    if(gpu_plane && gpu_w && gpu_h && createProbeFb(m_gpu_format, gpu_w, gpu_h, DRM_FORMAT_MOD_LINEAR, gpu_fb))
+        planes.push_back({gpu_plane, gpu_fb.fbId, {0, 0, gpu_w, gpu_h}, {0, 0, m_modeSettings.hdisplay, m_modeSettings.vdisplay}, cam_plane});
+    bool ok = testCommit(blob_id, planes);
+
+    destroyDumbBuffer(gpu_fb);
+    destroyDumbBuffer(cam_fb);
+    drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+
+    return ok;
+}
+
 bool Display::atomicModeSet()
 {
     Logger& log = m_logger;
     int ret;
-    uint32_t prop_conn_crtc_id = 0;
-    uint32_t prop_plane_crtc_id = 0;
-    uint32_t prop_crtc_mode_id = 0, prop_crtc_active = 0;
-    uint32_t prop_src_w = 0, prop_src_h = 0, prop_src_x = 0, prop_src_y = 0;
-    uint32_t prop_crtc_w = 0, prop_crtc_h = 0, prop_crtc_x = 0, prop_crtc_y = 0;
+    uint32_t hdisplay = m_modeSettings.hdisplay;
+    uint32_t vdisplay = m_modeSettings.vdisplay;
 
     log.status("Setting display mode...");
 
@@ -344,73 +736,33 @@ bool Display::atomicModeSet()
     uint32_t blob_id = 0;
     ret = drmModeCreatePropertyBlob(m_drmFd, &m_modeSettings, sizeof(m_modeSettings), &blob_id);
     if(ret < 0){
-        std::cerr << "Failed to create mode blob" << std::endl;
+        log.error("Failed to create mode blob");
         drmModeAtomicFree(req);
         return false;
     }
 
     // Connector: Link the connector to the crtc
-    prop_conn_crtc_id = get_drmModePropertyId(m_drmFd, m_connectorId, DRM_MODE_OBJECT_CONNECTOR, "CRTC_ID");
-    if(!prop_conn_crtc_id){
-        log.error("Failed to find CRTC_ID property on connector");
-        goto err;
-    }
-    drmModeAtomicAddProperty(req, m_connectorId, prop_conn_crtc_id, m_crtcId);
+    drmModeAtomicAddProperty(req, m_connectorId, m_connProps.crtc_id, m_crtcId);
 
     // CRTC: set the mode and activate
-    prop_crtc_mode_id = get_drmModePropertyId(m_drmFd, m_crtcId, DRM_MODE_OBJECT_CRTC, "MODE_ID");
-    prop_crtc_active  = get_drmModePropertyId(m_drmFd, m_crtcId, DRM_MODE_OBJECT_CRTC, "ACTIVE");
-    if(!prop_crtc_mode_id || !prop_crtc_active){
-        log.error("Failed to find CRTC properties: MODE_ID/ACTIVE");
-        goto err;
-    }
-    drmModeAtomicAddProperty(req, m_crtcId, prop_crtc_mode_id, blob_id);
-    drmModeAtomicAddProperty(req, m_crtcId, prop_crtc_active, 1);
-
-    // Plane: attach the splashscreen/testpatern FB to the plane and the plane to the crtc
-    m_modePropFb_id = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "FB_ID");
-    prop_plane_crtc_id = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_ID");
-    if(!m_modePropFb_id || !prop_plane_crtc_id){
-        log.error("Failed to find Plane properties: FB_ID/CRTC_ID");
-        goto err;
-    }
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, m_modePropFb_id, ((m_config.testing_display) ? m_testPattern_FbId : m_splashscreen_FbId));
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_plane_crtc_id, m_crtcId);
-
-    // Plane: set source coordinates in 16.16 fixed point format
-    prop_src_w = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "SRC_W");
-    prop_src_h = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "SRC_H");
-    prop_src_x = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "SRC_X");
-    prop_src_y = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "SRC_Y");
-    if(!prop_src_w || !prop_src_h || !prop_src_x || !prop_src_y){
-        log.error("Failed to find Plane SRC properties");
-        goto err;
-    }
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_src_w, ((uint32_t)m_modeSettings.hdisplay) << 16);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_src_h, ((uint32_t)m_modeSettings.vdisplay) << 16);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_src_x, 0);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_src_y, 0);
-
-    // Plane: set destination coordinates in integer
-    prop_crtc_w = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_W");
-    prop_crtc_h = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_H");
-    prop_crtc_x = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_X");
-    prop_crtc_y = get_drmModePropertyId(m_drmFd, m_primaryPlaneId, DRM_MODE_OBJECT_PLANE, "CRTC_Y");
-    if(!prop_crtc_w || !prop_crtc_h || !prop_crtc_x || !prop_crtc_y){
-        log.error("Failed to find Plane CRTC properties");
-        goto err;
-    }
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_crtc_w, m_modeSettings.hdisplay);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_crtc_h, m_modeSettings.vdisplay);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_crtc_x, 0);
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, prop_crtc_y, 0);
+    drmModeAtomicAddProperty(req, m_crtcId, m_crtcProps.mode_id, blob_id);
+    drmModeAtomicAddProperty(req, m_crtcId, m_crtcProps.active, 1);
+
+    // Planes: the splashscreen or mode sized testpatern FB on the camera plane, the ones we don't use off
+    std::vector<plane_state_t> planes;
+    for(const auto& p : m_planes){
+        if(p.id == m_camPlaneId)
+            planes.push_back(m_config.testing_display ? plane_state_t{&p, m_tp_ring[0].dbuf.fbId, {0, 0, hdisplay, vdisplay}, {0, 0, hdisplay, vdisplay}, nullptr}
+                                                      : plane_state_t{&p, m_splashscreen_FbId, m_splash_src, m_splash_dst, nullptr});
+    }
+    addPlaneState(req, planes);
 
     // Setup event context
     m_drm_evctx.version = 2;
     m_drm_evctx.page_flip_handler = eventCb;
     
-    // Commit
-    ret = drmModeAtomicCommit(m_drmFd, req, DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_ALLOW_MODESET, &m_frame);
+    // Commit, non-blocking: the caller negotiates the camera while the modeset completes, the flip event tells when it did
+    ret = drmModeAtomicCommit(m_drmFd, req, DRM_MODE_ATOMIC_NONBLOCK | DRM_MODE_PAGE_FLIP_EVENT | DRM_MODE_ATOMIC_ALLOW_MODESET, &m_frame);
     if(ret < 0){
         log.error("drmModeAtomicCommit: Atomic commit failed: %s", strerror(errno));
     } else {
@@ -422,11 +774,42 @@ bool Display::atomicModeSet()
     drmModeDestroyPropertyBlob(m_drmFd, blob_id);
 
     return (ret == 0);
+}
 
-err:
-    drmModeAtomicFree(req);
-    drmModeDestroyPropertyBlob(m_drmFd, blob_id);
-    return false;
+// Largest rectangle of the src aspect ratio centered in dst_w x dst_h, even sized for 4:2:0 formats
+static rect_t fit_rect(uint32_t src_w, uint32_t src_h, uint32_t dst_w, uint32_t dst_h)
+{
+    rect_t r{0, 0, dst_w, dst_h};
+
+    if((uint64_t)src_w * dst_h > (uint64_t)src_h * dst_w){
+        r.h = (uint32_t)((uint64_t)dst_w * src_h / src_w) & ~1u; // Wider: bars top and bottom
+        r.y = (dst_h - r.h) / 2;
+    }
+    else if((uint64_t)src_w * dst_h < (uint64_t)src_h * dst_w){
+        r.w = (uint32_t)((uint64_t)dst_h * src_w / src_h) & ~1u; // Taller: bars left and right
+        r.x = (dst_w - r.w) / 2;
+    }
+
+    return r;
+}
+
+void Display::computeCameraRects()
+{
+    Logger& log = m_logger;
+    uint32_t hdisplay = m_modeSettings.hdisplay;
+    uint32_t vdisplay = m_modeSettings.vdisplay;
+
+    // Test pattern and splashscreen are mode sized
+    if(m_config.testing_display){
+        m_cam_src = {0, 0, hdisplay, vdisplay};
+        m_cam_dst = m_cam_src;
+        return;
+    }
+
+    // Whole camera buffer, letterboxed by the plane scaler
+    m_cam_src = {0, 0, m_cam_layout.width, m_cam_layout.height};
+    m_cam_dst = fit_rect(m_cam_src.w, m_cam_src.h, hdisplay, vdisplay);
+    log.info("Camera %ux%u shown at %ux%u+%u+%u", m_cam_src.w, m_cam_src.h, m_cam_dst.w, m_cam_dst.h, m_cam_dst.x, m_cam_dst.y);
 }
 
 bool Display::initialize()
@@ -443,6 +826,21 @@ bool Display::initialize()
         return false;
     }
 
+    // Scaled camera: buffers fill the screen
+    if(m_config.cam_buf_mode_size && !m_config.testing_display){
+        m_config.cam_buf.width = m_modeSettings.hdisplay;
+        m_config.cam_buf.height = m_modeSettings.vdisplay;
+        m_config.cam_buf.stride = m_modeSettings.hdisplay;
+        log.info("Camera buffers sized to the display mode: %ux%u", m_config.cam_buf.width, m_config.cam_buf.height);
+    }
+
+    // Default camera layout, until the capture publishes the one it negotiated
+    if(!m_config.testing_display){
+        uint32_t bpp = (m_cam_format == DRM_FORMAT_XRGB8888) ? 4 : 1;
+        layout_contiguous(m_cam_format, m_config.cam_buf.width, m_config.cam_buf.height, m_config.cam_buf.stride * bpp, m_cam_layout);
+    }
+    computeCameraRects();
+
     // Find encoder
     if(!findEncoder()){
         log.error("findEncoder() failed !");
@@ -455,12 +853,24 @@ bool Display::initialize()
         return false;
     }
 
-    // Find Primary plane
+    // Find candidate planes
     if(!findPlane()){
         log.error("findPlane() failed !");
         return false;
     }
 
+    // Look up all property IDs once: commits then need no extra ioctl
+    if(!cacheProperties()){
+        log.error("cacheProperties() failed !");
+        return false;
+    }
+
+    // Validate the pipeline without touching the screen
+    if(!probePipeline()){
+        log.error("probePipeline() failed !");
+        return false;
+    }
+
     // Load Splashscreen or test patern
     if(m_config.testing_display){
         if(!createTestPattern()){
@@ -486,93 +896,306 @@ bool Display::initialize()
     return true;
 }
 
-bool Display::createTestPattern()
+bool Display::createPatternBuffer(tp_buf_t& out)
 {
     Logger& log = m_logger;
-    int ret = 0;
     struct drm_mode_create_dumb creq{};
     struct drm_mode_map_dumb mreq{};
-    struct drm_gem_close clreq{};
-    uint32_t fbId = 0;
-    void *map = MAP_FAILED;
-    uint32_t *pixels = nullptr;
 
-    log.status("Using test pattern (format : XR24)");
-    
+    out = tp_buf_t{};
+    out.dbuf.fd = -1;
+
     // Create Dumb Buffer
     creq.width = m_modeSettings.hdisplay;
     creq.height = m_modeSettings.vdisplay;
     creq.bpp = 32; // XRGB8888
-    ret = drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
-    if(ret < 0){
+    if(drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0){
         log.error("DRM_IOCTL_MODE_CREATE_DUMB failed: %s", strerror(errno));
         return false;
     }
+    out.dbuf.handle = creq.handle;
+    out.dbuf.size = creq.size;
+    out.dbuf.pitch = creq.pitch;
 
     // Create FB
     uint32_t handles[4] = {creq.handle, 0, 0, 0};
     uint32_t pitches[4] = {creq.pitch, 0, 0, 0};
     uint32_t offsets[4] = {0, 0, 0, 0};
-
-    ret = drmModeAddFB2(m_drmFd, creq.width, creq.height, DRM_FORMAT_XRGB8888, handles, pitches, offsets, &fbId, 0);
-    if(ret < 0){
+    if(drmModeAddFB2(m_drmFd, creq.width, creq.height, DRM_FORMAT_XRGB8888, handles, pitches, offsets, &out.dbuf.fbId, 0) < 0){
         log.error("drmModeAddFB2 failed: %s", strerror(errno));
-        goto err;
+        destroyDumbBuffer(out.dbuf);
+        return false;
     }
 
-    // Map
+    // Map, kept for the buffer lifetime
     mreq.handle = creq.handle;
-    ret = drmIoctl(m_drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mreq);
-    if(ret < 0){
+    if(drmIoctl(m_drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0){
         log.error("DRM_IOCTL_MODE_MAP_DUMB failed: %s", strerror(errno));
-        goto err;
+        destroyDumbBuffer(out.dbuf);
+        return false;
     }
-    map = mmap(0, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_drmFd, mreq.offset);
+    void *map = mmap(0, creq.size, PROT_READ | PROT_WRITE, MAP_SHARED, m_drmFd, mreq.offset);
     if(map == MAP_FAILED){
         log.error("mmap failed: %s", strerror(errno));
-        goto err;
+        destroyDumbBuffer(out.dbuf);
+        return false;
     }
+    out.pixels = static_cast<uint32_t*>(map);
 
-    // Fill
-    pixels = (uint32_t *)map;
-    for(uint32_t y = 0; y < creq.height; y++){
-        for(uint32_t x = 0; x < creq.width; x++){
-            // creq.pitch is in bytes
-            pixels[y * (creq.pitch / 4) + x] = 0xFFFF0000; // solid Red
-        }
+    return true;
+}
+
+void Display::destroyPatternBuffer(tp_buf_t& buf)
+{
+    if(buf.pixels){
+        munmap(buf.pixels, buf.dbuf.size);
+        buf.pixels = nullptr;
     }
+    destroyDumbBuffer(buf.dbuf);
+}
 
-    m_testPattern_FbId = fbId; // FB to display
+bool Display::createTestPattern()
+{
+    Logger& log = m_logger;
+    uint32_t width = m_modeSettings.hdisplay;
+    uint32_t height = m_modeSettings.vdisplay;
 
-    // Unmap
-    munmap(map, creq.size);
+    log.status("Using test pattern (format : XR24)");
 
-    // Ok
-    ret = 0;
-    goto cleanup;
+    // Every buffer rendered once: only the counter changes on still patterns
+    m_pattern.reset(new TestPattern(m_config.test_pattern, width, height));
+    for(unsigned int i = 0; i < TP_RING_SIZE; i++){
+        tp_buf_t buf;
+        if(!createPatternBuffer(buf))
+            return false;
+        m_pattern->render(buf.pixels, buf.dbuf.pitch / 4, 0, true);
+        m_tp_ring.push_back(buf);
+    }
+    m_tp_index = 0;
+    m_tp_frame = 0;
 
-err:
-    ret = -1;
-    if(fbId)
-        drmModeRmFB(m_drmFd, fbId);
-cleanup:
-    clreq.handle = creq.handle;
-    drmIoctl(m_drmFd, DRM_IOCTL_GEM_CLOSE, &clreq);
-    return (ret == 0);
+    return true;
 }
 
 bool Display::loadSplashScreen()
 {
     Logger& log = m_logger;
+    uint32_t hdisplay = m_modeSettings.hdisplay;
+    uint32_t vdisplay = m_modeSettings.vdisplay;
+    SplashImage img(log.get_verbose());
+    dumb_buf_t dbuf{};
+    dbuf.fd = -1;
+    struct drm_mode_map_dumb mreq{};
+    void *map = MAP_FAILED;
+    uint32_t blob_id = 0;
+    const plane_caps_t *plane = nullptr;
+    plane_state_t splash{};
+    bool ok = false;
 
     log.status("Loading SplashScreen");
 
-    // TODO
+    // Whole screen unless the image says otherwise
+    m_splash_src = {0, 0, hdisplay, vdisplay};
+    m_splash_dst = m_splash_src;
+
+    // Pre-converted image, the test pattern stands in without one
+    if(m_config.splash_path.empty() || !img.open(m_config.splash_path))
+        goto fallback;
+    {
+        const splash_hdr_t& hdr = img.header();
+        bool nv12 = (hdr.fourcc == DRM_FORMAT_NV12);
+        for(const auto& p : m_planes){
+            if(p.id == m_camPlaneId)
+                plane = &p;
+        }
+        if(!plane || !plane_supports(*plane, hdr.fourcc, DRM_FORMAT_MOD_LINEAR)){
+            log.warning("Plane %u can't show a %.4s splash", m_camPlaneId, (const char*)&hdr.fourcc);
+            goto fallback;
+        }
+
+        // Dumb buffer in the image format, NV12: Y plane followed by the half height UV plane
+        struct drm_mode_create_dumb creq{};
+        creq.width = hdr.width;
+        creq.height = nv12 ? hdr.height + hdr.height / 2 : hdr.height;
+        creq.bpp = nv12 ? 8 : 32;
+        if(drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq) < 0){
+            log.error("DRM_IOCTL_MODE_CREATE_DUMB failed: %s", strerror(errno));
+            goto fallback;
+        }
+        dbuf.handle = creq.handle;
+        dbuf.size = creq.size;
+        dbuf.pitch = creq.pitch;
+        uint32_t handles[4] = {dbuf.handle, nv12 ? dbuf.handle : 0, 0, 0};
+        uint32_t pitches[4] = {dbuf.pitch, nv12 ? dbuf.pitch : 0, 0, 0};
+        uint32_t offsets[4] = {0, nv12 ? dbuf.pitch * hdr.height : 0, 0, 0};
+        if(addFramebuffer(hdr.width, hdr.height, hdr.fourcc, handles, pitches, offsets, DRM_FORMAT_MOD_LINEAR, &dbuf.fbId) < 0){
+            log.error("drmModeAddFB2 failed: %s", strerror(errno));
+            goto fallback;
+        }
+
+        // Copy: a single stream per plane when the pitches match, row by row otherwise
+        mreq.handle = dbuf.handle;
+        if(drmIoctl(m_drmFd, DRM_IOCTL_MODE_MAP_DUMB, &mreq) < 0){
+            log.error("DRM_IOCTL_MODE_MAP_DUMB failed: %s", strerror(errno));
+            goto fallback;
+        }
+        map = mmap(0, dbuf.size, PROT_WRITE, MAP_SHARED, m_drmFd, mreq.offset);
+        if(map == MAP_FAILED){
+            log.error("mmap failed: %s", strerror(errno));
+            goto fallback;
+        }
+        uint64_t start_ns = monotonic_ns();
+        for(unsigned int p = 0; p < hdr.num_planes; p++){
+            uint8_t *dst = static_cast<uint8_t*>(map) + offsets[p];
+            const uint8_t *src = img.plane(p);
+            uint32_t rows = img.planeHeight(p);
+            uint32_t row_size = nv12 ? hdr.width : hdr.width * 4;
+            if(hdr.pitch[p] == dbuf.pitch){
+                stream_copy(dst, src, (size_t)dbuf.pitch * rows);
+                continue;
+            }
+            for(uint32_t y = 0; y < rows; y++)
+                stream_copy(dst + (size_t)y * dbuf.pitch, src + (size_t)y * hdr.pitch[p], row_size);
+        }
+        munmap(map, dbuf.size);
+        log.info("Splash copied in %lluus", (unsigned long long)((monotonic_ns() - start_ns) / 1000));
+
+        // Letterboxed like the camera, or 1:1 centered and cropped if the plane can't scale it
+        splash = {plane, dbuf.fbId, {0, 0, hdr.width, hdr.height}, fit_rect(hdr.width, hdr.height, hdisplay, vdisplay), nullptr};
+        if(drmModeCreatePropertyBlob(m_drmFd, &m_modeSettings, sizeof(m_modeSettings), &blob_id) < 0){
+            log.error("Failed to create mode blob");
+            goto fallback;
+        }
+        ok = testCommit(blob_id, {splash});
+        if(!ok && (splash.src.w != splash.dst.w || splash.src.h != splash.dst.h)){
+            splash.src.w = std::min(hdr.width, hdisplay);
+            splash.src.h = std::min(hdr.height, vdisplay);
+            splash.src.x = (hdr.width - splash.src.w) / 2;
+            splash.src.y = (hdr.height - splash.src.h) / 2;
+            splash.dst = {(hdisplay - splash.src.w) / 2, (vdisplay - splash.src.h) / 2, splash.src.w, splash.src.h};
+            ok = testCommit(blob_id, {splash});
+        }
+        drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+        if(!ok){
+            log.warning("Plane %u rejected the %ux%u splash", m_camPlaneId, hdr.width, hdr.height);
+            goto fallback;
+        }
+
+        // The FB holds the buffer from now on
+        m_splashscreen_FbId = dbuf.fbId;
+        m_splash_src = splash.src;
+        m_splash_dst = splash.dst;
+        dbuf.fbId = 0;
+        destroyDumbBuffer(dbuf);
+        log.info("Splash %.4s %ux%u shown at %ux%u+%u+%u", (const char*)&hdr.fourcc, hdr.width, hdr.height,
+                 m_splash_dst.w, m_splash_dst.h, m_splash_dst.x, m_splash_dst.y);
+
+        return true;
+    }
+
+fallback:
+    if(dbuf.handle)
+        destroyDumbBuffer(dbuf);
+
+    // The test pattern becomes the splash FB, without the counter
+    tp_buf_t buf;
+    if(!createPatternBuffer(buf))
+        return false;
+    TestPattern(m_config.test_pattern, hdisplay, vdisplay).render(buf.pixels, buf.dbuf.pitch / 4, 0, true, false);
+    m_splashscreen_FbId = buf.dbuf.fbId;
+    buf.dbuf.fbId = 0;
+    destroyPatternBuffer(buf);
 
-    // Fall back to createTestPattern() for now
-    bool ret = createTestPattern();
-    m_splashscreen_FbId = m_testPattern_FbId;
-    return ret;
+    return true;
+}
+
+bool Display::allocateCameraBuffers(unsigned int count, std::vector<dmabuf_t>& out_bufs)
+{
+    Logger& log = m_logger;
+    int ret = 0;
+
+    log.status("Allocating %u camera buffers", count);
+
+    // Sanity check
+    if(count == 0 || m_config.testing_display){
+        log.error("allocateCameraBuffers: incorrect arguments");
+        return false;
+    }
+
+    // We support only NV12 and XR24 (converted frames) for now
+    if(m_cam_format != DRM_FORMAT_NV12 && m_cam_format != DRM_FORMAT_XRGB8888){
+        log.error("allocateCameraBuffers: Only supporting NV12 and XR24 for now.");
+        return false;
+    }
+    bool nv12 = (m_cam_format == DRM_FORMAT_NV12);
+
+    uint32_t width = m_config.cam_buf.width;
+    uint32_t height = m_config.cam_buf.height;
+    out_bufs.clear();
+
+    for(unsigned int i = 0; i < count; i++){
+        struct drm_mode_create_dumb creq{};
+        dumb_buf_t dbuf{};
+        dbuf.fd = -1;
+
+        // Create Dumb Buffer. NV12: Y plane followed by the half height UV plane
+        creq.width = width;
+        creq.height = nv12 ? height + height / 2 : height;
+        creq.bpp = nv12 ? 8 : 32;
+        ret = drmIoctl(m_drmFd, DRM_IOCTL_MODE_CREATE_DUMB, &creq);
+        if(ret < 0){
+            log.error("DRM_IOCTL_MODE_CREATE_DUMB failed: %s", strerror(errno));
+            return false;
+        }
+        dbuf.handle = creq.handle;
+        dbuf.size = creq.size;
+        dbuf.pitch = creq.pitch;
+
+        // Export as DMA-BUF
+        ret = drmPrimeHandleToFD(m_drmFd, dbuf.handle, DRM_CLOEXEC | DRM_RDWR, &dbuf.fd);
+        if(ret < 0){
+            log.error("drmPrimeHandleToFD failed: %s", strerror(errno));
+            destroyDumbBuffer(dbuf);
+            return false;
+        }
+
+        // Create FB once, the scanout path then only looks it up
+        uint32_t handles[4] = {dbuf.handle, nv12 ? dbuf.handle : 0, 0, 0};
+        uint32_t pitches[4] = {dbuf.pitch, nv12 ? dbuf.pitch : 0, 0, 0};
+        uint32_t offsets[4] = {0, nv12 ? dbuf.pitch * height : 0, 0, 0};
+        ret = addFramebuffer(width, height, m_cam_format, handles, pitches, offsets, DRM_FORMAT_MOD_LINEAR, &dbuf.fbId);
+        if(ret < 0){
+            log.error("drmModeAddFB2 failed: %s", strerror(errno));
+            destroyDumbBuffer(dbuf);
+            return false;
+        }
+
+        m_cam_dumb_bufs.push_back(dbuf);
+        out_bufs.push_back({dbuf.fd, (uint32_t)dbuf.size, dbuf.pitch});
+
+        log.info(". Buffer %u: dma_fd=%d, fb=%u, size=%lu, pitch=%u", i, dbuf.fd, dbuf.fbId, (unsigned long)dbuf.size, dbuf.pitch);
+    }
+
+    return true;
+}
+
+void Display::destroyDumbBuffer(dumb_buf_t& dbuf)
+{
+    struct drm_mode_destroy_dumb dreq{};
+
+    if(dbuf.fbId > 0){
+        drmModeRmFB(m_drmFd, dbuf.fbId);
+        dbuf.fbId = 0;
+    }
+    if(dbuf.fd >= 0){
+        close(dbuf.fd);
+        dbuf.fd = -1;
+    }
+    if(dbuf.handle > 0){
+        dreq.handle = dbuf.handle;
+        drmIoctl(m_drmFd, DRM_IOCTL_MODE_DESTROY_DUMB, &dreq);
+        dbuf.handle = 0;
+    }
 }
 
 bool Display::createFbFromGbmBo(struct gbm_bo *bo, uint32_t *out_fbId)
@@ -586,26 +1209,32 @@ bool Display::createFbFromGbmBo(struct gbm_bo *bo, uint32_t *out_fbId)
         return false;
     }
 
-    // We only support XRGB8888 for now
-    if(m_gpu_format != GBM_FORMAT_XRGB8888){
-        log.error("createFbFromGbmBo: Only supporting XR24 for now.");
+    // We only support XRGB8888 and ARGB8888 (blended UI) for now
+    if(m_gpu_format != GBM_FORMAT_XRGB8888 && m_gpu_format != GBM_FORMAT_ARGB8888){
+        log.error("createFbFromGbmBo: Only supporting XR24 and AR24 for now.");
         return false;
     }
 
-    uint8_t XR24_depth = 24;
-
-    // Create FB
-    uint32_t handle = gbm_bo_get_handle(bo).u32;
-    uint32_t stride = gbm_bo_get_stride(bo);
+    // Create FB: AddFB2 carries the fourcc, so the alpha channel is honoured by the plane.
+    // Layout from the bo: compressed formats have extra planes (AFBC headers) and their own offsets
     uint32_t width = gbm_bo_get_width(bo);
     uint32_t height = gbm_bo_get_height(bo);
-    uint32_t bpp = gbm_bo_get_bpp(bo);
-    uint32_t depth = XR24_depth;
-    log.info("Creating framebuffer: %ux%u, format: %#x, handle: %u, stride: %u", width, height, m_gpu_format, handle, stride);
+    uint64_t modifier = gbm_bo_get_modifier(bo);
+    int planes = std::min(gbm_bo_get_plane_count(bo), 4);
+    uint32_t handles[4] = {0, 0, 0, 0};
+    uint32_t pitches[4] = {0, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    for(int p = 0; p < planes; p++){
+        handles[p] = gbm_bo_get_handle_for_plane(bo, p).u32;
+        pitches[p] = gbm_bo_get_stride_for_plane(bo, p);
+        offsets[p] = gbm_bo_get_offset(bo, p);
+    }
+    log.info("Creating framebuffer: %ux%u, format: %#x, modifier: %#llx, planes: %d, stride: %u", width, height, m_gpu_format,
+             (unsigned long long)modifier, planes, pitches[0]);
 
-    ret = drmModeAddFB(m_drmFd, width, height, depth, bpp, stride, handle, out_fbId);
+    ret = addFramebuffer(width, height, m_gpu_format, handles, pitches, offsets, modifier, out_fbId);
     if(ret < 0){
-        log.error("drmModeAddFB failed: %s", strerror(errno));
+        log.error("drmModeAddFB2 failed: %s", strerror(errno));
         return false;
     }
     log.info("Created framebuffer: ID %u", *out_fbId);
@@ -620,14 +1249,14 @@ bool Display::importGbmBoFromFD(int buf_fd, struct gbm_bo **out_bo)
     log.status("Importing GPU buffer.");
 
     // Sanity check
-    if(buf_fd < 0 || !*out_bo){
+    if(buf_fd < 0 || !out_bo){
         log.error("importGbmBoFromFD: incorrect arguments");
         return false;
     }
 
-    // We only support XRGB8888 for now
-    if(m_gpu_format != GBM_FORMAT_XRGB8888){
-        log.error("importGbmBoFromFD: Only supporting XR24 for now.");
+    // We only support XRGB8888 and ARGB8888 for now
+    if(m_gpu_format != GBM_FORMAT_XRGB8888 && m_gpu_format != GBM_FORMAT_ARGB8888){
+        log.error("importGbmBoFromFD: Only supporting XR24 and AR24 for now.");
         return false;
     }
 
@@ -642,7 +1271,7 @@ bool Display::importGbmBoFromFD(int buf_fd, struct gbm_bo **out_bo)
     idata.format = m_gpu_format;
     
     *out_bo = gbm_bo_import(m_gbmDev, GBM_BO_IMPORT_FD, &idata, m_gbm_flags);
-    if(!out_bo){
+    if(!*out_bo){
         log.error("gbm_bo_import failed: cannot import DMA_BUF: %s", strerror(errno));
         return false;
     }
@@ -663,108 +1292,307 @@ bool Display::createFbFromFd(int buf_fd, uint32_t *out_fbId)
         return false;
     }
 
-    // We support only NV12 for now
-    if(m_cam_format != DRM_FORMAT_NV12){
-        log.error("createFbFromFd: Only supporting NV12 for now.");
+    // Buffers allocated by us have their FB already
+    for(const auto& dbuf : m_cam_dumb_bufs){
+        if(dbuf.fd == buf_fd){
+            *out_fbId = dbuf.fbId;
+            return true;
+        }
+    }
+
+    // Single memory plane layouts only: one dma_fd per frame
+    const frame_layout_t& layout = m_cam_layout;
+    if(!layout.fourcc || layout.num_mem_planes != 1){
+        log.error("createFbFromFd: unsupported camera layout");
         return false;
     }
 
-    // Check if buf_fd already cached
-    auto it = m_fb_map.find(buf_fd);
-    if(it != m_fb_map.end()){
-        *out_fbId = it->second;
+    // Get GEM handle: identifies the buffer, whatever the fd number
+    uint32_t handle;
+    if(!m_fb_cache->importHandle(buf_fd, &handle)){
+        log.error("importHandle() failed!");
+        return false;
+    }
+
+    // Check if already cached
+    fb_key_t key{handle, layout.fourcc, layout.width, layout.height, layout.pitch[0]};
+    if(m_fb_cache->lookup(key, out_fbId)){
         return true;
     }
 
     log.info("Importing Camera buffer.");
 
-    // Create GEM handle
-    uint32_t handle;
-    ret = drmPrimeFDToHandle(m_drmFd, buf_fd, &handle);
+    // Create FB: every color plane in the same buffer, where the layout puts it
+    uint32_t handles[4] = {0, 0, 0, 0};
+    uint32_t pitches[4] = {0, 0, 0, 0};
+    uint32_t offsets[4] = {0, 0, 0, 0};
+    for(uint32_t p = 0; p < layout.num_planes && p < 4; p++){
+        handles[p] = handle;
+        pitches[p] = layout.pitch[p];
+        offsets[p] = layout.offset[p];
+    }
+
+    ret = addFramebuffer(layout.width, layout.height, layout.fourcc, handles, pitches, offsets, DRM_FORMAT_MOD_LINEAR, out_fbId); // V4L2 writes linear
     if(ret < 0){
-        log.error("drmPrimeFDToHandle failed: cannot import DMA_BUF: %s", strerror(errno));
+        log.error("drmModeAddFB2 failed: %s", strerror(errno));
+        m_fb_cache->releaseHandle(handle);
         return false;
     }
 
-    // Create FB
-    uint32_t stride = m_config.cam_buf.stride;
-    uint32_t height = m_config.cam_buf.height;
-    uint32_t width = m_config.cam_buf.width;
+    // Cache new FB, the cache keeps the GEM handle
+    if(!m_fb_cache->insert(key, *out_fbId)){
+        drmModeRmFB(m_drmFd, *out_fbId);
+        m_fb_cache->releaseHandle(handle);
+        return false;
+    }
 
-    uint32_t handles[4] = {handle, handle, 0, 0};
-    uint32_t pitches[4] = {stride, stride, 0, 0};
-    uint32_t offsets[4] = {0, stride*height, 0, 0}; // Here assuming UV is packed directly after Y plane
+    return true;
+}
 
-    ret = drmModeAddFB2(m_drmFd, width, height, m_cam_format, handles, pitches, offsets, out_fbId, 0);
-    if(ret < 0){
-        log.error("drmModeAddFB2 failed: %s", strerror(errno));
-        goto err;
+bool Display::setCameraLayout(const frame_layout_t& layout)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(m_config.testing_display || !layout.fourcc){
+        log.error("setCameraLayout: no camera or unknown layout");
+        return false;
+    }
+    if(layout.fourcc != m_cam_format){
+        log.error("setCameraLayout: format %.4s doesn't match the camera plane format %.4s", (const char*)&layout.fourcc, (const char*)&m_cam_format);
+        return false;
+    }
+    if(layout.num_mem_planes != 1){
+        log.error("setCameraLayout: %u memory planes, only single memory plane formats can be scanned out", layout.num_mem_planes);
+        return false;
     }
 
-    // Cache new FB
-    m_fb_map.emplace(buf_fd, *out_fbId);
+    // FBs built on the old layout are stale
+    bool resized = (layout.width != m_cam_layout.width || layout.height != m_cam_layout.height);
+    m_fb_cache->clear();
+    m_shown_fbs.clear();
+    m_committed_fbs.clear();
+    pinCameraFbs();
+    m_cam_layout = layout;
+    m_config.cam_buf.width = layout.width;
+    m_config.cam_buf.height = layout.height;
+    log.info("Camera layout: %ux%u, pitch %u, chroma at %u", layout.width, layout.height, layout.pitch[0], layout.offset[1]);
+
+    // Letterbox for the new size, on the plane probePipeline() picked: it has to take it too
+    if(resized && m_display_initialized){
+        log.warning("Camera size changed to %ux%u after probing", layout.width, layout.height);
+        computeCameraRects();
+        if(!testCameraPlane()){
+            log.error("setCameraLayout: plane %u rejects %ux%u shown at %ux%u", m_camPlaneId, m_cam_src.w, m_cam_src.h, m_cam_dst.w, m_cam_dst.h);
+            return false;
+        }
+    }
 
-    ret = 0;
-    goto cleanup;
+    return true;
+}
 
-err:
-    ret = -1;
-cleanup:
-    struct drm_gem_close clreq{};
-    clreq.handle = handle;
-    drmIoctl(m_drmFd, DRM_IOCTL_GEM_CLOSE, &clreq);
-    return (ret == 0);
+void Display::invalidateBuffer(int buf_fd)
+{
+    // Buffers allocated by us are never cached
+    for(const auto& dbuf : m_cam_dumb_bufs){
+        if(dbuf.fd == buf_fd)
+            return;
+    }
+    m_fb_cache->invalidate(buf_fd);
+}
+
+bool Display::getGpuFb(int buf_fd, uint32_t *out_fbId)
+{
+    Logger& log = m_logger;
+
+    // Check if buf_fd already cached
+    auto it = m_gpu_fb_map.find(buf_fd);
+    if(it != m_gpu_fb_map.end()){
+        *out_fbId = it->second.fbId;
+        return true;
+    }
+
+    gpu_fb_t gfb{nullptr, 0, false};
+    if(!importGbmBoFromFD(buf_fd, &gfb.bo)){
+        log.error("importGbmBoFromFD() failed!");
+        return false;
+    }
+    if(!createFbFromGbmBo(gfb.bo, &gfb.fbId)){
+        log.error("createFbFromGbmBo() failed!");
+        gbm_bo_destroy(gfb.bo);
+        return false;
+    }
+
+    // Cache new FB, the bo keeps the GEM handle alive
+    m_gpu_fb_map.emplace(buf_fd, gfb);
+    *out_fbId = gfb.fbId;
+
+    return true;
+}
+
+bool Display::allocateGpuBuffers(unsigned int count, std::vector<gpu_dmabuf_t>& out_bufs)
+{
+    Logger& log = m_logger;
+    uint32_t width = m_config.gpu_buf.width;
+    uint32_t height = m_config.gpu_buf.height;
+
+    log.status("Allocating %u GPU buffers", count);
+
+    // Sanity check: modifiers are known once the pipeline was probed
+    if(count == 0 || !m_display_initialized || !m_overlayPlaneId || !width || !height){
+        log.error("allocateGpuBuffers: incorrect arguments or no overlay plane");
+        return false;
+    }
+
+    out_bufs.clear();
+    for(unsigned int i = 0; i < count; i++){
+        gpu_fb_t gfb{nullptr, 0, true};
+
+        // GBM picks the best of the modifiers the overlay plane passed TEST_ONLY with (AFBC over LINEAR)
+        if(m_fb_modifiers && m_gpu_modifiers.size() > 1)
+            gfb.bo = gbm_bo_create_with_modifiers(m_gbmDev, width, height, m_gpu_format, m_gpu_modifiers.data(), m_gpu_modifiers.size());
+        if(!gfb.bo)
+            gfb.bo = gbm_bo_create(m_gbmDev, width, height, m_gpu_format, m_gbm_flags);
+        if(!gfb.bo){
+            log.error("gbm_bo_create failed: %s", strerror(errno));
+            return false;
+        }
+        if(!createFbFromGbmBo(gfb.bo, &gfb.fbId)){
+            log.error("createFbFromGbmBo() failed!");
+            gbm_bo_destroy(gfb.bo);
+            return false;
+        }
+        int fd = gbm_bo_get_fd(gfb.bo);
+        if(fd < 0){
+            log.error("gbm_bo_get_fd failed: %s", strerror(errno));
+            drmModeRmFB(m_drmFd, gfb.fbId);
+            gbm_bo_destroy(gfb.bo);
+            return false;
+        }
+
+        // Describe the layout for the renderer
+        gpu_dmabuf_t buf{};
+        buf.fd = fd;
+        buf.num_planes = (uint32_t)std::min(gbm_bo_get_plane_count(gfb.bo), 4);
+        buf.modifier = gbm_bo_get_modifier(gfb.bo);
+        for(uint32_t p = 0; p < buf.num_planes; p++){
+            buf.pitch[p] = gbm_bo_get_stride_for_plane(gfb.bo, p);
+            buf.offset[p] = gbm_bo_get_offset(gfb.bo, p);
+        }
+
+        // setOverlay() finds it here
+        m_gpu_fb_map.emplace(fd, gfb);
+        out_bufs.push_back(buf);
+
+        log.info(". Buffer %u: dma_fd=%d, fb=%u, modifier=%#llx, planes=%u", i, fd, gfb.fbId, (unsigned long long)buf.modifier, buf.num_planes);
+    }
+
+    return true;
+}
+
+bool Display::setOverlay(int gpu_buf_fd, int in_fence_fd)
+{
+    Logger& log = m_logger;
+
+    if(gpu_buf_fd >= 0){
+        if(!m_overlayPlaneId){
+            log.error("setOverlay: no overlay plane available");
+            return false;
+        }
+        // Import now so scanout() never pays for it
+        uint32_t fbId = 0;
+        if(!getGpuFb(gpu_buf_fd, &fbId)){
+            log.error("getGpuFb() failed!");
+            return false;
+        }
+    }
+
+    // A fence means new content, even in the same buffer: commit it again
+    if(gpu_buf_fd != m_overlay_fd || in_fence_fd >= 0){
+        m_overlay_fd = gpu_buf_fd;
+        m_overlay_fence = (gpu_buf_fd >= 0) ? in_fence_fd : -1;
+        m_overlay_dirty = true;
+    }
+
+    return true;
 }
 
 void eventCb(int fd, unsigned int sequence, unsigned int sec, unsigned int usec, void *user_data)
 {
     (void) fd;
-    (void) sequence;
     frame_info_t *f = static_cast<frame_info_t*>(user_data);
-    float old_t = 0;
-    float curr_t = 0;
-    float refresh_rate = 0;
 
-    // Calculate FPS
-    if(f->count > 0){
-        old_t = (float) f->sec + (float) f->usec * 0.000001f;
-        curr_t = (float) sec + (float) usec * 0.000001f;
-        refresh_rate = (1.0f / (curr_t - old_t));
-        f->sec = sec;
-        f->usec = usec;
-    }
+    // Keep it short: this runs in the vsync path. Timing stats are derived from these by the caller.
+    f->count++;
+    f->sequence = sequence;
+    f->sec = sec;
+    f->usec = usec;
 
     // Flip complete
     f->flip_pending = false;
-
-    printf("Flip complete for frame %u @%.02fhz\n", f->count++, refresh_rate);
 }
 
 bool Display::handleEvent()
 {
     Logger& log = m_logger;
 
+    unsigned int count = m_frame.count;
     int ret = drmHandleEvent(m_drmFd, &m_drm_evctx);
     if(ret < 0){
         log.error("drmHandleEvent failed: %s", strerror(errno));
         return false;
     }
 
+    // Test pattern: a new buffer is committed right after each flip, one per vblank when it keeps up
+    if(m_config.testing_display && m_frame.count != count){
+        unsigned int gap = m_frame.sequence - m_last_sequence;
+        if(count > 0 && gap > 1){
+            m_missed_vblanks += gap - 1;
+            if(m_missed_rl.allow())
+                log.warning("Flip %u: %u vblanks missed (%llu total)", m_frame.count, gap - 1, (unsigned long long)m_missed_vblanks);
+        }
+        m_last_sequence = m_frame.sequence;
+    }
+
+    // Flip done: the committed FBs are on screen, the ones they replaced can be evicted
+    if(!m_frame.flip_pending && m_shown_fbs != m_committed_fbs){
+        m_shown_fbs = m_committed_fbs;
+        pinCameraFbs();
+    }
+
+    // Camera on screen: the splash FB is no longer scanned out
+    if(!m_config.keep_splash && m_camera_shown && !m_frame.flip_pending && m_splashscreen_FbId){
+        drmModeRmFB(m_drmFd, m_splashscreen_FbId);
+        m_splashscreen_FbId = 0;
+        log.info("Splash FB freed");
+    }
+
     return true;
 }
 
-bool Display::atomicUpdate(uint32_t cam_fbId) // TODO: add gpu_fbId
+void Display::pinCameraFbs()
+{
+    m_pinned_fbs.assign(m_shown_fbs.begin(), m_shown_fbs.end());
+    m_pinned_fbs.insert(m_pinned_fbs.end(), m_committed_fbs.begin(), m_committed_fbs.end());
+    m_fb_cache->setPinned(m_pinned_fbs);
+}
+
+bool Display::atomicUpdate(const uint32_t *cam_fbIds, unsigned int count, uint32_t gpu_fbId, int in_fence_fd)
 {
     Logger& log = m_logger;
     int ret{0};
+    int32_t out_fence = -1; // Written by the kernel on commit
 
     // Sanity check
-    if(cam_fbId <= 0){
+    bool any = false;
+    for(unsigned int i = 0; i < count; i++)
+        any = any || cam_fbIds[i];
+    if(!any || count > std::max<size_t>(m_mosaic.size(), 1)){
         log.error("cam_fbId not defined");
         return false;
     }
-    if(m_modePropFb_id <= 0){
-        log.error("m_modePropFb_id is not defined");
+    if(m_camProps.fb_id == 0){
+        log.error("FB_ID property is not cached");
         return false;
     }
 
@@ -775,8 +1603,87 @@ bool Display::atomicUpdate(uint32_t cam_fbId) // TODO: add gpu_fbId
         return false;
     }
 
-    // Attach new FB
-    drmModeAtomicAddProperty(req, m_primaryPlaneId, m_modePropFb_id, cam_fbId);
+    // Attach new FBs, a camera without one keeps its plane as is (mosaic)
+    for(unsigned int i = 0; i < count; i++){
+        if(!cam_fbIds[i])
+            continue;
+        bool mosaic = !m_mosaic.empty();
+        uint32_t plane_id = mosaic ? m_mosaic[i].plane->id : m_camPlaneId;
+        const plane_props_t& pp = mosaic ? m_mosaic[i].plane->props : m_camProps;
+        const rect_t& src = mosaic ? m_mosaic[i].src : m_cam_src;
+        const rect_t& dst = mosaic ? m_mosaic[i].dst : m_cam_dst;
+        drmModeAtomicAddProperty(req, plane_id, pp.fb_id, cam_fbIds[i]);
+        drmModeAtomicAddProperty(req, plane_id, pp.crtc_id, m_crtcId);
+
+        // Camera rectangles on every commit: the plane still holds the mode sized splashscreen after the
+        // modeset, and these are only property writes. Source in 16.16 fixed point
+        drmModeAtomicAddProperty(req, plane_id, pp.src_x, src.x << 16);
+        drmModeAtomicAddProperty(req, plane_id, pp.src_y, src.y << 16);
+        drmModeAtomicAddProperty(req, plane_id, pp.src_w, src.w << 16);
+        drmModeAtomicAddProperty(req, plane_id, pp.src_h, src.h << 16);
+        drmModeAtomicAddProperty(req, plane_id, pp.crtc_x, dst.x);
+        drmModeAtomicAddProperty(req, plane_id, pp.crtc_y, dst.y);
+        drmModeAtomicAddProperty(req, plane_id, pp.crtc_w, dst.w);
+        drmModeAtomicAddProperty(req, plane_id, pp.crtc_h, dst.h);
+
+        // Explicit sync: scanout waits for the producer fence instead of the CPU waiting
+        if(in_fence_fd >= 0){
+            if(pp.in_fence_fd)
+                drmModeAtomicAddProperty(req, plane_id, pp.in_fence_fd, in_fence_fd);
+            else
+                log.warning("IN_FENCE_FD not supported by plane %u, ignoring fence", plane_id);
+        }
+    }
+
+    // Compose the GPU buffer on the overlay plane within the same commit.
+    // Only touched when it changed, the plane keeps its state otherwise.
+    if(m_overlayPlaneId && m_overlay_dirty){
+        const plane_props_t& op = m_overlayProps;
+        if(gpu_fbId){
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.fb_id, gpu_fbId);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_id, m_crtcId);
+            // Source in 16.16 fixed point
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.src_x, 0);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.src_y, 0);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.src_w, ((uint32_t)m_config.gpu_buf.width) << 16);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.src_h, ((uint32_t)m_config.gpu_buf.height) << 16);
+            // Scaled over the whole screen
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_x, 0);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_y, 0);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_w, m_modeSettings.hdisplay);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_h, m_modeSettings.vdisplay);
+            // Above every camera plane
+            const plane_caps_t *overlay = nullptr;
+            uint64_t top = 0;
+            for(const auto& p : m_planes){
+                bool cam = (p.id == m_camPlaneId);
+                for(const auto& c : m_mosaic)
+                    cam = cam || (c.plane == &p);
+                if(cam)
+                    top = std::max(top, p.zpos);
+                if(p.id == m_overlayPlaneId)
+                    overlay = &p;
+            }
+            if(overlay)
+                addOverlayStacking(req, *overlay, top);
+            // The GPU may still be rendering it
+            if(m_overlay_fence >= 0){
+                if(op.in_fence_fd)
+                    drmModeAtomicAddProperty(req, m_overlayPlaneId, op.in_fence_fd, m_overlay_fence);
+                else
+                    log.warning("IN_FENCE_FD not supported by plane %u, ignoring GPU fence", m_overlayPlaneId);
+            }
+        }
+        else {
+            // Disable the plane
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.fb_id, 0);
+            drmModeAtomicAddProperty(req, m_overlayPlaneId, op.crtc_id, 0);
+        }
+    }
+
+    if(m_config.explicit_sync && m_crtcProps.out_fence_ptr){
+        drmModeAtomicAddProperty(req, m_crtcId, m_crtcProps.out_fence_ptr, (uint64_t)(uintptr_t)&out_fence);
+    }
 
     // DRM_MODE_ATOMIC_NONBLOCK: Returns immediately, doesn't wait for VSYNC
     // DRM_MODE_PAGE_FLIP_EVENT: Generates a VBLANK event when the flip completes
@@ -787,6 +1694,24 @@ bool Display::atomicUpdate(uint32_t cam_fbId) // TODO: add gpu_fbId
         log.error("drmModeAtomicCommit: Atomic commit failed: %s", strerror(errno));
     } else {
         m_frame.flip_pending = true;
+        m_overlay_dirty = false;
+        m_overlay_fence = -1; // Taken by the kernel
+        m_camera_shown = !m_config.testing_display;
+        // Planes scan out the new FBs from the flip on, keep them and the ones still shown out of eviction
+        size_t planes = std::max<size_t>(m_mosaic.size(), 1);
+        if(m_committed_fbs.size() != planes){
+            m_committed_fbs.assign(planes, 0);
+            m_shown_fbs.assign(planes, 0);
+        }
+        for(unsigned int i = 0; i < count; i++){
+            if(cam_fbIds[i])
+                m_committed_fbs[i] = cam_fbIds[i];
+        }
+        pinCameraFbs();
+        // Replace a fence nobody took
+        if(m_out_fence >= 0)
+            close(m_out_fence);
+        m_out_fence = out_fence;
     }
 
     drmModeAtomicFree(req);
@@ -794,7 +1719,106 @@ bool Display::atomicUpdate(uint32_t cam_fbId) // TODO: add gpu_fbId
     return (ret == 0) ? true : false;
 }
 
-bool Display::scanout(int cam_buf_fd)
+bool Display::setMosaic(unsigned int count)
+{
+    Logger& log = m_logger;
+    uint32_t hdisplay = m_modeSettings.hdisplay;
+    uint32_t vdisplay = m_modeSettings.vdisplay;
+    uint32_t blob_id = 0;
+    dumb_buf_t cam_fb{};
+    cam_fb.fd = -1;
+    std::vector<plane_state_t> cells;
+
+    // Sanity check
+    if(!m_display_initialized || m_config.testing_display || !count){
+        log.error("setMosaic: Display not initialized or no camera");
+        return false;
+    }
+    m_mosaic.clear();
+    if(count == 1)
+        return true; // Camera plane alone
+
+    // One plane per camera: the camera plane first, then the ones taking the camera format
+    for(int pass = 0; pass < 2 && cells.size() < count; pass++){
+        for(const auto& p : m_planes){
+            if(cells.size() == count)
+                break;
+            bool cam = (p.id == m_camPlaneId);
+            if(cam != (pass == 0) || p.id == m_overlayPlaneId || !plane_supports(p, m_cam_format, DRM_FORMAT_MOD_LINEAR))
+                continue;
+            cells.push_back({&p, 0, {0, 0, 0, 0}, {0, 0, 0, 0}, nullptr});
+        }
+    }
+    if(cells.size() < count){
+        log.error("setMosaic: %u cameras but only %zu planes take %.4s", count, cells.size(), (const char*)&m_cam_format);
+        return false;
+    }
+
+    // Grid, each camera letterboxed in its cell
+    uint32_t cols = 1;
+    while(cols * cols < count)
+        cols++;
+    uint32_t rows = (count + cols - 1) / cols;
+    uint32_t cell_w = (hdisplay / cols) & ~1u;
+    uint32_t cell_h = (vdisplay / rows) & ~1u;
+    for(unsigned int i = 0; i < count; i++){
+        rect_t dst = fit_rect(m_cam_layout.width, m_cam_layout.height, cell_w, cell_h);
+        dst.x += (i % cols) * cell_w;
+        dst.y += (i / cols) * cell_h;
+        cells[i].src = {0, 0, m_cam_layout.width, m_cam_layout.height};
+        cells[i].dst = dst;
+    }
+
+    // Validate the whole layout once, scanoutSet() then only swaps FBs
+    if(drmModeCreatePropertyBlob(m_drmFd, &m_modeSettings, sizeof(m_modeSettings), &blob_id) < 0){
+        log.error("Failed to create mode blob");
+        return false;
+    }
+    if(!createProbeFb(m_cam_format, m_cam_layout.width, m_cam_layout.height, DRM_FORMAT_MOD_LINEAR, cam_fb)){
+        log.error("Failed to create the mosaic probe FB: %s", strerror(errno));
+        drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+        return false;
+    }
+    for(auto& c : cells)
+        c.fbId = cam_fb.fbId;
+    bool ok = testCommit(blob_id, cells);
+    destroyDumbBuffer(cam_fb);
+    drmModeDestroyPropertyBlob(m_drmFd, blob_id);
+    if(!ok){
+        log.error("setMosaic: the driver rejected %u scaled %.4s planes", count, (const char*)&m_cam_format);
+        return false;
+    }
+
+    for(auto& c : cells)
+        c.fbId = 0;
+    m_mosaic = cells;
+    log.info("Mosaic: %u cameras on a %ux%u grid", count, cols, rows);
+
+    return true;
+}
+
+bool Display::prepareBuffer(int buf_fd)
+{
+    Logger& log = m_logger;
+    uint32_t fbId = 0;
+
+    // Sanity check
+    if(!m_display_initialized || m_config.testing_display){
+        log.error("prepareBuffer: no camera buffers in this mode");
+        return false;
+    }
+
+    return createFbFromFd(buf_fd, &fbId);
+}
+
+int Display::takeOutFence()
+{
+    int fence = m_out_fence;
+    m_out_fence = -1;
+    return fence;
+}
+
+bool Display::scanout(int cam_buf_fd, int in_fence_fd)
 {
     Logger& log = m_logger;
     uint32_t cam_fbId = 0; // FB will be cached and removed in destructor
@@ -806,8 +1830,12 @@ bool Display::scanout(int cam_buf_fd)
         return false;
     }
 
-    // Import GPU FB
-    // TODO
+    // Import GPU FB (cached by setOverlay())
+    uint32_t gpu_fbId = 0;
+    if(m_overlay_fd >= 0 && !getGpuFb(m_overlay_fd, &gpu_fbId)){
+        log.error("getGpuFb() failed!");
+        return false;
+    }
 
     // Import camera FB
     if(!testing){
@@ -819,20 +1847,110 @@ bool Display::scanout(int cam_buf_fd)
 
     // Page flip
     if(testing){
-        if(!atomicUpdate(m_testPattern_FbId)){
+        // Next ring buffer: neither on screen nor pending
+        unsigned int next = (m_tp_index + 1) % m_tp_ring.size();
+        tp_buf_t& buf = m_tp_ring[next];
+        m_pattern->render(buf.pixels, buf.dbuf.pitch / 4, ++m_tp_frame, m_pattern->animated());
+        if(!atomicUpdate(&buf.dbuf.fbId, 1, gpu_fbId, in_fence_fd)){
             log.error("atomicUpdate() failed!");
             return false;
         }
+        m_tp_index = next;
     }
     else {
-        if(!atomicUpdate(cam_fbId)){
+        if(!atomicUpdate(&cam_fbId, 1, gpu_fbId, in_fence_fd)){
             log.error("atomicUpdate() failed!");
-            drmModeRmFB(m_drmFd, cam_fbId);
-            m_fb_map.erase(cam_buf_fd); // Erase corresponding entry
+            invalidateBuffer(cam_buf_fd); // Don't keep a FB the driver refused
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Display::scanoutSet(const std::vector<int>& cam_buf_fds, int in_fence_fd)
+{
+    Logger& log = m_logger;
+    std::vector<uint32_t> cam_fbIds(cam_buf_fds.size(), 0);
+
+    // Sanity check
+    if(!m_display_initialized || cam_buf_fds.size() != std::max<size_t>(m_mosaic.size(), 1)){
+        log.error("scanoutSet: %zu buffers for %zu planes", cam_buf_fds.size(), m_mosaic.size());
+        return false;
+    }
+
+    // Import GPU FB (cached by setOverlay())
+    uint32_t gpu_fbId = 0;
+    if(m_overlay_fd >= 0 && !getGpuFb(m_overlay_fd, &gpu_fbId)){
+        log.error("getGpuFb() failed!");
+        return false;
+    }
+
+    // Import camera FBs, -1: keep what the plane shows
+    for(size_t i = 0; i < cam_buf_fds.size(); i++){
+        if(cam_buf_fds[i] >= 0 && !createFbFromFd(cam_buf_fds[i], &cam_fbIds[i])){
+            log.error("createFbFromFd() failed!");
             return false;
         }
     }
 
+    // Page flip, all planes at once
+    if(!atomicUpdate(cam_fbIds.data(), (unsigned int)cam_fbIds.size(), gpu_fbId, in_fence_fd)){
+        log.error("atomicUpdate() failed!");
+        for(int fd : cam_buf_fds){
+            if(fd >= 0)
+                invalidateBuffer(fd);
+        }
+        return false;
+    }
+
+    return true;
+}
+
+bool Display::showSplash()
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(!m_display_initialized || m_config.testing_display || !m_splashscreen_FbId){
+        log.error("showSplash: no splash FB (keep_splash off?)");
+        return false;
+    }
+
+    // Splash alone on the camera plane: mosaic and overlay planes off
+    drmModeAtomicReq *req = drmModeAtomicAlloc();
+    if(!req){
+        log.error("drmModeAtomicAlloc: Failed to allocate atomic request");
+        return false;
+    }
+    for(const auto& p : m_planes){
+        if(p.id == m_camPlaneId)
+            addPlaneState(req, {plane_state_t{&p, m_splashscreen_FbId, m_splash_src, m_splash_dst, nullptr}});
+    }
+    for(const auto& c : m_mosaic){
+        if(c.plane->id != m_camPlaneId){
+            drmModeAtomicAddProperty(req, c.plane->id, c.plane->props.fb_id, 0);
+            drmModeAtomicAddProperty(req, c.plane->id, c.plane->props.crtc_id, 0);
+        }
+    }
+    if(m_overlayPlaneId){
+        drmModeAtomicAddProperty(req, m_overlayPlaneId, m_overlayProps.fb_id, 0);
+        drmModeAtomicAddProperty(req, m_overlayPlaneId, m_overlayProps.crtc_id, 0);
+    }
+
+    // Blocking: waits for a pending flip, the camera buffers are unused once it returns
+    int ret = drmModeAtomicCommit(m_drmFd, req, 0, nullptr);
+    drmModeAtomicFree(req);
+    if(ret < 0){
+        log.error("drmModeAtomicCommit: Atomic commit failed: %s", strerror(errno));
+        return false;
+    }
+    m_camera_shown = false;
+    m_overlay_dirty = (m_overlay_fd >= 0); // Back with the next camera frame
+    m_shown_fbs.clear();
+    m_committed_fbs.clear();
+    pinCameraFbs();
+
     return true;
 }
 
@@ -841,24 +1959,35 @@ Display::~Display()
     Logger& log = m_logger;
     log.status("Quitting...");
 
-    // Free used FBs
-    for(const auto& pair : m_fb_map){
-        if(pair.second > 0){
-            drmModeRmFB(m_drmFd, pair.second);
+    // Close fence nobody took
+    if(m_out_fence >= 0){
+        close(m_out_fence);
+    }
+    // Free camera buffers allocated by us
+    for(auto& dbuf : m_cam_dumb_bufs){
+        destroyDumbBuffer(dbuf);
+    }
+    // Free imported FBs and their GEM handles
+    m_fb_cache.reset();
+    // Free GPU FBs and imported bos
+    for(const auto& pair : m_gpu_fb_map){
+        if(pair.second.fbId > 0){
+            drmModeRmFB(m_drmFd, pair.second.fbId);
+        }
+        gbm_bo_destroy(pair.second.bo);
+        if(pair.second.owned){
+            close(pair.first);
         }
     }
     // Free splash FB
     if(m_splashscreen_FbId > 0){
         drmModeRmFB(m_drmFd, m_splashscreen_FbId);
     }
-    // Free test FB
-    if(m_testPattern_FbId > 0){
-        drmModeRmFB(m_drmFd, m_testPattern_FbId);
-    }
-    // Free DRM plane
-    if(m_drmPrimaryPlane){
-        drmModeFreePlane(m_drmPrimaryPlane);
-    }
+    // Free test pattern buffers
+    if(!m_tp_ring.empty() && m_frame.count > 1)
+        log.status("Test pattern: %u flips, %llu vblanks missed", m_frame.count, (unsigned long long)m_missed_vblanks);
+    for(auto& buf : m_tp_ring)
+        destroyPatternBuffer(buf);
     // Free DRM crtc
     if(m_drmCrtc){
         drmModeFreeCrtc(m_drmCrtc);
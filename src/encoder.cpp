@@ -0,0 +1,505 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "encoder.hpp"
+
+Encoder::Encoder(const encoder_config& conf, bool verbose)
+    : m_config(conf), m_logger("encoder", verbose)
+{
+    Logger& log = m_logger;
+    struct v4l2_capability caps{};
+
+    // Check config
+    if(conf.codec != "H264" && conf.codec != "HEVC")
+        log.fatal("Unsupported codec " + conf.codec + ", expected H264 or HEVC");
+    if(conf.buf_count == 0)
+        log.fatal("Encoder config not correctly defined. Please check!");
+
+    // Open device
+    log.status("Opening encoder %s", conf.device.c_str());
+    m_fd = open(conf.device.c_str(), O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if(m_fd < 0)
+        log.fatal("Failed to open encoder " + conf.device + ": " + strerror(errno));
+
+    // Memory-to-memory, multi-planar API only
+    if(!xioctl(m_fd, VIDIOC_QUERYCAP, &caps)){
+        close(m_fd);
+        log.fatal("VIDIOC_QUERYCAP failed on " + conf.device);
+    }
+    uint32_t dev_caps = (caps.capabilities & V4L2_CAP_DEVICE_CAPS) ? caps.device_caps : caps.capabilities;
+    if(!(dev_caps & V4L2_CAP_VIDEO_M2M_MPLANE) || !(dev_caps & V4L2_CAP_STREAMING)){
+        close(m_fd);
+        log.fatal(conf.device + " is not a multi-planar M2M device");
+    }
+    log.info("Encoder: %s (%s)", caps.card, caps.driver);
+}
+
+capture_config Encoder::config()
+{
+    capture_config conf;
+    conf.fmt_fourcc = m_config.codec;
+    conf.width = m_layout.width;
+    conf.height = m_layout.height;
+    conf.mem_type = TYPE_MMAP;
+    conf.buf_count = (unsigned int)m_packets.size();
+    return conf;
+}
+
+bool Encoder::setFormats(uint32_t width, uint32_t height)
+{
+    Logger& log = m_logger;
+    struct v4l2_format fmt{};
+    const std::string& codec = m_config.codec;
+
+    // Bitstream first: some drivers derive the accepted raw formats from it
+    fmt.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = v4l2_fourcc(codec[0], codec[1], codec[2], codec[3]);
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.num_planes = 1;
+    fmt.fmt.pix_mp.plane_fmt[0].sizeimage = width * height; // Worst case packet, the driver may raise it
+    if(!xioctl(m_fd, VIDIOC_S_FMT, &fmt) || fmt.fmt.pix_mp.pixelformat != v4l2_fourcc(codec[0], codec[1], codec[2], codec[3])){
+        log.error("Encoder doesn't produce %s", codec.c_str());
+        return false;
+    }
+
+    // Raw side: exactly the capture layout, or the buffers can't be shared
+    uint32_t pixfmt = m_layout.fourcc;
+    if(m_layout.num_mem_planes == 2)
+        pixfmt = (pixfmt == v4l2_fourcc('N', 'V', '1', '6')) ? V4L2_PIX_FMT_NV16M : V4L2_PIX_FMT_NV12M;
+    fmt = {};
+    fmt.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    fmt.fmt.pix_mp.pixelformat = pixfmt;
+    fmt.fmt.pix_mp.width = width;
+    fmt.fmt.pix_mp.height = height;
+    fmt.fmt.pix_mp.num_planes = m_layout.num_mem_planes;
+    for(unsigned int p = 0; p < m_layout.num_mem_planes; p++){
+        fmt.fmt.pix_mp.plane_fmt[p].bytesperline = m_layout.pitch[p];
+        fmt.fmt.pix_mp.plane_fmt[p].sizeimage = m_layout.mem_size[p];
+    }
+    if(!xioctl(m_fd, VIDIOC_S_FMT, &fmt)){
+        log.error("VIDIOC_S_FMT failed on the encoder input");
+        return false;
+    }
+    if(fmt.fmt.pix_mp.pixelformat != pixfmt || fmt.fmt.pix_mp.width != width || fmt.fmt.pix_mp.height != height ||
+       fmt.fmt.pix_mp.num_planes != m_layout.num_mem_planes){
+        log.error("Encoder doesn't take %.4s %ux%u", (const char*)&pixfmt, width, height);
+        return false;
+    }
+    for(unsigned int p = 0; p < m_layout.num_mem_planes; p++){
+        if(fmt.fmt.pix_mp.plane_fmt[p].bytesperline != m_layout.pitch[p] || fmt.fmt.pix_mp.plane_fmt[p].sizeimage > m_layout.mem_size[p]){
+            log.error("Encoder needs pitch %u and %u bytes for plane %u, capture has %u and %u", fmt.fmt.pix_mp.plane_fmt[p].bytesperline,
+                      fmt.fmt.pix_mp.plane_fmt[p].sizeimage, p, m_layout.pitch[p], m_layout.mem_size[p]);
+            return false;
+        }
+    }
+
+    log.info("Encoding %.4s %ux%u to %s", (const char*)&pixfmt, width, height, codec.c_str());
+
+    return true;
+}
+
+bool Encoder::setControls()
+{
+    Logger& log = m_logger;
+    struct v4l2_control ctrl{};
+
+    // Best effort: drivers differ in what they expose
+    ctrl.id = V4L2_CID_MPEG_VIDEO_BITRATE;
+    ctrl.value = (int32_t)m_config.bitrate;
+    if(ioctl(m_fd, VIDIOC_S_CTRL, &ctrl) < 0)
+        log.warning("Encoder bitrate not set: %s", strerror(errno));
+    ctrl.id = V4L2_CID_MPEG_VIDEO_GOP_SIZE;
+    ctrl.value = (int32_t)m_config.gop;
+    if(ioctl(m_fd, VIDIOC_S_CTRL, &ctrl) < 0)
+        log.warning("Encoder GOP size not set: %s", strerror(errno));
+
+    // Parameter sets with each key frame, so every segment decodes on its own
+    ctrl.id = V4L2_CID_MPEG_VIDEO_REPEAT_SEQ_HEADER;
+    ctrl.value = 1;
+    if(ioctl(m_fd, VIDIOC_S_CTRL, &ctrl) < 0)
+        log.info("Encoder can't repeat sequence headers: %s", strerror(errno));
+
+    return true;
+}
+
+bool Encoder::setupPackets()
+{
+    Logger& log = m_logger;
+    struct v4l2_requestbuffers req{};
+
+    // Raw side: imported capture DMA-BUFs, one V4L2 buffer per capture buffer
+    req.count = (uint32_t)m_inputs.size();
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    req.memory = V4L2_MEMORY_DMABUF;
+    if(!xioctl(m_fd, VIDIOC_REQBUFS, &req) || req.count < m_inputs.size()){
+        log.error("Encoder input: REQBUFS(DMABUF, %zu) failed", m_inputs.size());
+        return false;
+    }
+
+    // Bitstream side: driver buffers, mapped for the writer
+    req = {};
+    req.count = m_config.buf_count;
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    if(!xioctl(m_fd, VIDIOC_REQBUFS, &req) || req.count == 0){
+        log.error("Encoder output: REQBUFS(MMAP) failed");
+        return false;
+    }
+    m_packets.assign(req.count, enc_packet_buf_t{nullptr, 0, false, 0});
+    for(unsigned int i = 0; i < req.count; i++){
+        struct v4l2_buffer buf{};
+        struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+        buf.memory = V4L2_MEMORY_MMAP;
+        buf.index = i;
+        buf.m.planes = planes;
+        buf.length = VIDEO_MAX_PLANES;
+        if(!xioctl(m_fd, VIDIOC_QUERYBUF, &buf)){
+            log.error("VIDIOC_QUERYBUF failed for packet buffer %u", i);
+            return false;
+        }
+        void* mapped = mmap(NULL, planes[0].length, PROT_READ, MAP_SHARED, m_fd, planes[0].m.mem_offset);
+        if(mapped == MAP_FAILED){
+            log.error("mmap failed for packet buffer %u: %s", i, strerror(errno));
+            return false;
+        }
+        m_packets[i].addr = mapped;
+        m_packets[i].size = planes[0].length;
+        if(!queuePacket(i))
+            return false;
+    }
+    log.info("%zu camera buffers imported, %u packet buffers of %zu bytes", m_inputs.size(), req.count, m_packets[0].size);
+
+    return true;
+}
+
+bool Encoder::queuePacket(unsigned int index)
+{
+    Logger& log = m_logger;
+    struct v4l2_buffer buf{};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.index = index;
+    buf.m.planes = planes;
+    buf.length = 1;
+    if(!xioctl(m_fd, VIDIOC_QBUF, &buf)){
+        log.error("VIDIOC_QBUF failed for packet buffer %u", index);
+        return false;
+    }
+    m_packets[index].queued = true;
+
+    return true;
+}
+
+bool Encoder::start(const frame_layout_t& layout, unsigned int input_count)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(!layout.fourcc || !layout.num_mem_planes || !input_count){
+        log.error("Encoder::start: unknown camera layout");
+        return false;
+    }
+
+    m_layout = layout;
+    capture_frame_t none{};
+    none.index = -1;
+    m_inputs.assign(input_count, enc_input_t{none});
+    if(!setFormats(layout.width, layout.height) || !setControls() || !setupPackets())
+        return false;
+
+    // Start both queues
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    if(!xioctl(m_fd, VIDIOC_STREAMON, &type)){
+        log.error("VIDIOC_STREAMON failed on the encoder input");
+        return false;
+    }
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    if(!xioctl(m_fd, VIDIOC_STREAMON, &type)){
+        log.error("VIDIOC_STREAMON failed on the encoder output");
+        return false;
+    }
+    m_streaming = true;
+    m_draining = false;
+    m_finished = false;
+    log.status("Encoder is ON ! (%u kbit/s, GOP %u)", m_config.bitrate / 1000, m_config.gop);
+
+    return true;
+}
+
+bool Encoder::submit(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    struct v4l2_buffer buf{};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+
+    // Sanity check
+    if(!m_streaming || m_draining || frame.index < 0 || (size_t)frame.index >= m_inputs.size() ||
+       m_inputs[frame.index].frame.index >= 0 || frame.num_planes != m_layout.num_mem_planes)
+        return false;
+
+    // Encoder behind: skip this frame rather than starving the capture queue
+    if(m_inflight >= ENC_MAX_INFLIGHT){
+        m_busy++;
+        if(m_busy_rl.allow())
+            log.warning("Encoder busy, frame %u not encoded (%u similar messages suppressed)", frame.sequence, m_busy_rl.takeSuppressed());
+        return false;
+    }
+
+    // Same memory as the display reads: the encoder imports the capture DMA-BUF
+    buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    buf.memory = V4L2_MEMORY_DMABUF;
+    buf.index = frame.index;
+    buf.m.planes = planes;
+    buf.length = frame.num_planes;
+    buf.timestamp.tv_sec = frame.timestamp_ns / 1000000000ull; // Copied to the packet
+    buf.timestamp.tv_usec = (frame.timestamp_ns % 1000000000ull) / 1000;
+    for(unsigned int p = 0; p < frame.num_planes; p++){
+        planes[p].m.fd = frame.dma_fd[p];
+        planes[p].length = m_layout.mem_size[p];
+        planes[p].bytesused = frame.bytesused[p] ? frame.bytesused[p] : m_layout.mem_size[p];
+    }
+    if(!xioctl(m_fd, VIDIOC_QBUF, &buf)){
+        log.error("VIDIOC_QBUF failed for frame %u: %s", frame.sequence, strerror(errno));
+        return false;
+    }
+    m_inputs[frame.index].frame = frame;
+    m_inflight++;
+
+    return true;
+}
+
+bool Encoder::collect(std::vector<capture_frame_t>& done)
+{
+    Logger& log = m_logger;
+
+    // Camera frames the encoder finished reading
+    while(m_inflight){
+        struct v4l2_buffer buf{};
+        struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+        buf.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+        buf.memory = V4L2_MEMORY_DMABUF;
+        buf.m.planes = planes;
+        buf.length = VIDEO_MAX_PLANES;
+        if(ioctl(m_fd, VIDIOC_DQBUF, &buf) < 0){
+            if(errno == EINTR)
+                continue;
+            if(errno == EAGAIN)
+                break;
+            log.error("VIDIOC_DQBUF failed on the encoder input: %s", strerror(errno));
+            return false;
+        }
+        if(buf.index >= m_inputs.size() || m_inputs[buf.index].frame.index < 0){
+            log.error("Encoder returned unknown input buffer %u", buf.index);
+            return false;
+        }
+        done.push_back(m_inputs[buf.index].frame);
+        m_inputs[buf.index].frame.index = -1;
+        m_inflight--;
+    }
+
+    return true;
+}
+
+bool Encoder::forceKeyFrame()
+{
+    Logger& log = m_logger;
+    struct v4l2_control ctrl{};
+
+    ctrl.id = V4L2_CID_MPEG_VIDEO_FORCE_KEY_FRAME;
+    if(ioctl(m_fd, VIDIOC_S_CTRL, &ctrl) < 0){
+        log.warning("Encoder can't force a key frame: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool Encoder::flush()
+{
+    Logger& log = m_logger;
+    struct v4l2_encoder_cmd cmd{};
+
+    if(!m_streaming || m_draining)
+        return true;
+
+    // The driver marks the last packet with V4L2_BUF_FLAG_LAST
+    cmd.cmd = V4L2_ENC_CMD_STOP;
+    if(!xioctl(m_fd, VIDIOC_ENCODER_CMD, &cmd)){
+        log.warning("VIDIOC_ENCODER_CMD(STOP) failed, the last frames may be lost");
+        m_finished = true;
+    }
+    m_draining = true;
+
+    return true;
+}
+
+bool Encoder::tryDequeue(capture_frame_t& packet)
+{
+    Logger& log = m_logger;
+    struct v4l2_buffer buf{};
+    struct v4l2_plane planes[VIDEO_MAX_PLANES]{};
+
+    packet.index = -1;
+    if(!m_streaming || m_finished)
+        return true;
+
+    buf.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    buf.memory = V4L2_MEMORY_MMAP;
+    buf.m.planes = planes;
+    buf.length = VIDEO_MAX_PLANES;
+    while(ioctl(m_fd, VIDIOC_DQBUF, &buf) < 0){
+        if(errno == EINTR)
+            continue;
+        if(errno == EAGAIN)
+            return true;
+        if(errno == EPIPE){
+            m_finished = true; // Drained
+            return true;
+        }
+        log.error("VIDIOC_DQBUF failed on the encoder output: %s", strerror(errno));
+        return false;
+    }
+    m_packets[buf.index].queued = false;
+    if(buf.flags & V4L2_BUF_FLAG_LAST)
+        m_finished = true;
+
+    // Empty last buffer: nothing to hand out
+    if(!planes[0].bytesused){
+        return queuePacket(buf.index);
+    }
+
+    packet.index = buf.index;
+    packet.num_planes = 1;
+    packet.bytesused[0] = planes[0].bytesused;
+    packet.dma_fd[0] = -1;
+    packet.plane_addr[0] = m_packets[buf.index].addr;
+    packet.timestamp_ns = (uint64_t)buf.timestamp.tv_sec * 1000000000ull + (uint64_t)buf.timestamp.tv_usec * 1000ull;
+    packet.sequence = buf.sequence;
+    m_encoded++;
+    m_bytes += planes[0].bytesused;
+
+    return true;
+}
+
+bool Encoder::retain(const capture_frame_t& packet)
+{
+    Logger& log = m_logger;
+    int index = packet.index;
+
+    // Sanity check
+    if(index < 0 || (size_t)index >= m_packets.size() || m_packets[index].queued){
+        log.error("retain: packet buffer %d is not dequeued", index);
+        return false;
+    }
+
+    m_packets[index].users++;
+
+    return true;
+}
+
+bool Encoder::release(capture_frame_t& packet)
+{
+    Logger& log = m_logger;
+    int index = packet.index;
+
+    // Sanity check
+    if(index < 0 || (size_t)index >= m_packets.size() || m_packets[index].queued){
+        log.error("release: invalid packet buffer %d", index);
+        return false;
+    }
+
+    // Still held by someone else
+    if(m_packets[index].users > 0){
+        m_packets[index].users--;
+        packet.index = -1;
+        return true;
+    }
+
+    packet.index = -1;
+    if(!m_streaming)
+        return true; // Buffers are gone with STREAMOFF
+
+    return queuePacket(index);
+}
+
+bool Encoder::stop(std::vector<capture_frame_t>& done)
+{
+    Logger& log = m_logger;
+    bool ok = true;
+
+    if(!m_streaming)
+        return true;
+
+    // STREAMOFF returns every buffer: camera frames go back to their owner
+    enum v4l2_buf_type type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    ok = xioctl(m_fd, VIDIOC_STREAMOFF, &type) && ok;
+    type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    ok = xioctl(m_fd, VIDIOC_STREAMOFF, &type) && ok;
+    m_streaming = false;
+    for(auto& in : m_inputs){
+        if(in.frame.index >= 0){
+            done.push_back(in.frame);
+            in.frame.index = -1;
+        }
+    }
+    m_inflight = 0;
+
+    // Free both queues, the DMA-BUF imports included
+    for(auto& pkt : m_packets){
+        if(pkt.addr)
+            munmap(pkt.addr, pkt.size);
+    }
+    m_packets.clear();
+    struct v4l2_requestbuffers req{};
+    req.type = V4L2_BUF_TYPE_VIDEO_OUTPUT_MPLANE;
+    req.memory = V4L2_MEMORY_DMABUF;
+    ok = xioctl(m_fd, VIDIOC_REQBUFS, &req) && ok;
+    req = {};
+    req.type = V4L2_BUF_TYPE_VIDEO_CAPTURE_MPLANE;
+    req.memory = V4L2_MEMORY_MMAP;
+    ok = xioctl(m_fd, VIDIOC_REQBUFS, &req) && ok;
+
+    log.info("%llu packets, %llu kB encoded, %llu frames skipped (encoder busy)", (unsigned long long)m_encoded,
+             (unsigned long long)(m_bytes / 1024), (unsigned long long)m_busy);
+    log.status("Encoder is OFF !");
+
+    return ok;
+}
+
+Encoder::~Encoder()
+{
+    std::vector<capture_frame_t> done;
+    stop(done); // Owner released its frames already, or is going away too
+    close(m_fd);
+}
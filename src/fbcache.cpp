@@ -0,0 +1,224 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <xf86drm.h>
+#include <xf86drmMode.h>
+
+#include "fbcache.hpp"
+#include "metrics.hpp"
+
+static bool key_equal(const fb_key_t& a, const fb_key_t& b)
+{
+    return a.handle == b.handle && a.format == b.format && a.width == b.width
+        && a.height == b.height && a.pitch == b.pitch;
+}
+
+FbCache::FbCache(int drm_fd, size_t capacity, bool verbose)
+    : m_drmFd(drm_fd), m_logger("fbcache", verbose)
+{
+    Logger& log = m_logger;
+
+    if(capacity == 0){
+        log.warning("FB cache capacity can't be 0, using 1");
+        capacity = 1;
+    }
+    try{
+        m_entries.resize(capacity);
+    } catch(const std::bad_alloc& e){
+        log.fatal("Failed to allocate FB cache");
+    }
+    for(auto& e : m_entries){
+        e = entry_t{};
+    }
+}
+
+bool FbCache::handleInUse(uint32_t handle)
+{
+    for(const auto& e : m_entries){
+        if(e.last_use && e.key.handle == handle)
+            return true;
+    }
+    return false;
+}
+
+bool FbCache::isPinned(uint32_t fbId)
+{
+    for(uint32_t id : m_pinned){
+        if(id == fbId)
+            return true;
+    }
+    return false;
+}
+
+void FbCache::closeHandle(uint32_t handle)
+{
+    struct drm_gem_close clreq{};
+    clreq.handle = handle;
+    drmIoctl(m_drmFd, DRM_IOCTL_GEM_CLOSE, &clreq);
+}
+
+void FbCache::removeEntry(entry_t& e)
+{
+    if(e.fbId > 0){
+        drmModeRmFB(m_drmFd, e.fbId);
+    }
+    e.fbId = 0;
+    e.last_use = 0;
+}
+
+bool FbCache::importHandle(int buf_fd, uint32_t *out_handle)
+{
+    Logger& log = m_logger;
+
+    // The kernel returns the existing handle if this buffer is already imported on this device
+    if(drmPrimeFDToHandle(m_drmFd, buf_fd, out_handle) < 0){
+        log.error("drmPrimeFDToHandle failed: cannot import DMA_BUF fd %d: %s", buf_fd, strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool FbCache::lookup(const fb_key_t& key, uint32_t *out_fbId)
+{
+    for(auto& e : m_entries){
+        if(e.last_use && key_equal(e.key, key)){
+            e.last_use = ++m_tick;
+            *out_fbId = e.fbId;
+            m_hits++;
+            Metrics::add(MET_FB_CACHE_HITS);
+            return true;
+        }
+    }
+    m_misses++;
+    Metrics::add(MET_FB_CACHE_MISSES);
+    return false;
+}
+
+bool FbCache::insert(const fb_key_t& key, uint32_t fbId)
+{
+    Logger& log = m_logger;
+
+    // Pick a free slot, or the least recently used one that isn't on screen or waiting to flip
+    entry_t *slot = nullptr;
+    for(auto& e : m_entries){
+        if(!e.last_use){
+            slot = &e;
+            break;
+        }
+        if(isPinned(e.fbId))
+            continue;
+        if(!slot || e.last_use < slot->last_use)
+            slot = &e;
+    }
+    if(!slot){
+        log.error("All %zu FBs are in use by the display, can't cache FB %u", m_entries.size(), fbId);
+        return false;
+    }
+
+    // Evict
+    uint32_t evicted_handle = 0;
+    bool evicted = false;
+    if(slot->last_use){
+        log.info("Evicting FB %u (handle %u)", slot->fbId, slot->key.handle);
+        evicted_handle = slot->key.handle;
+        evicted = true;
+        removeEntry(*slot);
+        m_evictions++;
+    }
+
+    slot->key = key;
+    slot->fbId = fbId;
+    slot->last_use = ++m_tick;
+
+    // Close the evicted handle once nothing else refers to it
+    if(evicted && !handleInUse(evicted_handle)){
+        closeHandle(evicted_handle);
+    }
+
+    return true;
+}
+
+void FbCache::setPinned(const std::vector<uint32_t>& fbIds)
+{
+    m_pinned.assign(fbIds.begin(), fbIds.end()); // Keeps its capacity, no allocation per commit
+}
+
+void FbCache::releaseHandle(uint32_t handle)
+{
+    if(!handleInUse(handle)){
+        closeHandle(handle);
+    }
+}
+
+void FbCache::invalidate(int buf_fd)
+{
+    Logger& log = m_logger;
+    uint32_t handle;
+
+    if(!importHandle(buf_fd, &handle)){
+        return;
+    }
+
+    for(auto& e : m_entries){
+        if(e.last_use && e.key.handle == handle){
+            log.info("Invalidating FB %u (handle %u)", e.fbId, handle);
+            removeEntry(e);
+        }
+    }
+
+    // Handles aren't refcounted per import: a single close releases the buffer
+    closeHandle(handle);
+}
+
+void FbCache::clear()
+{
+    for(auto& e : m_entries){
+        if(e.last_use){
+            uint32_t handle = e.key.handle;
+            removeEntry(e);
+            if(!handleInUse(handle))
+                closeHandle(handle);
+        }
+    }
+}
+
+size_t FbCache::size()
+{
+    size_t n = 0;
+    for(const auto& e : m_entries){
+        if(e.last_use)
+            n++;
+    }
+    return n;
+}
+
+FbCache::~FbCache()
+{
+    Logger& log = m_logger;
+
+    log.info("FB cache: %llu hits, %llu misses, %llu evictions", (unsigned long long)m_hits,
+             (unsigned long long)m_misses, (unsigned long long)m_evictions);
+    clear();
+}
@@ -0,0 +1,106 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <sstream>
+#include <unistd.h>
+
+#include "fmtcache.hpp"
+
+FormatCache::FormatCache(const std::string& path, bool verbose)
+    : m_path(path), m_logger("fmtcache", verbose)
+{
+    Logger& log = m_logger;
+    std::ifstream in(path);
+    std::string line;
+
+    // Skip what doesn't parse, the entry is simply negotiated again
+    while(std::getline(in, line)){
+        std::istringstream fields(line);
+        std::string driver, bus_info, width, height;
+        entry_t e{};
+        if(!std::getline(fields, driver, '\t') || !std::getline(fields, bus_info, '\t') || !std::getline(fields, e.fourcc, '\t') ||
+           !std::getline(fields, width, '\t') || !std::getline(fields, height) || e.fourcc.size() != 4 ||
+           sscanf(width.c_str(), "%u", &e.width) != 1 || sscanf(height.c_str(), "%u", &e.height) != 1)
+            continue;
+        e.key = driver + '\t' + bus_info;
+        m_entries.push_back(e);
+    }
+
+    log.info("%zu known formats in %s", m_entries.size(), path.c_str());
+}
+
+std::string FormatCache::deviceKey(const char *driver, const char *bus_info)
+{
+    return std::string(driver) + '\t' + bus_info;
+}
+
+int FormatCache::find(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height)
+{
+    for(size_t i = 0; i < m_entries.size(); i++){
+        const entry_t& e = m_entries[i];
+        if(e.key == key && e.fourcc == fourcc && e.width == width && e.height == height)
+            return (int)i;
+    }
+    return -1;
+}
+
+void FormatCache::store(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height)
+{
+    if(find(key, fourcc, width, height) < 0)
+        m_entries.push_back({key, fourcc, width, height});
+}
+
+void FormatCache::remove(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height)
+{
+    int i = find(key, fourcc, width, height);
+    if(i >= 0)
+        m_entries.erase(m_entries.begin() + i);
+}
+
+bool FormatCache::save()
+{
+    Logger& log = m_logger;
+    std::string tmp = m_path + ".tmp";
+
+    FILE *f = fopen(tmp.c_str(), "w");
+    if(!f){
+        log.warning("Failed to create %s: %s", tmp.c_str(), strerror(errno));
+        return false;
+    }
+    for(const auto& e : m_entries)
+        fprintf(f, "%s\t%s\t%u\t%u\n", e.key.c_str(), e.fourcc.c_str(), e.width, e.height);
+
+    // On disk before the rename replaces the old cache
+    bool ok = (fflush(f) == 0 && fsync(fileno(f)) == 0);
+    ok = (fclose(f) == 0) && ok;
+    if(!ok || rename(tmp.c_str(), m_path.c_str()) < 0){
+        log.warning("Failed to write %s: %s", m_path.c_str(), strerror(errno));
+        unlink(tmp.c_str());
+        return false;
+    }
+
+    return true;
+}
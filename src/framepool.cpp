@@ -0,0 +1,246 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "helpers.hpp"
+#include "framepool.hpp"
+#include "metrics.hpp"
+
+FramePool::FramePool(bool verbose)
+    : m_logger("framepool", verbose)
+{
+}
+
+unsigned int FramePool::heldCount()
+{
+    unsigned int held = 0;
+    for(unsigned int i = 0; i < m_count; i++){
+        if(m_slots[i].refs.load(std::memory_order_relaxed) > 0)
+            held++;
+    }
+    return held;
+}
+
+void FramePool::reset(unsigned int count, pool_requeue_fn_t requeue)
+{
+    // Buffer gauges add up all the pools: take this one's previous share out
+    Metrics::sub(MET_BUFS_TOTAL, m_count);
+    Metrics::sub(MET_BUFS_QUEUED, m_queued.load());
+    Metrics::sub(MET_BUFS_HELD, heldCount());
+    Metrics::add(MET_BUFS_TOTAL, count);
+
+    m_slots.reset(new slot_t[count]);
+    m_count = count;
+    m_requeue = requeue;
+    m_free.store(0);
+    m_draining.store(false);
+    m_queued.store(0);
+
+    m_acquired.store(0);
+    m_starved.store(0);
+    m_min_queued.store(count);
+    m_max_out.store(0);
+    m_hold.reset();
+}
+
+void FramePool::push(unsigned int index)
+{
+    uint64_t head = m_free.load(std::memory_order_relaxed);
+    uint64_t next;
+    do {
+        m_slots[index].next.store((uint32_t)head, std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | (index + 1);
+    } while(!m_free.compare_exchange_weak(head, next, std::memory_order_release, std::memory_order_relaxed));
+}
+
+int FramePool::pop()
+{
+    uint64_t head = m_free.load(std::memory_order_acquire);
+    uint64_t next;
+    do {
+        uint32_t top = (uint32_t)head;
+        if(!top)
+            return -1;
+        next = (((head >> 32) + 1) << 32) | m_slots[top - 1].next.load(std::memory_order_relaxed);
+    } while(!m_free.compare_exchange_weak(head, next, std::memory_order_acquire, std::memory_order_acquire));
+
+    return (int)(uint32_t)head - 1;
+}
+
+bool FramePool::drain()
+{
+    Logger& log = m_logger;
+    bool ok = true;
+
+    // One drainer at a time, a concurrent push is picked up by the re-check
+    while(!m_draining.exchange(true, std::memory_order_acquire)){
+        int index;
+        while(ok && (index = pop()) >= 0){
+            // Owned by the producer before it can hand the buffer out again
+            slot_t& s = m_slots[index];
+            uint64_t hold_us = (monotonic_ns() - s.acquired_ns) / 1000;
+            m_hold.record(hold_us);
+            Metrics::sample(MET_REQUEUE_US_SUM, hold_us);
+            s.queued.store(true, std::memory_order_release);
+            m_queued.fetch_add(1, std::memory_order_relaxed);
+            Metrics::add(MET_BUFS_QUEUED);
+            if(!m_requeue(index)){
+                log.error("Requeue of buffer %d failed", index);
+                s.queued.store(false, std::memory_order_release);
+                m_queued.fetch_sub(1, std::memory_order_relaxed);
+                Metrics::sub(MET_BUFS_QUEUED);
+                push(index); // Retried by the next release
+                ok = false;
+                break;
+            }
+        }
+        m_draining.store(false, std::memory_order_release);
+        if(!ok || !(uint32_t)m_free.load(std::memory_order_acquire))
+            break;
+    }
+
+    return ok;
+}
+
+void FramePool::setQueued(unsigned int index, bool queued)
+{
+    if(index >= m_count || m_slots[index].queued.load(std::memory_order_relaxed) == queued)
+        return;
+    m_slots[index].queued.store(queued, std::memory_order_release);
+    if(queued){
+        m_queued.fetch_add(1, std::memory_order_relaxed);
+        Metrics::add(MET_BUFS_QUEUED);
+    } else {
+        m_queued.fetch_sub(1, std::memory_order_relaxed);
+        Metrics::sub(MET_BUFS_QUEUED);
+    }
+}
+
+bool FramePool::acquire(unsigned int index)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(index >= m_count || !m_slots[index].queued.load(std::memory_order_acquire)){
+        log.error("acquire: buffer %u was not queued", index);
+        return false;
+    }
+
+    slot_t& s = m_slots[index];
+    s.acquired_ns = monotonic_ns();
+    s.refs.store(1, std::memory_order_relaxed);
+    s.queued.store(false, std::memory_order_release);
+    m_acquired.fetch_add(1, std::memory_order_relaxed);
+    Metrics::sub(MET_BUFS_QUEUED);
+    Metrics::add(MET_BUFS_HELD);
+
+    // Starvation: nothing left for the producer to fill, its next frame is dropped
+    unsigned int queued = m_queued.fetch_sub(1, std::memory_order_relaxed) - 1;
+    if(queued == 0){
+        m_starved.fetch_add(1, std::memory_order_relaxed);
+        Metrics::add(MET_POOL_STARVED);
+    }
+    unsigned int prev = m_min_queued.load(std::memory_order_relaxed);
+    while(queued < prev && !m_min_queued.compare_exchange_weak(prev, queued, std::memory_order_relaxed));
+    unsigned int out = m_count - queued;
+    prev = m_max_out.load(std::memory_order_relaxed);
+    while(out > prev && !m_max_out.compare_exchange_weak(prev, out, std::memory_order_relaxed));
+
+    return true;
+}
+
+bool FramePool::retain(unsigned int index)
+{
+    Logger& log = m_logger;
+
+    // Only a holder may add one
+    if(index < m_count){
+        int refs = m_slots[index].refs.load(std::memory_order_relaxed);
+        while(refs > 0){
+            if(m_slots[index].refs.compare_exchange_weak(refs, refs + 1, std::memory_order_relaxed))
+                return true;
+        }
+    }
+    log.error("retain: buffer %u is not held", index);
+
+    return false;
+}
+
+bool FramePool::release(unsigned int index)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(index >= m_count){
+        log.error("release: invalid buffer index %u", index);
+        return false;
+    }
+
+    slot_t& s = m_slots[index];
+    int refs = s.refs.load(std::memory_order_relaxed);
+    do {
+        if(refs <= 0){
+            log.error("release: buffer %u is not held", index);
+            return false;
+        }
+    } while(!s.refs.compare_exchange_weak(refs, refs - 1, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+    // Last holder: back to the producer
+    if(refs > 1)
+        return true;
+    Metrics::sub(MET_BUFS_HELD);
+    push(index);
+
+    return drain();
+}
+
+void FramePool::returnAll()
+{
+    // Callers are done with the buffers: nothing is requeued any more
+    m_free.store(0, std::memory_order_relaxed);
+    Metrics::sub(MET_BUFS_HELD, heldCount());
+    for(unsigned int i = 0; i < m_count; i++){
+        m_slots[i].refs.store(0, std::memory_order_relaxed);
+        m_slots[i].queued.store(false, std::memory_order_relaxed);
+    }
+    Metrics::sub(MET_BUFS_QUEUED, m_queued.exchange(0, std::memory_order_release));
+}
+
+void FramePool::report()
+{
+    Logger& log = m_logger;
+    uint64_t acquired = m_acquired.load();
+
+    if(!m_count || !acquired)
+        return;
+
+    // One buffer being filled and one queued behind it on top of the most ever held
+    unsigned int max_out = m_max_out.load();
+    unsigned int suggested = max_out + 2;
+    log.info("%u buffers, %llu frames: producer starved %llu times (min %u queued), up to %u held at once",
+             m_count, (unsigned long long)acquired, (unsigned long long)m_starved.load(), m_min_queued.load(), max_out);
+    log.info("Held for p50=%lluus p99=%lluus max=%lluus", (unsigned long long)m_hold.percentile(50),
+             (unsigned long long)m_hold.percentile(99), (unsigned long long)m_hold.max());
+    if(m_starved.load())
+        log.warning("Buffer starvation: consider buf_count=%u", suggested);
+    else if(suggested < m_count)
+        log.info("buf_count could be lowered to %u", suggested);
+}
@@ -24,7 +24,9 @@
 #include <cerrno>
 #include <cstring>
 #include <cstdio>
+#include <ctime>
 #include <vector>
+#include <drm/drm_fourcc.h>
 #include "helpers.hpp"
 
 bool xioctl(int fd, unsigned long req, void *arg)
@@ -338,26 +340,56 @@ void print_drmModePlane(drmModePlane *plane)
     printf("=================\n");
 }
 
-uint32_t get_drmModePropertyId(int fd, uint32_t object_id, uint32_t object_type, const char *name)
+bool get_drmModeProperties(int fd, uint32_t object_id, uint32_t object_type, std::map<std::string, drm_prop_t>& out)
 {
     drmModeObjectProperties *props = drmModeObjectGetProperties(fd, object_id, object_type);
     if(!props)
-        return 0;
+        return false;
 
-    uint32_t prop_id = 0;
+    out.clear();
     for(uint32_t i = 0; i < props->count_props; i++){
         drmModePropertyRes *prop = drmModeGetProperty(fd, props->props[i]);
         if(prop){
-            if(strcmp(prop->name, name) == 0){
-                prop_id = prop->prop_id;
-                drmModeFreeProperty(prop);
-                break;
-            }
+            drm_prop_t p = {prop->prop_id, props->prop_values[i]};
+            out[prop->name] = p;
             drmModeFreeProperty(prop);
         }
     }
     drmModeFreeObjectProperties(props);
-    return prop_id;
+    return true;
+}
+
+bool get_drmModeInFormats(int fd, uint32_t blob_id, std::map<uint32_t, std::vector<uint64_t>>& out)
+{
+    drmModePropertyBlobRes *blob = drmModeGetPropertyBlob(fd, blob_id);
+    if(!blob)
+        return false;
+
+    out.clear();
+    if(blob->length < sizeof(struct drm_format_modifier_blob)){
+        drmModeFreePropertyBlob(blob);
+        return false;
+    }
+
+    // Each modifier covers a window of 64 formats, as a bitmask
+    const uint8_t *data = static_cast<const uint8_t*>(blob->data);
+    const struct drm_format_modifier_blob *hdr = reinterpret_cast<const struct drm_format_modifier_blob*>(data);
+    if((uint64_t)hdr->formats_offset + (uint64_t)hdr->count_formats * sizeof(uint32_t) > blob->length ||
+       (uint64_t)hdr->modifiers_offset + (uint64_t)hdr->count_modifiers * sizeof(struct drm_format_modifier) > blob->length){
+        drmModeFreePropertyBlob(blob);
+        return false;
+    }
+    const uint32_t *formats = reinterpret_cast<const uint32_t*>(data + hdr->formats_offset);
+    const struct drm_format_modifier *mods = reinterpret_cast<const struct drm_format_modifier*>(data + hdr->modifiers_offset);
+    for(uint32_t m = 0; m < hdr->count_modifiers; m++){
+        for(uint32_t bit = 0; bit < 64; bit++){
+            uint32_t f = mods[m].offset + bit;
+            if(f < hdr->count_formats && (mods[m].formats & (1ull << bit)))
+                out[formats[f]].push_back(mods[m].modifier);
+        }
+    }
+    drmModeFreePropertyBlob(blob);
+    return true;
 }
 
 bool validate_user_buffer(const buffer_t& buf) {
@@ -366,3 +398,68 @@ bool validate_user_buffer(const buffer_t& buf) {
     if (buf.stride < buf.width) return false;
     return true;
 }
+
+bool layout_contiguous(uint32_t fourcc, uint32_t width, uint32_t height, uint32_t pitch, frame_layout_t& out)
+{
+    out = frame_layout_t{};
+    out.fourcc = fourcc;
+    out.width = width;
+    out.height = height;
+    out.num_mem_planes = 1;
+
+    switch(fourcc){
+        case DRM_FORMAT_NV12:
+        case DRM_FORMAT_NV16:
+            out.num_planes = 2;
+            out.pitch[0] = out.pitch[1] = pitch;
+            out.offset[1] = pitch * height;
+            out.mem_size[0] = pitch * height + pitch * ((fourcc == DRM_FORMAT_NV12) ? height / 2 : height);
+            break;
+        case DRM_FORMAT_YUYV:
+        case DRM_FORMAT_XRGB8888:
+            out.num_planes = 1;
+            out.pitch[0] = pitch;
+            out.mem_size[0] = pitch * height;
+            break;
+        default:
+            out.fourcc = 0;
+            return false;
+    }
+
+    return true;
+}
+
+bool layout_from_v4l2(const struct v4l2_pix_format_mplane& pix, frame_layout_t& out)
+{
+    uint32_t fourcc = pix.pixelformat;
+    bool separate = false;
+
+    // Formats with one memory plane per color plane map to the same DRM format
+    if(fourcc == V4L2_PIX_FMT_NV12M || fourcc == V4L2_PIX_FMT_NV16M){
+        fourcc = (fourcc == V4L2_PIX_FMT_NV12M) ? DRM_FORMAT_NV12 : DRM_FORMAT_NV16;
+        separate = true;
+    }
+    // V4L2 XBGR32 ('XR24') is B, G, R, X in memory like DRM XRGB8888
+    if(pix.num_planes < 1 || !layout_contiguous(fourcc, pix.width, pix.height, pix.plane_fmt[0].bytesperline, out))
+        return false;
+
+    if(separate){
+        if(pix.num_planes != 2)
+            return false;
+        out.num_mem_planes = 2;
+        out.pitch[1] = pix.plane_fmt[1].bytesperline;
+        out.offset[1] = 0;
+        out.mem_plane[1] = 1;
+    }
+    for(uint32_t m = 0; m < out.num_mem_planes; m++)
+        out.mem_size[m] = pix.plane_fmt[m].sizeimage;
+
+    return true;
+}
+
+uint64_t monotonic_ns()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+}
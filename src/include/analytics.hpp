@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <vector>
+#include <cstdint>
+#include "logger.hpp"
+#include "helpers.hpp"
+#include "source.hpp"
+
+#define ANA_HIST_BINS 256
+
+struct analytics_config {
+    unsigned int factor{4}; // Thumbnail downscale: 4 or 8
+    uint32_t roi_x{0};      // Region of interest, roi_w/roi_h 0: whole frame
+    uint32_t roi_y{0};
+    uint32_t roi_w{0};
+    uint32_t roi_h{0};
+};
+
+// Statistics of one frame's luma ROI
+typedef struct {
+    uint32_t sequence;
+    uint64_t timestamp_ns;  // Capture time of the frame
+    uint32_t thumb_width;   // ROI / factor
+    uint32_t thumb_height;
+    float mean;             // Full resolution mean luma
+    uint32_t histogram[ANA_HIST_BINS]; // Full resolution luma histogram
+    uint64_t process_ns;    // Time spent on the frame
+} luma_stats_t;
+
+// Luma statistics tap on captured frames. The Y plane is read once, straight from the capture
+// mapping (bracketed by DMA_BUF_IOCTL_SYNC), on a worker thread: box-downsampled thumbnail,
+// histogram and mean in the same pass. Frames are held until returned by collect(), poll get_fd().
+// Results are published to a lock-free double buffer: snapshot() can be called from any thread.
+class AnalyticsTap {
+private:
+    typedef struct {
+        std::atomic<uint32_t> seq; // Odd while being written
+        luma_stats_t stats;
+        std::vector<uint8_t> thumb;
+    } result_t;
+
+    analytics_config m_config;
+    frame_layout_t m_layout{};
+    result_t m_results[2];
+    std::atomic<unsigned int> m_front{0}; // Slot readers copy from
+    std::atomic<bool> m_published{false};
+
+    // Worker hand-off
+    std::thread m_worker;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    capture_frame_t m_pending{}; // Frame for the worker, index -1: none
+    bool m_busy{false}; // Worker has a frame, new ones are skipped
+    std::vector<capture_frame_t> m_done;
+    bool m_quit{false};
+    int m_done_fd{-1};
+
+    std::vector<uint16_t> m_colsum; // Worker scratch: column sums of factor rows
+    uint32_t m_hist[4][ANA_HIST_BINS]; // Worker scratch: split to break dependency chains
+    uint64_t m_frames{0};
+    uint64_t m_skipped{0};
+    LogRateLimit m_report_rl{1000};
+    Logger m_logger;
+
+    void workerLoop();
+    bool process(const capture_frame_t& frame, result_t& out);
+
+public:
+    AnalyticsTap(const analytics_config& conf, bool verbose);
+    ~AnalyticsTap();
+
+    // Interface
+    int get_fd(){
+        return m_done_fd;
+    }
+
+    bool start(const frame_layout_t& layout); // Capture::layout()
+    bool submit(const capture_frame_t& frame); // Non-blocking. false: worker busy or not mappable, frame not taken
+    bool collect(std::vector<capture_frame_t>& done); // Frames processed, to be released by the caller
+    bool snapshot(luma_stats_t& stats, std::vector<uint8_t> *thumb = nullptr); // Latest results, false if none yet. Any thread
+    void stop(); // Joins the worker, frames in flight are returned by the next collect()
+};
@@ -23,14 +23,23 @@
 #pragma once
 
 #include <vector>
+#include <functional>
 #include <linux/videodev2.h>
 #include "logger.hpp"
+#include "helpers.hpp"
+#include "source.hpp"
+#include "framepool.hpp"
 
 struct capture_buf {
     void* plane_addr[VIDEO_MAX_PLANES];
     size_t plane_size[VIDEO_MAX_PLANES];
+    int dma_fd[VIDEO_MAX_PLANES]; // DMA-BUF fds exported with VIDIOC_EXPBUF
+    unsigned int num_planes;
 };
 
+// Called for each exported DMA-BUF right before it is closed, so importers can drop what they built on it
+typedef std::function<void(int dma_fd)> buf_release_cb_t;
+
 typedef enum {
     TYPE_MMAP=0,
     TYPE_DMABUF,
@@ -44,15 +53,25 @@ struct capture_config {
 
     mem_type_t mem_type;
     __u32 buf_count;
+    std::string format_cache; // Known-good formats file (fmtcache.hpp), empty: always enumerate
+    bool prefault{false}; // Page tables of the mapped buffers filled at mapBuffers(), not on the first CPU access
 };
 
-class Capture {
+class Capture : public FrameSource {
 private:
     int m_fd{-1};
     std::vector<capture_buf> m_capture_buf;
+    std::vector<dmabuf_t> m_dmabufs; // TYPE_DMABUF: buffers provided by the importer, not owned
     struct v4l2_buffer m_v4l2_buf{};
     capture_config& m_config;
+    frame_layout_t m_layout{}; // Negotiated by setFormat()
     bool m_is_mp_device{false};
+    bool m_source_changed{false};
+    std::string m_device_key; // Driver and bus_info, for the format cache
+    bool m_fmt_adjusted{false}; // S_FMT didn't give what was asked
+    LogRateLimit m_buf_error_rl{1000}; // Per-frame message: at most once per second
+    buf_release_cb_t m_release_cb;
+    FramePool m_pool; // Driver ownership and holders of each buffer, requeued on the last release()
     Logger m_logger;
 
     // Caps
@@ -67,8 +86,14 @@ private:
     // Buffers
     bool requestBuffers();
     bool mapBuffers();
+    bool exportBuffer(unsigned int index, unsigned int plane);
     bool queueBuffers();
+    bool queueBuffer(unsigned int index);
     bool dequeueBuffers();
+    bool freeBuffers(); // Unmap, close exported fds and give the buffers back to the driver
+
+    // Events
+    bool subscribeEvents();
 
     // Streaming
     bool streamOn();
@@ -79,7 +104,28 @@ public:
     ~Capture();
 
     // Interface
+    int get_fd() override {
+        return m_fd;
+    }
+
+    bool importBuffers(const std::vector<dmabuf_t>& bufs); // TYPE_DMABUF only. Call before start()
+    void setReleaseCallback(buf_release_cb_t cb){
+        m_release_cb = cb;
+    }
     bool start();
+    const frame_layout_t& layout(){
+        return m_layout; // Driver pitches and plane offsets, valid once start() returned
+    }
     bool saveOneFrame(const std::string& path);
-    bool stop();
+    bool tryDequeue(capture_frame_t& frame) override; // Non-blocking. frame.index is -1 when no frame is ready
+    bool retain(const capture_frame_t& frame) override; // One more holder: takes one more release() to requeue. Any thread
+    bool release(capture_frame_t& frame) override; // Drop a holder and invalidate the handle, the last one requeues. Any thread
+    unsigned int queuedCount(); // Buffers currently owned by the driver
+    bool handleEvent(); // Dequeue V4L2 events. Call when get_fd() reports POLLPRI
+
+    bool sourceChanged(){
+        return m_source_changed; // Set once the source resolution changed: format must be renegotiated
+    }
+
+    bool stop(); // Buffers are freed: start() renegotiates from scratch
 };
\ No newline at end of file
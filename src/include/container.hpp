@@ -0,0 +1,132 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "logger.hpp"
+#include "capture.hpp"
+
+// camcap container layout, all blocks aligned to CC_ALIGN (O_DIRECT friendly):
+//   [file header][frame header][plane 0]...[plane n][frame header]...[index header][index entries]
+// The header points to the trailing index once the file is closed, a frame is then found in O(1).
+// Files without an index (interrupted recording) are scanned record by record.
+#define CC_ALIGN 4096
+#define CC_VERSION 2     // 2: plane layout in the file header
+#define CC_MIN_VERSION 1 // Still read: no layout, replay derives it from the payload sizes
+#define CC_FILE_MAGIC  0x50434d43 // "CMCP"
+#define CC_FRAME_MAGIC 0x46524d43 // "CMRF"
+#define CC_INDEX_MAGIC 0x58444e49 // "INDX"
+
+// Everything needed to interpret the planes
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    char fourcc[4];
+    uint32_t width;
+    uint32_t height;
+    uint32_t mem_type;     // mem_type_t used while recording
+    uint32_t buf_count;
+    uint32_t segment;      // Segment number, 0 for a single file
+    uint64_t frame_count;  // 0 until the index is written
+    uint64_t index_offset; // 0 until the index is written
+    // Negotiated layout of the recorded planes (frame_layout_t), v2
+    uint32_t layout_fourcc; // DRM fourcc (NV12 for a V4L2 NM12 recording)
+    uint32_t num_planes;   // Color planes, 0: unknown (e.g. encoded packets)
+    uint32_t pitch[LAYOUT_MAX_PLANES];
+    uint32_t offset[LAYOUT_MAX_PLANES];    // From the start of its plane record
+    uint32_t mem_plane[LAYOUT_MAX_PLANES]; // Plane record holding each color plane
+} cc_file_hdr_t;
+
+// Frame record header. Each plane follows, padded to CC_ALIGN.
+typedef struct {
+    uint32_t magic;
+    uint32_t sequence;     // V4L2 sequence
+    uint64_t timestamp_ns; // V4L2 timestamp (CLOCK_MONOTONIC)
+    uint32_t num_planes;
+    uint32_t bytesused[VIDEO_MAX_PLANES];
+    uint32_t padded_size[VIDEO_MAX_PLANES]; // Bytes on disk for each plane
+} cc_frame_hdr_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t reserved;
+    uint64_t frame_count;
+} cc_index_hdr_t;
+
+typedef struct {
+    uint64_t offset; // Frame header offset in the file
+    uint64_t timestamp_ns;
+    uint32_t sequence;
+    uint32_t reserved;
+} cc_index_entry_t;
+
+static inline uint64_t cc_align_up(uint64_t v)
+{
+    return (v + CC_ALIGN - 1) & ~((uint64_t)CC_ALIGN - 1);
+}
+
+static inline uint64_t cc_index_size(uint64_t frame_count)
+{
+    return cc_align_up(sizeof(cc_index_hdr_t) + frame_count * sizeof(cc_index_entry_t));
+}
+
+// Frame view into the mapping, valid as long as the reader lives
+typedef struct {
+    const cc_frame_hdr_t *hdr;
+    const uint8_t *plane[VIDEO_MAX_PLANES];
+} cc_frame_t;
+
+// Read-only random access to a camcap file through a single mmap
+class ContainerReader {
+private:
+    int m_fd{-1};
+    const uint8_t *m_base{nullptr};
+    size_t m_size{0};
+    const cc_file_hdr_t *m_hdr{nullptr};
+    const cc_index_entry_t *m_index{nullptr}; // Into the mapping, or m_scanned
+    uint64_t m_frame_count{0};
+    std::vector<cc_index_entry_t> m_scanned;
+    Logger m_logger;
+
+    bool loadIndex();
+    bool scanRecords(); // No index: walk the records
+
+public:
+    ContainerReader(const std::string& path, bool verbose);
+    ~ContainerReader();
+
+    // Interface
+    const cc_file_hdr_t& header(){
+        return *m_hdr;
+    }
+    uint64_t frameCount(){
+        return m_frame_count;
+    }
+    bool getFrame(uint64_t n, cc_frame_t& out);
+    void prefetch(uint64_t n); // Start reading frame n from storage in the background
+    capture_config captureConfig(); // Format the file was recorded with
+    bool layout(frame_layout_t& out); // Plane layout it was recorded with, false if the file doesn't tell
+};
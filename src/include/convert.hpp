@@ -0,0 +1,135 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <cstdint>
+#include "logger.hpp"
+#include "helpers.hpp"
+#include "source.hpp"
+#include "capture.hpp"
+#include "threadpool.hpp"
+#if defined(CAMCAP_HAVE_RGA)
+#include "rga.hpp"
+#endif
+
+#define CONV_TILE_ROWS 32 // Rows per pool task, even for 4:2:0 sources and targets
+
+// CPU view of an image, fourcc is DRM/V4L2 (they match for the supported formats)
+typedef struct {
+    uint32_t fourcc;
+    uint32_t width;
+    uint32_t height;
+    uint8_t *plane[2]; // Packed formats only use plane[0]
+    uint32_t stride[2];
+} image_t;
+
+// Pixel format conversion, NEON kernels on ARM with a scalar fallback.
+// Supported: NV12, NV16, YUYV -> XR24 (BT.601 limited range) and YUYV -> NV12.
+// Images are split in row tiles processed by the thread pool.
+class Converter {
+private:
+    ThreadPool m_pool;
+    Logger m_logger;
+
+public:
+    Converter(unsigned int threads, bool verbose);
+
+    static bool supported(uint32_t src_fourcc, uint32_t dst_fourcc);
+    bool convert(const image_t& src, const image_t& dst);
+};
+
+struct convert_config {
+    std::string fourcc;        // Output format
+    uint32_t width{0};         // Output size, 0: source size (rotated)
+    uint32_t height{0};
+    unsigned int rotation{0};  // Clockwise degrees: 0, 90, 180, 270
+    unsigned int threads{4};   // CPU path, the calling thread included
+};
+
+typedef struct {
+    dmabuf_t dbuf;
+    void* addr; // CPU mapping of dbuf
+    unsigned int users; // Extra holders from retain()
+    bool out; // Handed out, waiting for release()
+} conv_buf_t;
+
+// FrameSource converting the frames of another source into buffers provided by the display,
+// for camera formats the plane can't scan out. Only the newest ready frame is converted.
+// With librga, the RGA engine does the work and can also scale and rotate. Otherwise (or if
+// the engine fails) the CPU converter is used, which converts formats only.
+class ConvertStage : public FrameSource {
+private:
+    FrameSource& m_upstream;
+    capture_config m_src_config;
+    capture_config m_config; // Output format
+    frame_layout_t m_src_layout{}; // Negotiated by the upstream capture
+    frame_layout_t m_layout{};     // Output buffers
+    uint32_t m_src_fourcc;
+    uint32_t m_dst_fourcc;
+    unsigned int m_rotation;
+    unsigned int m_threads;
+    std::unique_ptr<Converter> m_converter; // CPU path, created when needed
+#if defined(CAMCAP_HAVE_RGA)
+    std::unique_ptr<RgaEngine> m_rga;
+#endif
+    std::vector<conv_buf_t> m_bufs;
+    uint64_t m_converted{0};
+    uint64_t m_skipped{0}; // Replaced by a newer frame before conversion
+    uint64_t m_dropped{0}; // No free output buffer
+    uint64_t m_convert_ns{0};
+    LogRateLimit m_drop_rl{1000};
+    Logger m_logger;
+
+    bool sourceImage(const capture_frame_t& frame, image_t& img);
+    bool cpuCapable(); // Geometry and formats within the CPU converter reach
+    bool convertCpu(const capture_frame_t& frame, conv_buf_t& cbuf);
+#if defined(CAMCAP_HAVE_RGA)
+    bool convertRga(const capture_frame_t& frame, conv_buf_t& cbuf);
+#endif
+
+public:
+    ConvertStage(FrameSource& upstream, const capture_config& src_conf, const convert_config& conf, bool verbose);
+    ~ConvertStage();
+
+    // Interface
+    int get_fd() override {
+        return m_upstream.get_fd();
+    }
+
+    capture_config& config(){
+        return m_config;
+    }
+
+    bool importBuffers(const std::vector<dmabuf_t>& bufs); // Output buffers, call before the first frame
+    bool setSourceLayout(const frame_layout_t& layout); // Capture::layout(), once the capture started. Before the first frame
+    const frame_layout_t& layout(){
+        return m_layout; // Output, once importBuffers() returned
+    }
+    void invalidateBuffer(int buf_fd); // Upstream buffer is being freed by its exporter
+    bool tryDequeue(capture_frame_t& frame) override;
+    bool retain(const capture_frame_t& frame) override;
+    bool release(capture_frame_t& frame) override;
+};
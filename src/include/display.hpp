@@ -27,8 +27,14 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <map>
+#include <vector>
+#include <memory>
 #include "logger.hpp"
 #include "helpers.hpp"
+#include "fbcache.hpp"
+#include "testpattern.hpp"
+
+#define TP_RING_SIZE 3 // Test pattern buffers: on screen, flip pending, being rendered
 
 // DRM Event callback
 void eventCb(int fd, unsigned int frame, unsigned int sec, unsigned int usec, void *user_data);
@@ -37,15 +43,102 @@ struct display_config {
     buffer_t cam_buf;
     buffer_t gpu_buf;
     bool testing_display; // test dimensions: display mode settings & test format: XR24
+    bool explicit_sync{false}; // Request an OUT_FENCE_PTR per commit, see Display::takeOutFence()
+    unsigned int fb_cache_size{4}; // Imported camera FBs kept alive, least recently used are removed. Size it to cameras x buffers
+    bool cam_buf_mode_size{false}; // Camera buffers take the display mode size in initialize(), for a scaling stage
+    std::string splash_path; // Pre-converted splash image (splash.hpp), shown by initialize(). Empty or unusable: test pattern
+    bool keep_splash{true}; // Splash FB kept for showSplash(), else freed once the camera is on screen
+    test_pattern_t test_pattern{TP_BARS}; // testing_display, also the splash fallback
 };
 
 typedef struct {
     unsigned int count;
-    unsigned int sec;
+    unsigned int sequence; // vblank counter of the last flip
+    unsigned int sec;      // last flip timestamp (CLOCK_MONOTONIC)
     unsigned int usec;
     bool flip_pending;
 } frame_info_t;
 
+// DRM property IDs, enumerated once in initialize(). 0 when not exposed by the driver.
+typedef struct {
+    uint32_t crtc_id;
+} connector_props_t;
+
+typedef struct {
+    uint32_t mode_id;
+    uint32_t active;
+    uint32_t out_fence_ptr;
+} crtc_props_t;
+
+typedef struct {
+    uint32_t type;
+    uint32_t fb_id;
+    uint32_t crtc_id;
+    uint32_t src_x, src_y, src_w, src_h;     // 16.16 fixed point
+    uint32_t crtc_x, crtc_y, crtc_w, crtc_h; // integer
+    uint32_t in_fence_fd;
+    uint32_t in_formats;
+    uint32_t zpos;             // 0: absent or immutable, the driver's stacking order stands
+    uint64_t zpos_max;
+    uint32_t pixel_blend_mode; // 0: absent or without a "Pre-multiplied" mode
+    uint64_t blend_premulti;   // "Pre-multiplied" enum value
+} plane_props_t;
+
+// Plane rectangle, in pixels
+typedef struct {
+    uint32_t x, y, w, h;
+} rect_t;
+
+// Plane usable on our CRTC, enumerated by findPlane()
+typedef struct {
+    uint32_t id;
+    uint64_t type; // DRM_PLANE_TYPE_*
+    bool on_crtc;  // Currently bound to our CRTC (e.g. by fbcon)
+    uint64_t zpos; // Current stacking position, 0 without the property
+    plane_props_t props;
+    std::map<uint32_t, std::vector<uint64_t>> formats; // <format, modifiers> from IN_FORMATS, LINEAR only without it
+} plane_caps_t;
+
+// One plane of an atomic request
+typedef struct {
+    const plane_caps_t *plane;
+    uint32_t fbId;
+    rect_t src;
+    rect_t dst;
+    const plane_caps_t *below; // GPU plane: stacked above this one, alpha blended. nullptr: left as is
+} plane_state_t;
+
+// Dumb buffer exported as DMA-BUF with a pre-created FB
+typedef struct {
+    uint32_t handle;
+    uint32_t fbId;
+    int fd;
+    uint64_t size;
+    uint32_t pitch;
+} dumb_buf_t;
+
+// Mapped dumb buffer of the test pattern ring
+typedef struct {
+    dumb_buf_t dbuf;
+    uint32_t *pixels;
+} tp_buf_t;
+
+// GPU buffer imported or allocated through GBM
+typedef struct {
+    struct gbm_bo *bo;
+    uint32_t fbId;
+    bool owned; // dma_fd exported by allocateGpuBuffers(), closed with the entry
+} gpu_fb_t;
+
+// GPU buffer allocated by the display: what a renderer needs to import it (e.g. EGL dma_buf modifiers)
+typedef struct {
+    int fd;
+    uint32_t num_planes;
+    uint32_t pitch[4];  // in bytes
+    uint32_t offset[4]; // in bytes
+    uint64_t modifier;  // DRM_FORMAT_MOD_*, the layout may be compressed (AFBC)
+} gpu_dmabuf_t;
+
 class Display {
 private:
     int m_drmFd{-1};
@@ -54,43 +147,87 @@ private:
     drmModeEncoder *m_drmEncoder{nullptr};
     drmModeCrtc *m_drmCrtc{nullptr};
     drmModeModeInfo m_modeSettings{}; // Holds display preferred mode
-    uint32_t m_modePropFb_id{0}; // FB_ID DRM Mode property for atomicUpdate().
-    drmModePlane *m_drmPrimaryPlane{nullptr};
+    connector_props_t m_connProps{};
+    crtc_props_t m_crtcProps{};
+    std::vector<plane_caps_t> m_planes; // Candidates, probePipeline() picks the camera and overlay planes
     uint32_t m_connectorId{0};
     uint32_t m_crtcId{0};
-    uint32_t m_primaryPlaneId{0};
+    uint32_t m_camPlaneId{0};     // Primary plane unless it can't show the camera
+    plane_props_t m_camProps{};
+    uint32_t m_overlayPlaneId{0}; // 0: no overlay plane for the GPU format
+    plane_props_t m_overlayProps{};
+    std::vector<uint64_t> m_gpu_modifiers; // GPU format modifiers the overlay plane passed TEST_ONLY with, LINEAR first
 
+    bool m_fb_modifiers{false}; // DRM_CAP_ADDFB2_MODIFIERS
     struct gbm_device *m_gbmDev{nullptr};
     uint32_t m_gbm_flags{0};
     uint32_t m_gpu_format{0};
     uint32_t m_cam_format{0};
-    uint32_t m_testPattern_FbId{0};
+    frame_layout_t m_cam_layout{}; // Imported camera buffers: from cam_buf, or what the capture negotiated
+    std::unique_ptr<TestPattern> m_pattern;
+    std::vector<tp_buf_t> m_tp_ring; // testing_display: a different buffer on each flip
+    unsigned int m_tp_index{0}; // Buffer on screen or pending
+    uint64_t m_tp_frame{0};
+    unsigned int m_last_sequence{0}; // vblank counter of the previous flip
+    uint64_t m_missed_vblanks{0}; // Vblanks without a flip, testing_display: the pattern wasn't ready
+    LogRateLimit m_missed_rl{1000};
     uint32_t m_splashscreen_FbId{0};
+    rect_t m_splash_src{}; // Splash FB area shown
+    rect_t m_splash_dst{};
+    bool m_camera_shown{false}; // A camera frame was committed since the splash
+    rect_t m_cam_src{}; // Camera FB area shown
+    rect_t m_cam_dst{}; // Where it lands on the CRTC, the plane scaler fits one to the other
+    std::vector<plane_state_t> m_mosaic; // One plane per camera, empty: single camera on m_camPlaneId
 
     drmEventContext m_drm_evctx{};
     frame_info_t m_frame{};
-    std::map<int, uint32_t> m_fb_map{}; // <key: buffer dma_fd, value: drm framebuffer id>
+    std::unique_ptr<FbCache> m_fb_cache; // Imported camera FBs, keyed by GEM handle
+    std::vector<uint32_t> m_shown_fbs; // Camera FB per plane on screen (last completed flip), 0: none
+    std::vector<uint32_t> m_committed_fbs; // Camera FB per plane of the last commit, on screen once it flips
+    std::vector<uint32_t> m_pinned_fbs; // Both of the above: never evicted from m_fb_cache
+    std::vector<dumb_buf_t> m_cam_dumb_bufs{}; // Camera buffers allocated by the display
+    std::map<int, gpu_fb_t> m_gpu_fb_map{}; // <key: GPU buffer dma_fd, value: imported bo and FB>
+    int m_overlay_fd{-1};    // GPU buffer composed on the overlay plane, -1: none
+    bool m_overlay_dirty{false}; // Overlay changed since last commit
+    int m_overlay_fence{-1}; // Render fence of the overlay buffer, attached by the next commit (kept by the caller)
     
     display_config m_config{};
     Logger m_logger;
     bool m_display_initialized{false};
+    int m_out_fence{-1}; // Signals when the last commit reached the screen, i.e. the previous FB is free
 
     bool getResources();
     bool findConnector();
     bool findEncoder();
     bool findCrtc();
     bool findPlane();
+    bool cacheProperties();
+    bool probePipeline(); // TEST_ONLY commits: pick planes, scaling and modifiers before the first real commit
+    bool testCommit(uint32_t mode_blob, const std::vector<plane_state_t>& planes);
+    bool testCameraPlane(); // TEST_ONLY commit of the picked planes with the current camera rects
+    void addPlaneState(drmModeAtomicReq *req, const std::vector<plane_state_t>& planes); // Planes on our CRTC not listed are disabled
+    void addOverlayStacking(drmModeAtomicReq *req, const plane_caps_t& overlay, uint64_t below_zpos);
+    int addFramebuffer(uint32_t width, uint32_t height, uint32_t format, const uint32_t handles[4], const uint32_t pitches[4],
+                       const uint32_t offsets[4], uint64_t modifier, uint32_t *out_fbId); // drmModeAddFB2 return value
+    bool createProbeFb(uint32_t format, uint32_t width, uint32_t height, uint64_t modifier, dumb_buf_t& out);
+    bool cachePlaneProperties(uint32_t plane_id, plane_props_t& props);
+    bool createPatternBuffer(tp_buf_t& out); // Mode sized XR24, mapped
+    void destroyPatternBuffer(tp_buf_t& buf);
     bool createTestPattern();
     bool loadSplashScreen();
     bool atomicModeSet();
-    bool atomicUpdate(uint32_t fbId);
+    void computeCameraRects();
+    void pinCameraFbs(); // Hand the FBs in use to m_fb_cache
+    bool atomicUpdate(const uint32_t *cam_fbIds, unsigned int count, uint32_t gpu_fbId, int in_fence_fd); // 0 in cam_fbIds: plane unchanged. Fence on every plane getting a FB
 
     // Camera buffer
     bool createFbFromFd(int buf_fd, uint32_t *out_fbId);
+    void destroyDumbBuffer(dumb_buf_t& dbuf);
 
     // GPU buffer
     bool importGbmBoFromFD(int buf_fd, struct gbm_bo **out_bo);
     bool createFbFromGbmBo(struct gbm_bo *bo, uint32_t *out_fbId);
+    bool getGpuFb(int buf_fd, uint32_t *out_fbId); // Imports and caches the GPU buffer
 
 public:
     Display(display_config& conf, bool verbose);
@@ -104,7 +241,33 @@ public:
         return m_frame.flip_pending;
     }
 
+    unsigned int refreshRate(){
+        return m_modeSettings.vrefresh; // Hz, once initialize() returned
+    }
+
+    uint64_t lastFlipNs(){
+        return (uint64_t)m_frame.sec * 1000000000ull + (uint64_t)m_frame.usec * 1000ull;
+    }
+
+    const buffer_t& cameraBuffer(){
+        return m_config.cam_buf; // Final once initialize() returned
+    }
+
+    bool allocateCameraBuffers(unsigned int count, std::vector<dmabuf_t>& out_bufs); // Scanout-capable buffers in the camera format (NV12, XR24), for V4L2 DMABUF import or CPU writers
+    bool allocateGpuBuffers(unsigned int count, std::vector<gpu_dmabuf_t>& out_bufs); // Overlay buffers in the GPU format, with the best modifier the plane takes. After initialize()
     bool initialize(); // Initialize the display
-    bool scanout(int buf_fd); // Scanout buf_fd. Non-blocking call
+    bool scanout(int buf_fd, int in_fence_fd = -1); // Scanout buf_fd once in_fence_fd (sync_file, kept by caller) signals. Non-blocking call
+    bool setCameraLayout(const frame_layout_t& layout); // Layout of the imported camera buffers, e.g. Capture::layout(). Before the first scanout()
+    bool setMosaic(unsigned int count); // Show count cameras side by side, one plane each. After setCameraLayout()
+    bool scanoutSet(const std::vector<int>& cam_buf_fds, int in_fence_fd = -1); // One buffer per mosaic camera, -1 keeps its current frame
+    bool prepareBuffer(int buf_fd); // Import buf_fd ahead of its first scanout(), the FB is cached. After setCameraLayout()
+    void invalidateBuffer(int buf_fd); // Buffer is being freed by its exporter: drop its cached FBs
+    bool showSplash(); // Back to the splash, e.g. before the camera buffers are freed. Blocking, after the last flip
+    bool setOverlay(int gpu_buf_fd, int in_fence_fd = -1); // GPU (UI) buffer composed over the camera from the next scanout(), -1 to remove.
+                                                           // in_fence_fd: its render fence (sync_file, kept by caller until that scanout())
+    int takeOutFence(); // Out fence of the last scanout(), -1 if none. Caller owns and closes it
+    uint64_t missedVblanks(){
+        return m_missed_vblanks; // testing_display: vblanks the test pattern wasn't ready for
+    }
     bool handleEvent(); // Handle DRM events e.g., page flip
 };
\ No newline at end of file
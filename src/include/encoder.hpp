@@ -0,0 +1,104 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include <linux/videodev2.h>
+#include "logger.hpp"
+#include "helpers.hpp"
+#include "source.hpp"
+#include "capture.hpp"
+
+#define ENC_MAX_INFLIGHT 2 // Camera frames held by the encoder, the capture queue keeps the rest
+
+struct encoder_config {
+    std::string device;          // V4L2 M2M encoder
+    std::string codec{"H264"};   // H264 or HEVC
+    uint32_t bitrate{8000000};   // bits/s
+    unsigned int gop{30};        // Frames between key frames
+    unsigned int buf_count{4};   // Bitstream buffers
+};
+
+typedef struct {
+    capture_frame_t frame; // Camera frame being read by the encoder, index -1: free
+} enc_input_t;
+
+typedef struct {
+    void* addr;
+    size_t size;
+    bool queued; // Owned by the driver
+    unsigned int users; // Extra holders from retain()
+} enc_packet_buf_t;
+
+// Hardware video encoder (V4L2 memory-to-memory). Camera frames are queued zero-copy on the
+// OUTPUT queue as the DMA-BUFs the capture exported, and stay held until the encoder is done
+// reading them (collect()). Encoded packets come out of the CAPTURE queue: the encoder is a
+// FrameSource of bitstream packets, one plane each, e.g. for the Recorder.
+// get_fd() reports POLLIN for packets and POLLOUT for camera frames to collect.
+class Encoder : public FrameSource {
+private:
+    int m_fd{-1};
+    encoder_config m_config;
+    frame_layout_t m_layout{};
+    std::vector<enc_input_t> m_inputs; // One per capture buffer index
+    std::vector<enc_packet_buf_t> m_packets;
+    unsigned int m_inflight{0};
+    bool m_streaming{false};
+    bool m_draining{false}; // V4L2_ENC_CMD_STOP sent
+    bool m_finished{false}; // Last packet dequeued
+    uint64_t m_encoded{0};
+    uint64_t m_bytes{0};
+    uint64_t m_busy{0}; // Frames not encoded, ENC_MAX_INFLIGHT reached
+    LogRateLimit m_busy_rl{1000};
+    Logger m_logger;
+
+    bool setFormats(uint32_t width, uint32_t height);
+    bool setControls();
+    bool setupPackets();
+    bool queuePacket(unsigned int index);
+
+public:
+    Encoder(const encoder_config& conf, bool verbose);
+    ~Encoder();
+
+    // Interface
+    int get_fd() override {
+        return m_fd;
+    }
+
+    capture_config config(); // Bitstream format, for Recorder::start()
+    bool start(const frame_layout_t& layout, unsigned int input_count); // Camera layout (Capture::layout()) and buffer count
+    bool submit(const capture_frame_t& frame); // Non-blocking. false: not encoded, frame not taken
+    bool collect(std::vector<capture_frame_t>& done); // Camera frames the encoder is done with, to be released by the caller
+    bool forceKeyFrame(); // E.g. after a packet was lost: the stream decodes again from the next one
+    bool flush(); // Encode what was submitted, finished() once the last packet is out
+    bool finished(){
+        return m_finished;
+    }
+    bool tryDequeue(capture_frame_t& packet) override; // Non-blocking. packet.index is -1 when none is ready
+    bool retain(const capture_frame_t& packet) override;
+    bool release(capture_frame_t& packet) override; // Give the packet buffer back to the encoder
+    bool stop(std::vector<capture_frame_t>& done); // Camera frames still held are returned in done
+};
@@ -0,0 +1,82 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include "logger.hpp"
+
+// Identity of a scanout buffer. The GEM handle stays the same for as long as the buffer is imported,
+// unlike the dma-buf fd number which gets reused by another buffer once closed.
+typedef struct {
+    uint32_t handle;
+    uint32_t format;
+    uint32_t width;
+    uint32_t height;
+    uint32_t pitch;
+} fb_key_t;
+
+// Bounded framebuffer cache with LRU eviction.
+// Entries hold the GEM handle open so the key stays valid until the entry is evicted or invalidated.
+// Pinned FBs (scanned out or waiting to flip) are never evicted: removing one disables its plane.
+class FbCache {
+private:
+    typedef struct {
+        fb_key_t key;
+        uint32_t fbId;
+        uint64_t last_use; // 0: free slot
+    } entry_t;
+
+    int m_drmFd;
+    std::vector<entry_t> m_entries; // Flat table, never reallocated: size is the capacity
+    uint64_t m_tick{0};
+    uint64_t m_hits{0};
+    uint64_t m_misses{0};
+    uint64_t m_evictions{0};
+    std::vector<uint32_t> m_pinned; // FBs the display still uses, see setPinned()
+    Logger m_logger;
+
+    bool handleInUse(uint32_t handle);
+    bool isPinned(uint32_t fbId);
+    void closeHandle(uint32_t handle);
+    void removeEntry(entry_t& e); // RmFB, the handle is closed by the caller if unused
+
+public:
+    FbCache(int drm_fd, size_t capacity, bool verbose);
+    ~FbCache();
+
+    // Interface
+    bool importHandle(int buf_fd, uint32_t *out_handle); // Same buffer, same handle
+    bool lookup(const fb_key_t& key, uint32_t *out_fbId); // Marks the entry as recently used
+    bool insert(const fb_key_t& key, uint32_t fbId); // Takes ownership of fbId on success, may evict the LRU unpinned entry
+    void setPinned(const std::vector<uint32_t>& fbIds); // FBs of the current and pending commits, 0s ignored
+    void releaseHandle(uint32_t handle); // Drop an imported handle that didn't make it into the cache
+    void invalidate(int buf_fd); // Buffer is going away: remove its FBs and close its handle
+    void clear();
+
+    size_t size();
+    size_t capacity(){
+        return m_entries.size();
+    }
+};
@@ -0,0 +1,59 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "logger.hpp"
+
+// Capture formats a device already streamed, on disk: a later start() sets them directly instead of
+// enumerating formats and frame sizes. Devices are keyed by driver and bus_info (VIDIOC_QUERYCAP),
+// stable across reboots unlike /dev/videoN. One entry per line: driver, bus_info, fourcc, width, height,
+// tab separated.
+class FormatCache {
+private:
+    typedef struct {
+        std::string key;
+        std::string fourcc;
+        uint32_t width;
+        uint32_t height;
+    } entry_t;
+
+    std::string m_path;
+    std::vector<entry_t> m_entries;
+    Logger m_logger;
+
+    int find(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height); // -1: not found
+
+public:
+    FormatCache(const std::string& path, bool verbose); // A missing or unreadable file is an empty cache
+
+    static std::string deviceKey(const char *driver, const char *bus_info);
+    bool lookup(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height){
+        return find(key, fourcc, width, height) >= 0;
+    }
+    void store(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height);
+    void remove(const std::string& key, const std::string& fourcc, uint32_t width, uint32_t height); // No longer good
+    bool save(); // Written to a temporary file then renamed: a power cut leaves the old or the new cache
+};
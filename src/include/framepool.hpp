@@ -0,0 +1,88 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <memory>
+#include <functional>
+#include <cstdint>
+#include "logger.hpp"
+#include "latency.hpp"
+
+// Gives a buffer back to its producer (e.g. VIDIOC_QBUF), true on success
+typedef std::function<bool(unsigned int index)> pool_requeue_fn_t;
+
+// Ownership of a fixed set of producer buffers shared by several consumers (display, encoder, recorder...).
+// A dequeued buffer starts with one reference, retain() adds one, and the release() dropping the last one
+// pushes it on a lock-free free list. Whoever pushed drains the list and requeues, one thread at a time:
+// any thread may release, but requeue calls never run concurrently.
+// Also keeps starvation statistics to size the buffer count from data.
+class FramePool {
+private:
+    struct slot_t {
+        std::atomic<int> refs{0};       // Consumers holding the buffer, 0: free or with the producer
+        std::atomic<bool> queued{false}; // Owned by the producer
+        std::atomic<uint32_t> next{0};  // Free list link, index + 1, 0: end
+        uint64_t acquired_ns{0};        // When it was dequeued
+    };
+
+    std::unique_ptr<slot_t[]> m_slots;
+    unsigned int m_count{0};
+    pool_requeue_fn_t m_requeue;
+    std::atomic<uint64_t> m_free{0}; // Free list head: tag << 32 | (index + 1), the tag defeats ABA
+    std::atomic<bool> m_draining{false};
+    std::atomic<unsigned int> m_queued{0}; // Buffers with the producer
+
+    // Stats
+    std::atomic<uint64_t> m_acquired{0};
+    std::atomic<uint64_t> m_starved{0};   // Dequeues that left the producer without a buffer
+    std::atomic<unsigned int> m_min_queued{0};
+    std::atomic<unsigned int> m_max_out{0}; // Most buffers out at once
+    LatencyHistogram m_hold; // Dequeue to requeue, us
+    Logger m_logger;
+
+    void push(unsigned int index);
+    int pop(); // -1: empty
+    bool drain();
+    unsigned int heldCount(); // Buffers with a reference
+
+public:
+    FramePool(bool verbose);
+
+    void reset(unsigned int count, pool_requeue_fn_t requeue); // All buffers out of the producer, stats cleared
+    void setQueued(unsigned int index, bool queued); // Queued by the owner itself (initial queueing), before the ioctl
+    bool acquire(unsigned int index); // Dequeued from the producer: one reference
+    bool retain(unsigned int index);
+    bool release(unsigned int index); // Last reference requeues, false if the requeue failed
+    void returnAll(); // Producer took every buffer back (e.g. STREAMOFF)
+    bool isQueued(unsigned int index){
+        return index < m_count && m_slots[index].queued.load(std::memory_order_acquire);
+    }
+    bool isHeld(unsigned int index){
+        return index < m_count && m_slots[index].refs.load(std::memory_order_acquire) > 0;
+    }
+    unsigned int queuedCount(){
+        return m_queued.load(std::memory_order_relaxed);
+    }
+    void report(); // Starvation stats and a suggested buffer count
+};
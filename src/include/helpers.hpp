@@ -27,6 +27,8 @@
 #include <xf86drm.h>
 #include <xf86drmMode.h>
 #include <string>
+#include <map>
+#include <vector>
 
 // Generic buffer type
 typedef struct {
@@ -36,7 +38,34 @@ typedef struct {
     uint32_t stride; // in pixels
 } buffer_t;
 
+// DMA-BUF shared between display (exporter) and capture (importer)
+typedef struct {
+    int fd;
+    uint32_t size;  // in bytes
+    uint32_t pitch; // in bytes
+} dmabuf_t;
+
+// Memory layout of a negotiated frame format, published by the capture and consumed by the display.
+// Color planes (Y, UV) live in memory planes (V4L2 planes, one dma_fd each): a single one for contiguous formats.
+#define LAYOUT_MAX_PLANES 4
+typedef struct {
+    uint32_t fourcc;     // DRM fourcc, NV12 for both V4L2 NV12 and NM12. 0: unknown layout
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_planes; // Color planes
+    uint32_t pitch[LAYOUT_MAX_PLANES];     // in bytes, padding included
+    uint32_t offset[LAYOUT_MAX_PLANES];    // in bytes, from the start of its memory plane
+    uint32_t mem_plane[LAYOUT_MAX_PLANES]; // Memory plane holding each color plane
+    uint32_t num_mem_planes;
+    uint32_t mem_size[LAYOUT_MAX_PLANES];  // in bytes
+} frame_layout_t;
+
 bool validate_user_buffer(const buffer_t& buf);
+bool layout_contiguous(uint32_t fourcc, uint32_t width, uint32_t height, uint32_t pitch, frame_layout_t& out); // Chroma right after luma
+bool layout_from_v4l2(const struct v4l2_pix_format_mplane& pix, frame_layout_t& out); // From VIDIOC_S_FMT/G_FMT
+
+// Time
+uint64_t monotonic_ns(); // CLOCK_MONOTONIC, same clock as V4L2 and DRM event timestamps
 
 // V4L2
 bool xioctl(int fd, unsigned long req, void *arg);
@@ -48,4 +77,11 @@ void print_drmModeConnector(int drmfd, drmModeConnector *conn);
 void print_drmModeEncoder(drmModeEncoder *enc);
 void print_drmModeCrtc(drmModeCrtc *crtc);
 void print_drmModePlane(drmModePlane *plane);
-uint32_t get_drmModePropertyId(int fd, uint32_t object_id, uint32_t object_type, const char *name);
+
+// DRM object property: name -> {id, current value}
+typedef struct {
+    uint32_t id;
+    uint64_t value;
+} drm_prop_t;
+bool get_drmModeProperties(int fd, uint32_t object_id, uint32_t object_type, std::map<std::string, drm_prop_t>& out);
+bool get_drmModeInFormats(int fd, uint32_t blob_id, std::map<uint32_t, std::vector<uint64_t>>& out); // <format, modifiers> of an IN_FORMATS blob
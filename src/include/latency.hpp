@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <cstdint>
+#include "logger.hpp"
+
+#define LATENCY_WAKEUP_BUDGET_DIV 4 // Deadline miss: a flip event handled more than 1/4 of a frame period late
+
+// Lock-free log-linear histogram of durations in microseconds.
+// Values below 16us get their own bucket, above that each power of two is split in 8 sub-buckets
+// (12.5% resolution). Safe to record from one thread while another thread reads.
+class LatencyHistogram {
+public:
+    static const unsigned int LINEAR_BUCKETS = 16;
+    static const unsigned int SUB_BUCKETS = 8;
+    static const unsigned int BUCKETS = LINEAR_BUCKETS + (32 - 4) * SUB_BUCKETS; // Up to ~1h
+
+private:
+    std::atomic<uint32_t> m_buckets[BUCKETS];
+    std::atomic<uint64_t> m_count;
+    std::atomic<uint64_t> m_max;
+
+    static unsigned int bucketOf(uint64_t us);
+    static uint64_t bucketUpperBound(unsigned int bucket);
+
+public:
+    LatencyHistogram();
+
+    void record(uint64_t us);
+    uint64_t percentile(unsigned int p) const; // p in [0, 100], returns an upper bound in us
+    uint64_t count() const;
+    uint64_t max() const;
+    void reset();
+};
+
+// Per-frame glass-to-glass latency: V4L2 timestamp (DQBUF) -> atomic commit -> flip complete.
+// All timestamps are CLOCK_MONOTONIC in ns. Reports periodically, never per frame.
+class LatencyTracker {
+private:
+    LatencyHistogram m_capture_to_commit;
+    LatencyHistogram m_commit_to_flip;
+    LatencyHistogram m_end_to_end;
+    LatencyHistogram m_flip_interval;
+    LatencyHistogram m_wakeup; // Flip event timestamp to its handling: scheduling delay of the event loop
+    std::atomic<uint64_t> m_captured{0};
+    std::atomic<uint64_t> m_displayed{0};
+    std::atomic<uint64_t> m_dropped{0}; // Sequence gaps: frames lost in the driver
+    std::atomic<uint64_t> m_skipped{0}; // Replaced by a newer frame before reaching the display
+    std::atomic<uint64_t> m_late{0}; // Wakeups past the deadline, the next commit may miss its vblank
+    uint64_t m_deadline_us{0}; // 0: frame period unknown, no deadline
+    bool m_has_sequence{false};
+    uint32_t m_last_sequence{0};
+    uint64_t m_last_flip_ns{0};
+    uint64_t m_last_report_ns{0};
+    uint64_t m_report_period_ns;
+    Logger m_logger;
+
+public:
+    LatencyTracker(unsigned int report_period_ms, bool verbose);
+
+    void frameCaptured(uint32_t sequence); // Sequence gaps are driver drops
+    void frameCaptured(); // Gaps counted by the caller, see framesDropped()
+    void framesDropped(uint64_t count);
+    void frameSkipped(uint64_t count = 1);
+    void frameDisplayed(uint64_t capture_ns, uint64_t commit_ns, uint64_t flip_ns);
+    void flipCompleted(uint64_t flip_ns); // Right after the flip event was handled. Reports once the period elapsed
+    void setFramePeriod(uint64_t period_us); // Display refresh period, sets the wakeup deadline
+    void report();
+
+    // Current period, until report() resets it
+    const LatencyHistogram& commitToFlip() const {
+        return m_commit_to_flip;
+    }
+    const LatencyHistogram& endToEnd() const {
+        return m_end_to_end;
+    }
+    const LatencyHistogram& flipInterval() const {
+        return m_flip_interval;
+    }
+    const LatencyHistogram& wakeup() const {
+        return m_wakeup;
+    }
+    uint64_t displayed() const {
+        return m_displayed.load(std::memory_order_relaxed);
+    }
+};
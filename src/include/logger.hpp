@@ -23,12 +23,42 @@
 #pragma once
 
 #include <string>
+#include <cstdint>
+
+// Log levels
+#define LOG_LEVEL_INFO    0
+#define LOG_LEVEL_STATUS  1
+#define LOG_LEVEL_WARNING 2
+#define LOG_LEVEL_ERROR   3
+
+// Compile-time filter: calls below this level compile to nothing (set by CMake per build type)
+#ifndef CAMCAP_LOG_LEVEL
+#define CAMCAP_LOG_LEVEL LOG_LEVEL_INFO
+#endif
+
+// Allows a burst of messages per interval, e.g. for per-frame warnings
+class LogRateLimit {
+private:
+    uint64_t m_interval_ns;
+    unsigned int m_burst;
+    uint64_t m_window_start_ns{0};
+    unsigned int m_count{0};
+    unsigned int m_suppressed{0};
+
+public:
+    LogRateLimit(unsigned int interval_ms, unsigned int burst = 1);
+
+    bool allow(); // false: drop this message
+    unsigned int takeSuppressed(); // Messages dropped since the last call
+};
 
 class Logger {
 private:
     std::string m_name;
     bool m_verbose;
 
+    void write(int level, const char* fmt, ...) const;
+
 public:
     Logger(const std::string& name = "", bool verbose = false);
     ~Logger();
@@ -36,9 +66,34 @@ public:
     void set_verbose(bool verbose);
     bool get_verbose();
 
-    void info(const char* fmt, ...) const;
-    void status(const char* fmt, ...) const;
-    void error(const char* fmt, ...) const;
-    void warning(const char* fmt, ...) const;
+    // Async mode: records are formatted into a preallocated ring and written by a background thread.
+    // Process wide. stopAsync() flushes pending records, it's safe to call from any thread and more than once.
+    static bool startAsync();
+    static void stopAsync();
+
+    template<typename... Args>
+    void info(const char* fmt, Args... args) const {
+        if(CAMCAP_LOG_LEVEL <= LOG_LEVEL_INFO && m_verbose)
+            write(LOG_LEVEL_INFO, fmt, args...);
+    }
+
+    // Showing status even when verbose is false
+    template<typename... Args>
+    void status(const char* fmt, Args... args) const {
+        if(CAMCAP_LOG_LEVEL <= LOG_LEVEL_STATUS)
+            write(LOG_LEVEL_STATUS, fmt, args...);
+    }
+
+    template<typename... Args>
+    void warning(const char* fmt, Args... args) const {
+        if(CAMCAP_LOG_LEVEL <= LOG_LEVEL_WARNING)
+            write(LOG_LEVEL_WARNING, fmt, args...);
+    }
+
+    template<typename... Args>
+    void error(const char* fmt, Args... args) const {
+        write(LOG_LEVEL_ERROR, fmt, args...);
+    }
+
     [[noreturn]] void fatal(const std::string& msg) const;
-};
\ No newline at end of file
+};
@@ -0,0 +1,158 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "logger.hpp"
+#include "reactor.hpp"
+
+#define METRICS_MAGIC     0x544d4343 // "CCMT"
+#define METRICS_VERSION   1
+#define METRICS_SLOT_SIZE 64 // One cache line per value: writers on different threads don't share lines
+#define METRICS_NAME_LEN  56
+
+typedef enum {
+    MET_FRAMES_CAPTURED=0,
+    MET_FRAMES_DISPLAYED,
+    MET_FRAMES_DROPPED,       // Sequence gaps reported by the driver
+    MET_FRAMES_SKIPPED,       // Superseded before reaching the display
+    MET_FB_CACHE_HITS,
+    MET_FB_CACHE_MISSES,
+    MET_BUFS_TOTAL,           // Capture buffers, all cameras
+    MET_BUFS_QUEUED,          // With the driver
+    MET_BUFS_HELD,            // Dequeued, referenced by a consumer
+    MET_POOL_STARVED,         // Dequeues that left the driver without a buffer
+    MET_REQUEUE_US_SUM,       // Dequeue to requeue
+    MET_REQUEUE_COUNT,
+    MET_FLIP_INTERVAL_US_SUM,
+    MET_FLIP_INTERVAL_COUNT,
+    MET_END_TO_END_US_SUM,    // Capture to flip
+    MET_END_TO_END_COUNT,
+    MET_WAKEUP_US_SUM,        // Flip event to its handling
+    MET_WAKEUP_COUNT,
+    MET_DEADLINE_MISSES,      // Flip events handled past the wakeup deadline
+    MET_MAX
+} metric_id_t;
+
+typedef enum {
+    METRIC_COUNTER=0,
+    METRIC_GAUGE,
+    METRIC_SUMMARY_SUM,   // Microseconds, the next metric is its count
+    METRIC_SUMMARY_COUNT,
+} metric_kind_t;
+
+struct alignas(METRICS_SLOT_SIZE) metric_slot_t {
+    std::atomic<uint64_t> value;
+};
+
+typedef struct {
+    char name[METRICS_NAME_LEN]; // e.g. camcap_frames_captured_total, NUL terminated
+    uint32_t kind;               // metric_kind_t
+    uint32_t reserved;
+} metric_name_t;
+
+// Shared memory layout. A reader checks magic and version, then loads slots[i].value (64-bit, aligned)
+// for the names[i] it knows; count may grow in later versions, only by appending.
+typedef struct {
+    uint32_t magic;   // Written last, once the rest is valid
+    uint32_t version;
+    uint32_t count;
+    uint32_t pid;
+    uint64_t start_ns; // CLOCK_MONOTONIC at creation: changes when the process restarts
+    uint8_t reserved[METRICS_SLOT_SIZE - 24];
+    metric_name_t names[MET_MAX];
+    metric_slot_t slots[MET_MAX];
+} metrics_shm_t;
+
+// Process wide counters and gauges, updated from the hot paths with one relaxed atomic each.
+// By default they live in process memory; a MetricsSegment moves them to shared memory.
+class Metrics {
+private:
+    static metric_slot_t *s_slots;
+
+    friend class MetricsSegment;
+
+public:
+    static void add(metric_id_t id, uint64_t n = 1){
+        s_slots[id].value.fetch_add(n, std::memory_order_relaxed);
+    }
+    static void sub(metric_id_t id, uint64_t n = 1){
+        s_slots[id].value.fetch_sub(n, std::memory_order_relaxed);
+    }
+    static void sample(metric_id_t sum_id, uint64_t us){ // Summary: sum_id then its count
+        add(sum_id, us);
+        add((metric_id_t)(sum_id + 1));
+    }
+    static uint64_t get(metric_id_t id){
+        return s_slots[id].value.load(std::memory_order_relaxed);
+    }
+
+    static const char *name(metric_id_t id);
+    static metric_kind_t kind(metric_id_t id);
+    static std::string render(); // Prometheus text exposition format
+};
+
+// POSIX shared memory segment (/dev/shm) holding the metrics, for a sidecar to map read-only.
+// Create it before the threads updating metrics start, destroy it after they stopped.
+class MetricsSegment {
+private:
+    std::string m_name;
+    metrics_shm_t *m_shm{nullptr};
+    Logger m_logger;
+
+public:
+    MetricsSegment(const std::string& name, bool verbose); // name: e.g. /camcap
+    ~MetricsSegment(); // Metrics back to process memory, the segment is unlinked
+};
+
+// Prometheus scrape endpoint, HTTP/1.0 over a Unix socket or TCP, served from the event loop.
+// One request per connection: read up to the end of the headers, answer, close.
+class MetricsServer {
+private:
+    typedef struct {
+        int fd;
+        uint64_t accepted_ns;
+        std::string request;
+    } client_t;
+
+    Reactor& m_reactor;
+    std::string m_address;
+    int m_fd{-1};
+    bool m_started{false};
+    std::vector<client_t> m_clients;
+    Logger m_logger;
+
+    bool handleAccept(short revents);
+    bool handleClient(int fd, short revents);
+    void closeClient(size_t i);
+    void expireClients(uint64_t now);
+
+public:
+    MetricsServer(Reactor& reactor, const std::string& address, bool verbose); // address: socket path, or a TCP port
+    ~MetricsServer();
+
+    bool start(); // Register with the event loop
+};
@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include "logger.hpp"
+#include "helpers.hpp"
+#include "capture.hpp"
+#include "display.hpp"
+#include "latency.hpp"
+
+#define MCAM_MAX_CAMERAS 4
+
+struct camera_config {
+    std::string device;
+    int cpu{-1}; // Capture thread affinity, -1: any CPU
+};
+
+struct multicam_config {
+    capture_config capture;         // Same format for every camera
+    uint64_t max_wait_ns{25000000}; // How long a set waits for late cameras after its first frame
+};
+
+// Frames captured at about the same time, one per camera. index -1: nothing new from that camera
+typedef struct {
+    capture_frame_t frames[MCAM_MAX_CAMERAS];
+    unsigned int count;
+    uint64_t spread_ns; // Newest minus oldest capture timestamp of the set
+    uint32_t dropped[MCAM_MAX_CAMERAS];  // Sequence gaps since the previous set: lost in the driver
+    uint32_t replaced[MCAM_MAX_CAMERAS]; // Overwritten in the slot since the previous set, never shown
+} frame_set_t;
+
+// Several cameras captured in parallel, one thread per device (optionally pinned to a CPU).
+// Each thread keeps the newest frame of its camera in a slot and signals get_fd(). Sets are
+// taken from the slots once every camera has a fresh frame, or after max_wait_ns: late cameras
+// are then left out of the set rather than holding the others back.
+// Methods are called from the event loop thread, the Capture objects only from their own thread.
+class CameraManager {
+private:
+    struct camera {
+        std::string device;
+        int cpu;
+        capture_config conf; // Referenced by cap
+        std::unique_ptr<Capture> cap;
+        std::thread thread;
+        int wake_fd{-1}; // eventfd: frames to release, or stop
+        std::mutex mutex; // Guards ready, to_release and the counts for the next set
+        capture_frame_t ready{}; // Newest frame, index -1: none
+        std::vector<capture_frame_t> to_release;
+        uint32_t set_dropped{0};
+        uint32_t set_replaced{0};
+        bool has_sequence{false}; // Capture thread
+        uint32_t last_sequence{0};
+        uint64_t captured{0};
+        uint64_t dropped{0};  // Sequence gaps, before the slot: replaced frames are not gaps
+        uint64_t replaced{0}; // Overwritten in the slot before joining a set
+        std::atomic<bool> failed{false};
+    };
+
+    std::vector<std::unique_ptr<camera>> m_cams;
+    multicam_config m_config;
+    int m_ready_fd{-1}; // eventfd, signalled by the capture threads
+    int m_timer_fd{-1}; // Deadline of an incomplete set
+    bool m_timer_armed{false};
+    std::atomic<bool> m_running{false};
+    uint64_t m_sets{0};
+    uint64_t m_partial_sets{0}; // Taken without every camera
+    uint64_t m_spread_sum_ns{0};
+    uint64_t m_spread_max_ns{0};
+    Logger m_logger;
+
+    void captureLoop(camera& cam);
+    bool armTimer(uint64_t deadline_ns); // 0 disarms
+
+public:
+    CameraManager(const std::vector<camera_config>& cams, const multicam_config& conf, bool verbose);
+    ~CameraManager();
+
+    // Interface
+    int get_fd(){
+        return m_ready_fd; // Readable when a camera has a new frame
+    }
+    int get_timer_fd(){
+        return m_timer_fd; // Readable when an incomplete set is due
+    }
+    unsigned int count(){
+        return (unsigned int)m_cams.size();
+    }
+    const frame_layout_t& layout(){
+        return m_cams[0]->cap->layout(); // Same for every camera once start() returned
+    }
+
+    void setReleaseCallback(buf_release_cb_t cb); // See Capture::setReleaseCallback()
+    bool start(); // Negotiate every camera, then start the capture threads
+    bool tryDequeueSet(frame_set_t& set); // Non-blocking. set.count is 0 when no set is due
+    bool release(unsigned int cam, capture_frame_t& frame); // Handed back to the camera thread
+    bool stop();
+};
+
+// Latest-set-wins scheduling of a CameraManager on a Display mosaic, one plane per camera.
+// Like FrameScheduler, at most one set waits for the next flip and a newer frame replaces the
+// waiting one of the same camera. Cameras left out of a set keep their frame on screen.
+class MosaicScheduler {
+private:
+    CameraManager& m_cams;
+    Display& m_display;
+    LatencyTracker& m_latency;
+    std::vector<capture_frame_t> m_pending;   // Newest frame of each camera, waiting for the display
+    std::vector<capture_frame_t> m_flipping;  // Committed, waiting for the flip event
+    std::vector<capture_frame_t> m_on_screen; // Currently scanned out
+    std::vector<int> m_fds; // Reused by commit()
+    uint64_t m_commit_ns{0};
+    uint64_t m_flipping_ns{0}; // Oldest capture timestamp of the committed set
+    unsigned int m_replaced{0};
+    Logger m_logger;
+
+    bool commit();
+
+public:
+    MosaicScheduler(CameraManager& cams, Display& disp, LatencyTracker& latency, bool verbose);
+
+    bool handleSetReady(); // Call when one of the CameraManager fds is readable
+    bool handleFlipEvent(); // Handle DRM events. Call when the display fd is readable
+
+    unsigned int replacedCount(){
+        return m_replaced;
+    }
+};
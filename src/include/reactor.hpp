@@ -0,0 +1,61 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+#include <memory>
+#include <functional>
+#include <initializer_list>
+#include <poll.h>
+#include "logger.hpp"
+
+// Reactor callbacks: return false to report an error and stop the loop
+typedef std::function<bool(short revents)> fd_cb_t;
+typedef std::function<bool(int signo)> signal_cb_t;
+
+class Reactor {
+private:
+    std::vector<struct pollfd> m_pollfds;
+    std::vector<std::unique_ptr<fd_cb_t>> m_callbacks; // Heap held: stay in place when the vector grows during dispatch
+    int m_signalFd{-1};
+    signal_cb_t m_signal_cb;
+    bool m_running{false};
+    bool m_compact{false}; // fds were removed while dispatching
+    Logger m_logger;
+
+    int findFd(int fd);
+    bool handleSignal(short revents);
+    void compact();
+
+public:
+    Reactor(bool verbose);
+    ~Reactor();
+
+    bool addFd(int fd, short events, fd_cb_t cb);
+    bool modifyFd(int fd, short events); // Change the awaited events, 0 to pause the fd
+    bool removeFd(int fd);
+    bool addSignals(std::initializer_list<int> signals, signal_cb_t cb); // Block and deliver signals through a signalfd
+
+    bool run(); // Dispatch events until stop() is called or a callback fails
+    void stop();
+};
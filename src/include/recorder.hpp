@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "logger.hpp"
+#include "capture.hpp"
+#include "container.hpp"
+
+#define REC_QUEUE_DEPTH 8    // Frames in flight between the capture thread and the writer
+#define REC_PREALLOC_CHUNK (256ull * 1024 * 1024) // Single file: preallocation step
+
+struct recorder_config {
+    std::string path;
+    uint64_t segment_size{0};   // Bytes per segment file, 0: a single file
+    unsigned int max_segments{0}; // Rolling: oldest segment deleted beyond this count, 0: keep all
+    uint64_t prealloc_size{REC_PREALLOC_CHUNK}; // Single file: fallocate'd this much ahead of the writes, 0: not preallocated
+    bool direct_io{true};       // O_DIRECT, falls back to buffered I/O if the filesystem refuses it
+};
+
+// Continuous recorder to camcap container files (see container.hpp), one per segment. Frames are written straight from the V4L2 mappings by a writer thread
+// with large aligned pwritev() calls, so the capture thread never blocks on storage.
+// Frames stay owned by the recorder until returned by collect(): poll get_fd() for completions.
+class Recorder {
+private:
+    typedef struct {
+        capture_frame_t frame;
+        cc_frame_hdr_t *hdr; // CC_ALIGN sized block
+        bool written;
+    } rec_slot_t;
+
+    recorder_config m_config;
+    rec_slot_t m_slots[REC_QUEUE_DEPTH];
+    // Single ring, three cursors: [tail, written) done, [written, head) waiting for the writer
+    std::atomic<uint64_t> m_head{0};
+    std::atomic<uint64_t> m_written{0};
+    uint64_t m_tail{0};
+    int m_wake_fd{-1}; // Writer wake up
+    int m_done_fd{-1}; // Completions, polled by the owner
+    std::thread m_writer;
+    std::atomic<bool> m_running{false};
+
+    // Writer thread state
+    cc_file_hdr_t *m_file_hdr{nullptr}; // CC_ALIGN sized block
+    std::vector<cc_index_entry_t> m_index; // Frames of the current segment
+    int m_file_fd{-1};
+    unsigned int m_segment{0};
+    uint64_t m_offset{0};
+    uint64_t m_alloc_size{0}; // Preallocated in the current file
+    bool m_failed{false};
+    bool m_direct_ok{false}; // A direct frame write went through, later errors are real ones
+
+    // Stats
+    uint64_t m_frames{0};
+    uint64_t m_bytes{0};
+    uint64_t m_dropped{0}; // Queue full
+    uint64_t m_start_ns{0};
+    LogRateLimit m_drop_rl{1000};
+    Logger m_logger;
+
+    std::string segmentPath(unsigned int segment);
+    bool openSegment();
+    bool reopenBuffered(); // Current segment without O_DIRECT, when the kernel refuses direct writes
+    void closeSegment(); // Writes the index
+    bool writeFrame(rec_slot_t& slot);
+    void writerLoop();
+
+public:
+    Recorder(const recorder_config& conf, bool verbose);
+    ~Recorder();
+
+    // Interface
+    int get_fd(){
+        return m_done_fd;
+    }
+
+    bool start(const capture_config& conf, const frame_layout_t& layout); // Format and plane layout written in each file header, fourcc 0: no layout
+    bool submit(const capture_frame_t& frame); // Non-blocking. false: queue full or not recordable, frame not taken
+    bool collect(std::vector<capture_frame_t>& done); // Frames written (or not, after a write error), to be released by the caller
+    bool stop(); // Writes what was submitted, then joins the writer
+};
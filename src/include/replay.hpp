@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+#include "logger.hpp"
+#include "helpers.hpp"
+#include "source.hpp"
+#include "container.hpp"
+
+typedef enum {
+    REPLAY_BUF_FREE=0, // Can be uploaded to
+    REPLAY_BUF_READY,  // Uploaded, waiting for its time
+    REPLAY_BUF_OUT     // Handed out, waiting for release()
+} replay_buf_state_t;
+
+typedef struct {
+    dmabuf_t dbuf;
+    void* addr; // CPU mapping of dbuf
+    unsigned int users; // Extra holders from retain()
+    replay_buf_state_t state;
+    uint64_t rec_ts_ns; // Recorded timestamp of the uploaded frame
+    uint32_t sequence;  // Recorded sequence of the uploaded frame
+} replay_buf_t;
+
+// Plays a camcap recording back as a FrameSource, so the display pipeline runs without a camera.
+// Frames are uploaded ahead of time into buffers provided by the display, and handed out at
+// their recorded pace (or as fast as they are released). get_fd() is a timerfd.
+class ReplaySource : public FrameSource {
+private:
+    ContainerReader m_reader;
+    capture_config m_config;
+    frame_layout_t m_layout{}; // Recorded plane layout, fourcc 0: derived from each frame's payload (v1 files)
+    std::vector<replay_buf_t> m_bufs;
+    std::vector<int> m_ready; // Uploaded buffers, in frame order
+    uint64_t m_next_frame{0}; // Next frame to upload
+    uint64_t m_start_ns{0};   // Clock time of the first frame
+    uint64_t m_first_ts_ns{0}; // Recorded timestamp of the first frame
+    bool m_fast{false};
+    int m_timer_fd{-1};
+    Logger m_logger;
+
+    bool upload(replay_buf_t& rbuf, uint64_t n);
+    bool fill(); // Upload into all free buffers
+    bool armTimer(); // Fire when the oldest uploaded frame is due
+    uint64_t dueNs(const replay_buf_t& rbuf);
+
+public:
+    ReplaySource(const std::string& path, bool verbose);
+    ~ReplaySource();
+
+    // Interface
+    int get_fd() override {
+        return m_timer_fd;
+    }
+
+    capture_config& config(){
+        return m_config; // Format of the recording
+    }
+
+    bool importBuffers(const std::vector<dmabuf_t>& bufs); // NV12 buffers, call before start()
+    bool start(bool fast); // fast: ignore recorded timestamps
+    bool tryDequeue(capture_frame_t& frame) override;
+    bool retain(const capture_frame_t& frame) override;
+    bool release(capture_frame_t& frame) override;
+
+    bool finished(){
+        return m_next_frame >= m_reader.frameCount() && m_ready.empty(); // All frames handed out
+    }
+};
@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <map>
+#include <cstdint>
+#include <rga/rga.h>
+#include <rga/im2d.h>
+#include "logger.hpp"
+
+// DMA-BUF image as seen by the RGA. Chroma follows luma in the same buffer, rows luma rows from its start.
+typedef struct {
+    int fd;
+    uint32_t size;   // in bytes
+    uint32_t fourcc; // DRM/V4L2
+    uint32_t width;
+    uint32_t height;
+    uint32_t stride; // in bytes
+    uint32_t rows;   // Vertical stride: luma rows up to the chroma plane, 0: height
+} rga_image_t;
+
+// Rockchip RGA 2D engine: scaling, rotation and format conversion from one DMA-BUF to another,
+// the CPU never touches the pixels. Only built when librga is found (CAMCAP_HAVE_RGA).
+class RgaEngine {
+private:
+    std::map<int, rga_buffer_handle_t> m_handles; // Imported DMA-BUFs, by fd
+    Logger m_logger;
+
+    bool wrap(const rga_image_t& img, rga_buffer_t& out);
+
+public:
+    RgaEngine(bool verbose);
+    ~RgaEngine();
+
+    static bool supported(uint32_t src_fourcc, uint32_t dst_fourcc);
+    bool process(const rga_image_t& src, const rga_image_t& dst, unsigned int rotation); // Blocking. rotation: clockwise degrees
+    void forget(int fd); // fd is being closed by its exporter
+};
@@ -0,0 +1,110 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <vector>
+#include "logger.hpp"
+#include "source.hpp"
+#include "display.hpp"
+#include "latency.hpp"
+#include "reactor.hpp"
+#include "recorder.hpp"
+#include "encoder.hpp"
+#include "analytics.hpp"
+
+// Latest-frame-wins scheduling between a FrameSource (Capture, replay) and Display.
+// At most one frame waits for the next flip: a newer frame replaces it and the stale one
+// is requeued right away, so the V4L2 queue never starves and latency stays at one vsync.
+// With explicit sync the replaced buffer is requeued when the commit out fence signals,
+// without going through the DRM event.
+// When recording, every captured frame is also handed to the Recorder, which holds it until written.
+// With an Encoder, captured frames go to the encoder instead (sharing the buffer with the display)
+// and the Recorder writes the encoded packets. An AnalyticsTap gets every frame its worker is free for.
+class FrameScheduler {
+private:
+    typedef struct {
+        int fd;
+        capture_frame_t frame; // Released when fd signals
+    } fence_wait_t;
+
+    FrameSource& m_source;
+    Display& m_display;
+    LatencyTracker& m_latency;
+    Reactor& m_reactor;
+    Recorder* m_recorder{nullptr};
+    Encoder* m_encoder{nullptr};
+    AnalyticsTap* m_tap{nullptr};
+    std::vector<capture_frame_t> m_recorded; // Reused by handleRecordDone()
+    std::vector<capture_frame_t> m_encoded;  // Reused by handleEncodeDone()
+    std::vector<capture_frame_t> m_analysed; // Reused by handleTapDone()
+    capture_frame_t m_pending{};   // Newest frame, waiting for the display
+    capture_frame_t m_flipping{};  // Committed, waiting for the flip event
+    capture_frame_t m_on_screen{}; // Currently scanned out
+    uint64_t m_commit_ns{0};       // When m_flipping was committed
+    std::vector<fence_wait_t> m_fences; // Out fences waited on by the reactor
+    unsigned int m_replaced{0};    // Frames dropped because a newer one arrived
+    LogRateLimit m_replaced_rl{1000}; // Per-frame message: at most once per second
+    Logger m_logger;
+
+    bool commit();
+    bool releaseOnFence(int fence, const capture_frame_t& frame);
+    bool handleFence(int fence);
+    bool record(const capture_frame_t& frame);
+    bool encode(const capture_frame_t& frame);
+    bool analyse(const capture_frame_t& frame);
+    FrameSource& recorded(){
+        return m_encoder ? static_cast<FrameSource&>(*m_encoder) : m_source; // Owner of what the recorder holds
+    }
+
+public:
+    FrameScheduler(FrameSource& src, Display& disp, LatencyTracker& latency, Reactor& reactor, bool verbose);
+    ~FrameScheduler();
+
+    bool handleCaptureReady(); // Drain ready frames. Call when the capture fd is readable
+    bool handleFlipEvent(); // Handle DRM events. Call when the display fd is readable
+    bool handleRecordDone(); // Release written frames. Call when the recorder fd is readable
+    bool handleEncodeDone(); // Release encoded frames and record packets. Call when the encoder fd is ready
+    bool flushEncoder(unsigned int timeout_ms); // Record the packets of every submitted frame before stopping
+    bool handleTapDone(); // Release analysed frames. Call when the tap fd is readable
+    bool drain(); // Release every frame still held: pending, flipping, on screen, behind a fence. Once the display left them
+                  // (showSplash()), before the source stops. The destructor does it otherwise
+
+    void setRecorder(Recorder* rec){
+        m_recorder = rec;
+        m_recorded.reserve(REC_QUEUE_DEPTH);
+    }
+
+    void setEncoder(Encoder* enc){
+        m_encoder = enc;
+        m_encoded.reserve(ENC_MAX_INFLIGHT);
+    }
+
+    void setTap(AnalyticsTap* tap){
+        m_tap = tap;
+        m_analysed.reserve(2);
+    }
+
+    unsigned int replacedCount(){
+        return m_replaced;
+    }
+};
@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <cstdint>
+#include <linux/videodev2.h>
+
+// Handle on a dequeued buffer. Valid until given back with FrameSource::release()
+typedef struct {
+    int index; // -1: no frame
+    unsigned int num_planes;
+    __u32 bytesused[VIDEO_MAX_PLANES];
+    int dma_fd[VIDEO_MAX_PLANES];
+    void* plane_addr[VIDEO_MAX_PLANES]; // CPU mapping, nullptr if not mappable
+    uint64_t timestamp_ns; // Capture time (CLOCK_MONOTONIC), V4L2 buffer timestamp for a camera
+    __u32 sequence;
+} capture_frame_t;
+
+// Producer of frame handles consumed by the FrameScheduler: a camera or a recording.
+// A frame handle stays valid until every holder called release() on it.
+class FrameSource {
+public:
+    virtual ~FrameSource() {}
+
+    virtual int get_fd() = 0; // Readable when tryDequeue() may return a frame
+    virtual bool tryDequeue(capture_frame_t& frame) = 0; // Non-blocking. frame.index is -1 when no frame is ready
+    virtual bool retain(const capture_frame_t& frame) = 0;
+    virtual bool release(capture_frame_t& frame) = 0;
+};
@@ -0,0 +1,76 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <cstddef>
+#include <cstdint>
+#include "logger.hpp"
+
+// Pre-converted splash image: this header, then the pixels in a display format, ready for scanout.
+// No decoding at boot: the file is mapped and its planes copied into a dumb buffer as they are.
+// Planes are rows of pitch bytes at offset from the file start (page aligned: O_DIRECT and mmap friendly).
+//   XR24: one plane. NV12: Y plane, then the half height interleaved UV plane.
+#define SPLASH_MAGIC   0x4c505343 // "CSPL"
+#define SPLASH_VERSION 1
+#define SPLASH_ALIGN   4096
+#define SPLASH_MAX_PLANES 2
+
+typedef struct {
+    uint32_t magic;      // SPLASH_MAGIC
+    uint32_t version;    // SPLASH_VERSION
+    uint32_t fourcc;     // DRM fourcc: XR24 or NV12
+    uint32_t width;
+    uint32_t height;
+    uint32_t num_planes;
+    uint32_t pitch[SPLASH_MAX_PLANES];  // in bytes
+    uint32_t offset[SPLASH_MAX_PLANES]; // in bytes, from the start of the file
+} splash_hdr_t;
+
+// Read-only mapping of a splash file, validated against its own header
+class SplashImage {
+private:
+    int m_fd{-1};
+    const uint8_t *m_base{nullptr};
+    size_t m_size{0};
+    const splash_hdr_t *m_hdr{nullptr};
+    Logger m_logger;
+
+    void close();
+
+public:
+    SplashImage(bool verbose);
+    ~SplashImage();
+
+    bool open(const std::string& path); // false: missing or invalid file, the caller falls back to a plain pattern
+    const splash_hdr_t& header(){
+        return *m_hdr;
+    }
+    const uint8_t* plane(unsigned int index){
+        return m_base + m_hdr->offset[index];
+    }
+    uint32_t planeHeight(unsigned int index); // Rows of a plane, chroma of NV12 is half height
+};
+
+// Bulk copy into write-combined memory (dumb buffers): wide sequential stores, non-temporal on ARM64
+void stream_copy(void *dst, const void *src, size_t size);
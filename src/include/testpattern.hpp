@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include <cstdint>
+
+typedef enum {
+    TP_SOLID=0,    // Solid red
+    TP_BARS,       // SMPTE color bars
+    TP_GRADIENT,   // Horizontal gradient scrolling one step per frame
+    TP_MAX
+} test_pattern_t;
+
+bool test_pattern_from_name(const std::string& name, test_pattern_t& out); // solid, bars or gradient
+
+// XR24 test pattern renderer. Frames are built from whole rows: one row is computed, then copied down
+// the band it covers, so a frame costs about one memcpy of the buffer. The frame counter is burned in
+// the top left corner, to spot dropped or torn flips on a capture of the screen.
+class TestPattern {
+private:
+    test_pattern_t m_pattern;
+    uint32_t m_width;
+    uint32_t m_height;
+    std::vector<uint32_t> m_row; // Scratch row
+
+    void renderBand(uint32_t *pixels, uint32_t pitch, uint32_t y0, uint32_t y1); // m_row copied on rows [y0, y1)
+    void renderCounter(uint32_t *pixels, uint32_t pitch, uint64_t frame);
+
+public:
+    TestPattern(test_pattern_t pattern, uint32_t width, uint32_t height);
+
+    bool animated(){
+        return m_pattern == TP_GRADIENT;
+    }
+    void render(uint32_t *pixels, uint32_t pitch, uint64_t frame, bool full, bool counter = true); // pitch in pixels. full: whole frame, else counter only
+};
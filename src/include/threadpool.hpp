@@ -0,0 +1,65 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <vector>
+#include "logger.hpp"
+
+// Fixed set of workers running a parallel-for. The calling thread takes part in the work,
+// so a pool of 0 workers simply runs everything inline.
+class ThreadPool {
+public:
+    typedef std::function<void(unsigned int task)> task_fn_t;
+
+private:
+    std::vector<std::thread> m_workers;
+    std::mutex m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    const task_fn_t* m_fn{nullptr};
+    unsigned int m_tasks{0};
+    std::atomic<unsigned int> m_next{0};
+    unsigned int m_finished{0};
+    unsigned int m_active{0}; // Workers inside the current job
+    uint64_t m_generation{0};
+    bool m_quit{false};
+    Logger m_logger;
+
+    void workerLoop();
+    unsigned int runTasks(const task_fn_t& fn, unsigned int tasks); // Returns the number of tasks run by this thread
+
+public:
+    ThreadPool(unsigned int workers, bool verbose);
+    ~ThreadPool();
+
+    void run(unsigned int tasks, const task_fn_t& fn); // Returns once fn ran for every task in [0, tasks)
+
+    unsigned int size(){
+        return m_workers.size();
+    }
+};
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#pragma once
+
+#include <string>
+#include <sched.h>
+
+// Pipeline threads with their own scheduling. The display role is the event loop (main) thread:
+// threads it spawns without a role of their own (converter, analytics) inherit its settings.
+typedef enum {
+    THR_DISPLAY=0, // Event loop: flip events, commits, single camera capture
+    THR_CAPTURE,   // Per-camera capture threads (several cameras)
+    THR_WRITER,    // Recorder disk writer
+    THR_LOGGER,    // Async log drain
+    THR_MAX
+} thread_role_t;
+
+// Process wide scheduling configuration, set from the command line before any thread is started.
+// Without any configured role, apply() only names the thread.
+class ThreadSched {
+private:
+    typedef struct {
+        bool configured;
+        int priority;  // SCHED_FIFO priority, 0: SCHED_OTHER
+        bool pinned;
+        cpu_set_t cpus;
+    } role_t;
+
+    static role_t s_roles[THR_MAX];
+    static cpu_set_t s_default_cpus; // Affinity the process was started with, for roles not pinned
+    static bool s_enabled;
+
+public:
+    static void setVerbose(bool verbose); // Quiet by default, call before parse()
+    static bool parse(const std::string& spec); // <role>=<priority>[:<cpus>], e.g. display=60:big, writer=0:0-3
+    static bool parseCpus(const std::string& list, cpu_set_t& out); // 0-3,6, big or little (by cpu_capacity)
+    static void apply(thread_role_t role); // Calling thread: name, policy, priority and affinity of its role
+    static bool lockMemory(); // mlockall, current and future mappings
+    static bool pinIrqs(const std::string& spec); // <name>:<cpus>, IRQs whose /proc/interrupts name contains <name>
+};
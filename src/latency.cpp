@@ -0,0 +1,220 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include "helpers.hpp"
+#include "latency.hpp"
+#include "metrics.hpp"
+
+LatencyHistogram::LatencyHistogram()
+{
+    reset();
+}
+
+unsigned int LatencyHistogram::bucketOf(uint64_t us)
+{
+    if(us < LINEAR_BUCKETS)
+        return (unsigned int)us;
+
+    // Most significant bit selects the power of two, the next 3 bits the sub-bucket
+    unsigned int msb = 63 - __builtin_clzll(us);
+    unsigned int sub = (us >> (msb - 3)) & (SUB_BUCKETS - 1);
+    unsigned int bucket = LINEAR_BUCKETS + (msb - 4) * SUB_BUCKETS + sub;
+
+    return (bucket < BUCKETS) ? bucket : BUCKETS - 1;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(unsigned int bucket)
+{
+    if(bucket < LINEAR_BUCKETS)
+        return bucket;
+
+    unsigned int msb = (bucket - LINEAR_BUCKETS) / SUB_BUCKETS + 4;
+    unsigned int sub = (bucket - LINEAR_BUCKETS) % SUB_BUCKETS;
+
+    return ((uint64_t)(SUB_BUCKETS + sub + 1) << (msb - 3)) - 1;
+}
+
+void LatencyHistogram::record(uint64_t us)
+{
+    m_buckets[bucketOf(us)].fetch_add(1, std::memory_order_relaxed);
+    m_count.fetch_add(1, std::memory_order_relaxed);
+
+    uint64_t prev = m_max.load(std::memory_order_relaxed);
+    while(us > prev && !m_max.compare_exchange_weak(prev, us, std::memory_order_relaxed));
+}
+
+uint64_t LatencyHistogram::percentile(unsigned int p) const
+{
+    uint64_t total = count();
+    if(total == 0)
+        return 0;
+
+    // Rank of the requested percentile, rounded up
+    uint64_t rank = (total * p + 99) / 100;
+    if(rank == 0)
+        rank = 1;
+
+    uint64_t seen = 0;
+    for(unsigned int i = 0; i < BUCKETS; i++){
+        seen += m_buckets[i].load(std::memory_order_relaxed);
+        if(seen >= rank){
+            uint64_t bound = bucketUpperBound(i);
+            return (bound < max()) ? bound : max();
+        }
+    }
+
+    return max();
+}
+
+uint64_t LatencyHistogram::count() const
+{
+    return m_count.load(std::memory_order_relaxed);
+}
+
+uint64_t LatencyHistogram::max() const
+{
+    return m_max.load(std::memory_order_relaxed);
+}
+
+void LatencyHistogram::reset()
+{
+    for(unsigned int i = 0; i < BUCKETS; i++)
+        m_buckets[i].store(0, std::memory_order_relaxed);
+    m_count.store(0, std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+LatencyTracker::LatencyTracker(unsigned int report_period_ms, bool verbose)
+    : m_report_period_ns((uint64_t)report_period_ms * 1000000ull), m_logger("latency", verbose)
+{
+    m_last_report_ns = monotonic_ns();
+}
+
+void LatencyTracker::frameCaptured(uint32_t sequence)
+{
+    // V4L2 sequence numbers are consecutive unless the driver dropped frames
+    if(m_has_sequence && sequence > m_last_sequence + 1)
+        framesDropped(sequence - m_last_sequence - 1);
+    m_last_sequence = sequence;
+    m_has_sequence = true;
+    frameCaptured();
+}
+
+void LatencyTracker::frameCaptured()
+{
+    m_captured.fetch_add(1, std::memory_order_relaxed);
+    Metrics::add(MET_FRAMES_CAPTURED);
+}
+
+void LatencyTracker::framesDropped(uint64_t count)
+{
+    if(!count)
+        return;
+    m_dropped.fetch_add(count, std::memory_order_relaxed);
+    Metrics::add(MET_FRAMES_DROPPED, count);
+}
+
+void LatencyTracker::frameSkipped(uint64_t count)
+{
+    if(!count)
+        return;
+    m_skipped.fetch_add(count, std::memory_order_relaxed);
+    Metrics::add(MET_FRAMES_SKIPPED, count);
+}
+
+void LatencyTracker::frameDisplayed(uint64_t capture_ns, uint64_t commit_ns, uint64_t flip_ns)
+{
+    // Guard against clocks going backwards (e.g. non-monotonic V4L2 timestamps)
+    if(commit_ns >= capture_ns)
+        m_capture_to_commit.record((commit_ns - capture_ns) / 1000);
+    if(flip_ns >= commit_ns)
+        m_commit_to_flip.record((flip_ns - commit_ns) / 1000);
+    if(flip_ns >= capture_ns){
+        m_end_to_end.record((flip_ns - capture_ns) / 1000);
+        Metrics::sample(MET_END_TO_END_US_SUM, (flip_ns - capture_ns) / 1000);
+    }
+
+    m_displayed.fetch_add(1, std::memory_order_relaxed);
+    Metrics::add(MET_FRAMES_DISPLAYED);
+}
+
+void LatencyTracker::setFramePeriod(uint64_t period_us)
+{
+    m_deadline_us = period_us / LATENCY_WAKEUP_BUDGET_DIV;
+}
+
+void LatencyTracker::flipCompleted(uint64_t flip_ns)
+{
+    uint64_t now = monotonic_ns();
+
+    if(m_last_flip_ns && flip_ns > m_last_flip_ns){
+        m_flip_interval.record((flip_ns - m_last_flip_ns) / 1000);
+        Metrics::sample(MET_FLIP_INTERVAL_US_SUM, (flip_ns - m_last_flip_ns) / 1000);
+    }
+    m_last_flip_ns = flip_ns;
+
+    // The flip timestamp is the vblank: what's left of the frame period to commit the next one
+    if(now >= flip_ns){
+        uint64_t wakeup_us = (now - flip_ns) / 1000;
+        m_wakeup.record(wakeup_us);
+        Metrics::sample(MET_WAKEUP_US_SUM, wakeup_us);
+        if(m_deadline_us && wakeup_us > m_deadline_us){
+            m_late.fetch_add(1, std::memory_order_relaxed);
+            Metrics::add(MET_DEADLINE_MISSES);
+        }
+    }
+
+    if(now - m_last_report_ns >= m_report_period_ns){
+        report();
+        m_last_report_ns = now;
+    }
+}
+
+static void reportHistogram(const Logger& log, const char* name, LatencyHistogram& h)
+{
+    if(h.count() == 0)
+        return;
+
+    log.status("  %-17s p50=%6luus p95=%6luus p99=%6luus max=%6luus (n=%lu)", name,
+        (unsigned long)h.percentile(50), (unsigned long)h.percentile(95),
+        (unsigned long)h.percentile(99), (unsigned long)h.max(), (unsigned long)h.count());
+    h.reset();
+}
+
+void LatencyTracker::report()
+{
+    Logger& log = m_logger;
+
+    log.status("Frames: captured=%lu displayed=%lu dropped=%lu skipped=%lu",
+        (unsigned long)m_captured.exchange(0, std::memory_order_relaxed),
+        (unsigned long)m_displayed.exchange(0, std::memory_order_relaxed),
+        (unsigned long)m_dropped.exchange(0, std::memory_order_relaxed),
+        (unsigned long)m_skipped.exchange(0, std::memory_order_relaxed));
+    uint64_t late = m_late.exchange(0, std::memory_order_relaxed);
+    if(late)
+        log.warning("%lu flip event(s) handled more than %luus late", (unsigned long)late, (unsigned long)m_deadline_us);
+    reportHistogram(log, "capture->commit", m_capture_to_commit);
+    reportHistogram(log, "commit->flip", m_commit_to_flip);
+    reportHistogram(log, "end-to-end", m_end_to_end);
+    reportHistogram(log, "flip interval", m_flip_interval);
+    reportHistogram(log, "flip->wakeup", m_wakeup);
+}
@@ -22,83 +22,231 @@
 
 #include <cstdarg>
 #include <cstdio>
+#include <cstring>
 #include <stdexcept>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <chrono>
+#include <vector>
+#include "helpers.hpp"
 #include "logger.hpp"
-
-Logger::Logger(const std::string& name, bool verbose)
-    : m_name(name), m_verbose(verbose)
+#include "threadsched.hpp"
+
+#define LOG_RING_SIZE 1024 // Power of two
+#define LOG_RECORD_SIZE 256
+#define LOG_DRAIN_PERIOD_MS 10
+
+// Bounded lock-free MPSC ring (sequence numbered slots). Producers never block nor syscall:
+// a full ring drops the record and counts it.
+struct log_record {
+    std::atomic<size_t> seq;
+    bool to_stderr;
+    char text[LOG_RECORD_SIZE];
+};
+
+class LogRing {
+private:
+    std::vector<log_record> m_slots;
+    std::atomic<size_t> m_head{0}; // Next slot to produce
+    size_t m_tail{0};              // Next slot to consume, consumer only
+    std::atomic<uint64_t> m_dropped{0};
+
+public:
+    LogRing() : m_slots(LOG_RING_SIZE) {
+        for(size_t i = 0; i < LOG_RING_SIZE; i++)
+            m_slots[i].seq.store(i, std::memory_order_relaxed);
+    }
+
+    bool push(bool to_stderr, const char* prefix, const char* fmt, va_list args) {
+        size_t pos = m_head.load(std::memory_order_relaxed);
+        log_record* slot;
+
+        // Claim a slot
+        while(true){
+            slot = &m_slots[pos & (LOG_RING_SIZE - 1)];
+            size_t seq = slot->seq.load(std::memory_order_acquire);
+            intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+            if(diff == 0){
+                if(m_head.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                    break;
+            } else if(diff < 0){
+                m_dropped.fetch_add(1, std::memory_order_relaxed);
+                return false; // Full
+            } else {
+                pos = m_head.load(std::memory_order_relaxed);
+            }
+        }
+
+        // Format in place: no allocation, no I/O
+        int n = snprintf(slot->text, LOG_RECORD_SIZE, "%s", prefix);
+        if(n < 0 || n >= LOG_RECORD_SIZE - 1)
+            n = 0;
+        vsnprintf(slot->text + n, LOG_RECORD_SIZE - n, fmt, args);
+        slot->to_stderr = to_stderr;
+
+        // Publish
+        slot->seq.store(pos + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: write out all published records
+    bool drain() {
+        bool any = false;
+        while(true){
+            log_record* slot = &m_slots[m_tail & (LOG_RING_SIZE - 1)];
+            if(slot->seq.load(std::memory_order_acquire) != m_tail + 1)
+                break;
+            fprintf(slot->to_stderr ? stderr : stdout, "%s\n", slot->text);
+            slot->seq.store(m_tail + LOG_RING_SIZE, std::memory_order_release);
+            m_tail++;
+            any = true;
+        }
+
+        uint64_t dropped = m_dropped.exchange(0, std::memory_order_relaxed);
+        if(dropped)
+            fprintf(stderr, "[logger] Warning: %lu log record(s) dropped, ring full\n", (unsigned long)dropped);
+        if(any){
+            fflush(stdout);
+            fflush(stderr);
+        }
+        return any;
+    }
+};
+
+static LogRing* s_ring = nullptr;
+static std::atomic<bool> s_async{false};
+static std::atomic<unsigned int> s_producers{0}; // Writers between their s_async check and their push
+static std::mutex s_async_mutex; // Serializes start/stop: fatal() may stop from any thread
+static std::thread s_drain_thread;
+
+static void drainLoop()
 {
+    ThreadSched::apply(THR_LOGGER);
+    while(true){
+        // Async off and no writer in flight: nothing can be pushed anymore, one last drain gets it all
+        bool last = !s_async.load() && s_producers.load() == 0;
+        bool any = s_ring->drain();
+        if(last)
+            break;
+        if(!any)
+            std::this_thread::sleep_for(std::chrono::milliseconds(LOG_DRAIN_PERIOD_MS));
+    }
 }
 
-Logger::~Logger()
+bool Logger::startAsync()
 {
+    std::lock_guard<std::mutex> lock(s_async_mutex);
+
+    if(s_async.load())
+        return true;
+
+    try {
+        if(!s_ring)
+            s_ring = new LogRing();
+        s_async.store(true); // Before the thread starts: it exits once async is off
+        s_drain_thread = std::thread(drainLoop);
+    } catch(const std::exception& e){
+        fprintf(stderr, "[logger] Error: failed to start async logging: %s\n", e.what());
+        s_async.store(false);
+        return false;
+    }
+
+    return true;
 }
 
-void Logger::set_verbose(bool verbose)
+void Logger::stopAsync()
 {
-    m_verbose = verbose;
+    std::lock_guard<std::mutex> lock(s_async_mutex);
+
+    // Single shot: concurrent callers wait here for the flush, only the first one joins
+    if(!s_async.exchange(false))
+        return;
+
+    // Back to synchronous output, the drain thread flushes what's left before exiting
+    if(s_drain_thread.joinable())
+        s_drain_thread.join();
 }
 
-bool Logger::get_verbose()
+LogRateLimit::LogRateLimit(unsigned int interval_ms, unsigned int burst)
+    : m_interval_ns((uint64_t)interval_ms * 1000000ull), m_burst(burst)
 {
-    return m_verbose;
 }
 
-void Logger::info(const char* fmt, ...) const
+bool LogRateLimit::allow()
 {
-    if (!m_verbose)
-        return;
-
-    va_list args;
-    va_start(args, fmt);
-
-    printf("[%s] Info: ", m_name.c_str());
-    vprintf(fmt, args);
-    printf("\n");
-
-    va_end(args);
+    uint64_t now = monotonic_ns();
+
+    if(now - m_window_start_ns >= m_interval_ns){
+        m_window_start_ns = now;
+        m_count = 0;
+    }
+    if(m_count < m_burst){
+        m_count++;
+        return true;
+    }
+
+    m_suppressed++;
+    return false;
 }
 
-// Showing status even when verbose is false
-void Logger::status(const char* fmt, ...) const
+unsigned int LogRateLimit::takeSuppressed()
 {
-    va_list args;
-    va_start(args, fmt);
+    unsigned int n = m_suppressed;
+    m_suppressed = 0;
+    return n;
+}
 
-    printf("[%s] Status: ", m_name.c_str());
-    vprintf(fmt, args);
-    printf("\n");
+Logger::Logger(const std::string& name, bool verbose)
+    : m_name(name), m_verbose(verbose)
+{
+}
 
-    va_end(args);
+Logger::~Logger()
+{
 }
 
-void Logger::error(const char* fmt, ...) const
+void Logger::set_verbose(bool verbose)
 {
-    va_list args;
-    va_start(args, fmt);
-    
-    fprintf(stderr, "[%s] Error: ", m_name.c_str());
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
+    m_verbose = verbose;
+}
 
-    va_end(args);
+bool Logger::get_verbose()
+{
+    return m_verbose;
 }
 
-void Logger::warning(const char* fmt, ...) const
+void Logger::write(int level, const char* fmt, ...) const
 {
+    static const char* level_names[] = {"Info", "Status", "Warning", "Error"};
+    bool to_stderr = (level >= LOG_LEVEL_WARNING);
+    char prefix[64];
     va_list args;
-    va_start(args, fmt);
-    
-    fprintf(stderr, "[%s] Warning: ", m_name.c_str());
-    vfprintf(stderr, fmt, args);
-    fprintf(stderr, "\n");
 
+    snprintf(prefix, sizeof(prefix), "[%s] %s: ", m_name.c_str(), level_names[level]);
+
+    va_start(args, fmt);
+    // Counted before the check: the drain thread outlives every writer that saw async on, none pushes after the last drain
+    s_producers.fetch_add(1);
+    if(s_async.load()){
+        s_ring->push(to_stderr, prefix, fmt, args);
+        s_producers.fetch_sub(1);
+    }
+    else {
+        s_producers.fetch_sub(1);
+        FILE* out = to_stderr ? stderr : stdout;
+        fputs(prefix, out);
+        vfprintf(out, fmt, args);
+        fputc('\n', out);
+    }
     va_end(args);
 }
 
 [[noreturn]] void Logger::fatal(const std::string& msg) const
 {
+    // Make sure everything logged before gets out
+    stopAsync();
     fprintf(stderr, "[%s] Fatal: ", m_name.c_str());
     // Juts need to terminate: always throw runtime_error
     throw std::runtime_error(msg);
-}
\ No newline at end of file
+}
@@ -22,39 +22,509 @@
 
 #include <iostream>
 #include <csignal>
-#include <atomic>
-#include <thread>
-#include <chrono>
-#include <poll.h>
+#include <cstdlib>
+#include <string>
+#include <vector>
+#include <memory>
+#include <unistd.h>
 
 #include "helpers.hpp"
+#include "capture.hpp"
 #include "display.hpp"
+#include "reactor.hpp"
+#include "scheduler.hpp"
+#include "latency.hpp"
+#include "recorder.hpp"
+#include "replay.hpp"
+#include "convert.hpp"
+#include "multicam.hpp"
+#include "encoder.hpp"
+#include "analytics.hpp"
+#include "metrics.hpp"
+#include "threadsched.hpp"
 
 #define APP_VERBOSITY true
+#define CAM_BUF_COUNT 4
+#define LATENCY_REPORT_PERIOD_MS 5000
+#define REC_MAX_SEGMENTS 16 // Rolling recording: segments kept on disk
+#define CONV_THREADS 4 // Format conversion threads, the event loop thread included
+#define ENC_FLUSH_TIMEOUT_MS 1000 // Waiting for the last packets on exit
 
-static std::atomic<bool> running(true);
+static void usage(const char* name)
+{
+    printf("Usage: %s [-d <video device> [-d <video device>...] [-a <cpu>,...]] [-s <width>x<height>] [-c <fourcc>] [-C <file>] [-S] [-o <degrees>] [-D] [-F] [-r <file> [-R <MB>] [-e <encoder device> [-x <codec>] [-b <kbit/s>]]] [-A <factor>[:<w>x<h>+<x>+<y>]] [-p <file> [-f]] [-i <splash file>] [-t <pattern>] [-m <shm name>] [-M <socket path|port>] [-P <role>=<priority>[:<cpus>]...] [-I <irq name>:<cpus>...] [-L]\n", name);
+    printf("  Without -d or -p, the display test pattern is shown, a new frame on every vsync.\n");
+    printf("  With -d, NV12 frames are captured and scanned out zero-copy.\n");
+    printf("  More -d (up to %d): cameras are captured in parallel and shown side by side, one plane each\n", MCAM_MAX_CAMERAS);
+    printf("  -a: pin the capture thread of each camera on these CPUs, in -d order\n");
+    printf("  -c: camera format (default NV12). YUYV is converted to NV12, NV16 to XR24\n");
+    printf("  -C: known-good camera formats file: formats already streamed skip the format enumeration\n");
+    printf("  -S: scale the camera to the display mode with the RGA, instead of the display plane scaler\n");
+    printf("  -o: rotate the camera clockwise by 90, 180 or 270 degrees (RGA)\n");
+    printf("  -D: capture into display allocated buffers (V4L2 DMABUF import)\n");
+    printf("  -F: explicit sync, requeue buffers on commit out fences\n");
+    printf("  -r: record all captured frames to <file>\n");
+    printf("  -R: record to rolling segments of <MB> each, the last %d are kept\n", REC_MAX_SEGMENTS);
+    printf("  -e: record H.264/H.265 packets from this V4L2 M2M encoder instead of raw frames\n");
+    printf("  -x: encoder codec, H264 (default) or HEVC\n");
+    printf("  -b: encoder bitrate (default 8000 kbit/s)\n");
+    printf("  -A: luma statistics and a 1/<factor> (4 or 8) thumbnail of each frame, optionally of a region\n");
+    printf("  -p: replay a recording instead of capturing, at the recorded pace\n");
+    printf("  -f: replay as fast as the display takes the frames\n");
+    printf("  -i: splash image (raw XR24/NV12 with a splash header) shown until the first frame, and while the camera is stopped\n");
+    printf("  -t: test pattern: solid, bars (default) or gradient (scrolling)\n");
+    printf("  -m: publish the metrics in a shared memory segment, e.g. /camcap (/dev/shm/camcap)\n");
+    printf("  -M: serve the metrics to Prometheus on this Unix socket, or on this TCP port (GET /metrics)\n");
+    printf("  -P: scheduling of a pipeline thread: display (event loop), capture, writer or logger. Priority 1-99 is\n");
+    printf("      SCHED_FIFO, 0 SCHED_OTHER. cpus: a list (4-7) or a cluster (big, little). E.g. -P display=60:big\n");
+    printf("  -I: pin the IRQs whose /proc/interrupts name contains <irq name> on these CPUs, e.g. -I vop:4\n");
+    printf("  -L: lock all memory (mlockall) and pre-fault the capture buffer mappings\n");
+}
+
+// Flip events handled later than a fraction of this are reported as deadline misses
+static uint64_t frame_period_us(Display& disp)
+{
+    unsigned int hz = disp.refreshRate();
+    return hz ? 1000000 / hz : 0;
+}
 
-void signalHandler(int signal)
+// Test pattern: the next ring buffer on every vsync, the display counts the vblanks missed
+static int runTestPattern(Reactor& reactor, Display& disp, LatencyTracker& latency)
 {
-    if(signal == SIGINT){
-        running = false;
+    latency.setFramePeriod(frame_period_us(disp));
+    bool ok = reactor.addFd(disp.get_fd(), POLLIN, [&](short revents){ // Wake up when VSync/Flip event happens
+        (void) revents;
+        if(!disp.handleEvent()){
+            printf("[MAIN] Error on display handleEvent() !\n");
+            return false;
+        }
+        if(!disp.flipPending()){
+            latency.flipCompleted(disp.lastFlipNs());
+            if(!disp.scanout(0)){
+                printf("[MAIN] Error on display scanout() !\n");
+                return false;
+            }
+        }
+        return true;
+    });
+    if(!ok)
+        return -1;
+
+    printf("[MAIN] Starting loop (Press Ctrl+C to exit)...\n");
+
+    return reactor.run() ? 0 : -1;
+}
+
+// Camera: hand the exported DMA-BUF of each captured frame to the display.
+// The scheduler keeps only the newest frame for the next vsync.
+// src is the capture itself, or a conversion stage pulling from it.
+static int runCamera(Reactor& reactor, Display& disp, Capture& cap, FrameSource& src, LatencyTracker& latency, Recorder* rec, Encoder* enc,
+                     AnalyticsTap* tap)
+{
+    latency.setFramePeriod(frame_period_us(disp));
+    FrameScheduler sched(src, disp, latency, reactor, APP_VERBOSITY);
+    bool ok = true;
+
+    // Frame analysed
+    if(tap){
+        sched.setTap(tap);
+        ok = ok && reactor.addFd(tap->get_fd(), POLLIN, [&](short revents){
+            (void) revents;
+            return sched.handleTapDone();
+        });
+    }
+
+    // Frame read by the encoder, or packet out
+    if(enc){
+        sched.setEncoder(enc);
+        ok = ok && reactor.addFd(enc->get_fd(), POLLIN | POLLOUT, [&](short revents){
+            (void) revents;
+            return sched.handleEncodeDone();
+        });
+    }
+
+    // Frame written to storage
+    if(rec){
+        sched.setRecorder(rec);
+        ok = ok && reactor.addFd(rec->get_fd(), POLLIN, [&](short revents){
+            (void) revents;
+            return sched.handleRecordDone();
+        });
     }
+
+    // Flip complete
+    ok = ok && reactor.addFd(disp.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleFlipEvent();
+    });
+
+    // New frame or device event
+    ok = ok && reactor.addFd(cap.get_fd(), POLLIN | POLLPRI, [&](short revents){
+        if(revents & POLLPRI){
+            if(!cap.handleEvent()){
+                printf("[MAIN] Error on capture handleEvent() !\n");
+                return false;
+            }
+            if(cap.sourceChanged()){
+                printf("[MAIN] Capture source changed, stopping.\n");
+                reactor.stop();
+                return true;
+            }
+        }
+        if(revents & POLLIN)
+            return sched.handleCaptureReady();
+        return true;
+    });
+    if(!ok)
+        return -1;
+
+    printf("[MAIN] Starting capture loop (Press Ctrl+C to exit)...\n");
+
+    ok = reactor.run();
+    printf("[MAIN] %u frame(s) replaced before reaching the display\n", sched.replacedCount());
+
+    // Flush the recording and give its frames back
+    if(rec){
+        if(enc){
+            ok = sched.flushEncoder(ENC_FLUSH_TIMEOUT_MS) && ok;
+            reactor.removeFd(enc->get_fd());
+        }
+        ok = rec->stop() && ok;
+        ok = sched.handleRecordDone() && ok;
+        reactor.removeFd(rec->get_fd());
+    }
+
+    // Frames still with the analytics worker
+    if(tap){
+        tap->stop();
+        ok = sched.handleTapDone() && ok;
+        reactor.removeFd(tap->get_fd());
+    }
+
+    // Camera frames still in the encoder go back to the capture
+    if(enc){
+        std::vector<capture_frame_t> left;
+        ok = enc->stop(left) && ok;
+        for(auto& frame : left)
+            ok = src.release(frame) && ok;
+    }
+
+    // Off the camera buffers before they are freed, then the frames the scheduler holds go back
+    disp.showSplash();
+    ok = sched.drain() && ok;
+
+    return ok ? 0 : -1;
+}
+
+// Multi-camera: the manager threads capture, sets of frames are shown on the display mosaic
+static int runMulti(Reactor& reactor, Display& disp, CameraManager& cams, LatencyTracker& latency)
+{
+    latency.setFramePeriod(frame_period_us(disp));
+    MosaicScheduler sched(cams, disp, latency, APP_VERBOSITY);
+
+    // Flip complete
+    bool ok = reactor.addFd(disp.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleFlipEvent();
+    });
+
+    // New frame from a camera, or late cameras given up on
+    ok = ok && reactor.addFd(cams.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleSetReady();
+    });
+    ok = ok && reactor.addFd(cams.get_timer_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleSetReady();
+    });
+    if(!ok)
+        return -1;
+
+    printf("[MAIN] Starting multi-camera loop (Press Ctrl+C to exit)...\n");
+
+    ok = reactor.run();
+    printf("[MAIN] %u frame(s) replaced before reaching the display\n", sched.replacedCount());
+
+    return ok ? 0 : -1;
+}
+
+// Replay: same pipeline as the camera, frames come from a recording uploaded to display buffers
+static int runReplay(Reactor& reactor, Display& disp, ReplaySource& replay, LatencyTracker& latency)
+{
+    latency.setFramePeriod(frame_period_us(disp));
+    FrameScheduler sched(replay, disp, latency, reactor, APP_VERBOSITY);
+
+    // Flip complete
+    bool ok = reactor.addFd(disp.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        return sched.handleFlipEvent();
+    });
+
+    // Next frame due
+    ok = ok && reactor.addFd(replay.get_fd(), POLLIN, [&](short revents){
+        (void) revents;
+        if(!sched.handleCaptureReady())
+            return false;
+        if(replay.finished()){
+            printf("[MAIN] End of recording.\n");
+            reactor.stop();
+        }
+        return true;
+    });
+    if(!ok)
+        return -1;
+
+    printf("[MAIN] Starting replay loop (Press Ctrl+C to exit)...\n");
+
+    ok = reactor.run();
+    printf("[MAIN] %u frame(s) replaced before reaching the display\n", sched.replacedCount());
+    latency.report();
+
+    // Replay buffers are display buffers: off screen first
+    disp.showSplash();
+    ok = sched.drain() && ok;
+
+    return ok ? 0 : -1;
 }
 
 int main(int argc, char* argv[])
 {
-    (void) argc;
-    (void) argv;
     int ret = 0;
+    int opt;
+    std::vector<std::string> devices;
+    std::vector<int> cpus;
+    unsigned int width = 1920;
+    unsigned int height = 1080;
+    bool dmabuf_import = false;
+    bool explicit_sync = false;
+    recorder_config rec_conf;
+    unsigned int segment_mb = 0;
+    std::string replay_path;
+    std::string cam_fourcc = "NV12";
+    bool scale = false;
+    unsigned int rotation = 0;
+    bool replay_fast = false;
+    encoder_config enc_conf;
+    unsigned int bitrate_kbps = 0;
+    analytics_config ana_conf;
+    bool analytics = false;
+    std::string splash_path;
+    std::string fmt_cache;
+    test_pattern_t pattern = TP_BARS;
+    std::string metrics_shm;
+    std::string metrics_addr;
+    std::vector<std::string> irq_pins;
+    bool lock_memory = false;
 
-    // Setup signal handler for Ctrl+C
-    std::signal(SIGINT, signalHandler);
+    ThreadSched::setVerbose(APP_VERBOSITY); // -P is parsed below
+    while((opt = getopt(argc, argv, "d:a:s:c:C:So:DFr:R:e:x:b:A:p:fi:t:m:M:P:I:Lh")) != -1){
+        switch(opt){
+            case 'd':
+                devices.push_back(optarg);
+                break;
+            case 'a': {
+                std::string list = optarg;
+                size_t pos = 0;
+                while(pos <= list.size()){
+                    size_t end = list.find(',', pos);
+                    if(end == std::string::npos)
+                        end = list.size();
+                    int cpu = -1;
+                    if(sscanf(list.substr(pos, end - pos).c_str(), "%d", &cpu) != 1 || cpu < 0){
+                        usage(argv[0]);
+                        return -1;
+                    }
+                    cpus.push_back(cpu);
+                    pos = end + 1;
+                }
+                break;
+            }
+            case 's':
+                if(sscanf(optarg, "%ux%u", &width, &height) != 2){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'c':
+                cam_fourcc = optarg;
+                break;
+            case 'C':
+                fmt_cache = optarg;
+                break;
+            case 'S':
+                scale = true;
+                break;
+            case 'o':
+                if(sscanf(optarg, "%u", &rotation) != 1 || rotation % 90 || rotation >= 360){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'D':
+                dmabuf_import = true;
+                break;
+            case 'F':
+                explicit_sync = true;
+                break;
+            case 'r':
+                rec_conf.path = optarg;
+                break;
+            case 'R':
+                if(sscanf(optarg, "%u", &segment_mb) != 1 || segment_mb == 0){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'e':
+                enc_conf.device = optarg;
+                break;
+            case 'x':
+                enc_conf.codec = optarg;
+                break;
+            case 'b':
+                if(sscanf(optarg, "%u", &bitrate_kbps) != 1 || bitrate_kbps == 0){
+                    usage(argv[0]);
+                    return -1;
+                }
+                enc_conf.bitrate = bitrate_kbps * 1000;
+                break;
+            case 'A': {
+                int n = sscanf(optarg, "%u:%ux%u+%u+%u", &ana_conf.factor, &ana_conf.roi_w, &ana_conf.roi_h, &ana_conf.roi_x, &ana_conf.roi_y);
+                if((n != 1 && n != 5) || (ana_conf.factor != 4 && ana_conf.factor != 8)){
+                    usage(argv[0]);
+                    return -1;
+                }
+                analytics = true;
+                break;
+            }
+            case 'p':
+                replay_path = optarg;
+                break;
+            case 'f':
+                replay_fast = true;
+                break;
+            case 'i':
+                splash_path = optarg;
+                break;
+            case 't':
+                if(!test_pattern_from_name(optarg, pattern)){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'm':
+                metrics_shm = optarg;
+                break;
+            case 'M':
+                metrics_addr = optarg;
+                break;
+            case 'P':
+                if(!ThreadSched::parse(optarg)){
+                    usage(argv[0]);
+                    return -1;
+                }
+                break;
+            case 'I':
+                irq_pins.push_back(optarg);
+                break;
+            case 'L':
+                lock_memory = true;
+                break;
+            default:
+                usage(argv[0]);
+                return (opt == 'h') ? 0 : -1;
+        }
+    }
+
+    // Several cameras: plain zero-copy capture only
+    bool multi = (devices.size() > 1);
+    if(multi && (devices.size() > MCAM_MAX_CAMERAS || cam_fourcc != "NV12" || scale || rotation || dmabuf_import ||
+                 !rec_conf.path.empty() || !enc_conf.device.empty() || analytics || !replay_path.empty())){
+        printf("[MAIN] Up to %d NV12 cameras, without -c/-S/-o/-D/-r/-e/-A/-p\n", MCAM_MAX_CAMERAS);
+        return -1;
+    }
+
+    // Real-time setup before any thread is spawned: helper threads without a role inherit the event loop's
+    ThreadSched::apply(THR_DISPLAY);
+    if(lock_memory)
+        ThreadSched::lockMemory();
+    for(const auto& pin : irq_pins)
+        ThreadSched::pinIrqs(pin);
+
+    // Metrics move to shared memory before any thread updates them
+    std::unique_ptr<MetricsSegment> metrics_seg;
+    if(!metrics_shm.empty())
+        metrics_seg.reset(new MetricsSegment(metrics_shm, APP_VERBOSITY));
+
+    // Event loop: Ctrl+C and SIGTERM are handled as regular events
+    Reactor reactor(APP_VERBOSITY);
+    if(!reactor.addSignals({SIGINT, SIGTERM}, [&](int signo){ (void) signo; reactor.stop(); return true; })){
+        printf("[MAIN] Error on reactor addSignals() !\n");
+        return -1;
+    }
+
+    // Scrapes are served between frames, by the same loop
+    std::unique_ptr<MetricsServer> metrics_srv;
+    if(!metrics_addr.empty()){
+        metrics_srv.reset(new MetricsServer(reactor, metrics_addr, APP_VERBOSITY));
+        if(!metrics_srv->start()){
+            printf("[MAIN] Error on metrics server start() !\n");
+            return -1;
+        }
+    }
+
+    // Replay: the recording dictates the format
+    std::unique_ptr<ReplaySource> replay;
+    if(!replay_path.empty()){
+        replay.reset(new ReplaySource(replay_path, APP_VERBOSITY));
+        width = replay->config().width;
+        height = replay->config().height;
+    }
+
+    // Camera formats the plane can't take are converted, scaling and rotation need the RGA
+    std::string scanout_fourcc = "NV12";
+    bool converting = (!replay && (cam_fourcc != "NV12" || scale || rotation));
+    bool swap = (rotation == 90 || rotation == 270);
+    if(converting){
+        if(cam_fourcc != "NV12")
+            scanout_fourcc = (cam_fourcc == "YUYV") ? "NV12" : "XR24";
+        if(dmabuf_import){
+            printf("[MAIN] -D can't be used with a converted camera\n");
+            return -1;
+        }
+    }
+
+    // Analytics read the camera mapping
+    if(analytics && (converting || replay || dmabuf_import)){
+        printf("[MAIN] -A can't be used with a converted camera, a replay or -D\n");
+        return -1;
+    }
+
+    // Encoding: the camera buffers themselves go to the encoder, packets to the recorder
+    if(!enc_conf.device.empty() && (rec_conf.path.empty() || converting || replay)){
+        printf("[MAIN] -e needs -r, and can't be used with a converted camera or a replay\n");
+        return -1;
+    }
 
     // Init display
     display_config conf;
-    conf.testing_display = true;
+    conf.testing_display = devices.empty() && !replay;
+    conf.explicit_sync = explicit_sync;
+    conf.test_pattern = pattern;
+    conf.fb_cache_size = (multi ? devices.size() : 1) * CAM_BUF_COUNT; // Every camera buffer keeps its FB
+    if(!conf.testing_display){
+        uint32_t cam_w = (converting && swap) ? height : width;
+        uint32_t cam_h = (converting && swap) ? width : height;
+        conf.cam_buf = {scanout_fourcc, cam_w, cam_h, cam_w};
+        conf.cam_buf_mode_size = converting && scale;
+        conf.gpu_buf = {"XR24", width, height, width};
+        conf.splash_path = splash_path;
+    }
     Display disp(conf, APP_VERBOSITY);
     
+    LatencyTracker latency(LATENCY_REPORT_PERIOD_MS, APP_VERBOSITY);
+
+    // Splash committed before the camera is negotiated, the modeset completes in the kernel meanwhile
     printf("[MAIN] Initialize display...\n");
     ret = disp.initialize();
     if(!ret){
@@ -62,33 +532,166 @@ int main(int argc, char* argv[])
         return -1;
     }
 
-    // Init Polls
-    struct pollfd fds;
-    fds.fd = disp.get_fd();
-    fds.events = POLLIN; // Wake up when VSync/Flip event happens
+    if(conf.testing_display){
+        Logger::startAsync(); // Keep console I/O out of the vsync path
+        ret = runTestPattern(reactor, disp, latency);
+        Logger::stopAsync();
+    }
+    else if(multi){
+        multicam_config mc_conf;
+        mc_conf.capture.fmt_fourcc = cam_fourcc;
+        mc_conf.capture.width = width;
+        mc_conf.capture.height = height;
+        mc_conf.capture.mem_type = TYPE_MMAP;
+        mc_conf.capture.buf_count = CAM_BUF_COUNT;
+        mc_conf.capture.format_cache = fmt_cache;
+        mc_conf.capture.prefault = lock_memory;
+        std::vector<camera_config> cam_confs;
+        for(size_t i = 0; i < devices.size(); i++){
+            camera_config c;
+            c.device = devices[i];
+            c.cpu = (i < cpus.size()) ? cpus[i] : -1;
+            cam_confs.push_back(c);
+        }
+        CameraManager cams(cam_confs, mc_conf, APP_VERBOSITY);
+        cams.setReleaseCallback([&disp](int dma_fd){
+            disp.invalidateBuffer(dma_fd);
+        });
 
-    // Scanout
-    printf("[MAIN] Starting loop (Press Ctrl+C to exit)...\n");
+        printf("[MAIN] Starting %zu cameras...\n", devices.size());
+        if(!cams.start()){
+            printf("[MAIN] Error on cameras start() !\n");
+            return -1;
+        }
+        if(!disp.setCameraLayout(cams.layout()) || !disp.setMosaic(cams.count())){
+            printf("[MAIN] Error on display mosaic setup !\n");
+            return -1;
+        }
 
-    while(running){
-        ret = poll(&fds, 1, -1); // Wait indefinitely for an event
+        Logger::startAsync(); // Keep console I/O out of the vsync path
+        ret = runMulti(reactor, disp, cams, latency);
+        Logger::stopAsync();
+        disp.showSplash(); // Off the camera buffers before they are freed
+        cams.stop();
+    }
+    else if(replay){
+        std::vector<dmabuf_t> bufs;
+        if(!disp.allocateCameraBuffers(CAM_BUF_COUNT, bufs)){
+            printf("[MAIN] Error on display allocateCameraBuffers() !\n");
+            return -1;
+        }
+        if(!replay->importBuffers(bufs) || !replay->start(replay_fast)){
+            printf("[MAIN] Error on replay start() !\n");
+            return -1;
+        }
 
-        if(ret > 0){
-            if (fds.revents & POLLIN) {
-                if(!disp.handleEvent()){
-                    printf("[MAIN] Error on display handleEvent() !\n");
-                    return -1;
-                }
+        Logger::startAsync(); // Keep console I/O out of the vsync path
+        ret = runReplay(reactor, disp, *replay, latency);
+        Logger::stopAsync();
+    }
+    else {
+        // Init capture
+        capture_config cap_conf;
+        cap_conf.fmt_fourcc = cam_fourcc;
+        cap_conf.width = width;
+        cap_conf.height = height;
+        cap_conf.mem_type = dmabuf_import ? TYPE_DMABUF : TYPE_MMAP;
+        cap_conf.buf_count = CAM_BUF_COUNT;
+        cap_conf.format_cache = fmt_cache;
+        cap_conf.prefault = lock_memory;
+        std::unique_ptr<ConvertStage> stage; // Before the capture: its release callback reaches the stage until the buffers are freed
+        Capture cap(devices[0], cap_conf, APP_VERBOSITY);
+        cap.setReleaseCallback([&disp, &stage](int dma_fd){
+            disp.invalidateBuffer(dma_fd);
+            if(stage)
+                stage->invalidateBuffer(dma_fd);
+        });
+
+        if(dmabuf_import){
+            std::vector<dmabuf_t> bufs;
+            if(!disp.allocateCameraBuffers(CAM_BUF_COUNT, bufs)){
+                printf("[MAIN] Error on display allocateCameraBuffers() !\n");
+                return -1;
             }
-            if(!disp.flipPending()){
-                if(!disp.scanout(0)){
-                    printf("[MAIN] Error on display scanout() !\n");
-                    return -1;
-                }
+            if(!cap.importBuffers(bufs)){
+                printf("[MAIN] Error on capture importBuffers() !\n");
+                return -1;
+            }
+        }
+
+        // Conversion into display buffers
+        if(converting){
+            std::vector<dmabuf_t> bufs;
+            convert_config conv_conf;
+            conv_conf.fourcc = scanout_fourcc;
+            conv_conf.width = disp.cameraBuffer().width;
+            conv_conf.height = disp.cameraBuffer().height;
+            conv_conf.rotation = rotation;
+            conv_conf.threads = CONV_THREADS;
+            stage.reset(new ConvertStage(cap, cap_conf, conv_conf, APP_VERBOSITY));
+            if(!disp.allocateCameraBuffers(CAM_BUF_COUNT, bufs) || !stage->importBuffers(bufs)){
+                printf("[MAIN] Error on conversion buffers allocation !\n");
+                return -1;
             }
         }
+
+        printf("[MAIN] Starting capture...\n");
+        if(!cap.start()){
+            printf("[MAIN] Error on capture start() !\n");
+            return -1;
+        }
+
+        // Scan out with the negotiated pitches and offsets, converted frames land in display buffers
+        if(!stage && !disp.setCameraLayout(cap.layout())){
+            printf("[MAIN] Error on display setCameraLayout() !\n");
+            return -1;
+        }
+        if(stage && !stage->setSourceLayout(cap.layout())){
+            printf("[MAIN] Error on conversion setSourceLayout() !\n");
+            return -1;
+        }
+
+        // Hardware encoder, fed with the capture DMA-BUFs
+        std::unique_ptr<Encoder> enc;
+        if(!enc_conf.device.empty()){
+            enc.reset(new Encoder(enc_conf, APP_VERBOSITY));
+            if(!enc->start(cap.layout(), cap_conf.buf_count)){
+                printf("[MAIN] Error on encoder start() !\n");
+                return -1;
+            }
+        }
+
+        // Luma statistics
+        std::unique_ptr<AnalyticsTap> tap;
+        if(analytics){
+            tap.reset(new AnalyticsTap(ana_conf, APP_VERBOSITY));
+            if(!tap->start(cap.layout())){
+                printf("[MAIN] Error on analytics start() !\n");
+                return -1;
+            }
+        }
+
+        // Recording
+        std::unique_ptr<Recorder> rec;
+        if(!rec_conf.path.empty()){
+            rec_conf.segment_size = (uint64_t)segment_mb * 1024 * 1024;
+            rec_conf.max_segments = segment_mb ? REC_MAX_SEGMENTS : 0;
+            rec.reset(new Recorder(rec_conf, APP_VERBOSITY));
+            const frame_layout_t no_layout{}; // Encoded packets
+            const frame_layout_t& layout = enc ? no_layout : (stage ? stage->layout() : cap.layout());
+            if(!rec->start(enc ? enc->config() : (stage ? stage->config() : cap_conf), layout)){ // What reaches the display is recorded
+                printf("[MAIN] Error on recorder start() !\n");
+                return -1;
+            }
+        }
+
+        Logger::startAsync(); // Keep console I/O out of the vsync path
+        FrameSource& src = stage ? static_cast<FrameSource&>(*stage) : cap;
+        ret = runCamera(reactor, disp, cap, src, latency, rec.get(), enc.get(), tap.get());
+        Logger::stopAsync();
+        cap.stop();
     }
 
     printf("[MAIN] Exiting...\n");
-    return 0;
-}
\ No newline at end of file
+    return ret;
+}
@@ -0,0 +1,320 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <netinet/in.h>
+
+#include "metrics.hpp"
+#include "helpers.hpp"
+
+#define MET_MAX_CLIENTS       8
+#define MET_CLIENT_TIMEOUT_MS 1000 // A client that didn't send its request by then is dropped
+#define MET_REQUEST_MAX       2048
+
+static_assert(ATOMIC_LLONG_LOCK_FREE == 2, "metrics are read from another process: 64-bit atomics must be lock-free");
+static_assert(sizeof(metric_slot_t) == METRICS_SLOT_SIZE, "one metric per cache line");
+static_assert(sizeof(std::atomic<uint64_t>) == sizeof(uint64_t), "metric values are plain 64-bit words in shared memory");
+
+typedef struct {
+    const char *name;
+    metric_kind_t kind;
+    const char *help;
+} metric_desc_t;
+
+// In metric_id_t order. Summaries are named once, on their sum, in seconds once rendered.
+static const metric_desc_t s_desc[MET_MAX] = {
+    {"camcap_frames_captured_total", METRIC_COUNTER, "Frames dequeued from the cameras"},
+    {"camcap_frames_displayed_total", METRIC_COUNTER, "Frames that reached the screen"},
+    {"camcap_frames_dropped_total", METRIC_COUNTER, "Frames dropped by the capture driver"},
+    {"camcap_frames_skipped_total", METRIC_COUNTER, "Frames superseded before being committed"},
+    {"camcap_fb_cache_hits_total", METRIC_COUNTER, "Scanout framebuffers found in the cache"},
+    {"camcap_fb_cache_misses_total", METRIC_COUNTER, "Scanout framebuffers created"},
+    {"camcap_buffers", METRIC_GAUGE, "Capture buffers allocated"},
+    {"camcap_buffers_queued", METRIC_GAUGE, "Capture buffers queued to the driver"},
+    {"camcap_buffers_held", METRIC_GAUGE, "Capture buffers held by consumers"},
+    {"camcap_buffer_starved_total", METRIC_COUNTER, "Dequeues that left the driver without a buffer"},
+    {"camcap_buffer_requeue_seconds", METRIC_SUMMARY_SUM, "Capture buffer dequeue to requeue"},
+    {"camcap_buffer_requeue_seconds_count", METRIC_SUMMARY_COUNT, ""},
+    {"camcap_flip_interval_seconds", METRIC_SUMMARY_SUM, "Interval between page flips"},
+    {"camcap_flip_interval_seconds_count", METRIC_SUMMARY_COUNT, ""},
+    {"camcap_end_to_end_seconds", METRIC_SUMMARY_SUM, "Capture to page flip latency"},
+    {"camcap_end_to_end_seconds_count", METRIC_SUMMARY_COUNT, ""},
+    {"camcap_flip_wakeup_seconds", METRIC_SUMMARY_SUM, "Flip event to its handling by the event loop"},
+    {"camcap_flip_wakeup_seconds_count", METRIC_SUMMARY_COUNT, ""},
+    {"camcap_deadline_misses_total", METRIC_COUNTER, "Flip events handled past the wakeup deadline"},
+};
+
+// Until a segment is created
+static metric_slot_t s_local[MET_MAX];
+metric_slot_t *Metrics::s_slots = s_local;
+
+const char *Metrics::name(metric_id_t id)
+{
+    return s_desc[id].name;
+}
+
+metric_kind_t Metrics::kind(metric_id_t id)
+{
+    return s_desc[id].kind;
+}
+
+std::string Metrics::render()
+{
+    std::string out;
+    char line[192];
+
+    out.reserve(4096);
+    for(int i = 0; i < MET_MAX; i++){
+        const metric_desc_t& d = s_desc[i];
+        unsigned long long v = get((metric_id_t)i);
+        switch(d.kind){
+            case METRIC_COUNTER:
+            case METRIC_GAUGE:
+                snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s %s\n%s %llu\n", d.name, d.help, d.name,
+                         (d.kind == METRIC_COUNTER) ? "counter" : "gauge", d.name, v);
+                break;
+            case METRIC_SUMMARY_SUM:
+                snprintf(line, sizeof(line), "# HELP %s %s\n# TYPE %s summary\n%s_sum %llu.%06llu\n", d.name, d.help,
+                         d.name, d.name, v / 1000000ull, v % 1000000ull);
+                break;
+            case METRIC_SUMMARY_COUNT:
+                snprintf(line, sizeof(line), "%s %llu\n", d.name, v);
+                break;
+        }
+        out += line;
+    }
+
+    return out;
+}
+
+MetricsSegment::MetricsSegment(const std::string& name, bool verbose)
+    : m_name(name), m_logger("metrics", verbose)
+{
+    Logger& log = m_logger;
+
+    // A segment left by a previous run is replaced: readers notice the new start_ns
+    shm_unlink(name.c_str());
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_EXCL | O_CLOEXEC, 0644);
+    if(fd < 0){
+        log.fatal("shm_open " + name + " failed: " + strerror(errno));
+    }
+    if(ftruncate(fd, sizeof(metrics_shm_t)) < 0){
+        int err = errno;
+        close(fd);
+        shm_unlink(name.c_str());
+        log.fatal("ftruncate " + name + " failed: " + strerror(err));
+    }
+    void *ptr = mmap(NULL, sizeof(metrics_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if(ptr == MAP_FAILED){
+        shm_unlink(name.c_str());
+        log.fatal("mmap " + name + " failed: " + strerror(errno));
+    }
+    m_shm = (metrics_shm_t *)ptr;
+
+    // Fresh pages are zeroed: the header and names are all there is to fill, then the current values
+    m_shm->version = METRICS_VERSION;
+    m_shm->count = MET_MAX;
+    m_shm->pid = (uint32_t)getpid();
+    m_shm->start_ns = monotonic_ns();
+    for(int i = 0; i < MET_MAX; i++){
+        strncpy(m_shm->names[i].name, s_desc[i].name, METRICS_NAME_LEN - 1);
+        m_shm->names[i].kind = s_desc[i].kind;
+        m_shm->slots[i].value.store(s_local[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    }
+    __atomic_store_n(&m_shm->magic, METRICS_MAGIC, __ATOMIC_RELEASE);
+    Metrics::s_slots = m_shm->slots;
+
+    log.info("Metrics in /dev/shm%s (%zu bytes)", name.c_str(), sizeof(metrics_shm_t));
+}
+
+MetricsSegment::~MetricsSegment()
+{
+    for(int i = 0; i < MET_MAX; i++)
+        s_local[i].value.store(m_shm->slots[i].value.load(std::memory_order_relaxed), std::memory_order_relaxed);
+    Metrics::s_slots = s_local;
+
+    // Mapped readers keep their view, new ones find nothing
+    munmap(m_shm, sizeof(metrics_shm_t));
+    shm_unlink(m_name.c_str());
+}
+
+MetricsServer::MetricsServer(Reactor& reactor, const std::string& address, bool verbose)
+    : m_reactor(reactor), m_address(address), m_logger("metrics", verbose)
+{
+    Logger& log = m_logger;
+    bool tcp = !address.empty() && address.find_first_not_of("0123456789") == std::string::npos;
+    int ret;
+
+    m_fd = socket(tcp ? AF_INET : AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if(m_fd < 0){
+        log.fatal("socket failed: " + std::string(strerror(errno)));
+    }
+
+    if(tcp){
+        struct sockaddr_in sin{};
+        int one = 1;
+        setsockopt(m_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+        sin.sin_family = AF_INET;
+        sin.sin_addr.s_addr = htonl(INADDR_ANY);
+        sin.sin_port = htons((uint16_t)atoi(address.c_str()));
+        ret = bind(m_fd, (struct sockaddr *)&sin, sizeof(sin));
+    } else {
+        struct sockaddr_un sun{};
+        if(address.size() >= sizeof(sun.sun_path)){
+            close(m_fd);
+            log.fatal("Socket path too long: " + address);
+        }
+        sun.sun_family = AF_UNIX;
+        memcpy(sun.sun_path, address.c_str(), address.size());
+        unlink(address.c_str()); // Left by a previous run
+        ret = bind(m_fd, (struct sockaddr *)&sun, sizeof(sun));
+    }
+    if(ret < 0 || listen(m_fd, MET_MAX_CLIENTS) < 0){
+        int err = errno;
+        close(m_fd);
+        log.fatal("Failed to listen on " + address + ": " + strerror(err));
+    }
+
+    log.info("Serving metrics on %s %s", tcp ? "TCP port" : "socket", address.c_str());
+}
+
+MetricsServer::~MetricsServer()
+{
+    while(!m_clients.empty())
+        closeClient(m_clients.size() - 1);
+    if(m_started)
+        m_reactor.removeFd(m_fd);
+    if(m_fd >= 0){
+        close(m_fd);
+        if(m_address.find_first_not_of("0123456789") != std::string::npos)
+            unlink(m_address.c_str());
+    }
+}
+
+bool MetricsServer::start()
+{
+    m_started = m_reactor.addFd(m_fd, POLLIN, [this](short revents){ return handleAccept(revents); });
+    return m_started;
+}
+
+void MetricsServer::closeClient(size_t i)
+{
+    m_reactor.removeFd(m_clients[i].fd);
+    close(m_clients[i].fd);
+    m_clients.erase(m_clients.begin() + i);
+}
+
+void MetricsServer::expireClients(uint64_t now)
+{
+    for(size_t i = 0; i < m_clients.size();){
+        if(now - m_clients[i].accepted_ns >= MET_CLIENT_TIMEOUT_MS * 1000000ull)
+            closeClient(i);
+        else
+            i++;
+    }
+}
+
+bool MetricsServer::handleAccept(short revents)
+{
+    Logger& log = m_logger;
+
+    if(!(revents & POLLIN))
+        return true;
+
+    // Scrapes are rare: stale clients are only looked at when a new one shows up
+    uint64_t now = monotonic_ns();
+    expireClients(now);
+
+    int fd;
+    while((fd = accept4(m_fd, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC)) >= 0){
+        if(m_clients.size() >= MET_MAX_CLIENTS){
+            log.warning("Too many metrics clients, connection refused");
+            close(fd);
+            continue;
+        }
+        if(!m_reactor.addFd(fd, POLLIN, [this, fd](short ev){ return handleClient(fd, ev); })){
+            close(fd);
+            continue;
+        }
+        m_clients.push_back({fd, now, std::string()});
+    }
+    if(errno != EAGAIN && errno != EWOULDBLOCK)
+        log.warning("accept failed: %s", strerror(errno));
+
+    // Errors on the endpoint never stop the capture
+    return true;
+}
+
+bool MetricsServer::handleClient(int fd, short revents)
+{
+    Logger& log = m_logger;
+    size_t i;
+    char buf[512];
+
+    for(i = 0; i < m_clients.size() && m_clients[i].fd != fd; i++);
+    if(i == m_clients.size())
+        return true;
+    client_t& c = m_clients[i];
+
+    // Read whatever arrived, the request is complete at the empty line ending the headers
+    ssize_t n;
+    while((n = read(fd, buf, sizeof(buf))) > 0 && c.request.size() < MET_REQUEST_MAX)
+        c.request.append(buf, (size_t)n);
+    bool eof = (n == 0) || (n < 0 && errno != EAGAIN && errno != EWOULDBLOCK) || (revents & (POLLERR | POLLHUP));
+    bool complete = (c.request.find("\r\n\r\n") != std::string::npos);
+    if(!complete){
+        if(eof || c.request.size() >= MET_REQUEST_MAX)
+            closeClient(i);
+        return true;
+    }
+
+    std::string body;
+    const char *status;
+    if(c.request.compare(0, 13, "GET /metrics ") == 0 || c.request.compare(0, 6, "GET / ") == 0){
+        status = "200 OK";
+        body = Metrics::render();
+    } else {
+        status = "404 Not Found";
+    }
+
+    // A few KB: fits in the socket buffer, the write doesn't block
+    char hdr[160];
+    snprintf(hdr, sizeof(hdr), "HTTP/1.0 %s\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n"
+             "Connection: close\r\n\r\n", status, body.size());
+    std::string resp = hdr + body;
+    n = send(fd, resp.data(), resp.size(), MSG_NOSIGNAL);
+    if(n != (ssize_t)resp.size())
+        log.warning("Metrics response truncated (%zd/%zu bytes)", n, resp.size());
+    closeClient(i);
+
+    return true;
+}
@@ -0,0 +1,486 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+
+#include "multicam.hpp"
+#include "threadsched.hpp"
+
+static void signal_fd(int fd)
+{
+    uint64_t one = 1;
+    ssize_t ret = write(fd, &one, sizeof(one));
+    (void) ret; // Counter saturation only: the reader is awake anyway
+}
+
+static void drain_fd(int fd)
+{
+    uint64_t val = 0;
+    ssize_t ret = read(fd, &val, sizeof(val));
+    (void) ret; // EAGAIN: nothing pending
+}
+
+CameraManager::CameraManager(const std::vector<camera_config>& cams, const multicam_config& conf, bool verbose)
+    : m_config(conf), m_logger("multicam", verbose)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(cams.empty() || cams.size() > MCAM_MAX_CAMERAS){
+        log.fatal("Between 1 and " + std::to_string(MCAM_MAX_CAMERAS) + " cameras are supported");
+    }
+
+    m_ready_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_ready_fd < 0 || m_timer_fd < 0){
+        if(m_ready_fd >= 0)
+            close(m_ready_fd);
+        if(m_timer_fd >= 0)
+            close(m_timer_fd);
+        log.fatal("eventfd/timerfd failed: " + std::string(strerror(errno)));
+    }
+
+    // Open every device, a missing one fails the whole setup
+    for(const auto& c : cams){
+        std::unique_ptr<camera> cam(new camera());
+        cam->device = c.device;
+        cam->cpu = c.cpu;
+        cam->conf = conf.capture;
+        cam->ready.index = -1;
+        cam->to_release.reserve(conf.capture.buf_count);
+        cam->wake_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+        if(cam->wake_fd < 0){
+            log.fatal("eventfd failed: " + std::string(strerror(errno)));
+        }
+        m_cams.push_back(std::move(cam));
+        m_cams.back()->cap.reset(new Capture(c.device, m_cams.back()->conf, verbose));
+    }
+}
+
+void CameraManager::setReleaseCallback(buf_release_cb_t cb)
+{
+    for(auto& cam : m_cams)
+        cam->cap->setReleaseCallback(cb);
+}
+
+bool CameraManager::start()
+{
+    Logger& log = m_logger;
+
+    // Negotiate every camera first: the mosaic needs a single layout
+    for(auto& cam : m_cams){
+        if(!cam->cap->start()){
+            log.error("Failed to start %s", cam->device.c_str());
+            return false;
+        }
+        const frame_layout_t& l0 = m_cams[0]->cap->layout();
+        const frame_layout_t& l = cam->cap->layout();
+        if(l.fourcc != l0.fourcc || l.width != l0.width || l.height != l0.height || l.pitch[0] != l0.pitch[0] || l.offset[1] != l0.offset[1]){
+            log.error("%s negotiated %.4s %ux%u, %s %.4s %ux%u", cam->device.c_str(), (const char*)&l.fourcc, l.width, l.height,
+                      m_cams[0]->device.c_str(), (const char*)&l0.fourcc, l0.width, l0.height);
+            return false;
+        }
+    }
+
+    // Capture threads
+    m_running = true;
+    for(auto& cam : m_cams){
+        camera *c = cam.get();
+        cam->thread = std::thread([this, c](){ captureLoop(*c); });
+    }
+    log.status("%zu cameras started", m_cams.size());
+
+    return true;
+}
+
+void CameraManager::captureLoop(camera& cam)
+{
+    Logger& log = m_logger;
+    Capture& cap = *cam.cap;
+    std::vector<capture_frame_t> releasing;
+    releasing.reserve(cam.conf.buf_count);
+
+    // Affinity: keep the capture path off the cores the display loop runs on. -a overrides the role's CPUs.
+    ThreadSched::apply(THR_CAPTURE);
+    if(cam.cpu >= 0){
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        CPU_SET(cam.cpu, &set);
+        int err = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+        if(err != 0)
+            log.warning("%s: can't pin capture thread on CPU %d: %s", cam.device.c_str(), cam.cpu, strerror(err));
+    }
+
+    struct pollfd fds[2] = {{cap.get_fd(), POLLIN | POLLPRI, 0}, {cam.wake_fd, POLLIN, 0}};
+    while(m_running){
+        if(poll(fds, 2, -1) < 0){
+            if(errno == EINTR)
+                continue;
+            log.error("%s: poll failed: %s", cam.device.c_str(), strerror(errno));
+            break;
+        }
+
+        // Frames given back by the display
+        if(fds[1].revents & POLLIN)
+            drain_fd(cam.wake_fd);
+        {
+            std::lock_guard<std::mutex> lock(cam.mutex);
+            releasing.swap(cam.to_release);
+        }
+        bool ok = true;
+        for(auto& frame : releasing)
+            ok = cap.release(frame) && ok;
+        releasing.clear();
+        if(!ok){
+            log.error("%s: Capture::release Failed !", cam.device.c_str());
+            break;
+        }
+
+        // Device event
+        if(fds[0].revents & POLLPRI){
+            if(!cap.handleEvent() || cap.sourceChanged()){
+                log.error("%s: capture source changed or event error", cam.device.c_str());
+                break;
+            }
+        }
+
+        // Newest frame wins the slot
+        if(fds[0].revents & POLLIN){
+            bool fresh = false;
+            while(true){
+                capture_frame_t frame{};
+                if(!cap.tryDequeue(frame)){
+                    log.error("%s: Capture::tryDequeue Failed !", cam.device.c_str());
+                    ok = false;
+                    break;
+                }
+                if(frame.index < 0)
+                    break;
+
+                // Driver drops, counted here: what the slot overwrites never reaches the event loop
+                uint32_t gap = (cam.has_sequence && frame.sequence > cam.last_sequence + 1) ? frame.sequence - cam.last_sequence - 1 : 0;
+                cam.last_sequence = frame.sequence;
+                cam.has_sequence = true;
+                capture_frame_t old;
+                {
+                    std::lock_guard<std::mutex> lock(cam.mutex);
+                    old = cam.ready;
+                    cam.ready = frame;
+                    cam.set_dropped += gap;
+                    cam.set_replaced += (old.index >= 0) ? 1 : 0;
+                }
+                cam.captured++;
+                cam.dropped += gap;
+                fresh = true;
+                if(old.index >= 0){
+                    cam.replaced++;
+                    ok = cap.release(old) && ok;
+                }
+            }
+            if(fresh)
+                signal_fd(m_ready_fd);
+            if(!ok)
+                break;
+        }
+    }
+
+    // Let the event loop see it
+    if(m_running){
+        cam.failed = true;
+        signal_fd(m_ready_fd);
+    }
+}
+
+bool CameraManager::armTimer(uint64_t deadline_ns)
+{
+    Logger& log = m_logger;
+    struct itimerspec its{};
+
+    its.it_value.tv_sec = deadline_ns / 1000000000ull;
+    its.it_value.tv_nsec = deadline_ns % 1000000000ull;
+    if(timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0){
+        log.error("timerfd_settime failed: %s", strerror(errno));
+        return false;
+    }
+    m_timer_armed = (deadline_ns != 0);
+
+    return true;
+}
+
+bool CameraManager::tryDequeueSet(frame_set_t& set)
+{
+    Logger& log = m_logger;
+    unsigned int n = (unsigned int)m_cams.size();
+    unsigned int fresh = 0;
+    uint64_t oldest = UINT64_MAX, newest = 0;
+
+    set.count = 0;
+    drain_fd(m_ready_fd);
+    drain_fd(m_timer_fd);
+
+    // Snapshot the slots
+    for(unsigned int i = 0; i < n; i++){
+        camera& cam = *m_cams[i];
+        if(cam.failed){
+            log.error("Camera %s stopped", cam.device.c_str());
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(cam.mutex);
+        if(cam.ready.index >= 0){
+            fresh++;
+            oldest = std::min(oldest, cam.ready.timestamp_ns);
+            newest = std::max(newest, cam.ready.timestamp_ns);
+        }
+    }
+    if(!fresh)
+        return true;
+
+    // Incomplete: give the late cameras until the deadline
+    uint64_t deadline = oldest + m_config.max_wait_ns;
+    if(fresh < n && monotonic_ns() < deadline)
+        return m_timer_armed || armTimer(deadline);
+    if(m_timer_armed && !armTimer(0))
+        return false;
+
+    // Take the set. A camera may have delivered since the snapshot, its newer frame joins
+    oldest = UINT64_MAX;
+    newest = 0;
+    for(unsigned int i = 0; i < n; i++){
+        camera& cam = *m_cams[i];
+        std::lock_guard<std::mutex> lock(cam.mutex);
+        set.frames[i] = cam.ready;
+        set.dropped[i] = cam.set_dropped;
+        set.replaced[i] = cam.set_replaced;
+        cam.ready.index = -1;
+        cam.set_dropped = cam.set_replaced = 0;
+        if(set.frames[i].index >= 0){
+            oldest = std::min(oldest, set.frames[i].timestamp_ns);
+            newest = std::max(newest, set.frames[i].timestamp_ns);
+        }
+    }
+    set.count = n;
+    set.spread_ns = newest - oldest;
+
+    // Stats
+    m_sets++;
+    if(fresh < n)
+        m_partial_sets++;
+    m_spread_sum_ns += set.spread_ns;
+    m_spread_max_ns = std::max(m_spread_max_ns, set.spread_ns);
+
+    return true;
+}
+
+bool CameraManager::release(unsigned int cam, capture_frame_t& frame)
+{
+    // Sanity check
+    if(cam >= m_cams.size() || frame.index < 0)
+        return false;
+
+    // Stopped: the buffers are already back with the driver
+    if(!m_running){
+        frame.index = -1;
+        return true;
+    }
+
+    camera& c = *m_cams[cam];
+    {
+        std::lock_guard<std::mutex> lock(c.mutex);
+        c.to_release.push_back(frame);
+    }
+    signal_fd(c.wake_fd);
+    frame.index = -1;
+
+    return true;
+}
+
+bool CameraManager::stop()
+{
+    Logger& log = m_logger;
+    bool ok = true;
+
+    // Threads first, the captures are then ours again
+    if(m_running){
+        m_running = false;
+        for(auto& cam : m_cams)
+            signal_fd(cam->wake_fd);
+        for(auto& cam : m_cams){
+            if(cam->thread.joinable())
+                cam->thread.join();
+        }
+    }
+    armTimer(0);
+
+    for(auto& cam : m_cams){
+        if(cam->ready.index >= 0)
+            ok = cam->cap->release(cam->ready) && ok;
+        for(auto& frame : cam->to_release)
+            ok = cam->cap->release(frame) && ok;
+        cam->to_release.clear();
+        ok = cam->cap->stop() && ok;
+        log.info("%s: %llu frames captured, %llu dropped by the driver, %llu replaced before joining a set", cam->device.c_str(),
+                 (unsigned long long)cam->captured, (unsigned long long)cam->dropped, (unsigned long long)cam->replaced);
+    }
+    if(m_sets){
+        log.info("%llu sets, %llu partial, capture spread avg %llu us max %llu us", (unsigned long long)m_sets,
+                 (unsigned long long)m_partial_sets, (unsigned long long)(m_spread_sum_ns / m_sets / 1000),
+                 (unsigned long long)(m_spread_max_ns / 1000));
+    }
+    m_sets = 0;
+
+    return ok;
+}
+
+CameraManager::~CameraManager()
+{
+    stop();
+    for(auto& cam : m_cams)
+        close(cam->wake_fd);
+    close(m_timer_fd);
+    close(m_ready_fd);
+}
+
+MosaicScheduler::MosaicScheduler(CameraManager& cams, Display& disp, LatencyTracker& latency, bool verbose)
+    : m_cams(cams), m_display(disp), m_latency(latency), m_logger("mosaic", verbose)
+{
+    capture_frame_t none{};
+    none.index = -1;
+    m_pending.assign(cams.count(), none);
+    m_flipping.assign(cams.count(), none);
+    m_on_screen.assign(cams.count(), none);
+    m_fds.assign(cams.count(), -1);
+}
+
+bool MosaicScheduler::commit()
+{
+    Logger& log = m_logger;
+    bool any = false;
+
+    if(m_display.flipPending())
+        return true;
+    for(const auto& f : m_pending)
+        any = any || (f.index >= 0);
+    if(!any)
+        return true;
+
+    // Cameras without a new frame keep their plane
+    uint64_t oldest = UINT64_MAX;
+    for(unsigned int i = 0; i < m_pending.size(); i++){
+        m_fds[i] = (m_pending[i].index >= 0) ? m_pending[i].dma_fd[0] : -1;
+        if(m_pending[i].index >= 0)
+            oldest = std::min(oldest, m_pending[i].timestamp_ns);
+    }
+    if(!m_display.scanoutSet(m_fds)){
+        log.error("Display::scanoutSet Failed !");
+        for(unsigned int i = 0; i < m_pending.size(); i++){
+            if(m_pending[i].index >= 0)
+                m_cams.release(i, m_pending[i]);
+        }
+        return false;
+    }
+    m_commit_ns = monotonic_ns();
+    m_flipping_ns = oldest;
+    for(unsigned int i = 0; i < m_pending.size(); i++){
+        m_flipping[i] = m_pending[i];
+        m_pending[i].index = -1;
+    }
+
+    // Frames are released on the flip event
+    int fence = m_display.takeOutFence();
+    if(fence >= 0)
+        close(fence);
+
+    return true;
+}
+
+bool MosaicScheduler::handleSetReady()
+{
+    Logger& log = m_logger;
+    frame_set_t set{};
+
+    if(!m_cams.tryDequeueSet(set)){
+        log.error("CameraManager::tryDequeueSet Failed !");
+        return false;
+    }
+    for(unsigned int i = 0; i < set.count; i++){
+        capture_frame_t& frame = set.frames[i];
+        m_latency.framesDropped(set.dropped[i]);
+        m_latency.frameSkipped(set.replaced[i]);
+        if(frame.index < 0)
+            continue;
+        if(i == 0)
+            m_latency.frameCaptured(); // Gaps counted by the capture threads, before their slot
+        if(m_pending[i].index >= 0){
+            if(!m_cams.release(i, m_pending[i])){
+                log.error("CameraManager::release Failed !");
+                return false;
+            }
+            m_replaced++;
+            m_latency.frameSkipped();
+        }
+        m_pending[i] = frame;
+    }
+
+    // Display idle: show it right away
+    return commit();
+}
+
+bool MosaicScheduler::handleFlipEvent()
+{
+    Logger& log = m_logger;
+    bool flipped = false;
+
+    if(!m_display.handleEvent()){
+        log.error("Display::handleEvent Failed !");
+        return false;
+    }
+    if(m_display.flipPending())
+        return true;
+
+    // Flip complete: the previous frames of the updated cameras left the screen
+    uint64_t flip_ns = m_display.lastFlipNs();
+    for(unsigned int i = 0; i < m_flipping.size(); i++){
+        if(m_flipping[i].index < 0)
+            continue;
+        if(m_on_screen[i].index >= 0 && !m_cams.release(i, m_on_screen[i])){
+            log.error("CameraManager::release Failed !");
+            return false;
+        }
+        m_on_screen[i] = m_flipping[i];
+        m_flipping[i].index = -1;
+        flipped = true;
+    }
+    if(flipped)
+        m_latency.frameDisplayed(m_flipping_ns, m_commit_ns, flip_ns); // Oldest camera of the set
+    m_latency.flipCompleted(flip_ns);
+
+    // Commit the newest set captured during the last refresh
+    return commit();
+}
@@ -0,0 +1,216 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <csignal>
+#include <unistd.h>
+#include <sys/signalfd.h>
+
+#include "reactor.hpp"
+
+Reactor::Reactor(bool verbose)
+    : m_logger("reactor", verbose)
+{
+}
+
+int Reactor::findFd(int fd)
+{
+    for(size_t i = 0; i < m_pollfds.size(); i++){
+        if(m_pollfds[i].fd == fd)
+            return (int)i;
+    }
+    return -1;
+}
+
+bool Reactor::addFd(int fd, short events, fd_cb_t cb)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(fd < 0 || !cb){
+        log.error("addFd: incorrect arguments");
+        return false;
+    }
+    if(findFd(fd) >= 0){
+        log.error("addFd: fd %d already registered", fd);
+        return false;
+    }
+
+    struct pollfd pfd{};
+    pfd.fd = fd;
+    pfd.events = events;
+    m_pollfds.push_back(pfd);
+    m_callbacks.emplace_back(new fd_cb_t(std::move(cb)));
+
+    log.info("Registered fd %d (events %#x)", fd, events);
+
+    return true;
+}
+
+bool Reactor::modifyFd(int fd, short events)
+{
+    int i = findFd(fd);
+    if(i < 0){
+        m_logger.error("modifyFd: fd %d not registered", fd);
+        return false;
+    }
+
+    m_pollfds[i].events = events;
+
+    return true;
+}
+
+bool Reactor::removeFd(int fd)
+{
+    int i = findFd(fd);
+    if(i < 0){
+        m_logger.error("removeFd: fd %d not registered", fd);
+        return false;
+    }
+
+    // Negative fds are ignored by poll(), actual removal happens after dispatch
+    m_pollfds[i].fd = -1;
+    m_pollfds[i].revents = 0;
+    m_compact = true;
+
+    return true;
+}
+
+void Reactor::compact()
+{
+    for(size_t i = 0; i < m_pollfds.size();){
+        if(m_pollfds[i].fd < 0){
+            m_pollfds.erase(m_pollfds.begin() + i);
+            m_callbacks.erase(m_callbacks.begin() + i);
+        } else {
+            i++;
+        }
+    }
+    m_compact = false;
+}
+
+bool Reactor::addSignals(std::initializer_list<int> signals, signal_cb_t cb)
+{
+    Logger& log = m_logger;
+    sigset_t mask;
+
+    // Sanity check
+    if(m_signalFd >= 0 || !cb){
+        log.error("addSignals: incorrect arguments or signals already registered");
+        return false;
+    }
+
+    // Block the signals so they are only delivered through the signalfd.
+    // Must be called before other threads are spawned so they inherit the mask.
+    sigemptyset(&mask);
+    for(int signo : signals)
+        sigaddset(&mask, signo);
+    if(pthread_sigmask(SIG_BLOCK, &mask, NULL) != 0){
+        log.error("pthread_sigmask failed: %s", strerror(errno));
+        return false;
+    }
+
+    m_signalFd = signalfd(-1, &mask, SFD_NONBLOCK | SFD_CLOEXEC);
+    if(m_signalFd < 0){
+        log.error("signalfd failed: %s", strerror(errno));
+        return false;
+    }
+    m_signal_cb = cb;
+
+    return addFd(m_signalFd, POLLIN, [this](short revents){ return handleSignal(revents); });
+}
+
+bool Reactor::handleSignal(short revents)
+{
+    struct signalfd_siginfo info;
+
+    if(!(revents & POLLIN))
+        return true;
+
+    while(read(m_signalFd, &info, sizeof(info)) == sizeof(info)){
+        m_logger.info("Received signal %u", info.ssi_signo);
+        if(!m_signal_cb(info.ssi_signo))
+            return false;
+    }
+
+    return true;
+}
+
+bool Reactor::run()
+{
+    Logger& log = m_logger;
+
+    log.status("Running event loop...");
+    m_running = true;
+
+    while(m_running){
+        int ret = poll(m_pollfds.data(), m_pollfds.size(), -1);
+        if(ret < 0){
+            if(errno == EINTR)
+                continue;
+            log.error("poll failed: %s", strerror(errno));
+            m_running = false;
+            return false;
+        }
+
+        // Dispatch ready fds. Callbacks may add/modify/remove fds: iterate by index on the current size.
+        size_t count = m_pollfds.size();
+        for(size_t i = 0; i < count && m_running; i++){
+            short revents = m_pollfds[i].revents;
+            if(!revents || m_pollfds[i].fd < 0)
+                continue;
+            m_pollfds[i].revents = 0;
+
+            if(revents & (POLLERR | POLLNVAL)){
+                log.error("fd %d reported an error (revents %#x)", m_pollfds[i].fd, revents);
+            }
+
+            // By reference, no copy: removal is deferred to compact() and adds don't move the callback
+            fd_cb_t& cb = *m_callbacks[i];
+            if(!cb(revents)){
+                log.error("Callback for fd %d failed", m_pollfds[i].fd);
+                m_running = false;
+                return false;
+            }
+        }
+
+        if(m_compact)
+            compact();
+    }
+
+    log.status("Event loop stopped");
+
+    return true;
+}
+
+void Reactor::stop()
+{
+    m_running = false;
+}
+
+Reactor::~Reactor()
+{
+    if(m_signalFd >= 0){
+        close(m_signalFd);
+    }
+}
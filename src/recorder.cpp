@@ -0,0 +1,493 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <system_error>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/uio.h>
+#include <sys/eventfd.h>
+
+#include "helpers.hpp"
+#include "recorder.hpp"
+#include "threadsched.hpp"
+
+Recorder::Recorder(const recorder_config& conf, bool verbose)
+    : m_config(conf), m_logger("recorder", verbose)
+{
+    Logger& log = m_logger;
+
+    if(m_config.path.empty()){
+        log.fatal("No recording path given");
+    }
+    if(m_config.segment_size && m_config.segment_size < CC_ALIGN){
+        log.fatal("Segment size must be at least " + std::to_string(CC_ALIGN) + " bytes");
+    }
+    m_config.segment_size = cc_align_up(m_config.segment_size);
+
+    // Header blocks: written with O_DIRECT, must be aligned
+    void* block = nullptr;
+    if(posix_memalign(&block, CC_ALIGN, CC_ALIGN) != 0){
+        log.fatal("Failed to allocate file header");
+    }
+    memset(block, 0, CC_ALIGN);
+    m_file_hdr = static_cast<cc_file_hdr_t*>(block);
+    for(unsigned int i = 0; i < REC_QUEUE_DEPTH; i++){
+        if(posix_memalign(&block, CC_ALIGN, CC_ALIGN) != 0){
+            for(unsigned int j = 0; j < i; j++)
+                free(m_slots[j].hdr);
+            free(m_file_hdr);
+            log.fatal("Failed to allocate record headers");
+        }
+        memset(block, 0, CC_ALIGN);
+        m_slots[i].hdr = static_cast<cc_frame_hdr_t*>(block);
+        m_slots[i].frame.index = -1;
+        m_slots[i].written = false;
+    }
+
+    m_wake_fd = eventfd(0, EFD_CLOEXEC);
+    m_done_fd = eventfd(0, EFD_CLOEXEC | EFD_NONBLOCK);
+    if(m_wake_fd < 0 || m_done_fd < 0){
+        if(m_wake_fd >= 0) close(m_wake_fd);
+        if(m_done_fd >= 0) close(m_done_fd);
+        for(auto& slot : m_slots)
+            free(slot.hdr);
+        free(m_file_hdr);
+        log.fatal("eventfd failed: " + std::string(strerror(errno)));
+    }
+}
+
+std::string Recorder::segmentPath(unsigned int segment)
+{
+    if(!m_config.segment_size)
+        return m_config.path;
+
+    char suffix[16];
+    snprintf(suffix, sizeof(suffix), ".%04u", segment);
+    return m_config.path + suffix;
+}
+
+bool Recorder::openSegment()
+{
+    Logger& log = m_logger;
+    std::string path = segmentPath(m_segment);
+    int flags = O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC;
+
+    // Open file
+    m_file_fd = -1;
+    if(m_config.direct_io){
+        m_file_fd = open(path.c_str(), flags | O_DIRECT, 0644);
+        if(m_file_fd < 0 && errno == EINVAL){
+            log.warning("O_DIRECT not supported for %s, using buffered I/O", path.c_str());
+            m_config.direct_io = false;
+        }
+    }
+    if(m_file_fd < 0 && !m_config.direct_io){
+        m_file_fd = open(path.c_str(), flags, 0644);
+    }
+    if(m_file_fd < 0){
+        log.error("Failed to open %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    // Preallocate: keeps the file contiguous and the metadata updates out of the write path
+    uint64_t prealloc = m_config.segment_size ? m_config.segment_size : m_config.prealloc_size;
+    m_alloc_size = 0;
+    if(prealloc && fallocate(m_file_fd, 0, 0, (off_t)prealloc) < 0){
+        log.warning("fallocate(%llu) failed on %s: %s", (unsigned long long)prealloc, path.c_str(), strerror(errno));
+        m_config.prealloc_size = 0;
+    }
+    else {
+        m_alloc_size = prealloc;
+    }
+
+    // Rolling segments: drop the oldest
+    if(m_config.segment_size && m_config.max_segments && m_segment >= m_config.max_segments){
+        std::string oldest = segmentPath(m_segment - m_config.max_segments);
+        if(unlink(oldest.c_str()) < 0 && errno != ENOENT){
+            log.warning("Failed to remove %s: %s", oldest.c_str(), strerror(errno));
+        }
+    }
+
+    // File header, completed with the index location when closing
+    m_file_hdr->segment = m_segment;
+    m_file_hdr->frame_count = 0;
+    m_file_hdr->index_offset = 0;
+    ssize_t ret = pwrite(m_file_fd, m_file_hdr, CC_ALIGN, 0);
+    if(ret < 0 && errno == EINVAL && m_config.direct_io && reopenBuffered())
+        ret = pwrite(m_file_fd, m_file_hdr, CC_ALIGN, 0);
+    if(ret != CC_ALIGN){
+        log.error("Failed to write file header to %s: %s", path.c_str(), strerror(errno));
+        close(m_file_fd);
+        m_file_fd = -1;
+        return false;
+    }
+    m_offset = CC_ALIGN;
+    m_index.clear();
+
+    log.info("Recording to %s", path.c_str());
+
+    return true;
+}
+
+bool Recorder::reopenBuffered()
+{
+    Logger& log = m_logger;
+    std::string path = segmentPath(m_segment);
+
+    // Same file, no truncation: what was written and the preallocation stay
+    int fd = open(path.c_str(), O_WRONLY | O_CLOEXEC);
+    if(fd < 0){
+        log.error("Failed to reopen %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    close(m_file_fd);
+    m_file_fd = fd;
+    m_config.direct_io = false;
+    log.warning("O_DIRECT writes refused for %s, using buffered I/O", path.c_str());
+
+    return true;
+}
+
+void Recorder::closeSegment()
+{
+    Logger& log = m_logger;
+
+    if(m_file_fd < 0)
+        return;
+
+    // Trailing index
+    uint64_t index_size = cc_index_size(m_index.size());
+    void* block = nullptr;
+    if(posix_memalign(&block, CC_ALIGN, index_size) == 0){
+        memset(block, 0, index_size);
+        cc_index_hdr_t *ihdr = static_cast<cc_index_hdr_t*>(block);
+        ihdr->magic = CC_INDEX_MAGIC;
+        ihdr->frame_count = m_index.size();
+        if(!m_index.empty())
+            memcpy(ihdr + 1, m_index.data(), m_index.size() * sizeof(cc_index_entry_t));
+
+        if(pwrite(m_file_fd, block, index_size, (off_t)m_offset) == (ssize_t)index_size){
+            // Point the header to it
+            m_file_hdr->frame_count = m_index.size();
+            m_file_hdr->index_offset = m_offset;
+            if(pwrite(m_file_fd, m_file_hdr, CC_ALIGN, 0) != CC_ALIGN)
+                log.warning("Failed to update file header: %s", strerror(errno));
+            m_offset += index_size;
+        }
+        else {
+            log.warning("Failed to write index: %s. Readers will scan the records", strerror(errno));
+        }
+        free(block);
+    }
+    else {
+        log.warning("Failed to allocate index, readers will scan the records");
+    }
+
+    // Give back the preallocated tail
+    if(ftruncate(m_file_fd, (off_t)m_offset) < 0){
+        log.warning("ftruncate failed: %s", strerror(errno));
+    }
+    close(m_file_fd);
+    m_file_fd = -1;
+}
+
+bool Recorder::writeFrame(rec_slot_t& slot)
+{
+    Logger& log = m_logger;
+    const capture_frame_t& frame = slot.frame;
+    cc_frame_hdr_t *hdr = slot.hdr;
+    struct iovec iov[1 + VIDEO_MAX_PLANES];
+    int iovcnt = 0;
+
+    // Header block
+    hdr->magic = CC_FRAME_MAGIC;
+    hdr->sequence = frame.sequence;
+    hdr->timestamp_ns = frame.timestamp_ns;
+    hdr->num_planes = frame.num_planes;
+    iov[iovcnt].iov_base = hdr;
+    iov[iovcnt].iov_len = CC_ALIGN;
+    iovcnt++;
+    uint64_t record_size = CC_ALIGN;
+
+    // Planes: straight from the V4L2 mapping. Padding reads stay within the mapped pages.
+    for(unsigned int p = 0; p < frame.num_planes; p++){
+        hdr->bytesused[p] = frame.bytesused[p];
+        hdr->padded_size[p] = (uint32_t)cc_align_up(frame.bytesused[p]);
+        if(!hdr->padded_size[p])
+            continue;
+        iov[iovcnt].iov_base = frame.plane_addr[p];
+        iov[iovcnt].iov_len = hdr->padded_size[p];
+        iovcnt++;
+        record_size += hdr->padded_size[p];
+    }
+
+    // Next segment
+    if(m_config.segment_size && m_offset > 0 && m_offset + record_size > m_config.segment_size){
+        closeSegment();
+        m_segment++;
+        if(!openSegment())
+            return false;
+    }
+
+    // Single file: grow the preallocation ahead of the writes, one chunk at a time
+    if(!m_config.segment_size && m_config.prealloc_size && m_offset + record_size > m_alloc_size){
+        uint64_t size = m_offset + record_size + m_config.prealloc_size;
+        if(fallocate(m_file_fd, 0, (off_t)m_alloc_size, (off_t)(size - m_alloc_size)) < 0){
+            log.warning("fallocate(%llu) failed: %s, no more preallocation", (unsigned long long)size, strerror(errno));
+            m_config.prealloc_size = 0;
+        }
+        else {
+            m_alloc_size = size;
+        }
+    }
+
+    // Write the whole record, resuming on short writes
+    uint64_t done = 0;
+    int first = 0;
+    while(done < record_size){
+        ssize_t ret = pwritev(m_file_fd, &iov[first], iovcnt - first, (off_t)(m_offset + done));
+        if(ret < 0){
+            if(errno == EINTR)
+                continue;
+            // Opened, but direct writes refused: block size above CC_ALIGN, or planes direct I/O can't pin (EFAULT)
+            if((errno == EINVAL || errno == EFAULT) && m_config.direct_io && !m_direct_ok && reopenBuffered())
+                continue;
+            log.error("pwritev failed at offset %llu: %s", (unsigned long long)(m_offset + done), strerror(errno));
+            return false;
+        }
+        done += (uint64_t)ret;
+        while(ret > 0 && first < iovcnt){
+            if((size_t)ret >= iov[first].iov_len){
+                ret -= (ssize_t)iov[first].iov_len;
+                first++;
+            }
+            else {
+                iov[first].iov_base = static_cast<char*>(iov[first].iov_base) + ret;
+                iov[first].iov_len -= (size_t)ret;
+                ret = 0;
+            }
+        }
+    }
+    m_direct_ok = true;
+    cc_index_entry_t entry{};
+    entry.offset = m_offset;
+    entry.timestamp_ns = frame.timestamp_ns;
+    entry.sequence = frame.sequence;
+    m_index.push_back(entry);
+
+    m_offset += record_size;
+    m_bytes += record_size;
+    m_frames++;
+
+    return true;
+}
+
+void Recorder::writerLoop()
+{
+    Logger& log = m_logger;
+
+    ThreadSched::apply(THR_WRITER);
+
+    while(true){
+        uint64_t head = m_head.load(std::memory_order_acquire);
+        uint64_t written = m_written.load(std::memory_order_relaxed);
+
+        // Nothing to write: sleep until submit() or stop()
+        if(written == head){
+            // Stopping: leave once everything submitted before stop() is written
+            if(!m_running.load(std::memory_order_acquire)){
+                if(m_head.load(std::memory_order_acquire) == written)
+                    break;
+                continue;
+            }
+            uint64_t v;
+            if(read(m_wake_fd, &v, sizeof(v)) < 0 && errno != EINTR){
+                log.error("Writer wake up failed: %s", strerror(errno));
+                break;
+            }
+            continue;
+        }
+
+        // Write in submission order. After an error frames are only handed back.
+        rec_slot_t& slot = m_slots[written % REC_QUEUE_DEPTH];
+        slot.written = false;
+        if(!m_failed){
+            slot.written = writeFrame(slot);
+            if(!slot.written){
+                log.error("Recording stopped after %llu frames", (unsigned long long)m_frames);
+                m_failed = true;
+            }
+        }
+        m_written.store(written + 1, std::memory_order_release);
+
+        // Notify completion
+        uint64_t one = 1;
+        if(write(m_done_fd, &one, sizeof(one)) < 0){
+            log.error("Completion notify failed: %s", strerror(errno));
+        }
+    }
+
+    closeSegment();
+}
+
+bool Recorder::start(const capture_config& conf, const frame_layout_t& layout)
+{
+    Logger& log = m_logger;
+
+    if(m_running.load()){
+        log.error("Recorder already started");
+        return false;
+    }
+
+    // Format
+    m_file_hdr->magic = CC_FILE_MAGIC;
+    m_file_hdr->version = CC_VERSION;
+    memcpy(m_file_hdr->fourcc, conf.fmt_fourcc.c_str(), sizeof(m_file_hdr->fourcc));
+    m_file_hdr->width = conf.width;
+    m_file_hdr->height = conf.height;
+    m_file_hdr->mem_type = conf.mem_type;
+    m_file_hdr->buf_count = conf.buf_count;
+    m_file_hdr->layout_fourcc = layout.fourcc;
+    m_file_hdr->num_planes = layout.fourcc ? layout.num_planes : 0;
+    for(uint32_t p = 0; p < LAYOUT_MAX_PLANES; p++){
+        m_file_hdr->pitch[p] = layout.pitch[p];
+        m_file_hdr->offset[p] = layout.offset[p];
+        m_file_hdr->mem_plane[p] = layout.mem_plane[p];
+    }
+
+    m_segment = 0;
+    m_failed = false;
+    m_direct_ok = false;
+    if(!openSegment()){
+        log.error("Recorder::openSegment Failed !");
+        return false;
+    }
+
+    m_start_ns = monotonic_ns();
+    m_running.store(true, std::memory_order_release);
+    try{
+        m_writer = std::thread(&Recorder::writerLoop, this);
+    } catch(const std::system_error& e){
+        log.error("Failed to start writer thread: %s", e.what());
+        m_running.store(false);
+        closeSegment();
+        return false;
+    }
+
+    log.status("Recording started (%s I/O)", m_config.direct_io ? "direct" : "buffered");
+
+    return true;
+}
+
+bool Recorder::submit(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    // Sanity check
+    if(frame.index < 0 || !m_running.load(std::memory_order_relaxed))
+        return false;
+    for(unsigned int p = 0; p < frame.num_planes; p++){
+        if(!frame.plane_addr[p]){
+            log.error("submit: buffer %d plane %u has no CPU mapping", frame.index, p);
+            return false;
+        }
+    }
+
+    // Queue full: the writer can't keep up, drop this frame from the recording
+    uint64_t head = m_head.load(std::memory_order_relaxed);
+    if(head - m_tail >= REC_QUEUE_DEPTH){
+        m_dropped++;
+        if(m_drop_rl.allow())
+            log.warning("Storage too slow, frame %u not recorded (%u similar messages suppressed)", frame.sequence, m_drop_rl.takeSuppressed());
+        return false;
+    }
+
+    m_slots[head % REC_QUEUE_DEPTH].frame = frame;
+    m_head.store(head + 1, std::memory_order_release);
+
+    // Wake up writer
+    uint64_t one = 1;
+    if(write(m_wake_fd, &one, sizeof(one)) < 0){
+        log.error("Writer wake up failed: %s", strerror(errno));
+    }
+
+    return true;
+}
+
+bool Recorder::collect(std::vector<capture_frame_t>& done)
+{
+    Logger& log = m_logger;
+
+    // Clear the completion counter
+    uint64_t v;
+    if(read(m_done_fd, &v, sizeof(v)) < 0 && errno != EAGAIN){
+        log.error("Completion read failed: %s", strerror(errno));
+        return false;
+    }
+
+    uint64_t written = m_written.load(std::memory_order_acquire);
+    while(m_tail < written){
+        rec_slot_t& slot = m_slots[m_tail % REC_QUEUE_DEPTH];
+        done.push_back(slot.frame);
+        slot.frame.index = -1;
+        m_tail++;
+    }
+
+    return true;
+}
+
+bool Recorder::stop()
+{
+    Logger& log = m_logger;
+
+    if(!m_running.load())
+        return true;
+
+    // The writer drains the queue before leaving
+    m_running.store(false, std::memory_order_release);
+    uint64_t one = 1;
+    if(write(m_wake_fd, &one, sizeof(one)) < 0){
+        log.error("Writer wake up failed: %s", strerror(errno));
+    }
+    m_writer.join();
+
+    uint64_t elapsed_ns = monotonic_ns() - m_start_ns;
+    double mb = (double)m_bytes / (1024.0 * 1024.0);
+    log.status("Recorded %llu frames, %.1f MB (%.1f MB/s), %llu dropped", (unsigned long long)m_frames, mb,
+               elapsed_ns ? mb * 1e9 / (double)elapsed_ns : 0.0, (unsigned long long)m_dropped);
+
+    return !m_failed;
+}
+
+Recorder::~Recorder()
+{
+    stop();
+
+    close(m_wake_fd);
+    close(m_done_fd);
+    for(auto& slot : m_slots)
+        free(slot.hdr);
+    free(m_file_hdr);
+}
@@ -0,0 +1,309 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <algorithm>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/ioctl.h>
+#include <sys/timerfd.h>
+#include <linux/dma-buf.h>
+
+#include "replay.hpp"
+
+ReplaySource::ReplaySource(const std::string& path, bool verbose)
+    : m_reader(path, verbose), m_logger("replay", verbose)
+{
+    Logger& log = m_logger;
+
+    // We support only NV12 for now, same as the display
+    m_config = m_reader.captureConfig();
+    if(m_config.fmt_fourcc != "NV12" && m_config.fmt_fourcc != "NM12"){
+        log.fatal("Replay only supports NV12 recordings, got " + m_config.fmt_fourcc);
+    }
+    if(m_reader.layout(m_layout) && m_layout.num_planes != 2){
+        log.fatal("Replay expects 2 planes in the recorded layout, got " + std::to_string(m_layout.num_planes));
+    }
+
+    m_timer_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if(m_timer_fd < 0){
+        log.fatal("timerfd_create failed: " + std::string(strerror(errno)));
+    }
+}
+
+bool ReplaySource::importBuffers(const std::vector<dmabuf_t>& bufs)
+{
+    Logger& log = m_logger;
+
+    if(bufs.empty()){
+        log.error("importBuffers: no buffer");
+        return false;
+    }
+
+    for(const auto& dbuf : bufs){
+        void* mapped = mmap(NULL, dbuf.size, PROT_READ | PROT_WRITE, MAP_SHARED, dbuf.fd, 0);
+        if(mapped == MAP_FAILED){
+            log.error("mmap failed for dma_fd %d: %s", dbuf.fd, strerror(errno));
+            return false;
+        }
+        replay_buf_t rbuf{};
+        rbuf.dbuf = dbuf;
+        rbuf.addr = mapped;
+        rbuf.state = REPLAY_BUF_FREE;
+        m_bufs.push_back(rbuf);
+    }
+    m_ready.reserve(m_bufs.size());
+
+    log.info("Imported %zu buffers", m_bufs.size());
+
+    return true;
+}
+
+bool ReplaySource::upload(replay_buf_t& rbuf, uint64_t n)
+{
+    Logger& log = m_logger;
+    cc_frame_t frame;
+
+    if(!m_reader.getFrame(n, frame)){
+        log.error("ContainerReader::getFrame Failed for frame %llu", (unsigned long long)n);
+        return false;
+    }
+    const cc_frame_hdr_t *hdr = frame.hdr;
+    uint32_t width = m_config.width;
+    uint32_t height = m_config.height;
+    uint32_t pitch = rbuf.dbuf.pitch;
+
+    // Source layout: contiguous NV12 in one plane, or Y and UV planes
+    uint32_t y_stride, uv_stride;
+    const uint8_t *y_src = frame.plane[0];
+    const uint8_t *uv_src;
+    if(m_layout.fourcc){
+        if(m_layout.num_mem_planes > hdr->num_planes){
+            log.error("upload: frame has %u planes, layout needs %u", hdr->num_planes, m_layout.num_mem_planes);
+            return false;
+        }
+        y_stride = m_layout.pitch[0];
+        uv_stride = m_layout.pitch[1];
+        y_src = frame.plane[m_layout.mem_plane[0]] + m_layout.offset[0];
+        uv_src = frame.plane[m_layout.mem_plane[1]] + m_layout.offset[1];
+        if((uint64_t)m_layout.offset[0] + (uint64_t)y_stride * height > hdr->bytesused[m_layout.mem_plane[0]] ||
+           (uint64_t)m_layout.offset[1] + (uint64_t)uv_stride * (height / 2) > hdr->bytesused[m_layout.mem_plane[1]]){
+            log.error("Frame %llu is smaller than its recorded layout", (unsigned long long)n);
+            return false;
+        }
+    }
+    else if(hdr->num_planes >= 2){
+        y_stride = hdr->bytesused[0] / height;
+        uv_stride = hdr->bytesused[1] / (height / 2);
+        uv_src = frame.plane[1];
+    }
+    else {
+        y_stride = uv_stride = hdr->bytesused[0] / (height * 3 / 2);
+        uv_src = y_src + (size_t)y_stride * height;
+    }
+    uint32_t row = std::min(std::min(width, y_stride), std::min(uv_stride, pitch));
+    if(!row || (uint64_t)pitch * height * 3 / 2 > rbuf.dbuf.size){
+        log.error("Frame %llu doesn't fit the replay buffers", (unsigned long long)n);
+        return false;
+    }
+
+    // Upload, bracketed for CPU cache maintenance
+    struct dma_buf_sync sync{};
+    sync.flags = DMA_BUF_SYNC_START | DMA_BUF_SYNC_WRITE;
+    ioctl(rbuf.dbuf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    uint8_t *dst = static_cast<uint8_t*>(rbuf.addr);
+    for(uint32_t y = 0; y < height; y++)
+        memcpy(dst + (size_t)y * pitch, y_src + (size_t)y * y_stride, row);
+    dst += (size_t)pitch * height;
+    for(uint32_t y = 0; y < height / 2; y++)
+        memcpy(dst + (size_t)y * pitch, uv_src + (size_t)y * uv_stride, row);
+
+    sync.flags = DMA_BUF_SYNC_END | DMA_BUF_SYNC_WRITE;
+    ioctl(rbuf.dbuf.fd, DMA_BUF_IOCTL_SYNC, &sync);
+
+    rbuf.rec_ts_ns = hdr->timestamp_ns;
+    rbuf.sequence = hdr->sequence;
+
+    return true;
+}
+
+bool ReplaySource::fill()
+{
+    Logger& log = m_logger;
+
+    for(unsigned int i = 0; i < m_bufs.size() && m_next_frame < m_reader.frameCount(); i++){
+        replay_buf_t& rbuf = m_bufs[i];
+        if(rbuf.state != REPLAY_BUF_FREE)
+            continue;
+        if(!upload(rbuf, m_next_frame)){
+            log.error("Upload failed for frame %llu", (unsigned long long)m_next_frame);
+            return false;
+        }
+        rbuf.state = REPLAY_BUF_READY;
+        m_ready.push_back(i);
+        m_next_frame++;
+
+        // Double buffering on the storage side: read the next frame while this one waits
+        m_reader.prefetch(m_next_frame);
+    }
+
+    return true;
+}
+
+uint64_t ReplaySource::dueNs(const replay_buf_t& rbuf)
+{
+    if(m_fast)
+        return 0;
+    return m_start_ns + (rbuf.rec_ts_ns - m_first_ts_ns);
+}
+
+bool ReplaySource::armTimer()
+{
+    Logger& log = m_logger;
+    struct itimerspec its{};
+
+    // Nothing uploaded: disarm
+    if(!m_ready.empty()){
+        uint64_t due = std::max(dueNs(m_bufs[m_ready.front()]), (uint64_t)1); // 0 disarms, past fires now
+        its.it_value.tv_sec = due / 1000000000ull;
+        its.it_value.tv_nsec = due % 1000000000ull;
+    }
+    if(timerfd_settime(m_timer_fd, TFD_TIMER_ABSTIME, &its, NULL) < 0){
+        log.error("timerfd_settime failed: %s", strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+bool ReplaySource::start(bool fast)
+{
+    Logger& log = m_logger;
+
+    if(m_bufs.empty()){
+        log.error("Call importBuffers() before start()");
+        return false;
+    }
+
+    m_fast = fast;
+    m_next_frame = 0;
+    m_ready.clear();
+    if(!fill()){
+        log.error("ReplaySource::fill Failed !");
+        return false;
+    }
+    m_first_ts_ns = m_bufs[m_ready.front()].rec_ts_ns;
+    m_start_ns = monotonic_ns();
+
+    log.status("Replaying %llu frames (%s)", (unsigned long long)m_reader.frameCount(), fast ? "as fast as possible" : "recorded pace");
+
+    return armTimer();
+}
+
+bool ReplaySource::tryDequeue(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    frame.index = -1;
+
+    // Clear expirations, due times are checked below
+    uint64_t expirations;
+    if(read(m_timer_fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN){
+        log.error("timerfd read failed: %s", strerror(errno));
+        return false;
+    }
+
+    // Oldest uploaded frame, if due
+    uint64_t now = monotonic_ns();
+    if(!m_ready.empty() && dueNs(m_bufs[m_ready.front()]) <= now){
+        int index = m_ready.front();
+        m_ready.erase(m_ready.begin());
+        replay_buf_t& rbuf = m_bufs[index];
+        rbuf.state = REPLAY_BUF_OUT;
+
+        // Fill the handle
+        frame.index = index;
+        frame.num_planes = 1;
+        frame.bytesused[0] = rbuf.dbuf.pitch * m_config.height * 3 / 2;
+        frame.dma_fd[0] = rbuf.dbuf.fd;
+        frame.plane_addr[0] = rbuf.addr;
+        frame.timestamp_ns = m_fast ? now : dueNs(rbuf);
+        frame.sequence = rbuf.sequence;
+    }
+
+    return armTimer();
+}
+
+bool ReplaySource::retain(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_bufs.size() || m_bufs[index].state != REPLAY_BUF_OUT){
+        log.error("retain: buffer %d is not handed out", index);
+        return false;
+    }
+
+    m_bufs[index].users++;
+
+    return true;
+}
+
+bool ReplaySource::release(capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+    int index = frame.index;
+
+    // Sanity check
+    if(index < 0 || (unsigned int)index >= m_bufs.size() || m_bufs[index].state != REPLAY_BUF_OUT){
+        log.error("release: buffer %d is not handed out", index);
+        return false;
+    }
+    frame.index = -1;
+
+    // Still held by someone else
+    replay_buf_t& rbuf = m_bufs[index];
+    if(rbuf.users > 0){
+        rbuf.users--;
+        return true;
+    }
+
+    // Upload the next frame right away, it is ready before it is due
+    rbuf.state = REPLAY_BUF_FREE;
+    if(!fill()){
+        log.error("ReplaySource::fill Failed !");
+        return false;
+    }
+
+    return armTimer();
+}
+
+ReplaySource::~ReplaySource()
+{
+    for(auto& rbuf : m_bufs){
+        munmap(rbuf.addr, rbuf.dbuf.size);
+    }
+    close(m_timer_fd);
+}
@@ -0,0 +1,134 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <drm/drm_fourcc.h>
+
+#include "rga.hpp"
+
+// Formats used by camcap, RK_FORMAT_* name the byte order in memory
+static int rga_format(uint32_t fourcc)
+{
+    switch(fourcc){
+        case DRM_FORMAT_NV12:     return RK_FORMAT_YCbCr_420_SP;
+        case DRM_FORMAT_NV16:     return RK_FORMAT_YCbCr_422_SP;
+        case DRM_FORMAT_YUYV:     return RK_FORMAT_YUYV_422;
+        case DRM_FORMAT_XRGB8888: return RK_FORMAT_BGRX_8888;
+        default:                  return -1;
+    }
+}
+
+static uint32_t rga_bytes_per_pixel(uint32_t fourcc)
+{
+    switch(fourcc){
+        case DRM_FORMAT_YUYV:     return 2;
+        case DRM_FORMAT_XRGB8888: return 4;
+        default:                  return 1; // Semi-planar: luma plane
+    }
+}
+
+RgaEngine::RgaEngine(bool verbose)
+    : m_logger("rga", verbose)
+{
+    Logger& log = m_logger;
+    log.info("RGA 2D engine enabled");
+}
+
+bool RgaEngine::supported(uint32_t src_fourcc, uint32_t dst_fourcc)
+{
+    return rga_format(src_fourcc) >= 0 && rga_format(dst_fourcc) >= 0;
+}
+
+bool RgaEngine::wrap(const rga_image_t& img, rga_buffer_t& out)
+{
+    Logger& log = m_logger;
+
+    // Import once, the handle then lives as long as the fd
+    auto it = m_handles.find(img.fd);
+    if(it == m_handles.end()){
+        rga_buffer_handle_t handle = importbuffer_fd(img.fd, (int)img.size);
+        if(!handle){
+            log.error("importbuffer_fd failed for dma_fd %d", img.fd);
+            return false;
+        }
+        it = m_handles.insert(std::make_pair(img.fd, handle)).first;
+        log.info("Imported dma_fd %d (handle %d)", img.fd, (int)handle);
+    }
+
+    // Strides are in pixels for the RGA
+    out = wrapbuffer_handle(it->second, (int)img.width, (int)img.height, rga_format(img.fourcc),
+                            (int)(img.stride / rga_bytes_per_pixel(img.fourcc)), (int)(img.rows ? img.rows : img.height));
+
+    return true;
+}
+
+bool RgaEngine::process(const rga_image_t& src, const rga_image_t& dst, unsigned int rotation)
+{
+    Logger& log = m_logger;
+    rga_buffer_t rsrc{}, rdst{}, pat{};
+    im_rect srect{}, drect{}, prect{};
+    int usage = IM_SYNC;
+
+    // Sanity check
+    if(!supported(src.fourcc, dst.fourcc)){
+        log.error("process: unsupported formats");
+        return false;
+    }
+    switch(rotation){
+        case 0:   break;
+        case 90:  usage |= IM_HAL_TRANSFORM_ROT_90; break;
+        case 180: usage |= IM_HAL_TRANSFORM_ROT_180; break;
+        case 270: usage |= IM_HAL_TRANSFORM_ROT_270; break;
+        default:
+            log.error("process: invalid rotation %u", rotation);
+            return false;
+    }
+
+    if(!wrap(src, rsrc) || !wrap(dst, rdst))
+        return false;
+
+    // Whole images: the engine scales src to dst
+    srect = {0, 0, (int)src.width, (int)src.height};
+    drect = {0, 0, (int)dst.width, (int)dst.height};
+    IM_STATUS status = improcess(rsrc, rdst, pat, srect, drect, prect, usage);
+    if(status != IM_STATUS_SUCCESS){
+        log.error("improcess failed: %s", imStrError(status));
+        return false;
+    }
+
+    return true;
+}
+
+void RgaEngine::forget(int fd)
+{
+    auto it = m_handles.find(fd);
+    if(it != m_handles.end()){
+        releasebuffer_handle(it->second);
+        m_handles.erase(it);
+    }
+}
+
+RgaEngine::~RgaEngine()
+{
+    for(auto& h : m_handles){
+        releasebuffer_handle(h.second);
+    }
+}
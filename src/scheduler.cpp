@@ -0,0 +1,360 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <algorithm>
+#include "helpers.hpp"
+#include "scheduler.hpp"
+
+FrameScheduler::FrameScheduler(FrameSource& src, Display& disp, LatencyTracker& latency, Reactor& reactor, bool verbose)
+    : m_source(src), m_display(disp), m_latency(latency), m_reactor(reactor), m_logger("scheduler", verbose)
+{
+    m_pending.index = -1;
+    m_flipping.index = -1;
+    m_on_screen.index = -1;
+}
+
+bool FrameScheduler::commit()
+{
+    Logger& log = m_logger;
+
+    if(m_pending.index < 0 || m_display.flipPending())
+        return true;
+
+    if(!m_display.scanout(m_pending.dma_fd[0])){
+        log.error("Display::scanout Failed for buffer %d !", m_pending.index);
+        m_source.release(m_pending);
+        return false;
+    }
+    m_commit_ns = monotonic_ns();
+    m_flipping = m_pending;
+    m_pending.index = -1;
+
+    // Explicit sync: the fence signals once the buffer on screen is replaced
+    int fence = m_display.takeOutFence();
+    if(fence >= 0){
+        if(m_on_screen.index < 0){
+            close(fence);
+        }
+        else {
+            if(!releaseOnFence(fence, m_on_screen))
+                return false;
+            m_on_screen.index = -1; // Owned by the fence now
+        }
+    }
+
+    return true;
+}
+
+bool FrameScheduler::releaseOnFence(int fence, const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    bool ok = m_reactor.addFd(fence, POLLIN, [this, fence](short revents){
+        (void) revents;
+        return handleFence(fence);
+    });
+    if(!ok){
+        log.error("Failed to wait on out fence %d", fence);
+        close(fence);
+        capture_frame_t ref = frame;
+        m_source.release(ref);
+        return false;
+    }
+    m_fences.push_back({fence, frame});
+
+    return true;
+}
+
+bool FrameScheduler::handleFence(int fence)
+{
+    auto it = std::find_if(m_fences.begin(), m_fences.end(), [fence](const fence_wait_t& w){ return w.fd == fence; });
+    if(it == m_fences.end())
+        return true;
+    capture_frame_t frame = it->frame;
+    m_fences.erase(it);
+    m_reactor.removeFd(fence);
+    close(fence);
+
+    return m_source.release(frame);
+}
+
+bool FrameScheduler::record(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    // The recorder holds its own reference until the frame is written
+    if(!m_source.retain(frame)){
+        log.error("FrameSource::retain Failed !");
+        return false;
+    }
+    if(!m_recorder->submit(frame)){
+        capture_frame_t ref = frame;
+        return m_source.release(ref); // Not recorded: drop our reference
+    }
+
+    return true;
+}
+
+bool FrameScheduler::encode(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    // Shared with the display: the encoder holds its own reference until it read the frame
+    if(!m_source.retain(frame)){
+        log.error("FrameSource::retain Failed !");
+        return false;
+    }
+    if(!m_encoder->submit(frame)){
+        capture_frame_t ref = frame;
+        return m_source.release(ref); // Not encoded: drop our reference
+    }
+
+    return true;
+}
+
+bool FrameScheduler::analyse(const capture_frame_t& frame)
+{
+    Logger& log = m_logger;
+
+    // The tap reads the frame in place, next to the display
+    if(!m_source.retain(frame)){
+        log.error("FrameSource::retain Failed !");
+        return false;
+    }
+    if(!m_tap->submit(frame)){
+        capture_frame_t ref = frame;
+        return m_source.release(ref); // Worker busy: drop our reference
+    }
+
+    return true;
+}
+
+bool FrameScheduler::handleTapDone()
+{
+    Logger& log = m_logger;
+
+    m_analysed.clear();
+    if(!m_tap->collect(m_analysed)){
+        log.error("AnalyticsTap::collect Failed !");
+        return false;
+    }
+    for(auto& frame : m_analysed){
+        if(!m_source.release(frame)){
+            log.error("FrameSource::release Failed !");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FrameScheduler::handleEncodeDone()
+{
+    Logger& log = m_logger;
+
+    // Camera frames the encoder is done with
+    m_encoded.clear();
+    if(!m_encoder->collect(m_encoded)){
+        log.error("Encoder::collect Failed !");
+        return false;
+    }
+    for(auto& frame : m_encoded){
+        if(!m_source.release(frame)){
+            log.error("FrameSource::release Failed !");
+            return false;
+        }
+    }
+
+    // Packets to storage, held by the recorder until written
+    while(true){
+        capture_frame_t packet{};
+        if(!m_encoder->tryDequeue(packet)){
+            log.error("Encoder::tryDequeue Failed !");
+            return false;
+        }
+        if(packet.index < 0)
+            break;
+        if(m_recorder && m_recorder->submit(packet))
+            continue;
+
+        // Lost packet: the stream is broken until the next key frame, make it come now
+        m_encoder->forceKeyFrame();
+        if(!m_encoder->release(packet)){
+            log.error("Encoder::release Failed !");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FrameScheduler::flushEncoder(unsigned int timeout_ms)
+{
+    Logger& log = m_logger;
+    struct pollfd pfd{};
+    uint64_t deadline = monotonic_ns() + (uint64_t)timeout_ms * 1000000ull;
+
+    if(!m_encoder->flush())
+        return false;
+
+    // The reactor is stopped: poll the encoder directly, recorder completions included
+    pfd.fd = m_encoder->get_fd();
+    pfd.events = POLLIN | POLLOUT;
+    while(!m_encoder->finished()){
+        uint64_t now = monotonic_ns();
+        if(now >= deadline){
+            log.warning("Encoder flush timed out, last packets dropped");
+            break;
+        }
+        if(poll(&pfd, 1, (int)((deadline - now) / 1000000ull) + 1) < 0 && errno != EINTR){
+            log.error("poll failed: %s", strerror(errno));
+            return false;
+        }
+        if(!handleEncodeDone() || (m_recorder && !handleRecordDone()))
+            return false;
+    }
+
+    return true;
+}
+
+bool FrameScheduler::handleRecordDone()
+{
+    Logger& log = m_logger;
+
+    m_recorded.clear();
+    if(!m_recorder->collect(m_recorded)){
+        log.error("Recorder::collect Failed !");
+        return false;
+    }
+    for(auto& frame : m_recorded){
+        if(!recorded().release(frame)){
+            log.error("FrameSource::release Failed !");
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool FrameScheduler::handleCaptureReady()
+{
+    Logger& log = m_logger;
+
+    // Keep only the newest of all ready frames
+    while(true){
+        capture_frame_t frame{};
+        if(!m_source.tryDequeue(frame)){
+            log.error("FrameSource::tryDequeue Failed !");
+            return false;
+        }
+        if(frame.index < 0)
+            break;
+        m_latency.frameCaptured(frame.sequence);
+        if(m_encoder){
+            if(!encode(frame))
+                return false;
+        }
+        else if(m_recorder && !record(frame)){
+            return false;
+        }
+        if(m_tap && !analyse(frame))
+            return false;
+
+        if(m_pending.index >= 0){
+            if(m_replaced_rl.allow())
+                log.info("Frame %u replaced by frame %u (%u similar messages suppressed)", m_pending.sequence, frame.sequence, m_replaced_rl.takeSuppressed());
+            if(!m_source.release(m_pending)){
+                log.error("FrameSource::release Failed !");
+                return false;
+            }
+            m_replaced++;
+            m_latency.frameSkipped();
+        }
+        m_pending = frame;
+    }
+
+    // Display idle: show it right away
+    return commit();
+}
+
+bool FrameScheduler::handleFlipEvent()
+{
+    Logger& log = m_logger;
+
+    if(!m_display.handleEvent()){
+        log.error("Display::handleEvent Failed !");
+        return false;
+    }
+    if(m_display.flipPending())
+        return true;
+
+    // Flip complete: the previous frame left the screen
+    uint64_t flip_ns = m_display.lastFlipNs();
+    if(m_flipping.index >= 0){
+        m_latency.frameDisplayed(m_flipping.timestamp_ns, m_commit_ns, flip_ns);
+        if(m_on_screen.index >= 0 && !m_source.release(m_on_screen)){
+            log.error("FrameSource::release Failed !");
+            return false;
+        }
+        m_on_screen = m_flipping;
+        m_flipping.index = -1;
+    }
+    m_latency.flipCompleted(flip_ns);
+
+    // Commit the newest frame captured during the last refresh
+    return commit();
+}
+
+bool FrameScheduler::drain()
+{
+    Logger& log = m_logger;
+    bool ok = true;
+
+    // Frames owned by a fence: the display already left them
+    for(auto& w : m_fences){
+        m_reactor.removeFd(w.fd);
+        close(w.fd);
+        ok = m_source.release(w.frame) && ok;
+    }
+    m_fences.clear();
+
+    // Not every source takes its buffers back on stop (replay, conversion)
+    capture_frame_t *held[3] = {&m_pending, &m_flipping, &m_on_screen};
+    for(capture_frame_t *frame : held){
+        if(frame->index >= 0)
+            ok = m_source.release(*frame) && ok;
+        frame->index = -1;
+    }
+    if(!ok)
+        log.error("FrameSource::release Failed while draining !");
+
+    return ok;
+}
+
+FrameScheduler::~FrameScheduler()
+{
+    drain();
+}
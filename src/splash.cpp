@@ -0,0 +1,154 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <drm/drm_fourcc.h>
+
+#include "splash.hpp"
+
+SplashImage::SplashImage(bool verbose)
+    : m_logger("splash", verbose)
+{
+}
+
+SplashImage::~SplashImage()
+{
+    close();
+}
+
+void SplashImage::close()
+{
+    if(m_base)
+        munmap(const_cast<uint8_t*>(m_base), m_size);
+    if(m_fd >= 0)
+        ::close(m_fd);
+    m_fd = -1;
+    m_base = nullptr;
+    m_size = 0;
+    m_hdr = nullptr;
+}
+
+bool SplashImage::open(const std::string& path)
+{
+    Logger& log = m_logger;
+    struct stat st{};
+
+    close();
+
+    // Map the whole file: read once, front to back
+    m_fd = ::open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if(m_fd < 0){
+        log.error("Failed to open %s: %s", path.c_str(), strerror(errno));
+        return false;
+    }
+    if(fstat(m_fd, &st) < 0 || (size_t)st.st_size < sizeof(splash_hdr_t)){
+        log.error("%s is too small to be a splash image", path.c_str());
+        close();
+        return false;
+    }
+    m_size = (size_t)st.st_size;
+    void* base = mmap(NULL, m_size, PROT_READ, MAP_SHARED, m_fd, 0);
+    if(base == MAP_FAILED){
+        log.error("mmap failed for %s: %s", path.c_str(), strerror(errno));
+        m_size = 0;
+        close();
+        return false;
+    }
+    m_base = static_cast<const uint8_t*>(base);
+    madvise(base, m_size, MADV_WILLNEED); // Read ahead the whole file while the dumb buffer is created
+
+    // Validate header
+    m_hdr = reinterpret_cast<const splash_hdr_t*>(m_base);
+    bool nv12 = (m_hdr->fourcc == DRM_FORMAT_NV12);
+    if(m_hdr->magic != SPLASH_MAGIC || m_hdr->version != SPLASH_VERSION ||
+       (m_hdr->fourcc != DRM_FORMAT_XRGB8888 && !nv12) || m_hdr->num_planes != (nv12 ? 2u : 1u) ||
+       !m_hdr->width || !m_hdr->height || (nv12 && (m_hdr->width % 2 || m_hdr->height % 2))){
+        log.error("%s is not a camcap v%d XR24/NV12 splash image", path.c_str(), SPLASH_VERSION);
+        close();
+        return false;
+    }
+
+    // Every plane in the file
+    for(unsigned int p = 0; p < m_hdr->num_planes; p++){
+        uint32_t min_pitch = nv12 ? m_hdr->width : m_hdr->width * 4;
+        uint64_t end = (uint64_t)m_hdr->offset[p] + (uint64_t)m_hdr->pitch[p] * planeHeight(p);
+        if(m_hdr->pitch[p] < min_pitch || m_hdr->offset[p] < sizeof(splash_hdr_t) || end > m_size){
+            log.error("%s: plane %u out of file bounds", path.c_str(), p);
+            close();
+            return false;
+        }
+    }
+
+    log.info("Opened %s: %.4s %ux%u", path.c_str(), (const char*)&m_hdr->fourcc, m_hdr->width, m_hdr->height);
+
+    return true;
+}
+
+uint32_t SplashImage::planeHeight(unsigned int index)
+{
+    return (index && m_hdr->fourcc == DRM_FORMAT_NV12) ? m_hdr->height / 2 : m_hdr->height;
+}
+
+void stream_copy(void *dst, const void *src, size_t size)
+{
+#if defined(__aarch64__)
+    uint8_t *d = static_cast<uint8_t*>(dst);
+    const uint8_t *s = static_cast<const uint8_t*>(src);
+
+    // Head: up to a 64 bytes aligned destination
+    size_t head = (64 - ((uintptr_t)d & 63)) & 63;
+    if(head > size)
+        head = size;
+    memcpy(d, s, head);
+    d += head;
+    s += head;
+    size -= head;
+
+    // 64 bytes per step, STNP: the destination is never read back, keep it out of the caches
+    size_t blocks = size / 64;
+    if(blocks){
+        asm volatile(
+            "1:\n"
+            "ldp q0, q1, [%[s]]\n"
+            "ldp q2, q3, [%[s], #32]\n"
+            "add %[s], %[s], #64\n"
+            "stnp q0, q1, [%[d]]\n"
+            "stnp q2, q3, [%[d], #32]\n"
+            "add %[d], %[d], #64\n"
+            "subs %[n], %[n], #1\n"
+            "b.ne 1b\n"
+            : [d] "+r"(d), [s] "+r"(s), [n] "+r"(blocks)
+            :
+            : "v0", "v1", "v2", "v3", "memory", "cc");
+    }
+
+    // Tail
+    memcpy(d, s, size & 63);
+#else
+    memcpy(dst, src, size);
+#endif
+}
@@ -0,0 +1,164 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+#if defined(__ARM_NEON)
+#include <arm_neon.h>
+#endif
+
+#include "testpattern.hpp"
+#include "splash.hpp"
+
+#define TP_COUNTER_DIGITS 8
+#define TP_GRADIENT_STEP  4 // Pixels scrolled per frame
+
+// 5x7 digits, one byte per row, bit 4 is the leftmost column
+static const uint8_t s_digits[10][7] = {
+    {0x0e, 0x11, 0x13, 0x15, 0x19, 0x11, 0x0e}, // 0
+    {0x04, 0x0c, 0x04, 0x04, 0x04, 0x04, 0x0e}, // 1
+    {0x0e, 0x11, 0x01, 0x02, 0x04, 0x08, 0x1f}, // 2
+    {0x1f, 0x02, 0x04, 0x02, 0x01, 0x11, 0x0e}, // 3
+    {0x02, 0x06, 0x0a, 0x12, 0x1f, 0x02, 0x02}, // 4
+    {0x1f, 0x10, 0x1e, 0x01, 0x01, 0x11, 0x0e}, // 5
+    {0x06, 0x08, 0x10, 0x1e, 0x11, 0x11, 0x0e}, // 6
+    {0x1f, 0x01, 0x02, 0x04, 0x08, 0x08, 0x08}, // 7
+    {0x0e, 0x11, 0x11, 0x0e, 0x11, 0x11, 0x0e}, // 8
+    {0x0e, 0x11, 0x11, 0x0f, 0x01, 0x02, 0x0c}, // 9
+};
+
+// SMPTE ECR 1-1978 bars, 75% amplitude, as XR24
+static const uint32_t s_bars_top[7] = {0xc0c0c0, 0xc0c000, 0x00c0c0, 0x00c000, 0xc000c0, 0xc00000, 0x0000c0};
+static const uint32_t s_bars_mid[7] = {0x0000c0, 0x000000, 0xc000c0, 0x000000, 0x00c0c0, 0x000000, 0xc0c0c0};
+
+bool test_pattern_from_name(const std::string& name, test_pattern_t& out)
+{
+    static const char *names[TP_MAX] = {"solid", "bars", "gradient"};
+
+    for(int i = 0; i < TP_MAX; i++){
+        if(name == names[i]){
+            out = (test_pattern_t)i;
+            return true;
+        }
+    }
+    return false;
+}
+
+static void fill_span(uint32_t *dst, uint32_t color, uint32_t count)
+{
+#if defined(__ARM_NEON)
+    uint32x4_t v = vdupq_n_u32(color);
+    for(; count >= 16; count -= 16, dst += 16){
+        vst1q_u32(dst, v);
+        vst1q_u32(dst + 4, v);
+        vst1q_u32(dst + 8, v);
+        vst1q_u32(dst + 12, v);
+    }
+#endif
+    std::fill(dst, dst + count, color);
+}
+
+TestPattern::TestPattern(test_pattern_t pattern, uint32_t width, uint32_t height)
+    : m_pattern(pattern), m_width(width), m_height(height), m_row(width)
+{
+}
+
+void TestPattern::renderBand(uint32_t *pixels, uint32_t pitch, uint32_t y0, uint32_t y1)
+{
+    for(uint32_t y = y0; y < y1; y++)
+        stream_copy(pixels + (size_t)y * pitch, m_row.data(), m_width * 4);
+}
+
+void TestPattern::renderCounter(uint32_t *pixels, uint32_t pitch, uint64_t frame)
+{
+    uint32_t scale = std::max<uint32_t>(1, m_height / 135); // 8 at 1080p
+    uint32_t margin = 2 * scale;
+    uint32_t box_w = std::min(m_width, TP_COUNTER_DIGITS * 6 * scale + 2 * margin);
+    uint32_t box_h = std::min(m_height, 7 * scale + 2 * margin);
+    char text[TP_COUNTER_DIGITS + 1];
+
+    snprintf(text, sizeof(text), "%0*llu", TP_COUNTER_DIGITS, (unsigned long long)(frame % 100000000ull));
+
+    // One glyph row at a time, repeated scale times
+    for(uint32_t y = 0; y < box_h; y++){
+        uint32_t *row = pixels + (size_t)y * pitch;
+        fill_span(m_row.data(), 0x000000, box_w);
+        uint32_t gy = (y >= margin) ? (y - margin) / scale : 7;
+        for(uint32_t d = 0; gy < 7 && d < TP_COUNTER_DIGITS; d++){
+            uint8_t bits = s_digits[text[d] - '0'][gy];
+            for(uint32_t gx = 0; gx < 5; gx++){
+                uint32_t x = margin + (d * 6 + gx) * scale;
+                if((bits & (0x10 >> gx)) && x + scale <= box_w)
+                    fill_span(m_row.data() + x, 0xffffff, scale);
+            }
+        }
+        stream_copy(row, m_row.data(), box_w * 4);
+    }
+}
+
+void TestPattern::render(uint32_t *pixels, uint32_t pitch, uint64_t frame, bool full, bool counter)
+{
+    uint32_t w = m_width;
+    uint32_t h = m_height;
+
+    if(full){
+        switch(m_pattern){
+            case TP_SOLID:
+                fill_span(m_row.data(), 0xff0000, w);
+                renderBand(pixels, pitch, 0, h);
+                break;
+            case TP_BARS: {
+                // Bars 2/3, castellations 1/12, then -I, white, +Q, black and the PLUGE
+                uint32_t y_mid = h * 2 / 3;
+                uint32_t y_low = h * 3 / 4;
+                for(uint32_t b = 0; b < 7; b++)
+                    fill_span(m_row.data() + w * b / 7, s_bars_top[b], w * (b + 1) / 7 - w * b / 7);
+                renderBand(pixels, pitch, 0, y_mid);
+                for(uint32_t b = 0; b < 7; b++)
+                    fill_span(m_row.data() + w * b / 7, s_bars_mid[b], w * (b + 1) / 7 - w * b / 7);
+                renderBand(pixels, pitch, y_mid, y_low);
+                const uint32_t low[8] = {0x00214c, 0xffffff, 0x32006a, 0x000000, 0x000000, 0x000000, 0x0a0a0a, 0x000000};
+                const uint32_t edges[9] = {0, w * 5 / 28, w * 10 / 28, w * 15 / 28, w * 5 / 7, w * 5 / 7 + w / 21, w * 5 / 7 + 2 * w / 21, w * 6 / 7, w};
+                for(uint32_t s = 0; s < 8; s++)
+                    fill_span(m_row.data() + edges[s], low[s], edges[s + 1] - edges[s]);
+                renderBand(pixels, pitch, y_low, h);
+                break;
+            }
+            case TP_GRADIENT: {
+                // Gray ramp over the width, its wrap is a vertical edge: a torn flip breaks it
+                uint32_t shift = (uint32_t)((frame * TP_GRADIENT_STEP) % w);
+                for(uint32_t x = 0; x < w; x++){
+                    uint32_t v = (uint32_t)((uint64_t)((x + shift) % w) * 256 / w);
+                    m_row[x] = v << 16 | v << 8 | v;
+                }
+                renderBand(pixels, pitch, 0, h);
+                break;
+            }
+            default:
+                break;
+        }
+    }
+
+    if(counter)
+        renderCounter(pixels, pitch, frame);
+}
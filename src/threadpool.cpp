@@ -0,0 +1,125 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <system_error>
+
+#include "threadpool.hpp"
+
+ThreadPool::ThreadPool(unsigned int workers, bool verbose)
+    : m_logger("threadpool", verbose)
+{
+    Logger& log = m_logger;
+
+    try{
+        for(unsigned int i = 0; i < workers; i++)
+            m_workers.push_back(std::thread(&ThreadPool::workerLoop, this));
+    } catch(const std::system_error& e){
+        log.warning("Started only %zu of %u workers: %s", m_workers.size(), workers, e.what());
+    }
+
+    log.info("%zu workers", m_workers.size());
+}
+
+unsigned int ThreadPool::runTasks(const task_fn_t& fn, unsigned int tasks)
+{
+    unsigned int count = 0;
+
+    while(true){
+        unsigned int task = m_next.fetch_add(1, std::memory_order_relaxed);
+        if(task >= tasks)
+            break;
+        fn(task);
+        count++;
+    }
+
+    return count;
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t seen = 0;
+
+    while(true){
+        const task_fn_t* fn;
+        unsigned int tasks;
+
+        // Wait for a new job
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]{ return m_quit || m_generation != seen; });
+            if(m_quit)
+                return;
+            seen = m_generation;
+            // Woken too late: that job already completed and its function is gone
+            if(!m_fn)
+                continue;
+            fn = m_fn;
+            tasks = m_tasks;
+            m_active++; // run() doesn't return while we may still touch the job
+        }
+
+        unsigned int count = runTasks(*fn, tasks);
+
+        // Report
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_finished += count;
+        m_active--;
+        if(m_finished == m_tasks && m_active == 0)
+            m_done.notify_one();
+    }
+}
+
+void ThreadPool::run(unsigned int tasks, const task_fn_t& fn)
+{
+    if(!tasks)
+        return;
+
+    // Publish the job
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_fn = &fn;
+        m_tasks = tasks;
+        m_finished = 0;
+        m_next.store(0, std::memory_order_relaxed);
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    unsigned int count = runTasks(fn, tasks);
+
+    // Wait for the workers
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_finished += count;
+    m_done.wait(lock, [&]{ return m_finished == m_tasks && m_active == 0; });
+    m_fn = nullptr;
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_quit = true;
+    }
+    m_wake.notify_all();
+    for(auto& worker : m_workers)
+        worker.join();
+}
@@ -0,0 +1,251 @@
+/*
+ * Copyright (c) 2025 Abderrahim LAKBIR
+ *
+ * Permission is hereby granted, free of charge, to any person obtaining a copy
+ * of this software and associated documentation files (the "Software"), to deal
+ * in the Software without restriction, including without limitation the rights
+ * to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+ * copies of the Software, and to permit persons to whom the Software is
+ * furnished to do so, subject to the following conditions:
+ *
+ * The above copyright notice and this permission notice shall be included in all
+ * copies or substantial portions of the Software.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+ * IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+ * FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+ * AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+ * LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+ * OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+#include <cerrno>
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fstream>
+#include <algorithm>
+#include <pthread.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "threadsched.hpp"
+#include "logger.hpp"
+
+static const char *s_role_names[THR_MAX] = {"display", "capture", "writer", "logger"};
+// Thread names (15 chars max). The main thread keeps the process name, killall and ps rely on it.
+static const char *s_thread_names[THR_MAX] = {nullptr, "camcap-capture", "camcap-writer", "camcap-logger"};
+
+ThreadSched::role_t ThreadSched::s_roles[THR_MAX];
+cpu_set_t ThreadSched::s_default_cpus;
+bool ThreadSched::s_enabled = false;
+
+static Logger s_logger("sched", false);
+
+static std::string cpusToList(const cpu_set_t& set)
+{
+    std::string list;
+
+    for(int cpu = 0; cpu < CPU_SETSIZE; cpu++){
+        if(!CPU_ISSET(cpu, &set))
+            continue;
+        int last = cpu;
+        while(last + 1 < CPU_SETSIZE && CPU_ISSET(last + 1, &set))
+            last++;
+        if(!list.empty())
+            list += ',';
+        list += std::to_string(cpu);
+        if(last > cpu)
+            list += '-' + std::to_string(last);
+        cpu = last;
+    }
+    return list;
+}
+
+// cpu_capacity where the kernel has an energy model (e.g. RK3588: 1024 on the A76, ~530 on the A55),
+// else the highest frequency
+static unsigned long cpuCapacity(int cpu)
+{
+    static const char *files[2] = {"cpu_capacity", "cpufreq/cpuinfo_max_freq"};
+    char path[96];
+    unsigned long v = 0;
+
+    for(int i = 0; i < 2 && !v; i++){
+        snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d/%s", cpu, files[i]);
+        std::ifstream in(path);
+        if(!(in >> v))
+            v = 0;
+    }
+    return v;
+}
+
+void ThreadSched::setVerbose(bool verbose)
+{
+    s_logger.set_verbose(verbose);
+}
+
+bool ThreadSched::parseCpus(const std::string& list, cpu_set_t& out)
+{
+    Logger& log = s_logger;
+
+    CPU_ZERO(&out);
+
+    // Clusters: the biggest cores are "big", all the others "little"
+    if(list == "big" || list == "little"){
+        long count = sysconf(_SC_NPROCESSORS_CONF);
+        unsigned long max = 0;
+        for(long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++)
+            max = std::max(max, cpuCapacity((int)cpu));
+        for(long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++){
+            if((cpuCapacity((int)cpu) == max) == (list == "big"))
+                CPU_SET(cpu, &out);
+        }
+        if(!CPU_COUNT(&out)){
+            log.warning("No %s cores (CPU capacities are all the same), using all of them", list.c_str());
+            for(long cpu = 0; cpu < count && cpu < CPU_SETSIZE; cpu++)
+                CPU_SET(cpu, &out);
+        }
+        log.info("%s cores: %s", list.c_str(), cpusToList(out).c_str());
+        return true;
+    }
+
+    size_t pos = 0;
+    while(pos < list.size()){
+        size_t end = list.find(',', pos);
+        if(end == std::string::npos)
+            end = list.size();
+        int first, last;
+        std::string range = list.substr(pos, end - pos);
+        int n = sscanf(range.c_str(), "%d-%d", &first, &last);
+        if(n == 1)
+            last = first;
+        if(n < 1 || first < 0 || last < first || last >= CPU_SETSIZE){
+            log.error("Invalid CPU list: %s", list.c_str());
+            return false;
+        }
+        for(int cpu = first; cpu <= last; cpu++)
+            CPU_SET(cpu, &out);
+        pos = end + 1;
+    }
+    return CPU_COUNT(&out) > 0;
+}
+
+bool ThreadSched::parse(const std::string& spec)
+{
+    Logger& log = s_logger;
+    size_t eq = spec.find('=');
+    size_t colon = spec.find(':', eq);
+    int role = 0;
+
+    for(; role < THR_MAX && spec.compare(0, eq, s_role_names[role]) != 0; role++);
+    if(eq == std::string::npos || role == THR_MAX){
+        log.error("Unknown thread role in %s (display, capture, writer or logger)", spec.c_str());
+        return false;
+    }
+
+    role_t r{};
+    int min = sched_get_priority_min(SCHED_FIFO);
+    int max = sched_get_priority_max(SCHED_FIFO);
+    std::string prio = spec.substr(eq + 1, (colon == std::string::npos) ? std::string::npos : colon - eq - 1);
+    if(sscanf(prio.c_str(), "%d", &r.priority) != 1 || r.priority < 0 || r.priority > max || (r.priority && r.priority < min)){
+        log.error("Invalid priority in %s: 0 (SCHED_OTHER) or %d-%d (SCHED_FIFO)", spec.c_str(), min, max);
+        return false;
+    }
+    if(colon != std::string::npos){
+        if(!parseCpus(spec.substr(colon + 1), r.cpus))
+            return false;
+        r.pinned = true;
+    }
+    r.configured = true;
+
+    // Roles left alone get back what the process started with
+    if(!s_enabled && sched_getaffinity(0, sizeof(s_default_cpus), &s_default_cpus) < 0){
+        log.error("sched_getaffinity failed: %s", strerror(errno));
+        return false;
+    }
+    s_roles[role] = r;
+    s_enabled = true;
+
+    return true;
+}
+
+void ThreadSched::apply(thread_role_t role)
+{
+    Logger& log = s_logger;
+    const role_t& r = s_roles[role];
+
+    if(s_thread_names[role])
+        pthread_setname_np(pthread_self(), s_thread_names[role]);
+    if(!s_enabled)
+        return;
+
+    // Set for every role: an unconfigured one must not keep the RT policy of the thread that spawned it
+    struct sched_param param{};
+    param.sched_priority = r.priority;
+    int err = pthread_setschedparam(pthread_self(), r.priority ? SCHED_FIFO : SCHED_OTHER, &param);
+    if(err != 0)
+        log.warning("%s thread: can't set %s priority %d: %s (CAP_SYS_NICE or RLIMIT_RTPRIO needed)", s_role_names[role],
+                    r.priority ? "SCHED_FIFO" : "SCHED_OTHER", r.priority, strerror(err));
+    err = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), r.pinned ? &r.cpus : &s_default_cpus);
+    if(err != 0)
+        log.warning("%s thread: can't set CPU affinity: %s", s_role_names[role], strerror(err));
+
+    if(r.configured)
+        log.info("%s thread: %s %d on CPUs %s", s_role_names[role], r.priority ? "SCHED_FIFO" : "SCHED_OTHER",
+                 r.priority, cpusToList(r.pinned ? r.cpus : s_default_cpus).c_str());
+}
+
+bool ThreadSched::lockMemory()
+{
+    Logger& log = s_logger;
+
+    // Buffers, rings and stacks allocated later are locked as they are mapped: no major fault in the frame path
+    if(mlockall(MCL_CURRENT | MCL_FUTURE) < 0){
+        log.warning("mlockall failed: %s (CAP_IPC_LOCK or RLIMIT_MEMLOCK needed)", strerror(errno));
+        return false;
+    }
+    log.info("Memory locked");
+
+    return true;
+}
+
+bool ThreadSched::pinIrqs(const std::string& spec)
+{
+    Logger& log = s_logger;
+    size_t colon = spec.rfind(':');
+    cpu_set_t set;
+
+    if(colon == std::string::npos || colon == 0 || !parseCpus(spec.substr(colon + 1), set)){
+        log.error("Invalid IRQ affinity %s: <name>:<cpus>", spec.c_str());
+        return false;
+    }
+    std::string name = spec.substr(0, colon);
+    std::string list = cpusToList(set);
+
+    // "  NN:  <count per CPU>  <chip>  <hwirq>  <name>": the name is matched anywhere after the number
+    std::ifstream in("/proc/interrupts");
+    std::string line;
+    unsigned int pinned = 0;
+    bool ok = true;
+    while(std::getline(in, line)){
+        unsigned int irq;
+        size_t sep = line.find(':');
+        if(sep == std::string::npos || sscanf(line.c_str(), " %u:", &irq) != 1 || line.find(name, sep) == std::string::npos)
+            continue;
+        std::ofstream out("/proc/irq/" + std::to_string(irq) + "/smp_affinity_list");
+        if(!(out << list << std::flush)){
+            log.warning("Can't pin IRQ %u (%s) on CPUs %s", irq, name.c_str(), list.c_str());
+            ok = false;
+            continue;
+        }
+        log.info("IRQ %u (%s) on CPUs %s", irq, name.c_str(), list.c_str());
+        pinned++;
+    }
+    if(!pinned){
+        log.warning("No IRQ matching %s pinned", name.c_str());
+        return false;
+    }
+
+    return ok;
+}